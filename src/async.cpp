@@ -0,0 +1,956 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file async.cpp
+* \brief async.cpp implements the completion port engine and the decode and write requests that run on it
+* \author Blake Hamilton
+*
+* A decode goes open (compute) -> read strip (overlapped) -> decode strip (compute) -> sink (executor) -> read the
+* next strip, and ends with its completion on the executor. A write goes encode (compute) -> write spans one after
+* the other (overlapped) -> flush on close (compute), and ends the same way. Every step is a task posted to a
+* completion port, no thread ever waits on a request.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "async.h"
+#include "bif.h"
+#include "parallel.h"
+#include "pipeline.h"
+
+// consts
+const ULONG_PTR AsyncQuitKey = 0;			// stops the thread that dequeues it
+const ULONG_PTR AsyncIoKey = 1;				// an overlapped read or write completed, any other key is an AsyncTask
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PostPortTask
+//	Purpose:	Queues a task on a completion port
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL PostPortTask(HANDLE port, AsyncTask task, void* context)
+{
+	if (::PostQueuedCompletionStatus(port, 0, (ULONG_PTR) task, (LPOVERLAPPED) context) == FALSE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PostIoPortTask
+//	Purpose:	AsyncPost of the built in executor, tasks run on the I/O threads
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void PostIoPortTask(void* executorContext, AsyncTask task, void* taskContext)
+{
+	AsyncEngine* engine = (AsyncEngine*) executorContext;
+	PostPortTask(engine->ioPort, task, taskContext);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunPort
+//	Purpose:	Runs the tasks and I/O completions of a completion port until it dequeues AsyncQuitKey
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void RunPort(HANDLE port)
+{
+	for (;;)
+	{
+		DWORD byteCount = 0;
+		ULONG_PTR key = AsyncQuitKey;
+		LPOVERLAPPED overlapped = NULL;
+		BOOL result = ::GetQueuedCompletionStatus(port, &byteCount, &key, &overlapped, INFINITE);
+
+		// failed without a packet, the port itself is gone
+		if (result == FALSE && overlapped == NULL) break;
+		if (key == AsyncQuitKey) break;
+
+		if (key == AsyncIoKey)
+		{
+			AsyncFileIo* io = (AsyncFileIo*) overlapped;
+			io->byteCount = byteCount;
+			io->error = (result == TRUE) ? ERROR_SUCCESS : ::GetLastError();
+			io->complete(io->context);
+			continue;
+		}
+
+		((AsyncTask) key)((void*) overlapped);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		IoThreadProc
+//	Purpose:	I/O thread, read and write completions and tasks of the built in executor
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI IoThreadProc(LPVOID parameter)
+{
+	RunPort(((AsyncEngine*) parameter)->ioPort);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ComputeThreadProc
+//	Purpose:	Compute pool thread
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI ComputeThreadProc(LPVOID parameter)
+{
+	RunPort(((AsyncEngine*) parameter)->computePort);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAsyncEngine
+//	Purpose:	Starts the I/O threads and the compute pool. executor NULL runs callbacks on the I/O threads,
+//				computeThreadCount 0 uses one thread per processor.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAsyncEngine(AsyncEngine* engine, const AsyncExecutor* executor, int computeThreadCount)
+{
+	// validate parameters
+	if (engine == NULL || computeThreadCount < 0 || (executor != NULL && executor->post == NULL))
+	{
+		printf("Invalid parameter Engine NULL, executor without a post function or negative thread count.\n");
+		return FALSE;
+	}
+
+	::memset(engine, 0, sizeof(AsyncEngine));
+	engine->pending = 1;
+	if (computeThreadCount == 0) computeThreadCount = GetProcessorCount();
+	if (computeThreadCount > AsyncMaxThreads - AsyncIoThreads) computeThreadCount = AsyncMaxThreads - AsyncIoThreads;
+
+	engine->ioPort = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, AsyncIoThreads);
+	engine->computePort = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, computeThreadCount);
+	engine->idle = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (engine->ioPort == NULL || engine->computePort == NULL || engine->idle == NULL)
+	{
+		PrintOsErrorText();
+		CloseAsyncEngine(engine);
+		return FALSE;
+	}
+
+	engine->executor.post = (executor != NULL) ? executor->post : PostIoPortTask;
+	engine->executor.context = (executor != NULL) ? executor->context : engine;
+
+	for (int i = 0; i < AsyncIoThreads + computeThreadCount; ++i)
+	{
+		BOOL io = (i < AsyncIoThreads) ? TRUE : FALSE;
+		HANDLE thread = ::CreateThread(NULL, 0, (io == TRUE) ? IoThreadProc : ComputeThreadProc, engine, 0, NULL);
+		if (thread == NULL)
+		{
+			PrintOsErrorText();
+			CloseAsyncEngine(engine);
+			return FALSE;
+		}
+
+		engine->threads[i] = thread;
+		if (io == TRUE) engine->ioThreadCount++;
+		else engine->computeThreadCount++;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseAsyncEngine
+//	Purpose:	Waits for the requests in flight to complete and stops the threads. The executor must keep running
+//				the tasks posted to it meanwhile, so a caller's event loop can't call this from its own thread.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseAsyncEngine(AsyncEngine* engine)
+{
+	if (engine == NULL) return;
+
+	// requests still need the threads to finish, and completions may be queued behind quit packets otherwise. The
+	// engine gives up its own count, the last request to complete after that sets idle.
+	if (::InterlockedDecrement(&engine->pending) > 0) ::WaitForSingleObject(engine->idle, INFINITE);
+
+	// one quit packet per thread, every thread dequeues exactly one
+	for (int i = 0; i < engine->ioThreadCount; ++i) ::PostQueuedCompletionStatus(engine->ioPort, 0, AsyncQuitKey, NULL);
+	for (int i = 0; i < engine->computeThreadCount; ++i) ::PostQueuedCompletionStatus(engine->computePort, 0, AsyncQuitKey, NULL);
+
+	int threadCount = engine->ioThreadCount + engine->computeThreadCount;
+	if (threadCount > 0) ::WaitForMultipleObjects(threadCount, engine->threads, TRUE, INFINITE);
+
+	// close handles
+	for (int i = 0; i < threadCount; ++i) ::CloseHandle(engine->threads[i]);
+	if (engine->ioPort != NULL) ::CloseHandle(engine->ioPort);
+	if (engine->computePort != NULL) ::CloseHandle(engine->computePort);
+	if (engine->idle != NULL) ::CloseHandle(engine->idle);
+	::memset(engine, 0, sizeof(AsyncEngine));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReleasePending
+//	Purpose:	Counts a request as completed, waking CloseAsyncEngine if it was the last one it waits for
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ReleasePending(AsyncEngine* engine)
+{
+	// CloseAsyncEngine can't return before idle is set, so setting it is the last use of the engine
+	if (::InterlockedDecrement(&engine->pending) == 0) ::SetEvent(engine->idle);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompleteDecodeTask
+//	Purpose:	Executor task, calls the completion of a finished decode
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CompleteDecodeTask(void* context)
+{
+	// the caller may free the request in its completion, nothing of it is used after the call
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	AsyncEngine* engine = request->engine;
+	request->complete(request->context, request->status);
+	ReleasePending(engine);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishDecode
+//	Purpose:	Closes the file and frees the buffers of a decode, then queues its completion
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FinishDecode(AsyncDecodeRequest* request, AsyncStatus status)
+{
+	::AcquireSRWLockExclusive(&request->lock);
+	if (request->readerOpen == TRUE) CloseImageReader(&request->reader);
+	request->readerOpen = FALSE;
+	::ReleaseSRWLockExclusive(&request->lock);
+
+	// free heap memory
+	free(request->strip);
+	free(request->fileStrip);
+	free(request->compressed);
+	free(request->scratch);
+	request->strip = NULL;
+	request->fileStrip = NULL;
+	request->compressed = NULL;
+	request->scratch = NULL;
+
+	request->status = status;
+	request->engine->executor.post(request->engine->executor.context, CompleteDecodeTask, request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeliverStripTask
+//	Purpose:	Executor task, hands the decoded strip to the sink and starts on the next one
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ReadNextStrip(AsyncDecodeRequest* request);
+
+static void DeliverStripTask(void* context)
+{
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	if (request->cancelled == TRUE || request->sink(request->context, request->strip, request->reader.rowByteSize, request->firstRow, request->rowCount) == FALSE)
+	{
+		FinishDecode(request, AsyncCancelled);
+		return;
+	}
+
+	request->firstRow += request->rowCount;
+	ReadNextStrip(request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeliverFileStrip
+//	Purpose:	Converts the file rows of an alpha file to the rgb strip, then queues the strip for the sink
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void DeliverFileStrip(AsyncDecodeRequest* request)
+{
+	BifReader* reader = &request->reader;
+	if (request->fileStrip != NULL && ConvertImageRows(reader, request->fileStrip, reader->fileRowByteSize, request->strip, reader->rowByteSize, request->rowCount) == FALSE)
+	{
+		FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	request->engine->executor.post(request->engine->executor.context, DeliverStripTask, request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertStripTask
+//	Purpose:	Compute task, converts the raw rows of an alpha file that were read
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertStripTask(void* context)
+{
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	if (request->cancelled == TRUE)
+	{
+		FinishDecode(request, AsyncCancelled);
+		return;
+	}
+
+	DeliverFileStrip(request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeStripTask
+//	Purpose:	Compute task, decodes the chunks of the strip that was read
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void DecodeStripTask(void* context)
+{
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	if (request->cancelled == TRUE)
+	{
+		FinishDecode(request, AsyncCancelled);
+		return;
+	}
+
+	// chunks hold file rows, alpha files decode them aside for conversion
+	BifReader* reader = &request->reader;
+	int fileRowByteSize = reader->fileRowByteSize;
+	BYTE* fileRows = (request->fileStrip != NULL) ? request->fileStrip : request->strip;
+	int firstChunk = request->firstRow / (int) reader->header.chunkRows;
+	int row = 0;
+	for (int chunkIndex = firstChunk; row < request->rowCount; ++chunkIndex)
+	{
+		const BYTE* compressed = request->compressed + (reader->chunkOffsets[chunkIndex] - reader->chunkOffsets[firstChunk]);
+		if (DecodeImageChunk(reader, chunkIndex, compressed, fileRows + (ptrdiff_t) row * fileRowByteSize, fileRowByteSize, request->scratch) == FALSE)
+		{
+			FinishDecode(request, AsyncFailed);
+			return;
+		}
+
+		row += GetImageChunkRowCount(reader, chunkIndex);
+	}
+
+	DeliverFileStrip(request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FillStripTask
+//	Purpose:	Compute task, fills the strip of a solid file with its color
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FillStripTask(void* context)
+{
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	const BYTE* color = request->reader.header.statistics.minimum;
+	FillStage fill(color[0], color[1], color[2]);
+	for (int y = 0; y < request->rowCount; ++y)
+	{
+		fill(request->strip + (ptrdiff_t) y * request->reader.rowByteSize, request->reader.header.pixelWidth);
+	}
+
+	request->engine->executor.post(request->engine->executor.context, DeliverStripTask, request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadStripComplete
+//	Purpose:	Read completion on an I/O thread, raw rows go to the sink and lz chunks to the compute pool
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ReadStripComplete(void* context)
+{
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	if (request->cancelled == TRUE || request->read.error == ERROR_OPERATION_ABORTED)
+	{
+		FinishDecode(request, AsyncCancelled);
+		return;
+	}
+
+	if (request->read.error != ERROR_SUCCESS)
+	{
+		::SetLastError(request->read.error);
+		PrintOsErrorText();
+		FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	if (request->read.byteCount != request->readByteSize)
+	{
+		printf("Unsupported or corrupt file. Unexpected end of file.\n");
+		FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	if (request->reader.header.encoding == EncodingLz)
+	{
+		if (PostPortTask(request->engine->computePort, DecodeStripTask, request) == FALSE) FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	if (request->fileStrip != NULL)
+	{
+		if (PostPortTask(request->engine->computePort, ConvertStripTask, request) == FALSE) FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	request->engine->executor.post(request->engine->executor.context, DeliverStripTask, request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadNextStrip
+//	Purpose:	Starts the overlapped read of the next strip, or finishes the decode after the last one
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ReadNextStrip(AsyncDecodeRequest* request)
+{
+	BifReader* reader = &request->reader;
+	int pixelHeight = reader->header.pixelHeight;
+	if (request->cancelled == TRUE)
+	{
+		FinishDecode(request, AsyncCancelled);
+		return;
+	}
+
+	if (request->firstRow >= pixelHeight)
+	{
+		FinishDecode(request, AsyncSucceeded);
+		return;
+	}
+
+	request->rowCount = (pixelHeight - request->firstRow < request->stripRowCount) ? pixelHeight - request->firstRow : request->stripRowCount;
+
+	// solid files have no body to read
+	if (reader->header.encoding == EncodingSolid)
+	{
+		if (PostPortTask(request->engine->computePort, FillStripTask, request) == FALSE) FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	// raw rows are read straight into the strip, or the file strip of alpha files, lz strips are whole chunks that are
+	// read back to back
+	__int64 offset = 0;
+	BYTE* target = NULL;
+	if (reader->header.encoding == EncodingLz)
+	{
+		int firstChunk = request->firstRow / (int) reader->header.chunkRows;
+		int lastChunk = (request->firstRow + request->rowCount - 1) / (int) reader->header.chunkRows;
+		offset = reader->chunkOffsets[firstChunk];
+		request->readByteSize = (DWORD) (reader->chunkOffsets[lastChunk + 1] - offset);
+		target = request->compressed;
+	}
+	else
+	{
+		offset = reader->header.bodyOffset + (__int64) request->firstRow * reader->fileRowByteSize;
+		request->readByteSize = (DWORD) request->rowCount * reader->fileRowByteSize;
+		target = (request->fileStrip != NULL) ? request->fileStrip : request->strip;
+	}
+
+	::memset(&request->read, 0, sizeof(AsyncFileIo));
+	request->read.overlapped.Offset = (DWORD) offset;
+	request->read.overlapped.OffsetHigh = (DWORD) (offset >> 32);
+	request->read.complete = ReadStripComplete;
+	request->read.context = request;
+
+	// the completion is queued to the I/O threads even when the read finishes right away
+	if (::ReadFile(reader->file, target, request->readByteSize, NULL, &request->read.overlapped) == FALSE && ::GetLastError() != ERROR_IO_PENDING)
+	{
+		PrintOsErrorText();
+		FinishDecode(request, AsyncFailed);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenDecodeTask
+//	Purpose:	Compute task, reads the header and chunk table and reopens the file for overlapped reads
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void OpenDecodeTask(void* context)
+{
+	AsyncDecodeRequest* request = (AsyncDecodeRequest*) context;
+	if (request->cancelled == TRUE)
+	{
+		FinishDecode(request, AsyncCancelled);
+		return;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, request->filePath) == FALSE)
+	{
+		FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	// body reads are overlapped and complete on the I/O threads
+	if (reader.header.encoding != EncodingSolid)
+	{
+		HANDLE file = ::CreateFile(request->filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE || ::CreateIoCompletionPort(file, request->engine->ioPort, AsyncIoKey, 0) == NULL)
+		{
+			PrintOsErrorText();
+			if (file != INVALID_HANDLE_VALUE) ::CloseHandle(file);
+			CloseImageReader(&reader);
+			FinishDecode(request, AsyncFailed);
+			return;
+		}
+
+		::CloseHandle(reader.file);
+		reader.file = file;
+	}
+
+	// strips are whole chunks for lz files, at least one row or chunk even if that's over the budget. A strip is read
+	// with one ReadFile, so it stays under a DWORD of bytes whatever the budget, the header checks already bound a chunk.
+	// The file rows are the larger of the two for alpha files, so they size the strip.
+	int rowByteSize = reader.rowByteSize;
+	int fileRowByteSize = reader.fileRowByteSize;
+	int pixelHeight = reader.header.pixelHeight;
+	size_t stripRowCount = (fileRowByteSize > 0) ? request->memoryBudget / fileRowByteSize : pixelHeight;
+	size_t maxStripRowCount = (fileRowByteSize > 0) ? MAXDWORD / fileRowByteSize : pixelHeight;
+	if (stripRowCount > maxStripRowCount) stripRowCount = maxStripRowCount;
+	if (reader.header.encoding == EncodingLz)
+	{
+		size_t chunkRows = reader.header.chunkRows;
+		stripRowCount = (stripRowCount < chunkRows) ? chunkRows : stripRowCount / chunkRows * chunkRows;
+	}
+
+	if (stripRowCount < 1) stripRowCount = 1;
+	if (stripRowCount > (size_t) pixelHeight) stripRowCount = pixelHeight;
+	request->stripRowCount = (int) stripRowCount;
+
+	// compressed chunks are never larger than their rows
+	BOOL convert = (reader.channelCount != reader.header.channelCount) ? TRUE : FALSE;
+	request->strip = (BYTE*) ::malloc(stripRowCount * rowByteSize);
+	if (convert == TRUE) request->fileStrip = (BYTE*) ::malloc(stripRowCount * fileRowByteSize);
+	if (reader.header.encoding == EncodingLz)
+	{
+		request->compressed = (BYTE*) ::malloc(stripRowCount * fileRowByteSize);
+		request->scratch = (BYTE*) ::malloc((size_t) reader.header.chunkRows * fileRowByteSize);
+	}
+
+	::AcquireSRWLockExclusive(&request->lock);
+	request->reader = reader;
+	request->readerOpen = TRUE;
+	::ReleaseSRWLockExclusive(&request->lock);
+
+	if (request->strip == NULL || (convert == TRUE && request->fileStrip == NULL) || (reader.header.encoding == EncodingLz && (request->compressed == NULL || request->scratch == NULL)))
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		FinishDecode(request, AsyncFailed);
+		return;
+	}
+
+	ReadNextStrip(request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StartDecodeAsync
+//	Purpose:	Starts decoding a BIF file. The sink gets the rows top to bottom in strips of up to memoryBudget
+//				bytes, and never 4 GB or more, on the executor. The rows are only valid during the call. complete is
+//				called once at the end.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL StartDecodeAsync(AsyncEngine* engine, AsyncDecodeRequest* request, const char* filePath, size_t memoryBudget, ImageRowSink sink, AsyncCompletion complete, void* context)
+{
+	// validate parameters
+	if (engine == NULL || engine->computePort == NULL || request == NULL || filePath == NULL || sink == NULL || complete == NULL)
+	{
+		printf("Invalid parameter Engine, Request, FilePath, Sink or Complete NULL.\n");
+		return FALSE;
+	}
+
+	::memset(request, 0, sizeof(AsyncDecodeRequest));
+	if (::sprintf_s(request->filePath, MAX_PATH, "%s", filePath) < 0)
+	{
+		printf("File path %s is too long.\n", filePath);
+		return FALSE;
+	}
+
+	request->engine = engine;
+	request->memoryBudget = memoryBudget;
+	request->sink = sink;
+	request->complete = complete;
+	request->context = context;
+	::InitializeSRWLock(&request->lock);
+
+	::InterlockedIncrement(&engine->pending);
+	if (PostPortTask(engine->computePort, OpenDecodeTask, request) == FALSE)
+	{
+		ReleasePending(engine);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CancelAsyncRequest
+//	Purpose:	Stops a decode at its next step and cancels its read in flight, it completes with AsyncCancelled.
+//				Only valid until the completion is called.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CancelAsyncRequest(AsyncDecodeRequest* request)
+{
+	if (request == NULL) return;
+
+	::InterlockedExchange(&request->cancelled, TRUE);
+
+	// a read that isn't issued yet sees the flag before it starts
+	::AcquireSRWLockExclusive(&request->lock);
+	if (request->readerOpen == TRUE && request->reader.header.encoding != EncodingSolid) ::CancelIoEx(request->reader.file, &request->read.overlapped);
+	::ReleaseSRWLockExclusive(&request->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompleteWriteTask
+//	Purpose:	Executor task, calls the completion of a finished write or close
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CompleteWriteTask(void* context)
+{
+	AsyncWriteRequest* request = (AsyncWriteRequest*) context;
+	AsyncEngine* engine = request->engine;
+	request->complete(request->context, request->status);
+	ReleasePending(engine);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishWrite
+//	Purpose:	Closes the duplicate handle and frees the buffers of a write, then queues its completion
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FinishWrite(AsyncWriteRequest* request, AsyncStatus status)
+{
+	if (request->file != NULL) ::CloseHandle(request->file);
+	request->file = NULL;
+
+	// free heap memory
+	free(request->bytes);
+	free(request->spans);
+	request->bytes = NULL;
+	request->spans = NULL;
+
+	request->status = status;
+	request->engine->executor.post(request->engine->executor.context, CompleteWriteTask, request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		QueueWriteBytes
+//	Purpose:	ImageByteSink of async writers, keeps the bytes for the overlapped writes after the writer returns
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL QueueWriteBytes(void* context, const BYTE* bytes, DWORD byteSize, __int64 byteOffset)
+{
+	AsyncWriteRequest* request = (AsyncWriteRequest*) context;
+	if (request->byteCount + byteSize > request->byteCapacity)
+	{
+		size_t byteCapacity = (request->byteCapacity < ImageStripByteSize) ? ImageStripByteSize : request->byteCapacity * 2;
+		if (byteCapacity < request->byteCount + byteSize) byteCapacity = request->byteCount + byteSize;
+
+		BYTE* grown = (BYTE*) ::realloc(request->bytes, byteCapacity);
+		if (grown == NULL)
+		{
+			printf("Failed to allocate write buffer.\n");
+			return FALSE;
+		}
+
+		request->bytes = grown;
+		request->byteCapacity = byteCapacity;
+	}
+
+	// bytes that follow on from the last span in the file extend it, so the body goes out in few large writes
+	if (byteSize > 0 && request->spanCount > 0)
+	{
+		AsyncWriteSpan* last = &request->spans[request->spanCount - 1];
+		if (last->byteSize > 0 && last->byteOffset + last->byteSize == byteOffset && last->byteSize <= 0x40000000 - byteSize)
+		{
+			::memcpy(request->bytes + request->byteCount, bytes, byteSize);
+			request->byteCount += byteSize;
+			last->byteSize += byteSize;
+			return TRUE;
+		}
+	}
+
+	if (request->spanCount == request->spanCapacity)
+	{
+		int spanCapacity = (request->spanCapacity < 16) ? 16 : request->spanCapacity * 2;
+		AsyncWriteSpan* grown = (AsyncWriteSpan*) ::realloc(request->spans, spanCapacity * sizeof(AsyncWriteSpan));
+		if (grown == NULL)
+		{
+			printf("Failed to allocate write buffer.\n");
+			return FALSE;
+		}
+
+		request->spans = grown;
+		request->spanCapacity = spanCapacity;
+	}
+
+	AsyncWriteSpan* span = &request->spans[request->spanCount++];
+	span->byteOffset = byteOffset;
+	span->bufferOffset = request->byteCount;
+	span->byteSize = byteSize;
+	if (byteSize > 0) ::memcpy(request->bytes + request->byteCount, bytes, byteSize);
+	request->byteCount += byteSize;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FlushWriterTask
+//	Purpose:	Compute task, flushes the file of a closed writer once its last write is done
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FlushWriterTask(void* context)
+{
+	AsyncWriteRequest* request = (AsyncWriteRequest*) context;
+	::FlushFileBuffers(request->file);
+	FinishWrite(request, AsyncSucceeded);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteNextSpan
+//	Purpose:	Starts the overlapped write of the next span, or finishes the request after the last one
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void WriteSpanComplete(void* context);
+
+static void WriteNextSpan(AsyncWriteRequest* request)
+{
+	// ending the file only changes its size, that needs no completion
+	while (request->spanIndex < request->spanCount && request->spans[request->spanIndex].byteSize == 0)
+	{
+		FILE_END_OF_FILE_INFO end = {};
+		end.EndOfFile.QuadPart = request->spans[request->spanIndex].byteOffset;
+		if (::SetFileInformationByHandle(request->file, FileEndOfFileInfo, &end, sizeof(end)) == FALSE)
+		{
+			PrintOsErrorText();
+			FinishWrite(request, AsyncFailed);
+			return;
+		}
+
+		request->spanIndex++;
+	}
+
+	if (request->spanIndex == request->spanCount)
+	{
+		if (request->close == FALSE) FinishWrite(request, AsyncSucceeded);
+		else if (PostPortTask(request->engine->computePort, FlushWriterTask, request) == FALSE) FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	const AsyncWriteSpan* span = &request->spans[request->spanIndex];
+	::memset(&request->write, 0, sizeof(AsyncFileIo));
+	request->write.overlapped.Offset = (DWORD) span->byteOffset;
+	request->write.overlapped.OffsetHigh = (DWORD) (span->byteOffset >> 32);
+	request->write.complete = WriteSpanComplete;
+	request->write.context = request;
+
+	// the completion is queued to the I/O threads even when the write finishes right away
+	if (::WriteFile(request->file, request->bytes + span->bufferOffset, span->byteSize, NULL, &request->write.overlapped) == FALSE && ::GetLastError() != ERROR_IO_PENDING)
+	{
+		PrintOsErrorText();
+		FinishWrite(request, AsyncFailed);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteSpanComplete
+//	Purpose:	Write completion on an I/O thread, starts on the next span
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void WriteSpanComplete(void* context)
+{
+	AsyncWriteRequest* request = (AsyncWriteRequest*) context;
+	if (request->write.error != ERROR_SUCCESS)
+	{
+		::SetLastError(request->write.error);
+		PrintOsErrorText();
+		FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	if (request->write.byteCount != request->spans[request->spanIndex].byteSize)
+	{
+		printf("Failed to write the file. Wrote %lu of %lu bytes.\n", request->write.byteCount, request->spans[request->spanIndex].byteSize);
+		FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	request->spanIndex++;
+	WriteNextSpan(request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteTask
+//	Purpose:	Compute task, compresses the rows or closes the writer into the request's buffer, then starts
+//				writing it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void WriteTask(void* context)
+{
+	AsyncWriteRequest* request = (AsyncWriteRequest*) context;
+	BifWriter* writer = request->writer;
+
+	// the duplicate shares the port of the writer's handle and outlives CloseImageWriter
+	if (::DuplicateHandle(::GetCurrentProcess(), writer->file, ::GetCurrentProcess(), &request->file, 0, FALSE, DUPLICATE_SAME_ACCESS) == FALSE)
+	{
+		PrintOsErrorText();
+		request->file = NULL;
+		if (request->close == TRUE) AbortImageWriter(writer);
+		FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	writer->outputContext = request;
+	BOOL result = (request->close == TRUE) ? CloseImageWriter(writer) : WriteImageRows(writer, request->rows, request->rowStride, request->rowCount);
+	if (result == FALSE)
+	{
+		FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	WriteNextSpan(request);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StartWrite
+//	Purpose:	Queues a write or close on the compute pool
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL StartWrite(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount, BOOL close, AsyncCompletion complete, void* context)
+{
+	// validate parameters
+	if (engine == NULL || engine->computePort == NULL || request == NULL || writer == NULL || complete == NULL || (close == FALSE && rows == NULL))
+	{
+		printf("Invalid parameter Engine, Request, Writer, Rows or Complete NULL.\n");
+		return FALSE;
+	}
+
+	if (writer->file == NULL || writer->output != QueueWriteBytes)
+	{
+		printf("The writer wasn't opened with OpenAsyncImageWriter or is closed.\n");
+		return FALSE;
+	}
+
+	::memset(request, 0, sizeof(AsyncWriteRequest));
+	request->engine = engine;
+	request->writer = writer;
+	request->rows = rows;
+	request->rowStride = rowStride;
+	request->rowCount = rowCount;
+	request->close = close;
+	request->complete = complete;
+	request->context = context;
+
+	::InterlockedIncrement(&engine->pending);
+	if (PostPortTask(engine->computePort, WriteTask, request) == FALSE)
+	{
+		ReleasePending(engine);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenWriterTask
+//	Purpose:	Compute task, creates the file and writes its header, then reopens it for overlapped writes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void OpenWriterTask(void* context)
+{
+	AsyncWriteRequest* request = (AsyncWriteRequest*) context;
+	BifWriter* writer = request->writer;
+
+	// the header goes out with ordinary writes
+	if (OpenEncodedImageWriter(writer, request->filePath, request->pixelWidth, request->pixelHeight, request->fillColor, request->encoding, request->filter, request->storeMetadata) == FALSE)
+	{
+		FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	// the rest is written overlapped, completing on the I/O threads
+	::CloseHandle(writer->file);
+	writer->file = ::CreateFile(request->filePath, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+	if (writer->file == INVALID_HANDLE_VALUE || ::CreateIoCompletionPort(writer->file, request->engine->ioPort, AsyncIoKey, 0) == NULL)
+	{
+		PrintOsErrorText();
+		if (writer->file == INVALID_HANDLE_VALUE) writer->file = NULL;
+		AbortImageWriter(writer);
+		FinishWrite(request, AsyncFailed);
+		return;
+	}
+
+	// the compute pool already has a thread per processor
+	writer->serialEncode = TRUE;
+	writer->output = QueueWriteBytes;
+
+	FinishWrite(request, AsyncSucceeded);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAsyncImageWriter
+//	Purpose:	Runs OpenEncodedImageWriter on the compute pool for WriteImageRowsAsync and CloseImageWriterAsync,
+//				which are then the only calls the writer takes. The file is reopened for overlapped writes and
+//				compressed on one thread. The writer can only be used once the completion got AsyncSucceeded.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAsyncImageWriter(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata, AsyncCompletion complete, void* context)
+{
+	// validate parameters
+	if (engine == NULL || engine->computePort == NULL || request == NULL || writer == NULL || filePath == NULL || complete == NULL)
+	{
+		printf("Invalid parameter Engine, Request, Writer, FilePath or Complete NULL.\n");
+		return FALSE;
+	}
+
+	::memset(request, 0, sizeof(AsyncWriteRequest));
+	if (::sprintf_s(request->filePath, MAX_PATH, "%s", filePath) < 0)
+	{
+		printf("File path %s is too long.\n", filePath);
+		return FALSE;
+	}
+
+	// the writer isn't open until the completion, a call that uses it early is turned away
+	::memset(writer, 0, sizeof(BifWriter));
+	request->engine = engine;
+	request->writer = writer;
+	request->pixelWidth = pixelWidth;
+	request->pixelHeight = pixelHeight;
+	request->fillColor = fillColor;
+	request->encoding = encoding;
+	request->filter = filter;
+	request->storeMetadata = storeMetadata;
+	request->complete = complete;
+	request->context = context;
+
+	::InterlockedIncrement(&engine->pending);
+	if (PostPortTask(engine->computePort, OpenWriterTask, request) == FALSE)
+	{
+		ReleasePending(engine);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteImageRowsAsync
+//	Purpose:	Runs WriteImageRows on the compute pool and writes what it produced overlapped. A writer takes one
+//				request at a time, start the next write from the completion of the last. After a failed request
+//				the file is incomplete, close it with CloseImageWriterAsync and discard it.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteImageRowsAsync(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount, AsyncCompletion complete, void* context)
+{
+	return StartWrite(engine, request, writer, rows, rowStride, rowCount, FALSE, complete, context);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImageWriterAsync
+//	Purpose:	Runs CloseImageWriter on the compute pool, it compresses and writes the rows still held. The file is
+//				flushed on the compute pool once the overlapped writes are done.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseImageWriterAsync(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, AsyncCompletion complete, void* context)
+{
+	return StartWrite(engine, request, writer, NULL, 0, 0, TRUE, complete, context);
+}
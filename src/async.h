@@ -0,0 +1,220 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file async.h
+* \brief async.h decodes and encodes BIF files without blocking the caller, for services built on event loops
+* Example (optional):
+* \code
+* AsyncEngine engine = {};
+* OpenAsyncEngine(&engine, NULL, 0);
+* AsyncDecodeRequest* request = (AsyncDecodeRequest*) ::calloc(1, sizeof(AsyncDecodeRequest));
+* StartDecodeAsync(&engine, request, "c:\\images\\image.bif", ImageStripByteSize, OnRows, OnDecoded, context);
+* ...OnRows gets the rows a strip at a time, OnDecoded gets AsyncSucceeded, AsyncFailed or AsyncCancelled...
+* CloseAsyncEngine(&engine);
+* \endcode
+* \author Blake Hamilton
+*
+* Requests are state machines, not threads, so any number of them can be in flight. The engine has three places
+* where work runs:
+* I/O threads   - wait on an I/O completion port for the overlapped reads and writes of files, AsyncIoThreads of them.
+* Compute pool  - opens files, decompresses and unfilters chunks, compresses written rows. One thread per processor.
+* Executor      - runs the row sinks and completion callbacks. The caller's event loop supplies it through
+*                 AsyncExecutor.post, for example by posting to its own completion port or window. Without one the
+*                 callbacks run on the I/O threads.
+* A decode reads one strip of the body while nothing else of the request is in flight. Its memory is the strip, for lz
+* files another strip sized buffer for the compressed bytes and one chunk of scratch. Alpha files are read into a strip
+* of file rows that the compute pool converts to the rgb strip, like ReadImageRows does. Only the body reads are
+* overlapped: opening a file reads its header and chunk table with blocking reads, which hold a compute pool thread
+* until they return, so files on slow or remote disks stall the decodes and writes queued behind them.
+* A write runs WriteImageRows or CloseImageWriter on the compute pool into a buffer of the bytes they produce, then
+* writes them overlapped, so its memory is the encoded rows of the request. OpenAsyncImageWriter creates the file and
+* writes its header on the compute pool with blocking calls, like the open of a decode.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+#include "image.h"
+
+// consts
+const int AsyncIoThreads = 2;
+const int AsyncMaxThreads = MAXIMUM_WAIT_OBJECTS;
+
+// how a request ended
+enum AsyncStatus
+{
+	AsyncSucceeded = 0,
+	AsyncFailed = 1,
+	AsyncCancelled = 2			// CancelAsyncRequest, or the row sink returned FALSE
+};
+
+// a step of a request
+typedef void (*AsyncTask)(void* context);
+
+// queues a task on the caller's event loop, the task must run exactly once
+typedef void (*AsyncPost)(void* executorContext, AsyncTask task, void* taskContext);
+
+// receives the end of a request, the request memory can be freed or reused once it is called
+typedef void (*AsyncCompletion)(void* context, AsyncStatus status);
+
+// where sinks and completions run
+struct AsyncExecutor
+{
+	AsyncPost post;
+	void* context;
+};
+
+// threads and queues shared by every request
+struct AsyncEngine
+{
+	HANDLE ioPort;						// overlapped read completions, and tasks of the built in executor
+	HANDLE computePort;					// compute tasks
+	HANDLE threads[AsyncMaxThreads];
+	int ioThreadCount;
+	int computeThreadCount;
+	AsyncExecutor executor;
+	volatile LONG pending;				// requests that haven't completed, plus one for the engine until CloseAsyncEngine
+	HANDLE idle;						// set by the request that takes pending to zero, CloseAsyncEngine waits on it
+};
+
+// an overlapped read or write, OVERLAPPED first so completions lead back to it
+struct AsyncFileIo
+{
+	OVERLAPPED overlapped;
+	AsyncTask complete;
+	void* context;
+	DWORD byteCount;
+	DWORD error;
+};
+
+// caller owned decode, valid from StartDecodeAsync until its completion is called
+struct AsyncDecodeRequest
+{
+	AsyncEngine* engine;
+	char filePath[MAX_PATH];
+	size_t memoryBudget;
+	ImageRowSink sink;
+	AsyncCompletion complete;
+	void* context;
+	BifReader reader;					// its file is reopened for overlapped reads once the header is read
+	BOOL readerOpen;
+	BYTE* strip;
+	int stripRowCount;
+	BYTE* fileStrip;					// file rows of the strip before their alpha is dropped, version 103 files
+	BYTE* compressed;					// body bytes of the strip, lz encoding
+	BYTE* scratch;						// one chunk, lz encoding
+	int firstRow;						// first row of the strip in flight
+	int rowCount;
+	DWORD readByteSize;
+	AsyncFileIo read;
+	SRWLOCK lock;						// keeps the file open while CancelAsyncRequest cancels its read
+	volatile LONG cancelled;
+	AsyncStatus status;
+};
+
+// bytes a write puts at one file offset, byteSize 0 ends the file there
+struct AsyncWriteSpan
+{
+	__int64 byteOffset;
+	size_t bufferOffset;				// where the bytes start in the request's buffer
+	DWORD byteSize;
+};
+
+// caller owned open, write or close, valid from the call until its completion is called
+struct AsyncWriteRequest
+{
+	AsyncEngine* engine;
+	BifWriter* writer;
+	char filePath[MAX_PATH];			// open only, the file and header of the writer
+	unsigned short pixelWidth;
+	unsigned short pixelHeight;
+	COLORREF fillColor;
+	ImageEncoding encoding;
+	ImageFilter filter;
+	BOOL storeMetadata;
+	const BYTE* rows;					// not copied, must stay valid until the completion
+	ptrdiff_t rowStride;
+	int rowCount;
+	BOOL close;
+	AsyncCompletion complete;
+	void* context;
+	HANDLE file;						// duplicate of the writer's handle, still open after CloseImageWriter
+	BYTE* bytes;						// what the writer produced, written once it returns
+	size_t byteCount;
+	size_t byteCapacity;
+	AsyncWriteSpan* spans;
+	int spanCount;
+	int spanCapacity;
+	int spanIndex;						// span being written
+	AsyncFileIo write;
+	AsyncStatus status;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAsyncEngine
+//	Purpose:	Starts the I/O threads and the compute pool. executor NULL runs callbacks on the I/O threads,
+//				computeThreadCount 0 uses one thread per processor.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAsyncEngine(AsyncEngine* engine, const AsyncExecutor* executor, int computeThreadCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseAsyncEngine
+//	Purpose:	Waits for the requests in flight to complete and stops the threads. The executor must keep running
+//				the tasks posted to it meanwhile, so a caller's event loop can't call this from its own thread.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseAsyncEngine(AsyncEngine* engine);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StartDecodeAsync
+//	Purpose:	Starts decoding a BIF file. The sink gets the rows top to bottom in strips of up to memoryBudget
+//				bytes, and never 4 GB or more, on the executor. The rows are only valid during the call. complete is
+//				called once at the end.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL StartDecodeAsync(AsyncEngine* engine, AsyncDecodeRequest* request, const char* filePath, size_t memoryBudget, ImageRowSink sink, AsyncCompletion complete, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CancelAsyncRequest
+//	Purpose:	Stops a decode at its next step and cancels its read in flight, it completes with AsyncCancelled.
+//				Only valid until the completion is called.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CancelAsyncRequest(AsyncDecodeRequest* request);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAsyncImageWriter
+//	Purpose:	Runs OpenEncodedImageWriter on the compute pool for WriteImageRowsAsync and CloseImageWriterAsync,
+//				which are then the only calls the writer takes. The file is reopened for overlapped writes and
+//				compressed on one thread. The writer can only be used once the completion got AsyncSucceeded.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAsyncImageWriter(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata, AsyncCompletion complete, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteImageRowsAsync
+//	Purpose:	Runs WriteImageRows on the compute pool and writes what it produced overlapped. A writer takes one
+//				request at a time, start the next write from the completion of the last. After a failed request
+//				the file is incomplete, close it with CloseImageWriterAsync and discard it.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteImageRowsAsync(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount, AsyncCompletion complete, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImageWriterAsync
+//	Purpose:	Runs CloseImageWriter on the compute pool, it compresses and writes the rows still held. The file is
+//				flushed on the compute pool once the overlapped writes are done.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseImageWriterAsync(AsyncEngine* engine, AsyncWriteRequest* request, BifWriter* writer, AsyncCompletion complete, void* context);
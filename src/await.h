@@ -0,0 +1,332 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file await.h
+* \brief await.h lets C++20 coroutines co_await the requests of async.h
+* Example (optional):
+* \code
+* bif::detached_task Copy(AsyncEngine* engine, BifWriter* writer)
+* {
+*     AsyncStatus status = co_await bif::decode_async(engine, "c:\\images\\image.bif", ImageStripByteSize, OnRows, context);
+*     if (status == AsyncSucceeded) status = co_await bif::open_writer_async(engine, writer, "c:\\images\\copy.bif", 800, 600, 0, EncodingLz, FilterNone, FALSE);
+*     if (status == AsyncSucceeded) status = co_await bif::write_rows_async(engine, writer, rows, rowStride, rowCount);
+*     if (status == AsyncSucceeded) status = co_await bif::close_writer_async(engine, writer);
+* }
+* \endcode
+* \author Blake Hamilton
+*
+* The awaitables hold their request, so it lives in the coroutine frame until the coroutine resumes. The coroutine
+* resumes on the executor from the request's completion, with the same rules as a completion: CloseAsyncEngine can't
+* be called from there. The names follow the standard library, as coroutine code does.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <coroutine>
+#include <exception>
+#include "async.h"
+
+namespace bif
+{
+	// return type of a coroutine that runs on its own once called, its frame is freed when it returns
+	struct detached_task
+	{
+		struct promise_type
+		{
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+			//	Method		get_return_object
+			//	Purpose:	The caller gets nothing to wait on, the coroutine reports its end itself
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+			detached_task get_return_object() noexcept
+			{
+				return detached_task {};
+			}
+
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+			//	Method		initial_suspend
+			//	Purpose:	Runs the coroutine on the caller's thread up to its first co_await
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+			std::suspend_never initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+			//	Method		final_suspend
+			//	Purpose:	Frees the frame as the coroutine returns, nothing resumes it afterwards
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+			std::suspend_never final_suspend() const noexcept
+			{
+				return {};
+			}
+
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+			//	Method		return_void
+			//	Purpose:	Coroutines of this type return nothing
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+			void return_void() const noexcept
+			{
+			}
+
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+			//	Method		unhandled_exception
+			//	Purpose:	No one is left to catch it, the code of this tree reports errors with return values
+			///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+			void unhandled_exception() const noexcept
+			{
+				std::terminate();
+			}
+		};
+	};
+
+	// a decode in flight, the sink still gets the strips on the executor
+	struct decode_awaitable
+	{
+		AsyncEngine* engine;
+		const char* filePath;
+		size_t memoryBudget;
+		ImageRowSink sink;
+		void* context;
+		AsyncDecodeRequest request;
+		std::coroutine_handle<> coroutine;
+		AsyncStatus status;
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		forward_rows
+		//	Purpose:	Row sink of the request, hands the rows to the caller's sink with the caller's context
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		static BOOL forward_rows(void* awaitable, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+		{
+			decode_awaitable* decode = (decode_awaitable*) awaitable;
+			return decode->sink(decode->context, rows, rowStride, firstRow, rowCount);
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		resume
+		//	Purpose:	Completion of the request, resumes the coroutine with the status
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		static void resume(void* awaitable, AsyncStatus status)
+		{
+			decode_awaitable* decode = (decode_awaitable*) awaitable;
+			decode->status = status;
+			decode->coroutine.resume();
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_ready
+		//	Purpose:	A request always completes later, so the coroutine always suspends
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_suspend
+		//	Purpose:	Starts the decode, the coroutine carries on at once with AsyncFailed if it didn't start
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			// the completion may resume the coroutine on another thread before StartDecodeAsync returns, so nothing
+			// of this is touched after a successful start
+			coroutine = awaiting;
+			if (StartDecodeAsync(engine, &request, filePath, memoryBudget, forward_rows, resume, this) == TRUE) return true;
+
+			status = AsyncFailed;
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_resume
+		//	Purpose:	Returns how the request ended, the value of the co_await
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		AsyncStatus await_resume() const noexcept
+		{
+			return status;
+		}
+	};
+
+	// a write or close in flight
+	struct write_awaitable
+	{
+		AsyncEngine* engine;
+		BifWriter* writer;
+		const BYTE* rows;
+		ptrdiff_t rowStride;
+		int rowCount;
+		bool close;
+		AsyncWriteRequest request;
+		std::coroutine_handle<> coroutine;
+		AsyncStatus status;
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		resume
+		//	Purpose:	Completion of the request, resumes the coroutine with the status
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		static void resume(void* awaitable, AsyncStatus status)
+		{
+			write_awaitable* write = (write_awaitable*) awaitable;
+			write->status = status;
+			write->coroutine.resume();
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_ready
+		//	Purpose:	A request always completes later, so the coroutine always suspends
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_suspend
+		//	Purpose:	Starts the write or close, the coroutine carries on at once with AsyncFailed if it didn't start
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			coroutine = awaiting;
+			BOOL started = (close == true) ? CloseImageWriterAsync(engine, &request, writer, resume, this) : WriteImageRowsAsync(engine, &request, writer, rows, rowStride, rowCount, resume, this);
+			if (started == TRUE) return true;
+
+			status = AsyncFailed;
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_resume
+		//	Purpose:	Returns how the request ended, the value of the co_await
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		AsyncStatus await_resume() const noexcept
+		{
+			return status;
+		}
+	};
+
+	// an open of an async writer in flight
+	struct open_writer_awaitable
+	{
+		AsyncEngine* engine;
+		BifWriter* writer;
+		const char* filePath;
+		unsigned short pixelWidth;
+		unsigned short pixelHeight;
+		COLORREF fillColor;
+		ImageEncoding encoding;
+		ImageFilter filter;
+		BOOL storeMetadata;
+		AsyncWriteRequest request;
+		std::coroutine_handle<> coroutine;
+		AsyncStatus status;
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		resume
+		//	Purpose:	Completion of the request, resumes the coroutine with the status
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		static void resume(void* awaitable, AsyncStatus status)
+		{
+			open_writer_awaitable* open = (open_writer_awaitable*) awaitable;
+			open->status = status;
+			open->coroutine.resume();
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_ready
+		//	Purpose:	A request always completes later, so the coroutine always suspends
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_suspend
+		//	Purpose:	Starts the open, the coroutine carries on at once with AsyncFailed if it didn't start
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			coroutine = awaiting;
+			if (OpenAsyncImageWriter(engine, &request, writer, filePath, pixelWidth, pixelHeight, fillColor, encoding, filter, storeMetadata, resume, this) == TRUE) return true;
+
+			status = AsyncFailed;
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//	Method		await_resume
+		//	Purpose:	Returns how the request ended, the value of the co_await
+		///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		AsyncStatus await_resume() const noexcept
+		{
+			return status;
+		}
+	};
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//	Method		decode_async
+	//	Purpose:	Awaits StartDecodeAsync, the sink gets the rows as it does there
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline decode_awaitable decode_async(AsyncEngine* engine, const char* filePath, size_t memoryBudget, ImageRowSink sink, void* context)
+	{
+		return decode_awaitable { engine, filePath, memoryBudget, sink, context };
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//	Method		open_writer_async
+	//	Purpose:	Awaits OpenAsyncImageWriter, the writer takes write_rows_async and close_writer_async once it
+	//				returns AsyncSucceeded
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline open_writer_awaitable open_writer_async(AsyncEngine* engine, BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata)
+	{
+		return open_writer_awaitable { engine, writer, filePath, pixelWidth, pixelHeight, fillColor, encoding, filter, storeMetadata };
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//	Method		write_rows_async
+	//	Purpose:	Awaits WriteImageRowsAsync, for a writer opened with OpenAsyncImageWriter
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline write_awaitable write_rows_async(AsyncEngine* engine, BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount)
+	{
+		return write_awaitable { engine, writer, rows, rowStride, rowCount, false };
+	}
+
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//	Method		close_writer_async
+	//	Purpose:	Awaits CloseImageWriterAsync
+	///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline write_awaitable close_writer_async(AsyncEngine* engine, BifWriter* writer)
+	{
+		return write_awaitable { engine, writer, NULL, 0, 0, true };
+	}
+}
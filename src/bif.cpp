@@ -21,15 +21,19 @@
 /*
 * BLAKE IMAGE FORMAT (.bif)
 *
-* File Header:
-* 4 BYTES -	Unique four letter character code to identify file type on read = BIF1
+* File Header (version 100):
+* 4 BYTES - Unique four letter character code to identify file type on read = BIFF
+* 2 BYTES - File Version
 * 2 BYTES - Pixel Width
 * 2 BYTES - Pixel Height
 * 4 BYTES - Fill Color
 *
-* File Body:
+* File Body (version 100):
 * N BYTES - Pixel data - byte size is computed with formula ([Pixel Width] * [Pixel Height] * [Bytes Per Color Channel] * [Number Of Color Channels])
 *
+* Versions 101 (chunked lz body), 102 (metadata blocks) and 103 (rgba rows) extend this header, their layouts are in
+* image.h.
+*
 */
 
 // includes
@@ -42,18 +46,61 @@
 #include <Shlobj.h>
 #include <time.h>
 #include "resource.h"
+#include "bif.h"
+#include "async.h"
+#include "await.h"
+#include "composite.h"
+#include "convert.h"
+#include "frame.h"
+#include "generator.h"
+#include "hash.h"
+#include "image.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "store.h"
+#include "viewport.h"
 
 // libs
 #pragma comment(lib, "Shell32.lib")
 
-// consts
-const unsigned short FileVersion = 100;
-const BYTE BifFourCC[4] = { 0x42, 0x49, 0x46, 0x46 }; // BIFF
-
 // globals
 BITMAP mBitmapObject = {};
 HDC mMemoryHdc = NULL;
 
+// dib section the decoded rows are copied into
+struct DisplaySinkContext
+{
+	BYTE* targetScan0;
+	ptrdiff_t targetStride;
+	int pixelWidth;
+};
+
+// state shared by the requests of the decodeasync command
+struct DecodeAsyncState
+{
+	AsyncEngine* engine;
+	const char* filePath;
+	size_t memoryBudget;
+	const char* targetPath;			// where the last request writes what it decoded, or NULL
+	BifHeader header;				// size and fill color of the target
+	HANDLE done;					// set when the last request completes
+	volatile LONG completed;
+	volatile LONG succeeded;
+	volatile LONG cancelled;
+	LONG requestCount;
+};
+
+// one request of the decodeasync command, a coroutine holds the requests it awaits
+struct DecodeAsyncItem
+{
+	DecodeAsyncState* state;
+	BOOL cancel;					// the sink stops the decode at its first strip
+	int rowCount;					// rows delivered, the sink of a request is never called twice at once
+	BYTE* copy;						// the decoded rows kept for the target, the last request only
+	ptrdiff_t copyStride;
+};
+
 // forward declared functions
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -61,7 +108,7 @@ HDC mMemoryHdc = NULL;
 //	Purpose:	Creates a new BIF image file
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-BOOL CreateImage(const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor);
+BOOL CreateImage(const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, BOOL storeMetadata);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //	Method		DisplayImage
@@ -70,6 +117,153 @@ BOOL CreateImage(const char* filePath, unsigned short pixelWidth, unsigned short
 
 BOOL DisplayImage(const char* filePath);
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CopyRowsToDib
+//	Purpose:	Row sink that converts decoded rgb rows to bgr dib rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CopyRowsToDib(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunGenerateCommand
+//	Purpose:	Handles the generate command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunGenerateCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunStoreCommand
+//	Purpose:	Handles the store command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunStoreCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunRestoreCommand
+//	Purpose:	Handles the restore command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunRestoreCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunEncodeCommand
+//	Purpose:	Handles the encode command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunEncodeCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunRenderCommand
+//	Purpose:	Handles the render command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunRenderCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunStatsCommand
+//	Purpose:	Handles the stats command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunStatsCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDedupeCommand
+//	Purpose:	Handles the dedupe command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunDedupeCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunHashBenchCommand
+//	Purpose:	Handles the hashbench command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunHashBenchCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunCompositeCommand
+//	Purpose:	Handles the composite command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunCompositeCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunConvertCommand
+//	Purpose:	Handles the convert command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunConvertCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunConvertDirectoryCommand
+//	Purpose:	Handles the convertdir command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunConvertDirectoryCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunPublishCommand
+//	Purpose:	Handles the publish command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunPublishCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunSubscribeCommand
+//	Purpose:	Handles the subscribe command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunSubscribeCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDecodeAsyncCommand
+//	Purpose:	Handles the decodeasync command line
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunDecodeAsyncCommand(int argc, char* argv[]);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CountDecodedRows
+//	Purpose:	Row sink that discards the rows, used to time a decode
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CountDecodedRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CountAsyncRows
+//	Purpose:	Row sink of the decodeasync command, counts the rows of a request and keeps them for the target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CountAsyncRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OnAsyncDecoded
+//	Purpose:	End of a decodeasync request, signals the command once every request is done
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void OnAsyncDecoded(void* context, AsyncStatus status);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDecodeAsyncItem
+//	Purpose:	Coroutine of a decodeasync request, awaits the decode and then the writes of the target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bif::detached_task RunDecodeAsyncItem(DecodeAsyncItem* item);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrepareOutputFile
+//	Purpose:	Deletes the file if it exists and creates its directory if it doesn't
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL PrepareOutputFile(const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		TakeOptionFlag
+//	Purpose:	Removes an optional flag such as -metadata from the arguments
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL TakeOptionFlag(int* argc, char* argv[], const char* flag);
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //	Method		ConfigureScreen
 //	Purpose:	Prints usage to the screen
@@ -89,102 +283,1426 @@ BOOL CenterWindow(HWND hwndWindow);
 //	Purpose:	Prints a command line usage error
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void PrintUsageError();
+void PrintUsageError();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WindowProc
+//	Purpose:	Windos message loop function required for window
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+
+// function impementations
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		main
+//	Purpose:	application entry point
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// int main()
+int main(int argc, char* argv[])
+{
+	// configure screen
+	ConfigureScreen();
+
+	// commands
+	if (__argc >= 2 && ::_stricmp(__argv[1], "generate") == 0) return RunGenerateCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "store") == 0) return RunStoreCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "restore") == 0) return RunRestoreCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "encode") == 0) return RunEncodeCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "render") == 0) return RunRenderCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "stats") == 0) return RunStatsCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "dedupe") == 0) return RunDedupeCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "hashbench") == 0) return RunHashBenchCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "composite") == 0) return RunCompositeCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "convert") == 0) return RunConvertCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "convertdir") == 0) return RunConvertDirectoryCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "publish") == 0) return RunPublishCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "subscribe") == 0) return RunSubscribeCommand(__argc, __argv);
+	if (__argc >= 2 && ::_stricmp(__argv[1], "decodeasync") == 0) return RunDecodeAsyncCommand(__argc, __argv);
+
+	// optional metadata flag, files are version 100 without it
+	int argCount = __argc;
+	BOOL storeMetadata = TakeOptionFlag(&argCount, __argv, "-metadata");
+
+	// check arguments
+	if (argCount < 7)
+	{
+		// print usage error
+		PrintUsageError();
+		
+		// return failed status code
+		return -1;
+	}
+
+	// print log information message
+	printf("Validating command line arguments...\n");
+
+	// pixel width parameter
+	unsigned short pixelWidth = (unsigned short) atoi((const char*)__argv[1]);
+	if (pixelWidth == 0)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	// pixel height parameter
+	unsigned short pixelHeight = (unsigned short) atoi((const char*)__argv[2]);
+	if (pixelHeight == 0)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	// red channel parameter
+	BYTE red = (BYTE) atoi((const char*)__argv[3]);
+
+	// green channel parameter
+	BYTE green = (BYTE)atoi((const char*)__argv[4]);
+
+	// blue channel parameter
+	BYTE blue = (BYTE)atoi((const char*)__argv[5]);
+
+	// file path parameter
+	const char* filePath = (const char*) __argv[6];
+	if (filePath == NULL)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	// delete any existing file and create the directory
+	if (PrepareOutputFile(filePath) == FALSE)
+	{
+		// return failed status code
+		return -1;
+	}
+
+	// create fill colorref
+	COLORREF fillColor = RGB(red, green, blue);
+
+	// print log information message
+	printf("Creating image %s...\n", filePath);
+
+	// create blake image format (.bif)
+	if (CreateImage(filePath, pixelWidth, pixelHeight, fillColor, storeMetadata) == FALSE)
+	{
+		// return failed status code
+		return -1;
+	}
+
+	// print log information message
+	printf("Successfully created image %s.\n", filePath);
+
+	// print log information message
+	printf("Displaying image %s....\n", filePath);
+
+	// display blake image format (.bif)
+	if (DisplayImage(filePath) == FALSE)
+	{
+		// return failed status code
+		return -1;
+	}
+
+	// print log information message
+	printf("Successfully displayed image %s.\n", filePath);
+
+	// return success status code
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunGenerateCommand
+//	Purpose:	Handles "generate [Pattern] [Pixel Width] [Pixel Height] [Seed] [File Path] (Cell Size) (-metadata)"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunGenerateCommand(int argc, char* argv[])
+{
+	// optional metadata flag
+	BOOL storeMetadata = TakeOptionFlag(&argc, argv, "-metadata");
+
+	// check arguments
+	if (argc < 7)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	// print log information message
+	printf("Validating command line arguments...\n");
+
+	// pattern parameter
+	GeneratorPattern pattern = PatternSolid;
+	if (ParseGeneratorPattern(argv[2], &pattern) == FALSE)
+	{
+		printf("Unknown pattern %s.\n", argv[2]);
+		PrintUsageError();
+		return -1;
+	}
+
+	// pixel width and height parameters
+	unsigned short pixelWidth = (unsigned short) atoi((const char*) argv[3]);
+	unsigned short pixelHeight = (unsigned short) atoi((const char*) argv[4]);
+	if (pixelWidth == 0 || pixelHeight == 0)
+	{
+		PrintUsageError();
+		return -1;
+	}
+
+	// seed and file path parameters
+	GeneratorOptions options = {};
+	InitGeneratorOptions(&options, pattern);
+	options.seed = (unsigned int) ::strtoul(argv[5], NULL, 10);
+	options.storeMetadata = storeMetadata;
+	const char* filePath = (const char*) argv[6];
+
+	// optional cell size parameter
+	if (argc >= 8)
+	{
+		options.cellSize = atoi((const char*) argv[7]);
+		if (options.cellSize <= 0)
+		{
+			PrintUsageError();
+			return -1;
+		}
+	}
+
+	// delete any existing file and create the directory
+	if (PrepareOutputFile(filePath) == FALSE) return -1;
+
+	// print log information message
+	printf("Generating %s image %s (%u x %u, seed %u)...\n", argv[2], filePath, pixelWidth, pixelHeight, options.seed);
+
+	// generate the image
+	DWORD startTime = ::GetTickCount();
+	if (GenerateImage(filePath, &options, pixelWidth, pixelHeight) == FALSE) return -1;
+	DWORD elapsed = ::GetTickCount() - startTime;
+
+	// print log information message
+	printf("Successfully generated image %s in %lu ms.\n", filePath, elapsed);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunStoreCommand
+//	Purpose:	Handles "store [Pack Path] [BIF Path] [Map Path]"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunStoreCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 5)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* packPath = (const char*) argv[2];
+	const char* bifPath = (const char*) argv[3];
+	const char* mapPath = (const char*) argv[4];
+
+	// delete any existing tile map and create the directory
+	if (PrepareOutputFile(mapPath) == FALSE) return -1;
+
+	// print log information message
+	printf("Opening tile store %s...\n", packPath);
+
+	TileStore store = {};
+	if (OpenTileStore(&store, packPath, StoreTileSize) == FALSE) return -1;
+
+	// print log information message
+	printf("Storing image %s (%lu tiles in the store)...\n", bifPath, store.tileCount);
+
+	DWORD startTime = ::GetTickCount();
+	BOOL result = StoreImage(&store, bifPath, mapPath);
+	DWORD elapsed = ::GetTickCount() - startTime;
+	CloseTileStore(&store);
+
+	if (result == FALSE) return -1;
+
+	// print log information message
+	printf("Successfully stored image %s as %s in %lu ms.\n", bifPath, mapPath, elapsed);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunRestoreCommand
+//	Purpose:	Handles "restore [Pack Path] [Map Path] [BIF Path]"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunRestoreCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 5)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* packPath = (const char*) argv[2];
+	const char* mapPath = (const char*) argv[3];
+	const char* bifPath = (const char*) argv[4];
+
+	if (FileExists(mapPath) == FALSE)
+	{
+		printf("Tile map %s does not exist.\n", mapPath);
+		return -1;
+	}
+
+	// read only, so restores can run side by side and next to a store command
+	TileStore store = {};
+	if (OpenTileStoreForReading(&store, packPath, StoreTileSize) == FALSE) return -1;
+
+	// delete any existing file and create the directory
+	if (PrepareOutputFile(bifPath) == FALSE)
+	{
+		CloseTileStore(&store);
+		return -1;
+	}
+
+	TileCache cache = {};
+	if (OpenTileCache(&cache, &store, StoreCacheTiles) == FALSE)
+	{
+		CloseTileStore(&store);
+		return -1;
+	}
+
+	// print log information message
+	printf("Restoring image %s from %s...\n", bifPath, mapPath);
+
+	DWORD startTime = ::GetTickCount();
+	BOOL result = RestoreImage(&cache, mapPath, bifPath);
+	DWORD elapsed = ::GetTickCount() - startTime;
+	__int64 hits = cache.hits;
+	__int64 misses = cache.misses;
+	CloseTileCache(&cache);
+	CloseTileStore(&store);
+
+	if (result == FALSE) return -1;
+
+	// print log information message
+	printf("Successfully restored image %s in %lu ms (tile cache %lld hits, %lld misses).\n", bifPath, elapsed, hits, misses);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunEncodeCommand
+//	Purpose:	Handles "encode [Encoding] [Source File Path] [Target File Path] (-metadata)"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunEncodeCommand(int argc, char* argv[])
+{
+	// optional metadata flag
+	BOOL storeMetadata = TakeOptionFlag(&argc, argv, "-metadata");
+
+	// check arguments
+	if (argc < 5)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	// encoding parameter
+	ImageEncoding encoding = EncodingRaw;
+	ImageFilter filter = FilterNone;
+	if (ParseImageEncoding(argv[2], &encoding, &filter) == FALSE)
+	{
+		printf("Unknown encoding %s.\n", argv[2]);
+		PrintUsageError();
+		return -1;
+	}
+
+	const char* sourcePath = (const char*) argv[3];
+	const char* targetPath = (const char*) argv[4];
+
+	// delete any existing file and create the directory
+	if (PrepareOutputFile(targetPath) == FALSE) return -1;
+
+	// print log information message
+	printf("Encoding image %s as %s...\n", sourcePath, argv[2]);
+
+	DWORD startTime = ::GetTickCount();
+	if (EncodeImage(sourcePath, targetPath, encoding, filter, storeMetadata) == FALSE) return -1;
+	DWORD elapsed = ::GetTickCount() - startTime;
+
+	// time a full decode of the new file, a strip at a time
+	BifReader reader = {};
+	if (OpenImageReader(&reader, targetPath) == FALSE) return -1;
+	LARGE_INTEGER sourceByteSize = {};
+	LARGE_INTEGER targetByteSize = {};
+	::GetFileSizeEx(reader.file, &targetByteSize);
+	startTime = ::GetTickCount();
+	BOOL decoded = DecodeImageRows(&reader, ImageStripByteSize, CountDecodedRows, NULL);
+	DWORD decodeElapsed = ::GetTickCount() - startTime;
+	CloseImageReader(&reader);
+	if (decoded == FALSE) return -1;
+
+	HANDLE sourceFile = ::CreateFile(sourcePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (sourceFile != INVALID_HANDLE_VALUE)
+	{
+		::GetFileSizeEx(sourceFile, &sourceByteSize);
+		::CloseHandle(sourceFile);
+	}
+
+	// print log information message
+	printf("Successfully encoded image %s in %lu ms, %I64d bytes to %I64d bytes. Decode takes %lu ms.\n", targetPath, elapsed, sourceByteSize.QuadPart, targetByteSize.QuadPart, decodeElapsed);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunRenderCommand
+//	Purpose:	Handles "render [File Path] [Left] [Top] [Right] [Bottom] [Pixel Width] [Pixel Height] [Filter] [Target File Path]"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunRenderCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 11)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* filePath = (const char*) argv[2];
+	RECT sourceRect = { atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), atoi(argv[6]) };
+	unsigned short pixelWidth = (unsigned short) atoi((const char*) argv[7]);
+	unsigned short pixelHeight = (unsigned short) atoi((const char*) argv[8]);
+	const char* targetPath = (const char*) argv[10];
+	if (pixelWidth == 0 || pixelHeight == 0 || sourceRect.right <= sourceRect.left || sourceRect.bottom <= sourceRect.top)
+	{
+		PrintUsageError();
+		return -1;
+	}
+
+	// filter parameter
+	ResampleFilter filter = ResampleNearest;
+	if (ParseResampleFilter(argv[9], &filter) == FALSE)
+	{
+		printf("Unknown filter %s.\n", argv[9]);
+		PrintUsageError();
+		return -1;
+	}
+
+	// delete any existing file and create the directory
+	if (PrepareOutputFile(targetPath) == FALSE) return -1;
+
+	// print log information message
+	printf("Opening image %s...\n", filePath);
+
+	DWORD startTime = ::GetTickCount();
+	ViewportImage image = {};
+	if (OpenViewportImage(&image, filePath) == FALSE) return -1;
+	DWORD openElapsed = ::GetTickCount() - startTime;
+
+	ptrdiff_t rowByteSize = (ptrdiff_t) pixelWidth * ImageColorChannels;
+	BYTE* pixels = (BYTE*) ::malloc((size_t) rowByteSize * pixelHeight);
+	if (pixels == NULL)
+	{
+		printf("Failed to allocate %u x %u viewport.\n", pixelWidth, pixelHeight);
+		CloseViewportImage(&image);
+		return -1;
+	}
+
+	// first frame, then the same view panned by a quarter of its width to time a frame that mostly hits the tile cache
+	startTime = ::GetTickCount();
+	BOOL result = RenderViewport(&image, &sourceRect, pixelWidth, pixelHeight, filter, pixels, rowByteSize);
+	DWORD frameElapsed = ::GetTickCount() - startTime;
+
+	RECT pannedRect = sourceRect;
+	LONG panWidth = (sourceRect.right - sourceRect.left) / 4;
+	pannedRect.left += panWidth;
+	pannedRect.right += panWidth;
+	BYTE* panned = (BYTE*) ::malloc((size_t) rowByteSize * pixelHeight);
+	startTime = ::GetTickCount();
+	if (result == TRUE && panned != NULL) result = RenderViewport(&image, &pannedRect, pixelWidth, pixelHeight, filter, panned, rowByteSize);
+	DWORD panElapsed = ::GetTickCount() - startTime;
+	free(panned);
+
+	__int64 hits = image.tileHits;
+	__int64 misses = image.tileMisses;
+	CloseViewportImage(&image);
+
+	// write the first frame
+	BifWriter writer = {};
+	if (result == TRUE) result = OpenImageWriter(&writer, targetPath, pixelWidth, pixelHeight, RGB(0, 0, 0));
+	if (result == TRUE)
+	{
+		result = WriteImageRows(&writer, pixels, rowByteSize, pixelHeight);
+		if (result == TRUE) result = CloseImageWriter(&writer);
+		else AbortImageWriter(&writer);
+	}
+
+	free(pixels);
+
+	if (result == FALSE) return -1;
+
+	// print log information message
+	printf("Successfully rendered %s to %s. Open and overviews %lu ms, frame %lu ms, panned frame %lu ms (tile cache %lld hits, %lld misses).\n", filePath, targetPath, openElapsed, frameElapsed, panElapsed, hits, misses);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunStatsCommand
+//	Purpose:	Handles "stats [File Path]"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunStatsCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 3)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* filePath = (const char*) argv[2];
+
+	// print log information message
+	printf("Reading statistics of image %s...\n", filePath);
+
+	DWORD startTime = ::GetTickCount();
+	ImageStatistics statistics;
+	BOOL fromHeader = FALSE;
+	if (ComputeImageStatistics(filePath, &statistics, &fromHeader) == FALSE) return -1;
+	DWORD elapsed = ::GetTickCount() - startTime;
+
+	const char* channelNames[StatisticsChannels] = { "Red", "Green", "Blue" };
+	for (int c = 0; c < StatisticsChannels; ++c)
+	{
+		printf("%-5s minimum %3u maximum %3u mean %.2f\n", channelNames[c], statistics.minimum[c], statistics.maximum[c], GetChannelMean(&statistics, c));
+	}
+
+	// print log information message
+	printf("%I64u pixels%s. Read from the %s in %lu ms.\n", statistics.pixelCount, (statistics.solid == TRUE) ? ", solid color" : "", (fromHeader == TRUE) ? "header" : "pixels", elapsed);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDedupeCommand
+//	Purpose:	Handles "dedupe [Directory] (Max Distance)"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunDedupeCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 3)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* directory = (const char*) argv[2];
+	int maxDistance = (argc >= 4) ? atoi((const char*) argv[3]) : HashDuplicateDistance;
+	if (maxDistance < 0 || maxDistance > HashMaxDistance)
+	{
+		printf("Max distance must be between 0 and %d.\n", HashMaxDistance);
+		return -1;
+	}
+
+	// list the bif files of the directory
+	char pattern[MAX_PATH];
+	::sprintf_s(pattern, MAX_PATH, "%s\\*.bif", directory);
+	WIN32_FIND_DATA findData = {};
+	HANDLE find = ::FindFirstFile(pattern, &findData);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		printf("No BIF files found in %s.\n", directory);
+		return -1;
+	}
+
+	int fileCount = 0;
+	int fileCapacity = 0;
+	char* paths = NULL;
+	BOOL result = TRUE;
+	do
+	{
+		if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) continue;
+
+		if (fileCount == fileCapacity)
+		{
+			fileCapacity = (fileCapacity > 0) ? fileCapacity * 2 : 1024;
+			char* grown = (char*) ::realloc(paths, (size_t) fileCapacity * MAX_PATH);
+			if (grown == NULL)
+			{
+				result = FALSE;
+				break;
+			}
+
+			paths = grown;
+		}
+
+		::sprintf_s(paths + (size_t) fileCount * MAX_PATH, MAX_PATH, "%s\\%s", directory, findData.cFileName);
+		fileCount++;
+	}
+	while (::FindNextFile(find, &findData) == TRUE);
+
+	::FindClose(find);
+
+	const char** filePaths = (const char**) ::malloc((size_t) fileCount * sizeof(const char*) + 1);
+	unsigned __int64* hashes = (unsigned __int64*) ::malloc((size_t) fileCount * sizeof(unsigned __int64) + 1);
+	BOOL* hashed = (BOOL*) ::malloc((size_t) fileCount * sizeof(BOOL) + 1);
+	DWORD* groups = (DWORD*) ::malloc((size_t) fileCount * sizeof(DWORD) + 1);
+	DWORD* fileIds = (DWORD*) ::malloc((size_t) fileCount * sizeof(DWORD) + 1);
+	if (result == FALSE || filePaths == NULL || hashes == NULL || hashed == NULL || groups == NULL || fileIds == NULL)
+	{
+		printf("Failed to allocate the list of %d files.\n", fileCount);
+		result = FALSE;
+	}
+
+	// print log information message
+	if (result == TRUE) printf("Hashing %d images in %s...\n", fileCount, directory);
+
+	// hash every file, then index the ones that could be read
+	DWORD startTime = ::GetTickCount();
+	int headerCount = 0;
+	if (result == TRUE)
+	{
+		for (int i = 0; i < fileCount; ++i)
+		{
+			filePaths[i] = paths + (size_t) i * MAX_PATH;
+		}
+
+		result = HashImageFiles(filePaths, fileCount, hashes, hashed, &headerCount);
+	}
+
+	DWORD hashElapsed = ::GetTickCount() - startTime;
+
+	int hashCount = 0;
+	for (int i = 0; result == TRUE && i < fileCount; ++i)
+	{
+		if (hashed[i] == FALSE) continue;
+
+		hashes[hashCount] = hashes[i];
+		fileIds[hashCount] = (DWORD) i;
+		hashCount++;
+	}
+
+	startTime = ::GetTickCount();
+	HashIndex index = {};
+	if (result == TRUE) result = BuildHashIndex(&index, hashes, hashCount);
+	if (result == TRUE) result = FindDuplicateGroups(&index, maxDistance, groups);
+	DWORD searchElapsed = ::GetTickCount() - startTime;
+	FreeHashIndex(&index);
+
+	if (result == TRUE)
+	{
+		int duplicateCount = 0;
+		for (int i = 0; i < hashCount; ++i)
+		{
+			if (groups[i] == (DWORD) i) continue;
+
+			printf("%s is a near duplicate of %s\n", filePaths[fileIds[i]], filePaths[fileIds[groups[i]]]);
+			duplicateCount++;
+		}
+
+		// print log information message
+		printf("Found %d near duplicates among %d images. Hashing took %lu ms, %d hashes were read from the header. The search took %lu ms.\n", duplicateCount, hashCount, hashElapsed, headerCount, searchElapsed);
+	}
+
+	free(paths);
+	free(filePaths);
+	free(hashes);
+	free(hashed);
+	free(groups);
+	free(fileIds);
+
+	return (result == TRUE) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunHashBenchCommand
+//	Purpose:	Handles "hashbench [Hash Count] (Max Distance) (Seed)"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunHashBenchCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 3)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	int hashCount = atoi((const char*) argv[2]);
+	int maxDistance = (argc >= 4) ? atoi((const char*) argv[3]) : HashDuplicateDistance;
+	unsigned int seed = (argc >= 5) ? (unsigned int) strtoul((const char*) argv[4], NULL, 10) : 1;
+
+	// print log information message
+	printf("Benchmarking near duplicate search over %d hashes...\n", hashCount);
+
+	return (RunHashIndexBenchmark(hashCount, maxDistance, seed) == TRUE) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunCompositeCommand
+//	Purpose:	Handles "composite [Target File Path] [Pixel Width] [Pixel Height] [Layer File Path] [Mask File Path or -]
+//				[Left] [Top] [Opacity] [Operator] ... (-metadata)" with one group of six parameters per layer, bottom
+//				layer first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunCompositeCommand(int argc, char* argv[])
+{
+	// optional metadata flag
+	BOOL storeMetadata = TakeOptionFlag(&argc, argv, "-metadata");
+
+	// check arguments
+	if (argc < 11 || (argc - 5) % 6 != 0 || (argc - 5) / 6 > CompositeMaxLayers)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* targetPath = (const char*) argv[2];
+	unsigned short pixelWidth = (unsigned short) atoi((const char*) argv[3]);
+	unsigned short pixelHeight = (unsigned short) atoi((const char*) argv[4]);
+	int layerCount = (argc - 5) / 6;
+	if (pixelWidth == 0 || pixelHeight == 0)
+	{
+		PrintUsageError();
+		return -1;
+	}
+
+	// operators are checked before any file is opened
+	CompositeOperator operators[CompositeMaxLayers];
+	for (int i = 0; i < layerCount; ++i)
+	{
+		if (ParseCompositeOperator(argv[10 + i * 6], &operators[i]) == FALSE)
+		{
+			printf("Unknown operator %s.\n", argv[10 + i * 6]);
+			PrintUsageError();
+			return -1;
+		}
+	}
+
+	FileLayer* fileLayers = (FileLayer*) ::calloc(layerCount, sizeof(FileLayer));
+	CompositeLayer* layers = (CompositeLayer*) ::calloc(layerCount, sizeof(CompositeLayer));
+	if (fileLayers == NULL || layers == NULL)
+	{
+		printf("Failed to allocate %d layers.\n", layerCount);
+		free(fileLayers);
+		free(layers);
+		return -1;
+	}
+
+	// open layers
+	BOOL result = TRUE;
+	int opened = 0;
+	for (; result == TRUE && opened < layerCount; ++opened)
+	{
+		char** group = argv + 5 + opened * 6;
+		const char* maskPath = (::strcmp(group[1], "-") == 0) ? NULL : (const char*) group[1];
+		int opacity = atoi((const char*) group[4]);
+		opacity = (opacity < 0) ? 0 : (opacity > 255) ? 255 : opacity;
+
+		// print log information message
+		printf("Opening layer %s...\n", group[0]);
+		result = OpenFileLayer(&fileLayers[opened], &layers[opened], group[0], maskPath, atoi(group[2]), atoi(group[3]), (BYTE) opacity, operators[opened]);
+	}
+
+	DWORD elapsed = 0;
+	if (result == TRUE) result = PrepareOutputFile(targetPath);
+	if (result == TRUE)
+	{
+		// print log information message
+		printf("Compositing %d layers into %s...\n", layerCount, targetPath);
+
+		DWORD startTime = ::GetTickCount();
+		result = CompositeImage(layers, layerCount, pixelWidth, pixelHeight, RGB(0, 0, 0), targetPath, storeMetadata);
+		elapsed = ::GetTickCount() - startTime;
+	}
+
+	for (int i = 0; i < opened; ++i)
+	{
+		CloseFileLayer(&fileLayers[i]);
+	}
+
+	free(fileLayers);
+	free(layers);
+
+	if (result == FALSE) return -1;
+
+	// print log information message
+	printf("Successfully composited %d layers into %s in %lu ms.\n", layerCount, targetPath, elapsed);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunConvertCommand
+//	Purpose:	Handles "convert [Source File Path] [Target File Path] (Encoding) (-metadata)", the encoding and
+//				metadata only apply when the target is a BIF file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunConvertCommand(int argc, char* argv[])
+{
+	// optional metadata flag
+	BOOL storeMetadata = TakeOptionFlag(&argc, argv, "-metadata");
+
+	// check arguments
+	if (argc < 4)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* sourcePath = (const char*) argv[2];
+	const char* targetPath = (const char*) argv[3];
+
+	// encoding parameter
+	ImageEncoding encoding = EncodingLz;
+	ImageFilter filter = FilterNone;
+	if (argc >= 5 && ParseImageEncoding(argv[4], &encoding, &filter) == FALSE)
+	{
+		printf("Unknown encoding %s.\n", argv[4]);
+		PrintUsageError();
+		return -1;
+	}
+
+	// delete any existing file and create the directory
+	if (PrepareOutputFile(targetPath) == FALSE) return -1;
+
+	// print log information message
+	printf("Converting image %s to %s...\n", sourcePath, targetPath);
+
+	DWORD startTime = ::GetTickCount();
+	if (ConvertImage(sourcePath, targetPath, encoding, filter, storeMetadata) == FALSE) return -1;
+	DWORD elapsed = ::GetTickCount() - startTime;
+
+	// a single file converts on one thread
+	double megabytes = GetConvertedByteSize(sourcePath, targetPath) / (1024.0 * 1024.0);
+	double rate = (elapsed > 0) ? megabytes * 1000.0 / elapsed : 0.0;
+
+	// print log information message
+	printf("Successfully converted image %s in %lu ms, %.1f MB of pixels at %.1f MB/s on one thread.\n", targetPath, elapsed, megabytes, rate);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunConvertDirectoryCommand
+//	Purpose:	Handles "convertdir [Source Directory] [Target Directory] [Target Extension] (Encoding)
+//				(-metadata)". BIF targets are imported from every PPM, PGM, BMP and PNG file, other targets are
+//				exported from every BIF file.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunConvertDirectoryCommand(int argc, char* argv[])
+{
+	// optional metadata flag
+	BOOL storeMetadata = TakeOptionFlag(&argc, argv, "-metadata");
+
+	// check arguments
+	if (argc < 5)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* sourceDirectory = (const char*) argv[2];
+	const char* targetDirectory = (const char*) argv[3];
+	const char* targetExtension = (const char*) argv[4];
+	if (targetExtension[0] == '.') targetExtension++;
+
+	char targetName[_MAX_FNAME];
+	::sprintf_s(targetName, _MAX_FNAME, "target.%s", targetExtension);
+	ImageFileFormat targetFormat = GetImageFileFormat(targetName);
+	if (targetFormat == FileFormatUnknown)
+	{
+		printf("Unknown extension %s.\n", targetExtension);
+		PrintUsageError();
+		return -1;
+	}
+
+	// encoding parameter
+	ImageEncoding encoding = EncodingLz;
+	ImageFilter filter = FilterNone;
+	if (argc >= 6 && ParseImageEncoding(argv[5], &encoding, &filter) == FALSE)
+	{
+		printf("Unknown encoding %s.\n", argv[5]);
+		PrintUsageError();
+		return -1;
+	}
+
+	// list the source files, every import format for bif targets
+	const char* importPatterns[] = { "*.ppm", "*.pgm", "*.pnm", "*.bmp", "*.png" };
+	const char* exportPatterns[] = { "*.bif" };
+	const char** patterns = (targetFormat == FileFormatBif) ? importPatterns : exportPatterns;
+	int patternCount = (targetFormat == FileFormatBif) ? (int) (sizeof(importPatterns) / sizeof(importPatterns[0])) : 1;
+
+	int fileCount = 0;
+	int fileCapacity = 0;
+	char* sourcePaths = NULL;
+	char* targetPaths = NULL;
+	BOOL result = TRUE;
+	for (int p = 0; p < patternCount && result == TRUE; ++p)
+	{
+		char pattern[MAX_PATH];
+		::sprintf_s(pattern, MAX_PATH, "%s\\%s", sourceDirectory, patterns[p]);
+		WIN32_FIND_DATA findData = {};
+		HANDLE find = ::FindFirstFile(pattern, &findData);
+		if (find == INVALID_HANDLE_VALUE) continue;
+
+		do
+		{
+			if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) continue;
+
+			if (fileCount == fileCapacity)
+			{
+				fileCapacity = (fileCapacity > 0) ? fileCapacity * 2 : 1024;
+				char* grownSources = (char*) ::realloc(sourcePaths, (size_t) fileCapacity * MAX_PATH);
+				if (grownSources != NULL) sourcePaths = grownSources;
+				char* grownTargets = (char*) ::realloc(targetPaths, (size_t) fileCapacity * MAX_PATH);
+				if (grownTargets != NULL) targetPaths = grownTargets;
+				if (grownSources == NULL || grownTargets == NULL)
+				{
+					result = FALSE;
+					break;
+				}
+			}
+
+			// the target keeps the file name with the new extension
+			char fileNameBuffer[_MAX_FNAME] = "";
+			::_splitpath(findData.cFileName, NULL, NULL, fileNameBuffer, NULL);
+			::sprintf_s(sourcePaths + (size_t) fileCount * MAX_PATH, MAX_PATH, "%s\\%s", sourceDirectory, findData.cFileName);
+			::sprintf_s(targetPaths + (size_t) fileCount * MAX_PATH, MAX_PATH, "%s\\%s.%s", targetDirectory, fileNameBuffer, targetExtension);
+			fileCount++;
+		}
+		while (::FindNextFile(find, &findData) == TRUE);
+
+		::FindClose(find);
+	}
+
+	if (result == TRUE && fileCount == 0)
+	{
+		printf("No files to convert found in %s.\n", sourceDirectory);
+		result = FALSE;
+	}
+
+	const char** sourceList = (const char**) ::malloc((size_t) fileCount * sizeof(const char*) + 1);
+	const char** targetList = (const char**) ::malloc((size_t) fileCount * sizeof(const char*) + 1);
+	BOOL* converted = (BOOL*) ::malloc((size_t) fileCount * sizeof(BOOL) + 1);
+	if (result == TRUE && (sourceList == NULL || targetList == NULL || converted == NULL))
+	{
+		printf("Failed to allocate the list of %d files.\n", fileCount);
+		result = FALSE;
+	}
+
+	// create the target directory
+	if (result == TRUE && DirectoryExists(targetDirectory) == FALSE && ::SHCreateDirectoryEx(NULL, targetDirectory, NULL) != ERROR_SUCCESS)
+	{
+		PrintOsErrorText();
+		result = FALSE;
+	}
+
+	if (result == TRUE)
+	{
+		for (int i = 0; i < fileCount; ++i)
+		{
+			sourceList[i] = sourcePaths + (size_t) i * MAX_PATH;
+			targetList[i] = targetPaths + (size_t) i * MAX_PATH;
+		}
+
+		// print log information message
+		printf("Converting %d images from %s to %s...\n", fileCount, sourceDirectory, targetDirectory);
+
+		DWORD startTime = ::GetTickCount();
+		__int64 pixelByteCount = 0;
+		result = ConvertImageFiles(sourceList, targetList, fileCount, encoding, filter, storeMetadata, converted, &pixelByteCount);
+		DWORD elapsed = ::GetTickCount() - startTime;
+
+		int convertedCount = 0;
+		for (int i = 0; result == TRUE && i < fileCount; ++i)
+		{
+			if (converted[i] == TRUE) convertedCount++;
+			else printf("Failed to convert %s.\n", sourceList[i]);
+		}
+
+		// every file converts on one thread, so fewer files than processors can't use them all
+		int threadCount = (GetProcessorCount() < fileCount) ? GetProcessorCount() : fileCount;
+		double megabytes = pixelByteCount / (1024.0 * 1024.0);
+		double rate = (elapsed > 0) ? megabytes * 1000.0 / elapsed : 0.0;
+
+		// print log information message
+		if (result == TRUE) printf("Converted %d of %d images in %lu ms, %.1f MB of pixels at %.1f MB/s on %d threads, one file per thread.\n", convertedCount, fileCount, elapsed, megabytes, rate, threadCount);
+		if (convertedCount != fileCount) result = FALSE;
+	}
+
+	free(sourcePaths);
+	free(targetPaths);
+	free(sourceList);
+	free(targetList);
+	free(converted);
+
+	return (result == TRUE) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunPublishCommand
+//	Purpose:	Handles "publish [File Path] [Frame Name] (Frame Count)", decodes the image into the next shared frame
+//				Frame Count times, then keeps the frames open until Enter is pressed
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunPublishCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 4)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* filePath = (const char*) argv[2];
+	const char* frameName = (const char*) argv[3];
+	int frameCount = (argc >= 5) ? atoi((const char*) argv[4]) : 1;
+	if (frameCount <= 0)
+	{
+		PrintUsageError();
+		return -1;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, filePath) == FALSE) return -1;
+
+	FrameProducer producer = {};
+	if (OpenFrameProducer(&producer, frameName, reader.header.pixelWidth, reader.header.pixelHeight, FrameFormatRgb, FrameDefaultSlots) == FALSE)
+	{
+		CloseImageReader(&reader);
+		return -1;
+	}
+
+	// print log information message
+	printf("Publishing %d frames of %s as %s...\n", frameCount, filePath, frameName);
+
+	// every frame is decoded straight into its slot
+	BOOL result = TRUE;
+	DWORD startTime = ::GetTickCount();
+	for (int i = 0; i < frameCount && result == TRUE; ++i)
+	{
+		if (i > 0)
+		{
+			CloseImageReader(&reader);
+			result = OpenImageReader(&reader, filePath);
+			if (result == FALSE) break;
+		}
+
+		ptrdiff_t rowStride = 0;
+		BYTE* pixels = BeginFrameWrite(&producer, &rowStride);
+		result = (pixels != NULL) ? DecodeImageToBuffer(&reader, ImageStripByteSize, pixels, rowStride) : FALSE;
+		if (pixels != NULL && result == TRUE) result = EndFrameWrite(&producer);
+	}
+
+	DWORD elapsed = ::GetTickCount() - startTime;
+	CloseImageReader(&reader);
+
+	if (result == TRUE)
+	{
+		// print log information message
+		printf("Published %d frames in %lu ms. Press Enter to stop publishing.\n", frameCount, elapsed);
+		getchar();
+	}
+
+	CloseFrameProducer(&producer);
+
+	return (result == TRUE) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunSubscribeCommand
+//	Purpose:	Handles "subscribe [Frame Name] (Frame Count) (Target File Path)", reads frames in place as they are
+//				published and writes the last one that was read intact to the target. Each frame is encoded to a
+//				temporary file that replaces the target only once the frame turns out intact.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunSubscribeCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 3)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* frameName = (const char*) argv[2];
+	int frameCount = (argc >= 4) ? atoi((const char*) argv[3]) : 1;
+	const char* targetPath = (argc >= 5) ? (const char*) argv[4] : NULL;
+	if (frameCount <= 0)
+	{
+		PrintUsageError();
+		return -1;
+	}
+
+	// delete any existing file and create the directory
+	if (targetPath != NULL && PrepareOutputFile(targetPath) == FALSE) return -1;
+
+	// the temporary file sits next to the target so replacing the target is a rename on the same volume
+	char tempPath[MAX_PATH] = "";
+	if (targetPath != NULL) ::sprintf_s(tempPath, MAX_PATH, "%s.tmp", targetPath);
+
+	FrameConsumer consumer = {};
+	if (OpenFrameConsumer(&consumer, frameName) == FALSE) return -1;
+
+	// print log information message
+	printf("Waiting for %d frames of %s...\n", frameCount, frameName);
+
+	int received = 0;
+	int torn = 0;
+	LONG64 firstSequence = 0;
+	LONG64 lastSequence = 0;
+	LONG64 writtenSequence = 0;
+	BOOL written = FALSE;
+	BOOL result = TRUE;
+	DWORD startTime = ::GetTickCount();
+	while (received < frameCount && result == TRUE)
+	{
+		SharedFrame frame = {};
+		result = WaitForFrame(&consumer, FrameDefaultTimeout, &frame);
+		if (result == FALSE) break;
+
+		if (firstSequence == 0) firstSequence = frame.sequence;
+		lastSequence = frame.sequence;
+		received++;
+
+		// the pixels are encoded where the producer left them
+		BOOL encoded = FALSE;
+		if (targetPath != NULL && frame.format == FrameFormatRgb)
+		{
+			BifWriter writer = {};
+			result = OpenImageWriter(&writer, tempPath, (unsigned short) frame.pixelWidth, (unsigned short) frame.pixelHeight, RGB(0, 0, 0));
+			if (result == TRUE)
+			{
+				result = WriteImageRows(&writer, frame.pixels, frame.rowStride, frame.pixelHeight);
+				if (result == TRUE) result = CloseImageWriter(&writer);
+				else AbortImageWriter(&writer);
+			}
+
+			encoded = result;
+		}
+
+		// a frame that was overwritten meanwhile is dropped and the target keeps the last intact one
+		if (EndFrameRead(&consumer, &frame) == FALSE)
+		{
+			torn++;
+		}
+		else if (encoded == TRUE)
+		{
+			if (::MoveFileEx(tempPath, targetPath, MOVEFILE_REPLACE_EXISTING) == FALSE)
+			{
+				PrintOsErrorText();
+				result = FALSE;
+			}
+			else
+			{
+				written = TRUE;
+				writtenSequence = frame.sequence;
+			}
+		}
+	}
+
+	DWORD elapsed = ::GetTickCount() - startTime;
+	CloseFrameConsumer(&consumer);
+
+	// a torn or failed last frame leaves its temporary file behind
+	if (targetPath != NULL) ::DeleteFile(tempPath);
+
+	if (result == FALSE && received == 0) return -1;
+
+	// print log information message
+	printf("Received %d frames (%lld to %lld, %lld skipped), %d overwritten while read, in %lu ms.\n", received, firstSequence, lastSequence, lastSequence - firstSequence + 1 - received, torn, elapsed);
+	if (targetPath == NULL) return (result == TRUE) ? 0 : -1;
+
+	// the target is only ever replaced by a frame that was read intact
+	if (written == FALSE)
+	{
+		printf("No frame was read intact, %s was not written.\n", targetPath);
+		return -1;
+	}
+
+	// print log information message
+	printf("Successfully wrote frame %lld to %s.\n", writtenSequence, targetPath);
+
+	return (result == TRUE) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CountAsyncRows
+//	Purpose:	Row sink of the decodeasync command, counts the rows of a request and keeps them for the target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CountAsyncRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	DecodeAsyncItem* item = (DecodeAsyncItem*) context;
+	if (item->cancel == TRUE) return FALSE;
+
+	if (item->copy != NULL)
+	{
+		for (int y = 0; y < rowCount; ++y)
+		{
+			::memcpy(item->copy + (firstRow + y) * item->copyStride, rows + y * rowStride, item->copyStride);
+		}
+	}
+
+	item->rowCount += rowCount;
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OnAsyncDecoded
+//	Purpose:	End of a decodeasync request, signals the command once every request is done
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void OnAsyncDecoded(void* context, AsyncStatus status)
+{
+	DecodeAsyncState* state = ((DecodeAsyncItem*) context)->state;
+	if (status == AsyncSucceeded) ::InterlockedIncrement(&state->succeeded);
+	if (status == AsyncCancelled) ::InterlockedIncrement(&state->cancelled);
+	if (::InterlockedIncrement(&state->completed) == state->requestCount) ::SetEvent(state->done);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDecodeAsyncItem
+//	Purpose:	Coroutine of a decodeasync request, awaits the decode and then the writes of the target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bif::detached_task RunDecodeAsyncItem(DecodeAsyncItem* item)
+{
+	DecodeAsyncState* state = item->state;
+	AsyncStatus status = co_await bif::decode_async(state->engine, state->filePath, state->memoryBudget, CountAsyncRows, item);
+
+	// the rows are written back as one request, the writer lives in the coroutine frame like the requests
+	if (status == AsyncSucceeded && item->copy != NULL)
+	{
+		BifWriter writer = {};
+		const BifHeader* header = &state->header;
+		status = co_await bif::open_writer_async(state->engine, &writer, state->targetPath, header->pixelWidth, header->pixelHeight, header->fillColor, EncodingLz, FilterNone, TRUE);
+		if (status == AsyncSucceeded)
+		{
+			// a failed write still closes the writer, the incomplete file is deleted
+			status = co_await bif::write_rows_async(state->engine, &writer, item->copy, item->copyStride, header->pixelHeight);
+			AsyncStatus closed = co_await bif::close_writer_async(state->engine, &writer);
+			if (status == AsyncSucceeded) status = closed;
+			if (status != AsyncSucceeded) ::DeleteFile(state->targetPath);
+			else printf("Successfully wrote %s.\n", state->targetPath);
+		}
+	}
+
+	OnAsyncDecoded(item, status);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDecodeAsyncCommand
+//	Purpose:	Handles "decodeasync [File Path] [Request Count] (Cancel Count) (Target File Path)", starts every
+//				decode at once on the async engine and cancels the first Cancel Count of them while they are in
+//				flight. The last request writes what it decoded to the target.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int RunDecodeAsyncCommand(int argc, char* argv[])
+{
+	// check arguments
+	if (argc < 4)
+	{
+		// print usage error
+		PrintUsageError();
+
+		// return failed status code
+		return -1;
+	}
+
+	const char* filePath = (const char*) argv[2];
+	int requestCount = atoi((const char*) argv[3]);
+	int cancelCount = (argc >= 5) ? atoi((const char*) argv[4]) : 0;
+	const char* targetPath = (argc >= 6) ? (const char*) argv[5] : NULL;
+	if (requestCount <= 0 || cancelCount < 0 || cancelCount > requestCount || (targetPath != NULL && cancelCount == requestCount))
+	{
+		PrintUsageError();
+		return -1;
+	}
+
+	DecodeAsyncState state = {};
+	state.filePath = filePath;
+	state.targetPath = targetPath;
+	state.requestCount = requestCount;
+
+	// the size of the target comes from the header, the decodes themselves only see rows
+	BYTE* copy = NULL;
+	if (targetPath != NULL)
+	{
+		BifReader reader = {};
+		if (OpenImageReader(&reader, filePath) == FALSE) return -1;
+		state.header = reader.header;
+		CloseImageReader(&reader);
+
+		if (PrepareOutputFile(targetPath) == FALSE) return -1;
+
+		copy = (BYTE*) ::malloc((size_t) state.header.pixelWidth * ImageColorChannels * state.header.pixelHeight);
+		if (copy == NULL)
+		{
+			printf("Failed to allocate pixel buffer.\n");
+			return -1;
+		}
+	}
+
+	DecodeAsyncItem* items = (DecodeAsyncItem*) ::calloc(requestCount, sizeof(DecodeAsyncItem));
+	if (items == NULL)
+	{
+		printf("Failed to allocate requests.\n");
+		::free(copy);
+		return -1;
+	}
+
+	state.done = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	AsyncEngine engine = {};
+	if (state.done == NULL || OpenAsyncEngine(&engine, NULL, 0) == FALSE)
+	{
+		if (state.done == NULL) PrintOsErrorText();
+		else ::CloseHandle(state.done);
+		::free(items);
+		::free(copy);
+		return -1;
+	}
+
+	// print log information message
+	printf("Decoding %s %d times on %d I/O and %d compute threads...\n", filePath, requestCount, engine.ioThreadCount, engine.computeThreadCount);
+
+	// the strip budget is split between the requests so they fit in memory together
+	state.engine = &engine;
+	state.memoryBudget = ImageStripByteSize / requestCount;
+	DWORD startTime = ::GetTickCount();
+	for (int i = 0; i < requestCount; ++i)
+	{
+		items[i].state = &state;
+		items[i].cancel = (i < cancelCount) ? TRUE : FALSE;
+		if (i == requestCount - 1 && copy != NULL)
+		{
+			items[i].copy = copy;
+			items[i].copyStride = (ptrdiff_t) state.header.pixelWidth * ImageColorChannels;
+		}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//	Method		FileExists
-//	Purpose:	Returns TRUE is file path exists
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		// every request ends in OnAsyncDecoded, a decode that doesn't start included
+		RunDecodeAsyncItem(&items[i]);
+	}
 
-BOOL FileExists(const char* filePath);
+	::WaitForSingleObject(state.done, INFINITE);
+	DWORD elapsed = ::GetTickCount() - startTime;
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//	Method		DirectoryExists
-//	Purpose:	Returns TRUE is directory path exists
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	CloseAsyncEngine(&engine);
+	::CloseHandle(state.done);
 
-BOOL DirectoryExists(const char* directoryPath);
+	// every decode that succeeded delivered the same rows
+	__int64 rowCount = 0;
+	for (int i = 0; i < requestCount; ++i) rowCount += items[i].rowCount;
+	::free(items);
+	::free(copy);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//	Method		PrintOsErrorText
-//	Purpose:	Prints the friendly text associated with the last OS error message numeric code
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// print log information message
+	printf("%ld decodes succeeded, %ld cancelled, %ld failed, %lld rows in %lu ms.\n", state.succeeded, state.cancelled, requestCount - state.succeeded - state.cancelled, rowCount, elapsed);
 
-void PrintOsErrorText();
+	return (state.succeeded + state.cancelled == requestCount) ? 0 : -1;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//	Method		WindowProc
-//	Purpose:	Windos message loop function required for window
+//	Method		CountDecodedRows
+//	Purpose:	Row sink that discards the rows, used to time a decode
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
-
-// function impementations
+BOOL CountDecodedRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	return TRUE;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//	Method		main
-//	Purpose:	application entry point
+//	Method		TakeOptionFlag
+//	Purpose:	Removes an optional flag such as -metadata from the arguments, returns TRUE if it was given. The
+//				arguments after it move down one place so the positional parameters keep their indexes.
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// int main()
-int main(int argc, char* argv[])
+BOOL TakeOptionFlag(int* argc, char* argv[], const char* flag)
 {
-	// configure screen
-	ConfigureScreen();
-
-	// check arguments
-	if (__argc < 7)
+	// validate parameters
+	if (argc == NULL || argv == NULL || flag == NULL)
 	{
-		// print usage error
-		PrintUsageError();
-		
-		// return failed status code
-		return -1;
+		printf("Invalid parameter Argc, Argv or Flag NULL.\n");
+		return FALSE;
 	}
 
-	// print log information message
-	printf("Validating command line arguments...\n");
-
-	// pixel width parameter
-	unsigned short pixelWidth = (unsigned short) atoi((const char*)__argv[1]);
-	if (pixelWidth == 0)
+	for (int i = 1; i < *argc; ++i)
 	{
-		// print usage error
-		PrintUsageError();
-
-		// return failed status code
-		return -1;
-	}
+		if (argv[i] == NULL || ::_stricmp(argv[i], flag) != 0) continue;
 
-	// pixel height parameter
-	unsigned short pixelHeight = (unsigned short) atoi((const char*)__argv[2]);
-	if (pixelHeight == 0)
-	{
-		// print usage error
-		PrintUsageError();
+		for (int j = i; j + 1 < *argc; ++j) argv[j] = argv[j + 1];
+		(*argc)--;
+		argv[*argc] = NULL;
 
-		// return failed status code
-		return -1;
+		return TRUE;
 	}
 
-	// red channel parameter
-	BYTE red = (BYTE) atoi((const char*)__argv[3]);
-
-	// green channel parameter
-	BYTE green = (BYTE)atoi((const char*)__argv[4]);
+	return FALSE;
+}
 
-	// blue channel parameter
-	BYTE blue = (BYTE)atoi((const char*)__argv[5]);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrepareOutputFile
+//	Purpose:	Deletes the file if it exists and creates its directory if it doesn't
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	// file path parameter
-	const char* filePath = (const char*) __argv[6];
+BOOL PrepareOutputFile(const char* filePath)
+{
+	// validate parameters
 	if (filePath == NULL)
 	{
-		// print usage error
-		PrintUsageError();
-
-		// return failed status code
-		return -1;
+		printf("Invalid parameter FilePath NULL.\n");
+		return FALSE;
 	}
 
 	// print log information message
@@ -202,8 +1720,7 @@ int main(int argc, char* argv[])
 			// print message
 			PrintOsErrorText();
 
-			// return failed status code
-			return -1;
+			return FALSE;
 		}
 	}
 
@@ -221,8 +1738,7 @@ int main(int argc, char* argv[])
 		// print message
 		printf("Out of memory.\n");
 
-		// return failed status code
-		return -1;
+		return FALSE;
 	}
 
 	// set null terminator at first char in char array to make empty string
@@ -250,59 +1766,22 @@ int main(int argc, char* argv[])
 			// free memory allocated on the heap
 			free(directoryPath);
 
-			// return failed status code
-			return -1;
+			return FALSE;
 		}
 	}
 
-	// create fill colorref
-	COLORREF fillColor = RGB(red, green, blue);
-
-	// print log information message
-	printf("Creating image %s...\n", filePath);
-
-	// create blake image format (.bif)
-	if (CreateImage(filePath, pixelWidth, pixelHeight, fillColor) == FALSE)
-	{
-		// free memory allocated on the heap
-		free(directoryPath);
-
-		// return failed status code
-		return -1;
-	}
-
-	// print log information message
-	printf("Successfully created image %s.\n", filePath);
-
-	// print log information message
-	printf("Displaying image %s....\n", filePath);
-
-	// display blake image format (.bif)
-	if (DisplayImage(filePath) == FALSE)
-	{
-		// free memory allocated on the heap
-		free(directoryPath);
-
-		// return failed status code
-		return -1;
-	}
-
-	// print log information message
-	printf("Successfully displayed image %s.\n", filePath);
-
 	// free memory allocated on the heap
 	free(directoryPath);
 
-	// return success status code
-    return 0;
+	return TRUE;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //	Method		CreateImage
-//	Purpose:	Creates a new BIF image file
+//	Purpose:	Creates a new BIF image file, version 100 unless storeMetadata is TRUE
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-BOOL CreateImage(const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor)
+BOOL CreateImage(const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, BOOL storeMetadata)
 {
 	// validate parameters
 	if (filePath == NULL)
@@ -311,123 +1790,13 @@ BOOL CreateImage(const char* filePath, unsigned short pixelWidth, unsigned short
 		return FALSE;
 	}
 
-	// get red color
-	BYTE red = GetRValue(fillColor);
-
-	// get green color
-	BYTE green = GetGValue(fillColor);
-
-	// get blue color
-	BYTE blue = GetBValue(fillColor);
-
-	// number of bytes per color channel (our fill color is specified using one byte per color channel so numBytesPerChannel = 1)
-	int numBytesPerChannel = 1;
-
-	// number of color channels (bands) in image (rgb = 3)
-	int numColorChannels = 3;
-
-	// compute pixel buffer size (raw memory is always allocated using the count of data needed in bytes)
-	__int64 pixelBufferSize = pixelWidth * pixelHeight * numBytesPerChannel * numColorChannels;
-
-	// allocate memory buffer on the heap (malloc is the ANSI C way of allocating on the heap, ANSI C++ can also use the "new" keyword,
-	// the WIN32 API has even more ways to allocate memory but those are specific to Windows)
-	BYTE* pixels = (BYTE*) malloc(pixelBufferSize);
-	if (pixels == NULL)
-	{
-		printf("Failed to allocate pixel buffer.\n");
-		return FALSE;
-	}
-
-	// zero pixel memory buffer
-	::memset(pixels, 0, pixelBufferSize);
-
-	// fill the pixels with the fill color
-	BYTE* scan0 = (BYTE*) pixels;
-	for (int y = 0; y < pixelHeight; ++y)
-	{
-		for (int x = 0; x < pixelWidth; ++x)
-		{
-			scan0[0] = red;
-			scan0[1] = green;
-			scan0[2] = blue;
-			scan0 += 3;
-		}
-	}
-
-	// create file
-	HANDLE file = ::CreateFile(filePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (file == INVALID_HANDLE_VALUE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		return FALSE;
-	}
-
-	// write bif four letter character code (4CC)
-	DWORD numberOfBytesWritten = 0;
-	if (::WriteFile(file, BifFourCC, (DWORD) sizeof(BifFourCC), &numberOfBytesWritten, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// write file version
-	if (::WriteFile(file, &FileVersion, (DWORD) sizeof(unsigned short), &numberOfBytesWritten, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// write pixel width
-	if (::WriteFile(file, &pixelWidth, (DWORD) sizeof(pixelWidth), &numberOfBytesWritten, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// write pixel height
-	if (::WriteFile(file, &pixelHeight, (DWORD) sizeof(pixelHeight), &numberOfBytesWritten, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// write fill color
-	if (::WriteFile(file, &fillColor, (DWORD) sizeof(fillColor), &numberOfBytesWritten, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// write pixels
-	if (::WriteFile(file, pixels, (DWORD) pixelBufferSize, &numberOfBytesWritten, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// flush data to disk
-	::FlushFileBuffers(file);
+	// a solid fill is the simplest generator pattern, it is streamed to disk one strip at a time
+	GeneratorOptions options = {};
+	InitGeneratorOptions(&options, PatternSolid);
+	options.startColor = fillColor;
+	options.storeMetadata = storeMetadata;
 
-	// close file handle
-	::CloseHandle(file);
-
-	// free heap memory
-	free(pixels);
-
-	return TRUE;
+	return GenerateImage(filePath, &options, pixelWidth, pixelHeight);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -444,92 +1813,18 @@ BOOL DisplayImage(const char* filePath)
 		return FALSE;
 	}
 
-	// open file for read only
-	HANDLE file = ::CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (file == INVALID_HANDLE_VALUE)
-	{
-		PrintOsErrorText();
-		return FALSE;
-	}
-
-	// get file byte size
-	DWORD fileByteSize = ::GetFileSize(file, NULL);
-
-	// compute file header byte size - which is the sizeof() each variable that holds the header information ([4CC] + [FileVersion] + [Pixel Width] + [Pixel Height] + [Fill Color] == 14 bytes)
-	DWORD fileHeaderByteSize = sizeof(BifFourCC) + sizeof(unsigned short) + sizeof(short) + sizeof(short) + sizeof(COLORREF);
-
-	// validate mimimum file size, which in our case is the size of the header
-	if (fileByteSize < fileHeaderByteSize)
-	{
-		printf("Unsupported or corrupt file. File header must be %lu bytes.\n", fileHeaderByteSize);
-		return FALSE;
-	}
-
-	// read first four bytes (4CC)
-	BYTE fourCC[4] = {};
-	DWORD numberOfBytesRead = 0;
-	if (::ReadFile(file, fourCC, (DWORD) sizeof(fourCC), &numberOfBytesRead, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// validate its a BIF1 file by comparing 4 bytes of raw memory
-	if (::memcmp(fourCC, BifFourCC, sizeof(fourCC)) != 0)
-	{
-		printf("Unsupported file type. File doesn't start with correct 4 bytes.\n");
-		return FALSE;
-	}
-
-	// read file version
-	unsigned short fileVersion = 0;
-	if (::ReadFile(file, &fileVersion, (DWORD) sizeof(fileVersion), &numberOfBytesRead, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// validate correct file version for this reader
-	if (fileVersion != FileVersion)
-	{
-		printf("Unsupported file version. This reader only supports version %u.\n", FileVersion);
-		return FALSE;
-	}
-
-	// read pixel width
-	unsigned short pixelWidth = 0;
-	if (::ReadFile(file, &pixelWidth, (DWORD) sizeof(pixelWidth), &numberOfBytesRead, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// read pixel height
-	unsigned short pixelHeight = 0;
-	if (::ReadFile(file, &pixelHeight, (DWORD) sizeof(pixelHeight), &numberOfBytesRead, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		::CloseHandle(file);
-		return FALSE;
-	}
+	// open file and read its header, the pixel rows are streamed straight into the dib section below
+	BifReader reader = {};
+	if (OpenImageReader(&reader, filePath) == FALSE) return FALSE;
 
-	// read fill color
-	COLORREF fillColor = 0;
-	if (::ReadFile(file, &fillColor, (DWORD) sizeof(fillColor), &numberOfBytesRead, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		::CloseHandle(file);
-		return FALSE;
-	}
+	unsigned short pixelWidth = reader.header.pixelWidth;
+	unsigned short pixelHeight = reader.header.pixelHeight;
 
 	// number of bytes per color channel (our fill color is specified using one byte per color channel so numBytesPerChannel = 1)
 	int numBytesPerChannel = 1;
 
 	// number of color channels (bands) in image (rgb = 3)
-	int numColorChannels = 3;
+	int numColorChannels = ImageColorChannels;
 
 	// number of bits per byte
 	int numBitsPerByte = 8;
@@ -537,48 +1832,12 @@ BOOL DisplayImage(const char* filePath)
 	// number of bits per pixel
 	int numBitsPerPixel = numColorChannels * numBytesPerChannel * numBitsPerByte;
 
-	// compute pixel buffer size (raw memory is always allocated using the count of data needed in bytes)
-	__int64 pixelBufferSize = pixelWidth * pixelHeight * numBytesPerChannel * numColorChannels;
-
-	// validate file size matches what we want to read out
-	if (fileHeaderByteSize + pixelBufferSize > fileByteSize)
-	{
-		printf("Unsupported or corrupt file. File size must be at least %lu bytes.\n", (DWORD) (fileHeaderByteSize + pixelBufferSize));
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// allocate memory buffer on the heap (malloc is the ANSI C way of allocating on the heap, ANSI C++ can also use the "new" keyword,
-	// the WIN32 API has even more ways to allocate memory but those are specific to Windows)
-	BYTE* pixels = (BYTE*) malloc(pixelBufferSize);
-	if (pixels == NULL)
-	{
-		printf("Failed to allocate pixel buffer.\n");
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// zero pixel memory buffer
-	::memset(pixels, 0, pixelBufferSize);
-
-	// read pixels
-	if (::ReadFile(file, pixels, (DWORD) pixelBufferSize, &numberOfBytesRead, NULL) == FALSE)
-	{
-		PrintOsErrorText();
-		free(pixels);
-		::CloseHandle(file);
-		return FALSE;
-	}
-
-	// close file handle
-	::CloseHandle(file);
-
 	// get console window instance handle
 	HINSTANCE instance = (HINSTANCE) ::GetModuleHandle(NULL);
 	if (instance == NULL) 
 	{
 		printf("Invalid console window instance handle NULL.\n");
-		free(pixels);
+		CloseImageReader(&reader);
 		return FALSE;
 	}
 
@@ -599,7 +1858,7 @@ BOOL DisplayImage(const char* filePath)
 	if (hwnd == NULL)
 	{
 		printf("Invalid window handle NULL.\n");
-		free(pixels);
+		CloseImageReader(&reader);
 		return FALSE;
 	}
 
@@ -621,20 +1880,30 @@ BOOL DisplayImage(const char* filePath)
 	// create device independent bitmap (DIB)
 	UINT* bits = 0;
 	HBITMAP bitmap = ::CreateDIBSection(hdc, (BITMAPINFO*) &bitmapInfo, DIB_RGB_COLORS, (void **)&bits, NULL, 0);
+	if (bitmap == NULL || bits == NULL)
+	{
+		printf("Failed to create device independent bitmap.\n");
+		::ReleaseDC(hwnd, hdc);
+		::DestroyWindow(hwnd);
+		CloseImageReader(&reader);
+		return FALSE;
+	}
 
-	// copy the pixels to the dib section - rgb to bgr
-	BYTE* sourceScan0 = (BYTE*) pixels;
-	BYTE* targetScan0 = (BYTE*) bits;
-	for (int y = 0; y < pixelHeight; ++y)
+	// dib rows are padded to a multiple of 4 bytes and stored bottom-up
+	DisplaySinkContext sink = {};
+	sink.targetStride = ((pixelWidth * numBitsPerPixel + 31) / 32) * 4;
+	sink.targetScan0 = (BYTE*) bits + (pixelHeight - 1) * sink.targetStride;
+	sink.pixelWidth = pixelWidth;
+
+	// decode the pixels into the dib section a strip at a time - rgb to bgr
+	BOOL decoded = DecodeImageRows(&reader, ImageStripByteSize, CopyRowsToDib, &sink);
+	CloseImageReader(&reader);
+	if (decoded == FALSE)
 	{
-		for (int x = 0; x < pixelWidth; ++x)
-		{
-			targetScan0[0] = sourceScan0[2];
-			targetScan0[1] = sourceScan0[1];
-			targetScan0[2] = sourceScan0[0];
-			sourceScan0 += 3;
-			targetScan0 += 3;
-		}
+		::ReleaseDC(hwnd, hdc);
+		::DeleteObject(bitmap);
+		::DestroyWindow(hwnd);
+		return FALSE;
 	}
 
 	// create memory device context
@@ -666,8 +1935,6 @@ BOOL DisplayImage(const char* filePath)
 		::DispatchMessage(&msg);
 	}
 															
-	// free heap memory
-	free(pixels);
 
 	// delete device context
 	DeleteDC(mMemoryHdc);
@@ -678,6 +1945,22 @@ BOOL DisplayImage(const char* filePath)
 	return TRUE;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CopyRowsToDib
+//	Purpose:	Row sink that converts decoded rgb rows to bgr dib rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CopyRowsToDib(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	DisplaySinkContext* sink = (DisplaySinkContext*) context;
+
+	// the dib is bottom-up so image row y lives at scan0 - y * stride
+	PixelPipeline<SwapRedBlueStage> pipeline((SwapRedBlueStage()));
+	pipeline.Run(rows, rowStride, sink->targetScan0 - firstRow * sink->targetStride, -sink->targetStride, sink->pixelWidth, rowCount);
+
+	return TRUE;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //	Method		WindowProc
 //	Purpose:	Windows message call back routine
@@ -773,7 +2056,38 @@ void ConfigureScreen()
 	printf("Red Color Channel. (range: 0 - 255)\n");
 	printf("Green Color Channel. (range: 0 - 255)\n");
 	printf("Blue Color Channel. (range: 0 - 255)\n");
-	printf("Full path to image file. (example: 800 600 255 0 255 \"c:\\images\\image.bif\")\n\n");
+	printf("Full path to image file. (example: 800 600 255 0 255 \"c:\\images\\image.bif\")\n");
+	printf("-metadata stores the statistics and hash in the file, version 102. Also taken by generate, encode, composite,\n");
+	printf("    convert and convertdir. (optional)\n\n");
+	printf("Commands (optional):\n");
+	printf("generate [Pattern] [Pixel Width] [Pixel Height] [Seed] [File Path] (Cell Size) (-metadata)\n");
+	printf("    Patterns: solid, checker, linear, radial, value, perlin, photo\n");
+	printf("store [Pack Path] [BIF Path] [Map Path]\n");
+	printf("    Adds the image tiles to the pack, tiles already in the pack are stored once\n");
+	printf("restore [Pack Path] [Map Path] [BIF Path]\n");
+	printf("    Rebuilds a BIF file from its tile map\n");
+	printf("encode [Encoding] [Source File Path] [Target File Path] (-metadata)\n");
+	printf("    Encodings: raw, lz, lzdelta\n");
+	printf("render [File Path] [Left] [Top] [Right] [Bottom] [Pixel Width] [Pixel Height] [Filter] [Target File Path]\n");
+	printf("    Renders the source rectangle at the given size without a window. Filters: nearest, bilinear, lanczos\n");
+	printf("stats [File Path]\n");
+	printf("    Prints the minimum, maximum and mean of every channel\n");
+	printf("dedupe [Directory] (Max Distance)\n");
+	printf("    Lists the BIF files of the directory whose perceptual hashes differ in at most Max Distance bits\n");
+	printf("hashbench [Hash Count] (Max Distance) (Seed)\n");
+	printf("    Times the near duplicate search over random hashes\n");
+	printf("composite [Target File Path] [Pixel Width] [Pixel Height] [Layer File Path] [Mask File Path or -] [Left] [Top] [Opacity] [Operator] ... (-metadata)\n");
+	printf("    Flattens the layers, bottom first, over black. Layers keep their alpha, masks scale it by their red channel. Operators: over, in, out\n");
+	printf("convert [Source File Path] [Target File Path] (Encoding) (-metadata)\n");
+	printf("    Imports a PPM, PGM, BMP or PNG file to BIF, or exports a BIF file to the format of the target extension\n");
+	printf("convertdir [Source Directory] [Target Directory] [Target Extension] (Encoding) (-metadata)\n");
+	printf("    Converts every image of the directory in parallel, one file per processor. Extensions: bif, ppm, pgm, bmp, png\n");
+	printf("publish [File Path] [Frame Name] (Frame Count)\n");
+	printf("    Decodes the image into shared memory frames that other processes on this machine can read in place\n");
+	printf("subscribe [Frame Name] (Frame Count) (Target File Path)\n");
+	printf("    Reads published frames as they arrive and writes the last one to the target\n");
+	printf("decodeasync [File Path] [Request Count] (Cancel Count) (Target File Path)\n");
+	printf("    Decodes the image Request Count times at once on the async engine, cancelling the first Cancel Count. The last decode is written to the target\n\n");
 
 	// print notes
 	printf("Notes\n\n");
@@ -830,8 +2144,23 @@ void PrintUsageError()
 	::SetConsoleTextAttribute(::GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
 
 	// print error message
-	printf("Parameters are: [Pixel Width] [Pixel Height] [Red Color Channel] [Green Color Channel] [Blue Color Channel] [File Path]\n");
-	printf("Example: 800 600 255 0 255 \"c:\\images\\image.bif\"\n\n");
+	printf("Parameters are: [Pixel Width] [Pixel Height] [Red Color Channel] [Green Color Channel] [Blue Color Channel] [File Path] (-metadata)\n");
+	printf("Example: 800 600 255 0 255 \"c:\\images\\image.bif\"\n");
+	printf("Or: generate [Pattern] [Pixel Width] [Pixel Height] [Seed] [File Path] (Cell Size) (-metadata)\n");
+	printf("Example: generate perlin 8192 8192 42 \"c:\\images\\noise.bif\"\n");
+	printf("Or: store [Pack Path] [BIF Path] [Map Path]\n");
+	printf("Or: restore [Pack Path] [Map Path] [BIF Path]\n");
+	printf("Or: encode [Encoding] [Source File Path] [Target File Path] (-metadata)\n");
+	printf("Or: render [File Path] [Left] [Top] [Right] [Bottom] [Pixel Width] [Pixel Height] [Filter] [Target File Path]\n");
+	printf("Or: stats [File Path]\n");
+	printf("Or: dedupe [Directory] (Max Distance)\n");
+	printf("Or: hashbench [Hash Count] (Max Distance) (Seed)\n");
+	printf("Or: composite [Target File Path] [Pixel Width] [Pixel Height] [Layer File Path] [Mask File Path or -] [Left] [Top] [Opacity] [Operator] ... (-metadata)\n");
+	printf("Or: convert [Source File Path] [Target File Path] (Encoding) (-metadata)\n");
+	printf("Or: convertdir [Source Directory] [Target Directory] [Target Extension] (Encoding) (-metadata)\n");
+	printf("Or: publish [File Path] [Frame Name] (Frame Count)\n");
+	printf("Or: subscribe [Frame Name] (Frame Count) (Target File Path)\n");
+	printf("Or: decodeasync [File Path] [Request Count] (Cancel Count) (Target File Path)\n\n");
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,41 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file bif.h
+* \brief bif.h declares the utility functions in bif.cpp that the other modules share
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FileExists
+//	Purpose:	Returns TRUE is file path exists
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FileExists(const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DirectoryExists
+//	Purpose:	Returns TRUE is directory path exists
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DirectoryExists(const char* directoryPath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrintOsErrorText
+//	Purpose:	Prints the friendly text associated with the last OS error message numeric code
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintOsErrorText();
@@ -0,0 +1,734 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file composite.cpp
+* \brief composite.cpp implements the Porter-Duff blend kernels and the layer flattening pass
+* \author Blake Hamilton
+*
+* Every output row is cut in blocks of CompositeBlockPixels. A block starts transparent, each layer is blended into
+* it in turn and the result is flattened over the background before the next block starts, so a pixel is read
+* once per layer and written once no matter how many layers there are. Rows of a strip are split across the
+* processors, the layer rows a strip needs are fetched before that because the sources read files in order.
+*
+* Pixels are premultiplied, so the operators are the plain Porter-Duff sums (as = source alpha, ab = alpha below):
+* over: source + below * (1 - as), in: source * ab, out: source * (1 - ab). Channels are widened to 16 bits,
+* multiplied and divided by 255 with the exact (x + 128) * 257 >> 16 rounding.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#include "composite.h"
+#include "parallel.h"
+#include "simd.h"
+
+// state shared by the threads compositing one strip
+struct CompositeState
+{
+	const CompositeLayer* layers;
+	int layerCount;
+	BYTE** layerRows;			// rows of the strip of every layer
+	int* layerFirstRows;		// output row of the first row held in layerRows
+	int* layerRowCounts;		// 0 where the layer doesn't cover the strip
+	int pixelWidth;
+	int firstRow;				// output row of the strip
+	BYTE* strip;				// flattened rgb rows
+	ptrdiff_t stripStride;
+	BYTE background[CompositeBlockPixels * CompositeChannels];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		Div255
+//	Purpose:	Divides a product of two channel values by 255, rounded to nearest
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int Div255(int value)
+{
+	return ((value + 128) * 257) >> 16;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendPixel
+//	Purpose:	Scalar kernel, combines one premultiplied rgba pixel with the pixel below it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static inline void BlendPixel(BYTE* target, const BYTE* source)
+{
+	if (Operator == CompositeOver)
+	{
+		int inverse = 255 - source[3];
+		for (int c = 0; c < CompositeChannels; ++c)
+		{
+			int value = source[c] + Div255(target[c] * inverse);
+			target[c] = (BYTE) ((value > 255) ? 255 : value);
+		}
+	}
+	else
+	{
+		int factor = (Operator == CompositeIn) ? target[3] : 255 - target[3];
+		for (int c = 0; c < CompositeChannels; ++c)
+		{
+			target[c] = (BYTE) Div255(source[c] * factor);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		Div255Sse2
+//	Purpose:	Div255 of eight 16 bit products
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i Div255Sse2(__m128i value)
+{
+	return _mm_mulhi_epu16(_mm_add_epi16(value, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BroadcastAlphaSse2
+//	Purpose:	Copies the alpha of each of two 16 bit rgba pixels to all four of its channels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i BroadcastAlphaSse2(__m128i pixels)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendPixelsSse2
+//	Purpose:	Combines two 16 bit rgba pixels of source with target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static inline __m128i BlendPixelsSse2(__m128i target, __m128i source)
+{
+	const __m128i full = _mm_set1_epi16(255);
+	if (Operator == CompositeOver) return _mm_add_epi16(source, Div255Sse2(_mm_mullo_epi16(target, _mm_sub_epi16(full, BroadcastAlphaSse2(source)))));
+	if (Operator == CompositeIn) return Div255Sse2(_mm_mullo_epi16(source, BroadcastAlphaSse2(target)));
+
+	return Div255Sse2(_mm_mullo_epi16(source, _mm_sub_epi16(full, BroadcastAlphaSse2(target))));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendRowsSse2
+//	Purpose:	Blends 4 pixels at a time, returns the number of pixels blended
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static int BlendRowsSse2(BYTE* target, const BYTE* source, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i below = _mm_loadu_si128((const __m128i*) (target + x * CompositeChannels));
+		__m128i layer = _mm_loadu_si128((const __m128i*) (source + x * CompositeChannels));
+		__m128i low = BlendPixelsSse2<Operator>(_mm_unpacklo_epi8(below, zero), _mm_unpacklo_epi8(layer, zero));
+		__m128i high = BlendPixelsSse2<Operator>(_mm_unpackhi_epi8(below, zero), _mm_unpackhi_epi8(layer, zero));
+		_mm_storeu_si128((__m128i*) (target + x * CompositeChannels), _mm_packus_epi16(low, high));
+	}
+
+	return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendPixelsAvx2
+//	Purpose:	Combines four 16 bit rgba pixels of source with target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static inline __m256i BlendPixelsAvx2(__m256i target, __m256i source)
+{
+	const __m256i full = _mm256_set1_epi16(255);
+	const __m256i round = _mm256_set1_epi16(128);
+	const __m256i scale = _mm256_set1_epi16(257);
+	__m256i product;
+	if (Operator == CompositeOver)
+	{
+		__m256i inverse = _mm256_sub_epi16(full, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+		product = _mm256_mullo_epi16(target, inverse);
+		return _mm256_add_epi16(source, _mm256_mulhi_epu16(_mm256_add_epi16(product, round), scale));
+	}
+
+	__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(target, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	product = _mm256_mullo_epi16(source, (Operator == CompositeIn) ? alpha : _mm256_sub_epi16(full, alpha));
+
+	return _mm256_mulhi_epu16(_mm256_add_epi16(product, round), scale);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendRowsAvx2
+//	Purpose:	Blends 8 pixels at a time, returns the number of pixels blended
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static int BlendRowsAvx2(BYTE* target, const BYTE* source, int count)
+{
+	// unpack and pack both work within 16 byte lanes, so the pixel order survives the round trip
+	const __m256i zero = _mm256_setzero_si256();
+	int x = 0;
+	for (; x + 8 <= count; x += 8)
+	{
+		__m256i below = _mm256_loadu_si256((const __m256i*) (target + x * CompositeChannels));
+		__m256i layer = _mm256_loadu_si256((const __m256i*) (source + x * CompositeChannels));
+		__m256i low = BlendPixelsAvx2<Operator>(_mm256_unpacklo_epi8(below, zero), _mm256_unpacklo_epi8(layer, zero));
+		__m256i high = BlendPixelsAvx2<Operator>(_mm256_unpackhi_epi8(below, zero), _mm256_unpackhi_epi8(layer, zero));
+		_mm256_storeu_si256((__m256i*) (target + x * CompositeChannels), _mm256_packus_epi16(low, high));
+	}
+
+	return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendRowsWith
+//	Purpose:	Blends with the widest kernel the cpu supports, the remainder with the narrower ones
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static void BlendRowsWith(BYTE* target, const BYTE* source, int count)
+{
+	int x = 0;
+	if (CpuSupportsAvx2() == true) x = BlendRowsAvx2<Operator>(target, source, count);
+	x += BlendRowsSse2<Operator>(target + x * CompositeChannels, source + x * CompositeChannels, count - x);
+
+	for (; x < count; ++x)
+	{
+		BlendPixel<Operator>(target + x * CompositeChannels, source + x * CompositeChannels);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendRows
+//	Purpose:	Combines count premultiplied rgba pixels of source with target, the result goes to target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BlendRows(CompositeOperator compositeOperator, BYTE* target, const BYTE* source, int count)
+{
+	if (target == NULL || source == NULL || count <= 0) return;
+
+	if (compositeOperator == CompositeIn) BlendRowsWith<CompositeIn>(target, source, count);
+	else if (compositeOperator == CompositeOut) BlendRowsWith<CompositeOut>(target, source, count);
+	else BlendRowsWith<CompositeOver>(target, source, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckBlendKernelsWith
+//	Purpose:	Blends count pixels with the scalar kernel and with each vector kernel the cpu supports, returns
+//				FALSE and prints the first pixel where a vector kernel disagrees
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <CompositeOperator Operator>
+static BOOL CheckBlendKernelsWith(const char* name, const BYTE* source, const BYTE* below, BYTE* scalar, BYTE* vector, int count)
+{
+	::memcpy(scalar, below, (size_t) count * CompositeChannels);
+	for (int x = 0; x < count; ++x)
+	{
+		BlendPixel<Operator>(scalar + x * CompositeChannels, source + x * CompositeChannels);
+	}
+
+	BOOL result = TRUE;
+	for (int kernel = 0; kernel < 2 && result == TRUE; ++kernel)
+	{
+		if (kernel == 0 && CpuSupportsAvx2() == false) continue;
+
+		// each kernel leaves the pixels past its last whole register to the caller
+		::memcpy(vector, below, (size_t) count * CompositeChannels);
+		int blended = (kernel == 0) ? BlendRowsAvx2<Operator>(vector, source, count) : BlendRowsSse2<Operator>(vector, source, count);
+		for (int x = 0; x < blended && result == TRUE; ++x)
+		{
+			if (::memcmp(vector + x * CompositeChannels, scalar + x * CompositeChannels, CompositeChannels) != 0)
+			{
+				const BYTE* got = vector + x * CompositeChannels;
+				const BYTE* expected = scalar + x * CompositeChannels;
+				printf("%s %s kernel gives %u %u %u %u at pixel %d, the scalar kernel %u %u %u %u.\n", name, (kernel == 0) ? "AVX2" : "SSE2", got[0], got[1], got[2], got[3], x, expected[0], expected[1], expected[2], expected[3]);
+				result = FALSE;
+			}
+		}
+	}
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckBlendKernels
+//	Purpose:	Checks that the AVX2, SSE2 and scalar kernels of every operator give identical pixels for rows of
+//				random premultiplied pixels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CheckBlendKernels(unsigned int seed, int rowCount)
+{
+	// odd row lengths leave a tail behind every vector kernel
+	const int maxCount = 257;
+	size_t byteSize = (size_t) maxCount * CompositeChannels;
+	BYTE* source = (BYTE*) ::malloc(byteSize);
+	BYTE* below = (BYTE*) ::malloc(byteSize);
+	BYTE* scalar = (BYTE*) ::malloc(byteSize);
+	BYTE* vector = (BYTE*) ::malloc(byteSize);
+	if (source == NULL || below == NULL || scalar == NULL || vector == NULL)
+	{
+		printf("Failed to allocate pixel buffers.\n");
+		free(source);
+		free(below);
+		free(scalar);
+		free(vector);
+		return FALSE;
+	}
+
+	// xorshift, so a seed gives the same rows with every runtime library
+	DWORD random = (seed != 0) ? seed : 1;
+	BOOL result = TRUE;
+	for (int row = 0; row < rowCount && result == TRUE; ++row)
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		int count = 1 + (int) (random % maxCount);
+
+		// premultiplied pixels never have a color above their alpha, the first rows also cover the extremes
+		for (int i = 0; i < 2 * count; ++i)
+		{
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			BYTE* pixel = (i < count) ? source + i * CompositeChannels : below + (i - count) * CompositeChannels;
+			BYTE alpha = (row == 0) ? 255 : (row == 1) ? 0 : (BYTE) (random >> 24);
+			pixel[0] = (BYTE) ((random & 0xff) * alpha / 255);
+			pixel[1] = (BYTE) (((random >> 8) & 0xff) * alpha / 255);
+			pixel[2] = (BYTE) (((random >> 16) & 0xff) * alpha / 255);
+			pixel[3] = alpha;
+		}
+
+		if (CheckBlendKernelsWith<CompositeOver>("over", source, below, scalar, vector, count) == FALSE) result = FALSE;
+		if (CheckBlendKernelsWith<CompositeIn>("in", source, below, scalar, vector, count) == FALSE) result = FALSE;
+		if (CheckBlendKernelsWith<CompositeOut>("out", source, below, scalar, vector, count) == FALSE) result = FALSE;
+	}
+
+	// free heap memory
+	free(source);
+	free(below);
+	free(scalar);
+	free(vector);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ScalePixels
+//	Purpose:	Multiplies every channel of count rgba pixels by factor / 255, which scales premultiplied
+//				pixels by an opacity. With premultiply set the factor of each pixel is its own alpha instead
+//				and alpha is kept.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ScalePixels(BYTE* pixels, int count, BYTE factor, BOOL premultiply)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i constant = _mm_set1_epi16(factor);
+	const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i alphaKept = _mm_and_si128(alphaLanes, _mm_set1_epi16(255));
+	int x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i value = _mm_loadu_si128((const __m128i*) (pixels + x * CompositeChannels));
+		__m128i low = _mm_unpacklo_epi8(value, zero);
+		__m128i high = _mm_unpackhi_epi8(value, zero);
+		__m128i lowFactor = constant;
+		__m128i highFactor = constant;
+		if (premultiply == TRUE)
+		{
+			lowFactor = _mm_or_si128(_mm_andnot_si128(alphaLanes, BroadcastAlphaSse2(low)), alphaKept);
+			highFactor = _mm_or_si128(_mm_andnot_si128(alphaLanes, BroadcastAlphaSse2(high)), alphaKept);
+		}
+
+		low = Div255Sse2(_mm_mullo_epi16(low, lowFactor));
+		high = Div255Sse2(_mm_mullo_epi16(high, highFactor));
+		_mm_storeu_si128((__m128i*) (pixels + x * CompositeChannels), _mm_packus_epi16(low, high));
+	}
+
+	for (; x < count; ++x)
+	{
+		BYTE* pixel = pixels + x * CompositeChannels;
+		int channelFactor = (premultiply == TRUE) ? pixel[3] : factor;
+		pixel[0] = (BYTE) Div255(pixel[0] * channelFactor);
+		pixel[1] = (BYTE) Div255(pixel[1] * channelFactor);
+		pixel[2] = (BYTE) Div255(pixel[2] * channelFactor);
+		if (premultiply == FALSE) pixel[3] = (BYTE) Div255(pixel[3] * channelFactor);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PackRow
+//	Purpose:	Converts a row of opaque rgba pixels to rgb
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void PackRow(BYTE* target, const BYTE* source, int count)
+{
+	int x = 0;
+	if (CpuSupportsSsse3() == true)
+	{
+		// the store writes 4 bytes past the 4 pixels, they are overwritten by the next store or the scalar tail
+		const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		for (; x + 6 <= count; x += 4)
+		{
+			__m128i value = _mm_loadu_si128((const __m128i*) (source + x * CompositeChannels));
+			_mm_storeu_si128((__m128i*) (target + x * ImageColorChannels), _mm_shuffle_epi8(value, pack));
+		}
+	}
+
+	for (; x < count; ++x)
+	{
+		target[x * ImageColorChannels + 0] = source[x * CompositeChannels + 0];
+		target[x * ImageColorChannels + 1] = source[x * CompositeChannels + 1];
+		target[x * ImageColorChannels + 2] = source[x * CompositeChannels + 2];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadFileLayerRows
+//	Purpose:	LayerRowSource of file layers
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadFileLayerRows(void* context, BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	FileLayer* fileLayer = (FileLayer*) context;
+	int pixelWidth = fileLayer->reader.header.pixelWidth;
+
+	// the reader delivers rgba, rgb files come in opaque
+	if (ReadImageRowsAt(&fileLayer->reader, firstRow, rows, rowStride, rowCount) == FALSE) return FALSE;
+
+	if (fileLayer->hasMask == TRUE)
+	{
+		// the mask rows are read into a buffer that grows to the largest request
+		int maskByteSize = fileLayer->maskReader.rowByteSize;
+		if (rowCount > fileLayer->rowCapacity)
+		{
+			free(fileLayer->maskRows);
+			fileLayer->maskRows = (BYTE*) ::malloc((size_t) rowCount * maskByteSize + 1);
+			fileLayer->rowCapacity = rowCount;
+			if (fileLayer->maskRows == NULL)
+			{
+				printf("Failed to allocate layer rows.\n");
+				fileLayer->rowCapacity = 0;
+				return FALSE;
+			}
+		}
+
+		if (ReadImageRowsAt(&fileLayer->maskReader, firstRow, fileLayer->maskRows, maskByteSize, rowCount) == FALSE) return FALSE;
+
+		// the red channel of the mask scales the alpha of the file
+		for (int y = 0; y < rowCount; ++y)
+		{
+			BYTE* pixel = rows + y * rowStride;
+			const BYTE* mask = fileLayer->maskRows + (size_t) y * maskByteSize;
+			for (int x = 0; x < pixelWidth; ++x)
+			{
+				pixel[x * CompositeChannels + 3] = (BYTE) Div255(pixel[x * CompositeChannels + 3] * mask[x * ImageColorChannels]);
+			}
+		}
+	}
+
+	// alpha files and masks hold straight alpha, opaque layers are premultiplied already
+	if (fileLayer->hasMask == TRUE || fileLayer->reader.header.channelCount == ImageAlphaChannels)
+	{
+		for (int y = 0; y < rowCount; ++y)
+		{
+			ScalePixels(rows + y * rowStride, pixelWidth, 255, TRUE);
+		}
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenFileLayer
+//	Purpose:	Opens a BIF file, and optionally its mask, as a layer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenFileLayer(FileLayer* fileLayer, CompositeLayer* layer, const char* filePath, const char* maskPath, int left, int top, BYTE opacity, CompositeOperator compositeOperator)
+{
+	// validate parameters
+	if (fileLayer == NULL || layer == NULL || filePath == NULL)
+	{
+		printf("Invalid parameter FileLayer, Layer or FilePath NULL.\n");
+		return FALSE;
+	}
+
+	::memset(fileLayer, 0, sizeof(FileLayer));
+	::memset(layer, 0, sizeof(CompositeLayer));
+	if (OpenAlphaImageReader(&fileLayer->reader, filePath) == FALSE) return FALSE;
+
+	if (maskPath != NULL)
+	{
+		if (OpenImageReader(&fileLayer->maskReader, maskPath) == FALSE)
+		{
+			CloseImageReader(&fileLayer->reader);
+			return FALSE;
+		}
+
+		fileLayer->hasMask = TRUE;
+		if (fileLayer->maskReader.header.pixelWidth != fileLayer->reader.header.pixelWidth || fileLayer->maskReader.header.pixelHeight != fileLayer->reader.header.pixelHeight)
+		{
+			printf("Mask %s is %u x %u, layer %s is %u x %u.\n", maskPath, fileLayer->maskReader.header.pixelWidth, fileLayer->maskReader.header.pixelHeight, filePath, fileLayer->reader.header.pixelWidth, fileLayer->reader.header.pixelHeight);
+			CloseFileLayer(fileLayer);
+			return FALSE;
+		}
+	}
+
+	layer->compositeOperator = compositeOperator;
+	layer->left = left;
+	layer->top = top;
+	layer->pixelWidth = fileLayer->reader.header.pixelWidth;
+	layer->pixelHeight = fileLayer->reader.header.pixelHeight;
+	layer->opacity = opacity;
+	layer->source = ReadFileLayerRows;
+	layer->context = fileLayer;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFileLayer
+//	Purpose:	Closes the files of a layer and frees its buffers
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseFileLayer(FileLayer* fileLayer)
+{
+	if (fileLayer == NULL) return;
+
+	if (fileLayer->reader.file != NULL) CloseImageReader(&fileLayer->reader);
+	if (fileLayer->maskReader.file != NULL) CloseImageReader(&fileLayer->maskReader);
+	free(fileLayer->maskRows);
+	::memset(fileLayer, 0, sizeof(FileLayer));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompositeRowRange
+//	Purpose:	ParallelFor callback, blends and flattens rows [begin, end) of the strip
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CompositeRowRange(void* context, int begin, int end)
+{
+	CompositeState* state = (CompositeState*) context;
+	BYTE block[CompositeBlockPixels * CompositeChannels];
+	BYTE flat[CompositeBlockPixels * CompositeChannels];
+
+	for (int r = begin; r < end; ++r)
+	{
+		int y = state->firstRow + r;
+		for (int x = 0; x < state->pixelWidth; x += CompositeBlockPixels)
+		{
+			int count = (state->pixelWidth - x < CompositeBlockPixels) ? state->pixelWidth - x : CompositeBlockPixels;
+			::memset(block, 0, (size_t) count * CompositeChannels);
+
+			for (int i = 0; i < state->layerCount; ++i)
+			{
+				const CompositeLayer* layer = &state->layers[i];
+
+				// the part of the block the layer covers, empty if it misses the block
+				int coverBegin = x + count;
+				int coverEnd = x + count;
+				if (y >= state->layerFirstRows[i] && y < state->layerFirstRows[i] + state->layerRowCounts[i])
+				{
+					coverBegin = (layer->left > x) ? layer->left : x;
+					coverEnd = (layer->left + layer->pixelWidth < x + count) ? layer->left + layer->pixelWidth : x + count;
+					if (coverBegin >= coverEnd) coverBegin = coverEnd = x + count;
+				}
+
+				// in and out clear everything the layer doesn't cover, over leaves it alone
+				if (layer->compositeOperator != CompositeOver)
+				{
+					::memset(block, 0, (size_t) (coverBegin - x) * CompositeChannels);
+					::memset(block + (coverEnd - x) * CompositeChannels, 0, (size_t) (x + count - coverEnd) * CompositeChannels);
+				}
+
+				if (coverBegin == coverEnd) continue;
+
+				const BYTE* layerRow = state->layerRows[i] + (size_t) (y - state->layerFirstRows[i]) * layer->pixelWidth * CompositeChannels;
+				BlendRows(layer->compositeOperator, block + (coverBegin - x) * CompositeChannels, layerRow + (size_t) (coverBegin - layer->left) * CompositeChannels, coverEnd - coverBegin);
+			}
+
+			// the finished block over the opaque background
+			::memcpy(flat, state->background, (size_t) count * CompositeChannels);
+			BlendRows(CompositeOver, flat, block, count);
+			PackRow(state->strip + r * state->stripStride + x * ImageColorChannels, flat, count);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompositeLayers
+//	Purpose:	Blends the layers over an opaque background and passes the flattened rows to the sink
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CompositeLayers(const CompositeLayer* layers, int layerCount, int pixelWidth, int pixelHeight, COLORREF background, size_t memoryBudget, ImageRowSink sink, void* context)
+{
+	// validate parameters
+	if ((layers == NULL && layerCount > 0) || layerCount < 0 || layerCount > CompositeMaxLayers || sink == NULL || pixelWidth <= 0 || pixelHeight <= 0)
+	{
+		printf("Invalid parameter Layers or Sink NULL, more than %d layers or empty image.\n", CompositeMaxLayers);
+		return FALSE;
+	}
+
+	for (int i = 0; i < layerCount; ++i)
+	{
+		if (layers[i].source == NULL || layers[i].pixelWidth < 0 || layers[i].pixelHeight < 0)
+		{
+			printf("Invalid layer %d, source NULL or negative size.\n", i);
+			return FALSE;
+		}
+	}
+
+	// a strip row costs its rgb output plus the rgba rows of every layer
+	size_t rowCost = (size_t) pixelWidth * ImageColorChannels;
+	for (int i = 0; i < layerCount; ++i)
+	{
+		rowCost += (size_t) layers[i].pixelWidth * CompositeChannels;
+	}
+
+	if (memoryBudget < rowCost)
+	{
+		printf("Memory budget of %llu bytes is smaller than one %llu byte row of all layers.\n", (unsigned __int64) memoryBudget, (unsigned __int64) rowCost);
+		return FALSE;
+	}
+
+	int stripRowCount = (memoryBudget / rowCost < (size_t) pixelHeight) ? (int) (memoryBudget / rowCost) : pixelHeight;
+
+	CompositeState* state = (CompositeState*) ::calloc(1, sizeof(CompositeState));
+	BYTE** layerRows = (BYTE**) ::calloc(layerCount + 1, sizeof(BYTE*));
+	int* layerFirstRows = (int*) ::calloc(layerCount + 1, sizeof(int));
+	int* layerRowCounts = (int*) ::calloc(layerCount + 1, sizeof(int));
+	BYTE* strip = (BYTE*) ::malloc((size_t) stripRowCount * pixelWidth * ImageColorChannels);
+	BOOL result = (state != NULL && layerRows != NULL && layerFirstRows != NULL && layerRowCounts != NULL && strip != NULL) ? TRUE : FALSE;
+	for (int i = 0; result == TRUE && i < layerCount; ++i)
+	{
+		layerRows[i] = (BYTE*) ::malloc((size_t) stripRowCount * layers[i].pixelWidth * CompositeChannels + 1);
+		if (layerRows[i] == NULL) result = FALSE;
+	}
+
+	if (result == FALSE) printf("Failed to allocate composite strips.\n");
+
+	if (result == TRUE)
+	{
+		state->layers = layers;
+		state->layerCount = layerCount;
+		state->layerRows = layerRows;
+		state->layerFirstRows = layerFirstRows;
+		state->layerRowCounts = layerRowCounts;
+		state->pixelWidth = pixelWidth;
+		state->strip = strip;
+		state->stripStride = (ptrdiff_t) pixelWidth * ImageColorChannels;
+		for (int x = 0; x < CompositeBlockPixels; ++x)
+		{
+			state->background[x * CompositeChannels + 0] = GetRValue(background);
+			state->background[x * CompositeChannels + 1] = GetGValue(background);
+			state->background[x * CompositeChannels + 2] = GetBValue(background);
+			state->background[x * CompositeChannels + 3] = 255;
+		}
+	}
+
+	for (int firstRow = 0; result == TRUE && firstRow < pixelHeight; firstRow += stripRowCount)
+	{
+		int rowCount = (pixelHeight - firstRow < stripRowCount) ? pixelHeight - firstRow : stripRowCount;
+
+		// fetch the rows of every layer that overlaps the strip, in order since sources read files
+		for (int i = 0; result == TRUE && i < layerCount; ++i)
+		{
+			const CompositeLayer* layer = &layers[i];
+			int top = (layer->top > firstRow) ? layer->top : firstRow;
+			int bottom = (layer->top + layer->pixelHeight < firstRow + rowCount) ? layer->top + layer->pixelHeight : firstRow + rowCount;
+			BOOL visible = (bottom > top && layer->left < pixelWidth && layer->left + layer->pixelWidth > 0) ? TRUE : FALSE;
+			layerFirstRows[i] = top;
+			layerRowCounts[i] = (visible == TRUE) ? bottom - top : 0;
+			if (visible == FALSE) continue;
+
+			result = layer->source(layer->context, layerRows[i], (ptrdiff_t) layer->pixelWidth * CompositeChannels, top - layer->top, bottom - top);
+			if (result == TRUE && layer->opacity < 255) ScalePixels(layerRows[i], (bottom - top) * layer->pixelWidth, layer->opacity, FALSE);
+		}
+
+		if (result == FALSE) break;
+
+		state->firstRow = firstRow;
+		ParallelFor(rowCount, CompositeRowRange, state);
+		result = sink(context, strip, state->stripStride, firstRow, rowCount);
+	}
+
+	// free heap memory
+	for (int i = 0; layerRows != NULL && i < layerCount; ++i)
+	{
+		free(layerRows[i]);
+	}
+
+	free(layerRows);
+	free(layerFirstRows);
+	free(layerRowCounts);
+	free(strip);
+	free(state);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteCompositeRows
+//	Purpose:	Row sink that appends the flattened rows to a BIF writer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteCompositeRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	return WriteImageRows((BifWriter*) context, rows, rowStride, rowCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompositeImage
+//	Purpose:	Flattens the layers into a new BIF file, version 102 with its statistics and hash when
+//				storeMetadata is TRUE
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CompositeImage(const CompositeLayer* layers, int layerCount, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF background, const char* filePath, BOOL storeMetadata)
+{
+	// validate parameters
+	if (filePath == NULL)
+	{
+		printf("Invalid parameter FilePath NULL.\n");
+		return FALSE;
+	}
+
+	BifWriter writer = {};
+	if (OpenEncodedImageWriter(&writer, filePath, pixelWidth, pixelHeight, background, EncodingRaw, FilterNone, storeMetadata) == FALSE) return FALSE;
+
+	if (CompositeLayers(layers, layerCount, pixelWidth, pixelHeight, background, ImageStripByteSize, WriteCompositeRows, &writer) == FALSE)
+	{
+		AbortImageWriter(&writer);
+		return FALSE;
+	}
+
+	return CloseImageWriter(&writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseCompositeOperator
+//	Purpose:	Maps an operator name (over, in, out) to its operator
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseCompositeOperator(const char* name, CompositeOperator* compositeOperator)
+{
+	if (name == NULL || compositeOperator == NULL) return FALSE;
+
+	if (::_stricmp(name, "over") == 0) *compositeOperator = CompositeOver;
+	else if (::_stricmp(name, "in") == 0) *compositeOperator = CompositeIn;
+	else if (::_stricmp(name, "out") == 0) *compositeOperator = CompositeOut;
+	else return FALSE;
+
+	return TRUE;
+}
@@ -0,0 +1,124 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file composite.h
+* \brief composite.h blends layers of premultiplied rgba pixels with the Porter-Duff operators and flattens them
+* to rgb rows or a BIF file
+* Example (optional):
+* \code
+* FileLayer photo = {};
+* CompositeLayer layers[1] = {};
+* OpenFileLayer(&photo, &layers[0], "c:\\images\\photo.bif", NULL, 0, 0, 255, CompositeOver);
+* CompositeImage(layers, 1, 800, 600, RGB(0, 0, 0), "c:\\images\\flat.bif", FALSE);
+* CloseFileLayer(&photo);
+* \endcode
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+#include "image.h"
+
+// consts
+const int CompositeChannels = 4;			// premultiplied rgba, one byte per channel
+const int CompositeBlockPixels = 1024;		// 4 KB of rgba, every layer is blended into it while it stays in L1
+const int CompositeMaxLayers = 64;
+
+// Porter-Duff operators, each layer is combined with the result of the layers below it
+enum CompositeOperator
+{
+	CompositeOver = 0,			// layer over what is below
+	CompositeIn = 1,			// layer where what is below is opaque, the rest is cleared
+	CompositeOut = 2			// layer where what is below is transparent, the rest is cleared
+};
+
+// supplies premultiplied rgba rows [firstRow, firstRow + rowCount) of a layer, rows are requested top to bottom
+typedef BOOL (*LayerRowSource)(void* context, BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount);
+
+// a layer placed on the output, pixels outside it are transparent
+struct CompositeLayer
+{
+	CompositeOperator compositeOperator;
+	int left;
+	int top;
+	int pixelWidth;
+	int pixelHeight;
+	BYTE opacity;				// scales the alpha of every pixel of the layer
+	LayerRowSource source;
+	void* context;
+};
+
+// layer read from a BIF file, alpha comes from the file, opaque for rgb files, scaled by the red channel of an
+// optional mask file of the same size
+struct FileLayer
+{
+	BifReader reader;			// reads rgba rows
+	BifReader maskReader;
+	BOOL hasMask;
+	BYTE* maskRows;				// rows read from the mask file
+	int rowCapacity;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BlendRows
+//	Purpose:	Combines count premultiplied rgba pixels of source with target, the result goes to target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BlendRows(CompositeOperator compositeOperator, BYTE* target, const BYTE* source, int count);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckBlendKernels
+//	Purpose:	Blends rowCount rows of random pixels, seeded by seed, with the scalar kernel and each vector
+//				kernel the cpu supports. Returns FALSE and prints the first difference if they disagree.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CheckBlendKernels(unsigned int seed, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenFileLayer
+//	Purpose:	Opens a BIF file, and optionally its mask, as a layer. maskPath can be NULL to keep the alpha of
+//				the file, rgb files are opaque.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenFileLayer(FileLayer* fileLayer, CompositeLayer* layer, const char* filePath, const char* maskPath, int left, int top, BYTE opacity, CompositeOperator compositeOperator);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFileLayer
+//	Purpose:	Closes the files of a layer and frees its buffers
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseFileLayer(FileLayer* fileLayer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompositeLayers
+//	Purpose:	Blends the layers bottom to top over an opaque background and passes the flattened rgb rows to
+//				the sink a strip at a time. The strips and the layer rows they need fit in memoryBudget bytes.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CompositeLayers(const CompositeLayer* layers, int layerCount, int pixelWidth, int pixelHeight, COLORREF background, size_t memoryBudget, ImageRowSink sink, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompositeImage
+//	Purpose:	Flattens the layers into a new BIF file, version 102 with its statistics and hash when
+//				storeMetadata is TRUE
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CompositeImage(const CompositeLayer* layers, int layerCount, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF background, const char* filePath, BOOL storeMetadata);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseCompositeOperator
+//	Purpose:	Maps an operator name (over, in, out) to its operator
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseCompositeOperator(const char* name, CompositeOperator* compositeOperator);
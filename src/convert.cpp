@@ -0,0 +1,1376 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file convert.cpp
+* \brief convert.cpp implements the PPM / PGM, BMP and PNG readers and writers and the BIF conversions built on them
+* \author Blake Hamilton
+*
+* Every reader and writer holds one row (PNM, PNG) or one 256 KB strip of rows (BMP) plus its file buffer, so
+* memory doesn't grow with the image. BMP rows are bottom-up on disk, they are read and written a strip at a time
+* at their file offsets and flipped with a negative stride on the way, the same way DisplayImage fills its DIB.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bif.h"
+#include "convert.h"
+#include "parallel.h"
+#include "pipeline.h"
+
+// consts
+const BYTE PngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+const int BmpFileHeaderByteSize = 14;
+const int BmpInfoHeaderByteSize = 40;
+const int BmpMaxInfoHeaderByteSize = 124;		// BITMAPV5HEADER
+const int PngChunkHeaderByteSize = 8;			// length and type
+const int PngFilterCount = 5;
+
+// state shared by the threads of a batch conversion
+struct ConvertFilesState
+{
+	const char* const* sourcePaths;
+	const char* const* targetPaths;
+	int fileCount;
+	ImageEncoding encoding;
+	ImageFilter filter;
+	BOOL storeMetadata;
+	BOOL* converted;
+	volatile LONG nextFile;
+	volatile LONGLONG pixelByteCount;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LoadBigEndian32
+//	Purpose:	Reads a big endian DWORD (PNG)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline DWORD LoadBigEndian32(const BYTE* bytes)
+{
+	return ((DWORD) bytes[0] << 24) | ((DWORD) bytes[1] << 16) | ((DWORD) bytes[2] << 8) | bytes[3];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StoreBigEndian32
+//	Purpose:	Writes a big endian DWORD (PNG)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline void StoreBigEndian32(BYTE* bytes, DWORD value)
+{
+	bytes[0] = (BYTE) (value >> 24);
+	bytes[1] = (BYTE) (value >> 16);
+	bytes[2] = (BYTE) (value >> 8);
+	bytes[3] = (BYTE) value;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LoadLittleEndian32
+//	Purpose:	Reads a little endian DWORD (BMP)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline DWORD LoadLittleEndian32(const BYTE* bytes)
+{
+	return bytes[0] | ((DWORD) bytes[1] << 8) | ((DWORD) bytes[2] << 16) | ((DWORD) bytes[3] << 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StoreLittleEndian32
+//	Purpose:	Writes a little endian DWORD (BMP)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline void StoreLittleEndian32(BYTE* bytes, DWORD value)
+{
+	bytes[0] = (BYTE) value;
+	bytes[1] = (BYTE) (value >> 8);
+	bytes[2] = (BYTE) (value >> 16);
+	bytes[3] = (BYTE) (value >> 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrintUnsupportedFile
+//	Purpose:	Prints why a file can't be imported, returns FALSE
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL PrintUnsupportedFile(const char* reason)
+{
+	printf("Unsupported or corrupt file. %s.\n", reason);
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckImportSize
+//	Purpose:	Rejects files larger than a BIF file can hold, before any buffer is sized from them
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CheckImportSize(const ImportReader* reader)
+{
+	if (reader->pixelWidth <= ConvertMaxPixelSize && reader->pixelHeight <= ConvertMaxPixelSize) return TRUE;
+
+	printf("Image is %d x %d, BIF files are at most %d x %d.\n", reader->pixelWidth, reader->pixelHeight, ConvertMaxPixelSize, ConvertMaxPixelSize);
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetImageFileFormat
+//	Purpose:	Returns the format of a file path from its extension
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ImageFileFormat GetImageFileFormat(const char* filePath)
+{
+	if (filePath == NULL) return FileFormatUnknown;
+
+	const char* extension = ::strrchr(filePath, '.');
+	if (extension == NULL || ::strchr(extension, '\\') != NULL || ::strchr(extension, '/') != NULL) return FileFormatUnknown;
+
+	if (::_stricmp(extension, ".bif") == 0) return FileFormatBif;
+	if (::_stricmp(extension, ".ppm") == 0 || ::_stricmp(extension, ".pnm") == 0) return FileFormatPpm;
+	if (::_stricmp(extension, ".pgm") == 0) return FileFormatPgm;
+	if (::_stricmp(extension, ".bmp") == 0) return FileFormatBmp;
+	if (::_stricmp(extension, ".png") == 0) return FileFormatPng;
+
+	return FileFormatUnknown;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadInput
+//	Purpose:	Reads exactly byteSize bytes through the input buffer, reads of a whole buffer or more bypass it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadInput(ImportReader* reader, void* buffer, int byteSize)
+{
+	BYTE* bytes = (BYTE*) buffer;
+	while (byteSize > 0)
+	{
+		if (reader->inputPosition == reader->inputEnd)
+		{
+			if (byteSize >= ConvertBufferSize) return ReadFileBytes(reader->file, bytes, byteSize);
+
+			DWORD numberOfBytesRead = 0;
+			if (::ReadFile(reader->file, reader->inputBytes, ConvertBufferSize, &numberOfBytesRead, NULL) == FALSE)
+			{
+				PrintOsErrorText();
+				return FALSE;
+			}
+
+			if (numberOfBytesRead == 0) return PrintUnsupportedFile("Unexpected end of file");
+
+			reader->inputPosition = 0;
+			reader->inputEnd = (int) numberOfBytesRead;
+		}
+
+		int copyCount = reader->inputEnd - reader->inputPosition;
+		if (copyCount > byteSize) copyCount = byteSize;
+		::memcpy(bytes, reader->inputBytes + reader->inputPosition, copyCount);
+		reader->inputPosition += copyCount;
+		bytes += copyCount;
+		byteSize -= copyCount;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadPnmNumber
+//	Purpose:	Reads a decimal header field, skipping whitespace and comments before it and one whitespace after it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadPnmNumber(ImportReader* reader, int* value)
+{
+	BYTE character = 0;
+	for (;;)
+	{
+		if (ReadInput(reader, &character, 1) == FALSE) return FALSE;
+
+		if (character == '#')
+		{
+			while (character != '\n' && character != '\r')
+			{
+				if (ReadInput(reader, &character, 1) == FALSE) return FALSE;
+			}
+
+			continue;
+		}
+
+		if (character != ' ' && character != '\t' && character != '\n' && character != '\r' && character != '\v' && character != '\f') break;
+	}
+
+	__int64 number = 0;
+	if (character < '0' || character > '9') return PrintUnsupportedFile("Invalid PNM header");
+
+	while (character >= '0' && character <= '9')
+	{
+		number = number * 10 + (character - '0');
+		if (number > 0x7FFFFFFF) return PrintUnsupportedFile("Invalid PNM header");
+		if (ReadInput(reader, &character, 1) == FALSE) return FALSE;
+	}
+
+	if (character != ' ' && character != '\t' && character != '\n' && character != '\r' && character != '\v' && character != '\f') return PrintUnsupportedFile("Invalid PNM header");
+
+	*value = (int) number;
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenPnm
+//	Purpose:	Reads the rest of a P5 or P6 header
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL OpenPnm(ImportReader* reader)
+{
+	if (ReadPnmNumber(reader, &reader->pixelWidth) == FALSE || ReadPnmNumber(reader, &reader->pixelHeight) == FALSE || ReadPnmNumber(reader, &reader->maxValue) == FALSE) return FALSE;
+	if (reader->pixelWidth <= 0 || reader->pixelHeight <= 0 || reader->maxValue <= 0 || reader->maxValue > 65535) return PrintUnsupportedFile("Invalid PNM size or maximum value");
+	if (CheckImportSize(reader) == FALSE) return FALSE;
+
+	// samples above the maximum value are clamped
+	reader->channels = (reader->format == FileFormatPpm) ? 3 : 1;
+	reader->bitDepth = (reader->maxValue > 255) ? 16 : 8;
+	for (int i = 0; i < 256; ++i)
+	{
+		int value = (i >= reader->maxValue) ? 255 : (i * 255 + reader->maxValue / 2) / reader->maxValue;
+		reader->sampleScale[i] = (BYTE) value;
+	}
+
+	__int64 rowByteSize = (__int64) reader->pixelWidth * reader->channels * (reader->bitDepth / 8);
+	if (rowByteSize > 0x7FFFFFFF) return PrintUnsupportedFile("PNM rows are too large");
+
+	reader->fileRowByteSize = (int) rowByteSize;
+	reader->rowBytes = (BYTE*) ::malloc((size_t) rowByteSize);
+	if (reader->rowBytes == NULL)
+	{
+		printf("Failed to allocate row buffer.\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadPnmRows
+//	Purpose:	Reads rows of a P5 or P6 file as rgb
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadPnmRows(ImportReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	int sampleCount = reader->pixelWidth * reader->channels;
+	for (int y = 0; y < rowCount; ++y)
+	{
+		BYTE* target = rows + y * rowStride;
+
+		// 8 bit rgb is already the row
+		if (reader->channels == 3 && reader->maxValue == 255)
+		{
+			if (ReadInput(reader, target, reader->fileRowByteSize) == FALSE) return FALSE;
+			continue;
+		}
+
+		if (ReadInput(reader, reader->rowBytes, reader->fileRowByteSize) == FALSE) return FALSE;
+
+		const BYTE* source = reader->rowBytes;
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			BYTE sample = 0;
+			if (reader->bitDepth == 16)
+			{
+				int value = (source[i * 2] << 8) | source[i * 2 + 1];
+				sample = (BYTE) ((value >= reader->maxValue) ? 255 : (value * 255 + reader->maxValue / 2) / reader->maxValue);
+			}
+			else sample = reader->sampleScale[source[i]];
+
+			if (reader->channels == 3)
+			{
+				target[i] = sample;
+				continue;
+			}
+
+			target[i * 3 + 0] = sample;
+			target[i * 3 + 1] = sample;
+			target[i * 3 + 2] = sample;
+		}
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenBmp
+//	Purpose:	Reads the rest of the file header, the info header and the palette of a BMP file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL OpenBmp(ImportReader* reader)
+{
+	BYTE fileHeader[BmpFileHeaderByteSize - 2];
+	BYTE infoHeader[BmpMaxInfoHeaderByteSize + 12] = {};
+	if (ReadInput(reader, fileHeader, sizeof(fileHeader)) == FALSE || ReadInput(reader, infoHeader, 4) == FALSE) return FALSE;
+
+	DWORD infoByteSize = LoadLittleEndian32(infoHeader);
+	if (infoByteSize < (DWORD) BmpInfoHeaderByteSize || infoByteSize > (DWORD) BmpMaxInfoHeaderByteSize) return PrintUnsupportedFile("Only BMP files with a BITMAPINFOHEADER or newer are supported");
+	if (ReadInput(reader, infoHeader + 4, infoByteSize - 4) == FALSE) return FALSE;
+
+	int width = (int) LoadLittleEndian32(infoHeader + 4);
+	int height = (int) LoadLittleEndian32(infoHeader + 8);
+	int planes = infoHeader[12] | (infoHeader[13] << 8);
+	int bitCount = infoHeader[14] | (infoHeader[15] << 8);
+	DWORD compression = LoadLittleEndian32(infoHeader + 16);
+	DWORD colorsUsed = LoadLittleEndian32(infoHeader + 32);
+	if (width <= 0 || height == 0 || height == (int) 0x80000000 || planes != 1) return PrintUnsupportedFile("Invalid BMP size");
+	if (bitCount != 8 && bitCount != 24 && bitCount != 32) return PrintUnsupportedFile("Only 8, 24 and 32 bit BMP files are supported");
+
+	// 32 bit files may describe their layout with bit fields, only the one that is plain bgrx is supported
+	if (compression == 3 && bitCount == 32)
+	{
+		if (infoByteSize == (DWORD) BmpInfoHeaderByteSize && ReadInput(reader, infoHeader + BmpInfoHeaderByteSize, 12) == FALSE) return FALSE;
+		if (LoadLittleEndian32(infoHeader + 40) != 0x00FF0000 || LoadLittleEndian32(infoHeader + 44) != 0x0000FF00 || LoadLittleEndian32(infoHeader + 48) != 0x000000FF) return PrintUnsupportedFile("Only BMP bit fields in bgrx order are supported");
+	}
+	else if (compression != 0) return PrintUnsupportedFile("Compressed BMP files are not supported");
+
+	reader->pixelWidth = width;
+	reader->pixelHeight = (height < 0) ? -height : height;
+	reader->topDown = (height < 0) ? TRUE : FALSE;
+	if (CheckImportSize(reader) == FALSE) return FALSE;
+
+	reader->channels = bitCount / 8;
+	reader->bitDepth = 8;
+	reader->pixelOffset = LoadLittleEndian32(fileHeader + 8);
+
+	__int64 rowByteSize = (((__int64) width * bitCount + 31) / 32) * 4;
+	if (rowByteSize > ConvertBufferSize * 64) return PrintUnsupportedFile("BMP rows are too large");
+
+	// palette entries are bgrx, missing entries stay black
+	if (bitCount == 8)
+	{
+		DWORD paletteSize = (colorsUsed == 0 || colorsUsed > 256) ? 256 : colorsUsed;
+		BYTE entries[256 * 4];
+		if (SeekFile(reader->file, BmpFileHeaderByteSize + infoByteSize) == FALSE || ReadFileBytes(reader->file, entries, paletteSize * 4) == FALSE) return FALSE;
+
+		for (DWORD i = 0; i < paletteSize; ++i)
+		{
+			reader->palette[i * 3 + 0] = entries[i * 4 + 2];
+			reader->palette[i * 3 + 1] = entries[i * 4 + 1];
+			reader->palette[i * 3 + 2] = entries[i * 4 + 0];
+		}
+	}
+
+	reader->fileRowByteSize = (int) rowByteSize;
+	reader->stripRowCount = (ConvertBufferSize / reader->fileRowByteSize > 0) ? ConvertBufferSize / reader->fileRowByteSize : 1;
+	reader->rowBytes = (BYTE*) ::malloc((size_t) reader->stripRowCount * reader->fileRowByteSize);
+	if (reader->rowBytes == NULL)
+	{
+		printf("Failed to allocate row buffer.\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadBmpRows
+//	Purpose:	Reads rows of a BMP file as rgb, a strip at a time from its file offset
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadBmpRows(ImportReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	while (rowCount > 0)
+	{
+		int stripRowCount = (rowCount < reader->stripRowCount) ? rowCount : reader->stripRowCount;
+
+		// the strip is contiguous in the file either way, bottom-up files just hold it last row first
+		__int64 fileRow = (reader->topDown == TRUE) ? reader->rowsRead : reader->pixelHeight - reader->rowsRead - stripRowCount;
+		if (SeekFile(reader->file, reader->pixelOffset + fileRow * reader->fileRowByteSize) == FALSE) return FALSE;
+		if (ReadFileBytes(reader->file, reader->rowBytes, (__int64) stripRowCount * reader->fileRowByteSize) == FALSE) return FALSE;
+
+		const BYTE* scan0 = (reader->topDown == TRUE) ? reader->rowBytes : reader->rowBytes + (ptrdiff_t) (stripRowCount - 1) * reader->fileRowByteSize;
+		ptrdiff_t scanStride = (reader->topDown == TRUE) ? reader->fileRowByteSize : -reader->fileRowByteSize;
+		if (reader->channels == 3)
+		{
+			PixelPipeline<SwapRedBlueStage> pipeline((SwapRedBlueStage()));
+			pipeline.Run(scan0, scanStride, rows, rowStride, reader->pixelWidth, stripRowCount);
+		}
+		else
+		{
+			for (int y = 0; y < stripRowCount; ++y)
+			{
+				const BYTE* source = scan0 + y * scanStride;
+				BYTE* target = rows + y * rowStride;
+				for (int x = 0; x < reader->pixelWidth; ++x)
+				{
+					const BYTE* color = (reader->channels == 1) ? reader->palette + source[x] * 3 : NULL;
+					target[x * 3 + 0] = (color != NULL) ? color[0] : source[x * 4 + 2];
+					target[x * 3 + 1] = (color != NULL) ? color[1] : source[x * 4 + 1];
+					target[x * 3 + 2] = (color != NULL) ? color[2] : source[x * 4 + 0];
+				}
+			}
+		}
+
+		rows += stripRowCount * rowStride;
+		rowCount -= stripRowCount;
+		reader->rowsRead += stripRowCount;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadPngChunk
+//	Purpose:	Reads the data of a chunk whose header was read and checks its CRC. data can be NULL to skip it.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadPngChunk(ImportReader* reader, const BYTE* header, BYTE* data)
+{
+	DWORD byteSize = LoadBigEndian32(header);
+	DWORD crc = UpdateCrc32(0, header + 4, 4);
+	BYTE scratch[4096];
+	for (DWORD offset = 0; offset < byteSize;)
+	{
+		int readSize = (data != NULL) ? (int) byteSize : ((byteSize - offset < sizeof(scratch)) ? (int) (byteSize - offset) : (int) sizeof(scratch));
+		BYTE* target = (data != NULL) ? data : scratch;
+		if (ReadInput(reader, target, readSize) == FALSE) return FALSE;
+
+		crc = UpdateCrc32(crc, target, readSize);
+		offset += readSize;
+	}
+
+	BYTE stored[4];
+	if (ReadInput(reader, stored, 4) == FALSE) return FALSE;
+	if (LoadBigEndian32(stored) != crc) return PrintUnsupportedFile("PNG chunk CRC mismatch");
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadPngData
+//	Purpose:	InflateInput of PNG files, hands out the data of consecutive IDAT chunks
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadPngData(void* context, BYTE* bytes, int capacity, int* byteCount)
+{
+	ImportReader* reader = (ImportReader*) context;
+	*byteCount = 0;
+
+	while (reader->chunkLeft == 0)
+	{
+		if (reader->dataEnded == TRUE) return TRUE;
+
+		// the CRC of the finished chunk and the header of the next one, a file always ends with IEND
+		BYTE trailer[4 + PngChunkHeaderByteSize];
+		if (ReadInput(reader, trailer, sizeof(trailer)) == FALSE) return FALSE;
+		if (LoadBigEndian32(trailer) != reader->chunkCrc) return PrintUnsupportedFile("PNG chunk CRC mismatch");
+
+		if (::memcmp(trailer + 8, "IDAT", 4) != 0)
+		{
+			reader->dataEnded = TRUE;
+			return TRUE;
+		}
+
+		reader->chunkLeft = LoadBigEndian32(trailer + 4);
+		reader->chunkCrc = UpdateCrc32(0, trailer + 8, 4);
+	}
+
+	int readSize = (reader->chunkLeft < (DWORD) capacity) ? (int) reader->chunkLeft : capacity;
+	if (ReadInput(reader, bytes, readSize) == FALSE) return FALSE;
+
+	reader->chunkCrc = UpdateCrc32(reader->chunkCrc, bytes, readSize);
+	reader->chunkLeft -= readSize;
+	*byteCount = readSize;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenPng
+//	Purpose:	Reads the chunks of a PNG file up to its first IDAT chunk
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL OpenPng(ImportReader* reader)
+{
+	BYTE signature[6];
+	if (ReadInput(reader, signature, sizeof(signature)) == FALSE) return FALSE;
+	if (::memcmp(signature, PngSignature + 2, sizeof(signature)) != 0) return PrintUnsupportedFile("Invalid PNG signature");
+
+	BYTE header[PngChunkHeaderByteSize];
+	BYTE imageHeader[13];
+	if (ReadInput(reader, header, sizeof(header)) == FALSE) return FALSE;
+	if (::memcmp(header + 4, "IHDR", 4) != 0 || LoadBigEndian32(header) != sizeof(imageHeader)) return PrintUnsupportedFile("PNG files must start with IHDR");
+	if (ReadPngChunk(reader, header, imageHeader) == FALSE) return FALSE;
+
+	reader->pixelWidth = (int) LoadBigEndian32(imageHeader);
+	reader->pixelHeight = (int) LoadBigEndian32(imageHeader + 4);
+	reader->bitDepth = imageHeader[8];
+	reader->colorType = imageHeader[9];
+	if (reader->pixelWidth <= 0 || reader->pixelHeight <= 0 || imageHeader[10] != 0 || imageHeader[11] != 0) return PrintUnsupportedFile("Invalid PNG header");
+	if (imageHeader[12] != 0) return PrintUnsupportedFile("Interlaced PNG files are not supported");
+	if (CheckImportSize(reader) == FALSE) return FALSE;
+
+	// channels of each color type and the bit depths it allows
+	int depth = reader->bitDepth;
+	BOOL validDepth = FALSE;
+	switch (reader->colorType)
+	{
+		case 0: reader->channels = 1; validDepth = (depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16) ? TRUE : FALSE; break;
+		case 2: reader->channels = 3; validDepth = (depth == 8 || depth == 16) ? TRUE : FALSE; break;
+		case 3: reader->channels = 1; validDepth = (depth == 1 || depth == 2 || depth == 4 || depth == 8) ? TRUE : FALSE; break;
+		case 4: reader->channels = 2; reader->outputChannels = ImageAlphaChannels; validDepth = (depth == 8 || depth == 16) ? TRUE : FALSE; break;
+		case 6: reader->channels = 4; reader->outputChannels = ImageAlphaChannels; validDepth = (depth == 8 || depth == 16) ? TRUE : FALSE; break;
+		default: break;
+	}
+
+	if (validDepth == FALSE) return PrintUnsupportedFile("Invalid PNG color type or bit depth");
+
+	// chunks up to the image data, only the palette and its transparency matter
+	BOOL hasPalette = FALSE;
+	::memset(reader->paletteAlpha, 255, sizeof(reader->paletteAlpha));
+	for (;;)
+	{
+		if (ReadInput(reader, header, sizeof(header)) == FALSE) return FALSE;
+		if (::memcmp(header + 4, "IDAT", 4) == 0) break;
+		if (::memcmp(header + 4, "IEND", 4) == 0) return PrintUnsupportedFile("PNG file has no image data");
+
+		DWORD byteSize = LoadBigEndian32(header);
+		if (::memcmp(header + 4, "PLTE", 4) == 0)
+		{
+			if (byteSize % 3 != 0 || byteSize > 256 * 3) return PrintUnsupportedFile("Invalid PNG palette");
+			if (ReadPngChunk(reader, header, reader->palette) == FALSE) return FALSE;
+
+			hasPalette = TRUE;
+			continue;
+		}
+
+		// alpha of the first palette entries, the rest stay opaque and the file imports as rgba
+		if (::memcmp(header + 4, "tRNS", 4) == 0 && reader->colorType == 3)
+		{
+			if (hasPalette == FALSE || byteSize > 256) return PrintUnsupportedFile("Invalid PNG transparency");
+			if (ReadPngChunk(reader, header, reader->paletteAlpha) == FALSE) return FALSE;
+
+			reader->outputChannels = ImageAlphaChannels;
+			continue;
+		}
+
+		// a capital first letter marks a chunk that can't be ignored
+		if (header[4] >= 'A' && header[4] <= 'Z') return PrintUnsupportedFile("Unknown critical PNG chunk");
+		if (byteSize > 0x7FFFFFFF || ReadPngChunk(reader, header, NULL) == FALSE) return FALSE;
+	}
+
+	if (reader->colorType == 3 && hasPalette == FALSE) return PrintUnsupportedFile("Paletted PNG file has no palette");
+
+	reader->chunkLeft = LoadBigEndian32(header);
+	reader->chunkCrc = UpdateCrc32(0, header + 4, 4);
+
+	__int64 rowByteSize = ((__int64) reader->pixelWidth * reader->channels * reader->bitDepth + 7) / 8;
+	if (rowByteSize > 0x7FFFFFF0) return PrintUnsupportedFile("PNG rows are too large");
+
+	// rows keep their filter byte in front
+	reader->fileRowByteSize = (int) rowByteSize;
+	reader->rowBytes = (BYTE*) ::malloc((size_t) rowByteSize + 1);
+	reader->previousRow = (BYTE*) ::calloc((size_t) rowByteSize + 1, 1);
+	reader->samples = (BYTE*) ::malloc((size_t) reader->pixelWidth * reader->channels);
+	if (reader->rowBytes == NULL || reader->previousRow == NULL || reader->samples == NULL)
+	{
+		printf("Failed to allocate row buffer.\n");
+		return FALSE;
+	}
+
+	if (OpenInflateStream(&reader->inflate, ReadPngData, reader) == FALSE) return FALSE;
+
+	reader->inflateOpen = TRUE;
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PaethPredictor
+//	Purpose:	Returns whichever of left, above and upper left is closest to left + above - upper left
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int PaethPredictor(int left, int above, int upperLeft)
+{
+	int leftDistance = abs(above - upperLeft);
+	int aboveDistance = abs(left - upperLeft);
+	int upperLeftDistance = abs(left + above - 2 * upperLeft);
+	if (leftDistance <= aboveDistance && leftDistance <= upperLeftDistance) return left;
+
+	return (aboveDistance <= upperLeftDistance) ? above : upperLeft;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UnfilterPngRow
+//	Purpose:	Reverses the filter of a row in place, bytesPerPixel is the distance to the byte on the left
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL UnfilterPngRow(int filterType, BYTE* row, const BYTE* previous, int byteCount, int bytesPerPixel)
+{
+	switch (filterType)
+	{
+		case 0:
+			break;
+
+		case 1:
+			for (int i = bytesPerPixel; i < byteCount; ++i) row[i] += row[i - bytesPerPixel];
+			break;
+
+		case 2:
+			for (int i = 0; i < byteCount; ++i) row[i] += previous[i];
+			break;
+
+		case 3:
+			for (int i = 0; i < bytesPerPixel && i < byteCount; ++i) row[i] += previous[i] >> 1;
+			for (int i = bytesPerPixel; i < byteCount; ++i) row[i] += (BYTE) ((row[i - bytesPerPixel] + previous[i]) >> 1);
+			break;
+
+		case 4:
+			for (int i = 0; i < bytesPerPixel && i < byteCount; ++i) row[i] += previous[i];
+			for (int i = bytesPerPixel; i < byteCount; ++i) row[i] += (BYTE) PaethPredictor(row[i - bytesPerPixel], previous[i], previous[i - bytesPerPixel]);
+			break;
+
+		default:
+			return PrintUnsupportedFile("Invalid PNG filter type");
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertPngRow
+//	Purpose:	Converts an unfiltered row to rgb, or rgba for color types with alpha
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertPngRow(ImportReader* reader, const BYTE* row, BYTE* target)
+{
+	int width = reader->pixelWidth;
+	int targetChannels = reader->outputChannels;
+	int sampleCount = width * reader->channels;
+	const BYTE* samples = row;
+
+	// 16 bit samples keep their high byte, samples below 8 bits are unpacked most significant first
+	if (reader->bitDepth == 16)
+	{
+		for (int i = 0; i < sampleCount; ++i) reader->samples[i] = row[i * 2];
+		samples = reader->samples;
+	}
+	else if (reader->bitDepth < 8)
+	{
+		int depth = reader->bitDepth;
+		int mask = (1 << depth) - 1;
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			int value = (row[(i * depth) >> 3] >> (8 - depth - ((i * depth) & 7))) & mask;
+			reader->samples[i] = (BYTE) ((reader->colorType == 0) ? value * 255 / mask : value);
+		}
+
+		samples = reader->samples;
+	}
+
+	switch (reader->colorType)
+	{
+		case 2:
+			::memcpy(target, samples, (size_t) width * 3);
+			break;
+
+		case 3:
+			for (int x = 0; x < width; ++x)
+			{
+				::memcpy(target + x * targetChannels, reader->palette + samples[x] * 3, 3);
+				if (targetChannels == ImageAlphaChannels) target[x * targetChannels + 3] = reader->paletteAlpha[samples[x]];
+			}
+			break;
+
+		case 6:
+			::memcpy(target, samples, (size_t) width * 4);
+			break;
+
+		default:
+			// gray, with or without alpha
+			for (int x = 0; x < width; ++x)
+			{
+				BYTE gray = samples[x * reader->channels];
+				target[x * targetChannels + 0] = gray;
+				target[x * targetChannels + 1] = gray;
+				target[x * targetChannels + 2] = gray;
+				if (targetChannels == ImageAlphaChannels) target[x * targetChannels + 3] = samples[x * reader->channels + 1];
+			}
+			break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadPngRows
+//	Purpose:	Decompresses, unfilters and converts rows of a PNG file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadPngRows(ImportReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	int bytesPerPixel = reader->channels * reader->bitDepth / 8;
+	if (bytesPerPixel < 1) bytesPerPixel = 1;
+
+	for (int y = 0; y < rowCount; ++y)
+	{
+		if (InflateBytes(&reader->inflate, reader->rowBytes, reader->fileRowByteSize + 1) == FALSE) return FALSE;
+		if (UnfilterPngRow(reader->rowBytes[0], reader->rowBytes + 1, reader->previousRow + 1, reader->fileRowByteSize, bytesPerPixel) == FALSE) return FALSE;
+
+		ConvertPngRow(reader, reader->rowBytes + 1, rows + y * rowStride);
+
+		BYTE* previous = reader->previousRow;
+		reader->previousRow = reader->rowBytes;
+		reader->rowBytes = previous;
+	}
+
+	// the checksum of the image data once it has all been read
+	if (reader->rowsRead + rowCount == reader->pixelHeight) return FinishInflateStream(&reader->inflate);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenImportReader
+//	Purpose:	Opens a PPM, PGM, BMP or PNG file, the format comes from the file signature
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenImportReader(ImportReader* reader, const char* filePath)
+{
+	// validate parameters
+	if (reader == NULL || filePath == NULL)
+	{
+		printf("Invalid parameter Reader or FilePath NULL.\n");
+		return FALSE;
+	}
+
+	::memset(reader, 0, sizeof(ImportReader));
+	HANDLE file = ::CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	reader->file = file;
+	reader->outputChannels = ImageColorChannels;
+	reader->inputBytes = (BYTE*) ::malloc(ConvertBufferSize);
+	if (reader->inputBytes == NULL)
+	{
+		printf("Failed to allocate file buffer.\n");
+		CloseImportReader(reader);
+		return FALSE;
+	}
+
+	BYTE signature[2];
+	BOOL result = ReadInput(reader, signature, sizeof(signature));
+	if (result == TRUE)
+	{
+		if (signature[0] == 'P' && (signature[1] == '5' || signature[1] == '6'))
+		{
+			reader->format = (signature[1] == '6') ? FileFormatPpm : FileFormatPgm;
+			result = OpenPnm(reader);
+		}
+		else if (signature[0] == 'B' && signature[1] == 'M')
+		{
+			reader->format = FileFormatBmp;
+			result = OpenBmp(reader);
+		}
+		else if (signature[0] == PngSignature[0] && signature[1] == PngSignature[1])
+		{
+			reader->format = FileFormatPng;
+			result = OpenPng(reader);
+		}
+		else
+		{
+			printf("Unsupported file %s. Only binary PPM / PGM, BMP and PNG files can be imported.\n", filePath);
+			result = FALSE;
+		}
+	}
+
+	if (result == FALSE)
+	{
+		CloseImportReader(reader);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImportRows
+//	Purpose:	Reads the next rowCount rows as rgb, or rgba when outputChannels is 4, top to bottom
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImportRows(ImportReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (reader == NULL || reader->file == NULL || rows == NULL || rowCount < 0 || reader->rowsRead + rowCount > reader->pixelHeight)
+	{
+		printf("Invalid parameter Reader or Rows NULL, or more rows than the image has.\n");
+		return FALSE;
+	}
+
+	BOOL result = FALSE;
+	if (reader->format == FileFormatBmp) return ReadBmpRows(reader, rows, rowStride, rowCount);
+
+	if (reader->format == FileFormatPng) result = ReadPngRows(reader, rows, rowStride, rowCount);
+	else result = ReadPnmRows(reader, rows, rowStride, rowCount);
+
+	if (result == TRUE) reader->rowsRead += rowCount;
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImportReader
+//	Purpose:	Closes the file and frees the buffers of a reader
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseImportReader(ImportReader* reader)
+{
+	if (reader == NULL) return;
+
+	if (reader->inflateOpen == TRUE) CloseInflateStream(&reader->inflate);
+	if (reader->file != NULL) ::CloseHandle(reader->file);
+
+	// free heap memory
+	free(reader->inputBytes);
+	free(reader->rowBytes);
+	free(reader->previousRow);
+	free(reader->samples);
+	::memset(reader, 0, sizeof(ImportReader));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FlushExportOutput
+//	Purpose:	Writes the buffered output to the file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL FlushExportOutput(ExportWriter* writer)
+{
+	if (writer->outputFill == 0) return TRUE;
+
+	BOOL result = WriteFileBytes(writer->file, writer->outputBytes, writer->outputFill);
+	writer->outputFill = 0;
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteExportOutput
+//	Purpose:	Appends bytes through the output buffer, writes of a whole buffer or more bypass it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteExportOutput(ExportWriter* writer, const void* buffer, int byteSize)
+{
+	const BYTE* bytes = (const BYTE*) buffer;
+	if (byteSize >= ConvertBufferSize) return (FlushExportOutput(writer) == TRUE) ? WriteFileBytes(writer->file, bytes, byteSize) : FALSE;
+
+	while (byteSize > 0)
+	{
+		if (writer->outputFill == ConvertBufferSize && FlushExportOutput(writer) == FALSE) return FALSE;
+
+		int copyCount = ConvertBufferSize - writer->outputFill;
+		if (copyCount > byteSize) copyCount = byteSize;
+		::memcpy(writer->outputBytes + writer->outputFill, bytes, copyCount);
+		writer->outputFill += copyCount;
+		bytes += copyCount;
+		byteSize -= copyCount;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WritePngChunk
+//	Purpose:	Appends a chunk with its length, type and CRC
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WritePngChunk(ExportWriter* writer, const char* type, const BYTE* data, int byteSize)
+{
+	BYTE header[PngChunkHeaderByteSize];
+	StoreBigEndian32(header, (DWORD) byteSize);
+	::memcpy(header + 4, type, 4);
+
+	BYTE trailer[4];
+	StoreBigEndian32(trailer, UpdateCrc32(UpdateCrc32(0, header + 4, 4), data, byteSize));
+
+	if (WriteExportOutput(writer, header, sizeof(header)) == FALSE) return FALSE;
+	if (byteSize > 0 && WriteExportOutput(writer, data, byteSize) == FALSE) return FALSE;
+
+	return WriteExportOutput(writer, trailer, sizeof(trailer));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WritePngData
+//	Purpose:	DeflateOutput of PNG files, every piece of compressed data becomes an IDAT chunk
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WritePngData(void* context, const BYTE* bytes, int byteCount)
+{
+	return WritePngChunk((ExportWriter*) context, "IDAT", bytes, byteCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteExportHeader
+//	Purpose:	Writes the header of the file and allocates the row buffers of its format
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteExportHeader(ExportWriter* writer)
+{
+	int width = writer->pixelWidth;
+	int height = writer->pixelHeight;
+	if (writer->format == FileFormatPpm || writer->format == FileFormatPgm)
+	{
+		char header[64];
+		int byteSize = ::sprintf_s(header, sizeof(header), "P%c\n%d %d\n255\n", (writer->format == FileFormatPpm) ? '6' : '5', width, height);
+		writer->rowBytes = (BYTE*) ::malloc((size_t) width);
+		if (writer->rowBytes == NULL)
+		{
+			printf("Failed to allocate row buffer.\n");
+			return FALSE;
+		}
+
+		return WriteExportOutput(writer, header, byteSize);
+	}
+
+	if (writer->format == FileFormatBmp)
+	{
+		// 24 bit bottom-up rows padded to 4 bytes, every size field is 32 bits
+		writer->fileRowByteSize = ((width * 24 + 31) / 32) * 4;
+		unsigned __int64 imageByteSize = (unsigned __int64) writer->fileRowByteSize * height;
+		if (imageByteSize + BmpFileHeaderByteSize + BmpInfoHeaderByteSize > 0xFFFFFFFF)
+		{
+			printf("Image is too large for a BMP file (%d x %d).\n", width, height);
+			return FALSE;
+		}
+
+		BYTE header[BmpFileHeaderByteSize + BmpInfoHeaderByteSize] = {};
+		header[0] = 'B';
+		header[1] = 'M';
+		StoreLittleEndian32(header + 2, (DWORD) imageByteSize + BmpFileHeaderByteSize + BmpInfoHeaderByteSize);
+		StoreLittleEndian32(header + 10, BmpFileHeaderByteSize + BmpInfoHeaderByteSize);
+		StoreLittleEndian32(header + 14, BmpInfoHeaderByteSize);
+		StoreLittleEndian32(header + 18, (DWORD) width);
+		StoreLittleEndian32(header + 22, (DWORD) height);
+		header[26] = 1;
+		header[28] = 24;
+		StoreLittleEndian32(header + 34, (DWORD) imageByteSize);
+		StoreLittleEndian32(header + 38, 2835);			// 72 dpi
+		StoreLittleEndian32(header + 42, 2835);
+
+		// padding stays zero, the rows only ever overwrite their pixels
+		writer->stripRowCount = (ConvertBufferSize / writer->fileRowByteSize > 0) ? ConvertBufferSize / writer->fileRowByteSize : 1;
+		writer->rowBytes = (BYTE*) ::calloc((size_t) writer->stripRowCount * writer->fileRowByteSize, 1);
+		if (writer->rowBytes == NULL)
+		{
+			printf("Failed to allocate row buffer.\n");
+			return FALSE;
+		}
+
+		return WriteFileBytes(writer->file, header, sizeof(header));
+	}
+
+	// png, 8 bit rgb that isn't interlaced
+	BYTE imageHeader[13] = {};
+	StoreBigEndian32(imageHeader, (DWORD) width);
+	StoreBigEndian32(imageHeader + 4, (DWORD) height);
+	imageHeader[8] = 8;
+	imageHeader[9] = 2;
+
+	// one candidate row per filter type, each with its filter byte
+	int rowByteSize = width * ImageColorChannels;
+	writer->rowBytes = (BYTE*) ::malloc((size_t) PngFilterCount * (rowByteSize + 1));
+	writer->previousRow = (BYTE*) ::calloc((size_t) rowByteSize, 1);
+	if (writer->rowBytes == NULL || writer->previousRow == NULL)
+	{
+		printf("Failed to allocate row buffer.\n");
+		return FALSE;
+	}
+
+	if (WriteExportOutput(writer, PngSignature, sizeof(PngSignature)) == FALSE || WritePngChunk(writer, "IHDR", imageHeader, sizeof(imageHeader)) == FALSE) return FALSE;
+	if (OpenDeflateStream(&writer->deflate, WritePngData, writer) == FALSE) return FALSE;
+
+	writer->deflateOpen = TRUE;
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenExportWriter
+//	Purpose:	Creates a PPM, PGM, BMP or PNG file and writes its header
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenExportWriter(ExportWriter* writer, const char* filePath, ImageFileFormat format, int pixelWidth, int pixelHeight)
+{
+	// validate parameters
+	if (writer == NULL || filePath == NULL || pixelWidth <= 0 || pixelHeight <= 0 || (format != FileFormatPpm && format != FileFormatPgm && format != FileFormatBmp && format != FileFormatPng))
+	{
+		printf("Invalid parameter Writer or FilePath NULL, empty image or format that can't be exported.\n");
+		return FALSE;
+	}
+
+	::memset(writer, 0, sizeof(ExportWriter));
+	HANDLE file = ::CreateFile(filePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	writer->file = file;
+	writer->format = format;
+	writer->pixelWidth = pixelWidth;
+	writer->pixelHeight = pixelHeight;
+	writer->outputBytes = (BYTE*) ::malloc(ConvertBufferSize);
+	if (writer->outputBytes == NULL) printf("Failed to allocate file buffer.\n");
+
+	if (writer->outputBytes == NULL || WriteExportHeader(writer) == FALSE)
+	{
+		// the row count check fails, the writer is only closed
+		CloseExportWriter(writer);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WritePngRow
+//	Purpose:	Filters a row with the filter that gives the smallest sum of absolute differences and compresses it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WritePngRow(ExportWriter* writer, const BYTE* row)
+{
+	int byteCount = writer->pixelWidth * ImageColorChannels;
+	const BYTE* previous = writer->previousRow;
+	BYTE* best = NULL;
+	unsigned int bestSum = 0xFFFFFFFF;
+
+	for (int filterType = 0; filterType < PngFilterCount; ++filterType)
+	{
+		BYTE* candidate = writer->rowBytes + (size_t) filterType * (byteCount + 1);
+		candidate[0] = (BYTE) filterType;
+		unsigned int sum = 0;
+		for (int i = 0; i < byteCount; ++i)
+		{
+			int left = (i >= ImageColorChannels) ? row[i - ImageColorChannels] : 0;
+			int upperLeft = (i >= ImageColorChannels) ? previous[i - ImageColorChannels] : 0;
+			int prediction = 0;
+			switch (filterType)
+			{
+				case 1: prediction = left; break;
+				case 2: prediction = previous[i]; break;
+				case 3: prediction = (left + previous[i]) >> 1; break;
+				case 4: prediction = PaethPredictor(left, previous[i], upperLeft); break;
+				default: break;
+			}
+
+			BYTE value = (BYTE) (row[i] - prediction);
+			candidate[i + 1] = value;
+			sum += (value < 128) ? value : 256 - value;
+		}
+
+		if (sum < bestSum)
+		{
+			bestSum = sum;
+			best = candidate;
+		}
+	}
+
+	::memcpy(writer->previousRow, row, byteCount);
+
+	return DeflateBytes(&writer->deflate, best, byteCount + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteExportRows
+//	Purpose:	Appends rowCount rgb rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteExportRows(ExportWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (writer == NULL || writer->file == NULL || rows == NULL || rowCount < 0 || writer->rowsWritten + rowCount > writer->pixelHeight)
+	{
+		printf("Invalid parameter Writer or Rows NULL, or more rows than the image has.\n");
+		return FALSE;
+	}
+
+	int width = writer->pixelWidth;
+	if (writer->format == FileFormatBmp)
+	{
+		for (int y = 0; y < rowCount;)
+		{
+			// the strip goes to the buffer last row first, bgr, which is its order in the bottom-up file
+			int stripRowCount = (rowCount - y < writer->stripRowCount) ? rowCount - y : writer->stripRowCount;
+			PixelPipeline<SwapRedBlueStage> pipeline((SwapRedBlueStage()));
+			pipeline.Run(rows + y * rowStride, rowStride, writer->rowBytes + (ptrdiff_t) (stripRowCount - 1) * writer->fileRowByteSize, -writer->fileRowByteSize, width, stripRowCount);
+
+			__int64 fileRow = writer->pixelHeight - writer->rowsWritten - stripRowCount;
+			if (SeekFile(writer->file, BmpFileHeaderByteSize + BmpInfoHeaderByteSize + fileRow * writer->fileRowByteSize) == FALSE) return FALSE;
+			if (WriteFileBytes(writer->file, writer->rowBytes, (__int64) stripRowCount * writer->fileRowByteSize) == FALSE) return FALSE;
+
+			writer->rowsWritten += stripRowCount;
+			y += stripRowCount;
+		}
+
+		return TRUE;
+	}
+
+	for (int y = 0; y < rowCount; ++y)
+	{
+		const BYTE* row = rows + y * rowStride;
+		BOOL result = TRUE;
+		if (writer->format == FileFormatPng) result = WritePngRow(writer, row);
+		else if (writer->format == FileFormatPpm) result = WriteExportOutput(writer, row, width * ImageColorChannels);
+		else
+		{
+			// BT.601 luma
+			for (int x = 0; x < width; ++x)
+			{
+				writer->rowBytes[x] = (BYTE) ((77 * row[x * 3] + 150 * row[x * 3 + 1] + 29 * row[x * 3 + 2] + 128) >> 8);
+			}
+
+			result = WriteExportOutput(writer, writer->rowBytes, width);
+		}
+
+		if (result == FALSE) return FALSE;
+
+		writer->rowsWritten++;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseExportWriter
+//	Purpose:	Finishes the file, fails if it didn't get all of its rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseExportWriter(ExportWriter* writer)
+{
+	if (writer == NULL || writer->file == NULL) return FALSE;
+
+	BOOL result = TRUE;
+	if (writer->rowsWritten != writer->pixelHeight)
+	{
+		printf("Image is incomplete, %d of %d rows were written.\n", writer->rowsWritten, writer->pixelHeight);
+		result = FALSE;
+	}
+
+	if (writer->deflateOpen == TRUE)
+	{
+		if (result == TRUE) result = FinishDeflateStream(&writer->deflate);
+		if (result == TRUE) result = WritePngChunk(writer, "IEND", NULL, 0);
+		CloseDeflateStream(&writer->deflate);
+	}
+
+	if (writer->outputBytes != NULL && FlushExportOutput(writer) == FALSE) result = FALSE;
+
+	// close file handle
+	::CloseHandle(writer->file);
+
+	// free heap memory
+	free(writer->outputBytes);
+	free(writer->rowBytes);
+	free(writer->previousRow);
+	::memset(writer, 0, sizeof(ExportWriter));
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ImportImage
+//	Purpose:	Converts a PPM, PGM, BMP or PNG file to a BIF file with the given encoding and filter. With
+//				storeMetadata the file is version 102 and carries its statistics and hash. PNG files with alpha
+//				become version 103 alpha files, which carry no metadata.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ImportImage(const char* sourcePath, const char* targetPath, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata)
+{
+	// validate parameters
+	if (sourcePath == NULL || targetPath == NULL)
+	{
+		printf("Invalid parameter SourcePath or TargetPath NULL.\n");
+		return FALSE;
+	}
+
+	ImportReader reader = {};
+	if (OpenImportReader(&reader, sourcePath) == FALSE) return FALSE;
+
+	// copy the image a strip at a time, the reader already rejected sizes a BIF file can't hold
+	unsigned short pixelWidth = (unsigned short) reader.pixelWidth;
+	unsigned short pixelHeight = (unsigned short) reader.pixelHeight;
+	int stripRowCount = GetStripRowCount(pixelWidth, pixelHeight);
+	ptrdiff_t rowByteSize = (ptrdiff_t) pixelWidth * reader.outputChannels;
+	BYTE* strip = (BYTE*) ::malloc((size_t) stripRowCount * rowByteSize);
+	if (strip == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		CloseImportReader(&reader);
+		return FALSE;
+	}
+
+	// images with alpha keep it in an alpha file
+	BOOL alpha = (reader.outputChannels == ImageAlphaChannels) ? TRUE : FALSE;
+	if (alpha == TRUE && storeMetadata == TRUE) printf("%s has alpha, alpha files carry no metadata.\n", sourcePath);
+
+	BifWriter writer = {};
+	BOOL opened = (alpha == TRUE) ? OpenAlphaImageWriter(&writer, targetPath, pixelWidth, pixelHeight, RGB(0, 0, 0), encoding, filter) :
+		OpenEncodedImageWriter(&writer, targetPath, pixelWidth, pixelHeight, RGB(0, 0, 0), encoding, filter, storeMetadata);
+	if (opened == FALSE)
+	{
+		free(strip);
+		CloseImportReader(&reader);
+		return FALSE;
+	}
+
+	BOOL result = TRUE;
+	for (int y = 0; y < pixelHeight && result == TRUE; y += stripRowCount)
+	{
+		int rowCount = (pixelHeight - y < stripRowCount) ? pixelHeight - y : stripRowCount;
+		result = ReadImportRows(&reader, strip, rowByteSize, rowCount);
+		if (result == TRUE) result = WriteImageRows(&writer, strip, rowByteSize, rowCount);
+	}
+
+	if (result == TRUE) result = CloseImageWriter(&writer);
+	else AbortImageWriter(&writer);
+
+	// free heap memory
+	free(strip);
+	CloseImportReader(&reader);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteExportSink
+//	Purpose:	Row sink that appends decoded rows to an export writer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteExportSink(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	return WriteExportRows((ExportWriter*) context, rows, rowStride, rowCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ExportImage
+//	Purpose:	Converts a BIF file to the format of the target extension
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ExportImage(const char* sourcePath, const char* targetPath)
+{
+	// validate parameters
+	if (sourcePath == NULL || targetPath == NULL)
+	{
+		printf("Invalid parameter SourcePath or TargetPath NULL.\n");
+		return FALSE;
+	}
+
+	ImageFileFormat format = GetImageFileFormat(targetPath);
+	if (format != FileFormatPpm && format != FileFormatPgm && format != FileFormatBmp && format != FileFormatPng)
+	{
+		printf("Can't export to %s, the extension must be .ppm, .pnm, .pgm, .bmp or .png.\n", targetPath);
+		return FALSE;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, sourcePath) == FALSE) return FALSE;
+
+	ExportWriter writer = {};
+	if (OpenExportWriter(&writer, targetPath, format, reader.header.pixelWidth, reader.header.pixelHeight) == FALSE)
+	{
+		CloseImageReader(&reader);
+		return FALSE;
+	}
+
+	BOOL result = DecodeImageRows(&reader, ImageStripByteSize, WriteExportSink, &writer);
+	if (CloseExportWriter(&writer) == FALSE) result = FALSE;
+	CloseImageReader(&reader);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertImage
+//	Purpose:	Imports when the target is a BIF file and exports otherwise, storeMetadata only applies to
+//				imports
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ConvertImage(const char* sourcePath, const char* targetPath, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata)
+{
+	if (GetImageFileFormat(targetPath) == FileFormatBif) return ImportImage(sourcePath, targetPath, encoding, filter, storeMetadata);
+
+	return ExportImage(sourcePath, targetPath);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertFilesRange
+//	Purpose:	ParallelFor callback, one per worker. Workers take the next file until there are none left, so a
+//				few large files don't keep one processor busy while the others sit idle.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertFilesRange(void* context, int begin, int end)
+{
+	ConvertFilesState* state = (ConvertFilesState*) context;
+	for (;;)
+	{
+		int i = (int) ::InterlockedIncrement(&state->nextFile) - 1;
+		if (i >= state->fileCount) break;
+
+		state->converted[i] = ConvertImage(state->sourcePaths[i], state->targetPaths[i], state->encoding, state->filter, state->storeMetadata);
+		if (state->converted[i] == TRUE) ::InterlockedExchangeAdd64(&state->pixelByteCount, GetConvertedByteSize(state->sourcePaths[i], state->targetPaths[i]));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertImageFiles
+//	Purpose:	Converts fileCount files in parallel, each processor takes the next file when it is done with one.
+//				converted is FALSE for the files that failed.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ConvertImageFiles(const char* const* sourcePaths, const char* const* targetPaths, int fileCount, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata, BOOL* converted, __int64* pixelByteCount)
+{
+	// validate parameters
+	if (sourcePaths == NULL || targetPaths == NULL || converted == NULL || fileCount < 0)
+	{
+		printf("Invalid parameter SourcePaths, TargetPaths or Converted NULL.\n");
+		return FALSE;
+	}
+
+	ConvertFilesState state = {};
+	state.sourcePaths = sourcePaths;
+	state.targetPaths = targetPaths;
+	state.fileCount = fileCount;
+	state.encoding = encoding;
+	state.filter = filter;
+	state.storeMetadata = storeMetadata;
+	state.converted = converted;
+
+	int workerCount = (GetProcessorCount() < fileCount) ? GetProcessorCount() : fileCount;
+	ParallelFor(workerCount, ConvertFilesRange, &state);
+	if (pixelByteCount != NULL) *pixelByteCount = state.pixelByteCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetConvertedByteSize
+//	Purpose:	Returns the pixel bytes of a converted image, from the header of its BIF file, 0 if it can't be
+//				read
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__int64 GetConvertedByteSize(const char* sourcePath, const char* targetPath)
+{
+	// validate parameters
+	if (sourcePath == NULL || targetPath == NULL) return 0;
+
+	// imports write the BIF file, exports read it
+	const char* bifPath = (GetImageFileFormat(targetPath) == FileFormatBif) ? targetPath : sourcePath;
+	HANDLE file = ::CreateFile(bifPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+
+	BifHeader header = {};
+	BOOL result = ReadImageHeader(file, &header);
+	::CloseHandle(file);
+
+	return (result == TRUE) ? (__int64) header.pixelWidth * header.pixelHeight * header.channelCount : 0;
+}
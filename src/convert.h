@@ -0,0 +1,196 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file convert.h
+* \brief convert.h streams images between BIF and PPM / PGM, BMP and PNG files a strip of rows at a time
+* Example (optional):
+* \code
+* ImportImage("c:\\images\\photo.png", "c:\\images\\photo.bif", EncodingLz, FilterNone, FALSE);
+* ExportImage("c:\\images\\photo.bif", "c:\\images\\photo.bmp");
+* \endcode
+* \author Blake Hamilton
+*
+* Supported files:
+* PPM / PGM - binary P6 and P5, any maximum value (16 bit samples are scaled to 8 bits). Exported as 8 bit P6, or P5
+*             luma for .pgm.
+* BMP       - uncompressed 8 bit paletted, 24 and 32 bit, bottom-up or top-down. Exported as 24 bit bottom-up.
+* PNG       - every color type and bit depth, not interlaced. Files with alpha, and paletted files with a tRNS
+*             chunk, import as rgba alpha files. The single transparent color tRNS of gray and rgb files is
+*             ignored. 16 bit samples keep their high byte. Exported as 8 bit rgb.
+*
+* A file converts on one thread from start to end. The PNG inflate and deflate streams can't be split, so PNG
+* files convert far slower than the others, see README.md for measured rates. ConvertImageFiles scales by
+* converting a file per processor, a directory with fewer files than processors leaves the rest idle.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+#include "deflate.h"
+#include "image.h"
+
+// consts
+const int ConvertBufferSize = 256 * 1024;		// buffered file input and output
+const int ConvertMaxPixelSize = 65535;			// largest width and height a BIF file can hold
+
+// file formats, told apart by extension for targets and by signature for sources
+enum ImageFileFormat
+{
+	FileFormatUnknown = 0,
+	FileFormatBif = 1,
+	FileFormatPpm = 2,
+	FileFormatPgm = 3,
+	FileFormatBmp = 4,
+	FileFormatPng = 5
+};
+
+// streaming reader of a PPM, PGM, BMP or PNG file
+struct ImportReader
+{
+	HANDLE file;
+	ImageFileFormat format;
+	int pixelWidth;
+	int pixelHeight;
+	int rowsRead;
+	BYTE* inputBytes;				// buffered file input
+	int inputPosition;
+	int inputEnd;
+	int channels;					// samples per pixel in the file
+	int outputChannels;				// channels of the rows read, 4 for png files with alpha and 3 otherwise
+	int bitDepth;					// bits per sample in the file
+	int fileRowByteSize;			// bytes of a row in the file, without the png filter byte and bmp padding included
+	BYTE* rowBytes;					// one file row, or a strip of them for bmp
+	BYTE* previousRow;				// png rows need the one above them to unfilter
+	BYTE* samples;					// png rows converted to 8 bit samples
+	BYTE palette[256 * 3];
+	BYTE paletteAlpha[256];			// png tRNS alpha of each palette entry
+	int maxValue;					// pnm maximum sample value
+	BYTE sampleScale[256];			// pnm 8 bit samples scaled to 0 - 255
+	__int64 pixelOffset;			// bmp file offset of the first row in the file
+	BOOL topDown;					// bmp rows are stored top to bottom
+	int stripRowCount;				// bmp rows read at once
+	int colorType;					// png color type
+	DWORD chunkLeft;				// png bytes left in the current IDAT chunk
+	DWORD chunkCrc;
+	BOOL dataEnded;					// png IDAT chunks are over
+	BOOL inflateOpen;
+	InflateStream inflate;
+};
+
+// streaming writer of a PPM, PGM, BMP or PNG file
+struct ExportWriter
+{
+	HANDLE file;
+	ImageFileFormat format;
+	int pixelWidth;
+	int pixelHeight;
+	int rowsWritten;
+	BYTE* outputBytes;				// buffered file output
+	int outputFill;
+	int fileRowByteSize;			// bmp rows with padding
+	int stripRowCount;				// bmp rows converted at once
+	BYTE* rowBytes;					// bmp strip in file order, or png filter candidates
+	BYTE* previousRow;				// png row above the next one
+	BOOL deflateOpen;
+	DeflateStream deflate;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetImageFileFormat
+//	Purpose:	Returns the format of a file path from its extension
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ImageFileFormat GetImageFileFormat(const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenImportReader
+//	Purpose:	Opens a PPM, PGM, BMP or PNG file, the format comes from the file signature
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenImportReader(ImportReader* reader, const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImportRows
+//	Purpose:	Reads the next rowCount rows as rgb, or rgba when outputChannels is 4, top to bottom
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImportRows(ImportReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImportReader
+//	Purpose:	Closes the file and frees the buffers of a reader
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseImportReader(ImportReader* reader);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenExportWriter
+//	Purpose:	Creates a PPM, PGM, BMP or PNG file and writes its header
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenExportWriter(ExportWriter* writer, const char* filePath, ImageFileFormat format, int pixelWidth, int pixelHeight);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteExportRows
+//	Purpose:	Appends rowCount rgb rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteExportRows(ExportWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseExportWriter
+//	Purpose:	Finishes the file, fails if it didn't get all of its rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseExportWriter(ExportWriter* writer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ImportImage
+//	Purpose:	Converts a PPM, PGM, BMP or PNG file to a BIF file with the given encoding and filter. With
+//				storeMetadata the file is version 102 and carries its statistics and hash. PNG files with alpha
+//				become version 103 alpha files, which carry no metadata.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ImportImage(const char* sourcePath, const char* targetPath, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ExportImage
+//	Purpose:	Converts a BIF file to the format of the target extension
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ExportImage(const char* sourcePath, const char* targetPath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertImage
+//	Purpose:	Imports when the target is a BIF file and exports otherwise, storeMetadata only applies to
+//				imports
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ConvertImage(const char* sourcePath, const char* targetPath, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertImageFiles
+//	Purpose:	Converts fileCount files in parallel, each processor takes the next file when it is done with one.
+//				converted is FALSE for the files that failed. pixelByteCount, when not NULL, gets the pixel bytes
+//				of the files converted.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ConvertImageFiles(const char* const* sourcePaths, const char* const* targetPaths, int fileCount, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata, BOOL* converted, __int64* pixelByteCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetConvertedByteSize
+//	Purpose:	Returns the pixel bytes of a converted image, from the header of its BIF file, 0 if it can't be
+//				read
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__int64 GetConvertedByteSize(const char* sourcePath, const char* targetPath);
@@ -0,0 +1,1449 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file deflate.cpp
+* \brief deflate.cpp implements the zlib stream compressor and decompressor and the checksums
+* \author Blake Hamilton
+*
+* The decompressor pulls compressed bytes through a 64 bit bit buffer and decodes codes of up to 10 bits with a
+* single table lookup, longer ones canonically a bit at a time. Output goes to the caller and to a 32 KB ring that
+* matches copy from, so a match can stop anywhere and continue on the next call.
+*
+* The compressor is greedy: every position is looked up in hash chains of 3 byte prefixes, at most DeflateMaxChain
+* candidates deep. Each block gets length limited Huffman codes built from its own symbol counts and is written as
+* a dynamic, fixed or stored block, whichever is smallest.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include "deflate.h"
+
+// consts
+const int DeflateMinMatch = 3;
+const int DeflateMaxMatch = 258;
+const int DeflateLengthCodes = 286;			// literals, end of block and 29 length codes
+const int DeflateDistanceCodes = 30;
+const int DeflateCodeLengthCodes = 19;
+const int DeflateMaxCodeLength = 15;
+const int DeflateMaxCodeLengthLength = 7;	// longest code of the code length alphabet
+const int DeflateStoredMaxLength = 65535;
+const int DeflateEndOfBlock = 256;
+const int AdlerModulo = 65521;
+const int AdlerMaxRun = 5552;				// bytes that can be summed before the 32 bit sums overflow
+
+const WORD LengthBases[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const BYTE LengthExtraBits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const WORD DistanceBases[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const BYTE DistanceExtraBits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const BYTE CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// slicing by 4 tables of the reflected CRC-32 polynomial
+struct CrcTables
+{
+	DWORD values[4][256];
+};
+
+// symbol and frequency pair sorted while building code lengths
+struct SymbolFrequency
+{
+	int frequency;
+	int symbol;
+};
+
+// code lengths and bit reversed codes of one alphabet, ready to write
+struct HuffmanCodes
+{
+	BYTE lengths[288];
+	WORD codes[288];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildCrcTables
+//	Purpose:	Computes the slicing by 4 tables
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static CrcTables BuildCrcTables()
+{
+	CrcTables tables;
+	for (DWORD i = 0; i < 256; ++i)
+	{
+		DWORD value = i;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+		}
+
+		tables.values[0][i] = value;
+	}
+
+	for (int i = 0; i < 256; ++i)
+	{
+		for (int t = 1; t < 4; ++t)
+		{
+			DWORD previous = tables.values[t - 1][i];
+			tables.values[t][i] = (previous >> 8) ^ tables.values[0][previous & 0xFF];
+		}
+	}
+
+	return tables;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UpdateCrc32
+//	Purpose:	Continues a CRC-32 (PNG, zip) over byteSize more bytes, start with 0
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD UpdateCrc32(DWORD crc, const BYTE* bytes, size_t byteSize)
+{
+	static const CrcTables tables = BuildCrcTables();
+
+	crc = ~crc;
+	for (; byteSize >= 4; bytes += 4, byteSize -= 4)
+	{
+		crc ^= (DWORD) bytes[0] | ((DWORD) bytes[1] << 8) | ((DWORD) bytes[2] << 16) | ((DWORD) bytes[3] << 24);
+		crc = tables.values[3][crc & 0xFF] ^ tables.values[2][(crc >> 8) & 0xFF] ^ tables.values[1][(crc >> 16) & 0xFF] ^ tables.values[0][crc >> 24];
+	}
+
+	for (; byteSize > 0; ++bytes, --byteSize)
+	{
+		crc = (crc >> 8) ^ tables.values[0][(crc ^ *bytes) & 0xFF];
+	}
+
+	return ~crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UpdateAdler32
+//	Purpose:	Continues an Adler-32 (zlib) over byteSize more bytes, start with 1
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD UpdateAdler32(DWORD adler, const BYTE* bytes, size_t byteSize)
+{
+	DWORD low = adler & 0xFFFF;
+	DWORD high = adler >> 16;
+	while (byteSize > 0)
+	{
+		// the modulo is only taken once per run
+		size_t runSize = (byteSize < (size_t) AdlerMaxRun) ? byteSize : (size_t) AdlerMaxRun;
+		byteSize -= runSize;
+		for (; runSize > 0; --runSize)
+		{
+			low += *bytes++;
+			high += low;
+		}
+
+		low %= AdlerModulo;
+		high %= AdlerModulo;
+	}
+
+	return (high << 16) | low;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrintCorruptStream
+//	Purpose:	Prints why a compressed stream can't be decoded
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL PrintCorruptStream(const char* reason)
+{
+	printf("Unsupported or corrupt compressed data. %s.\n", reason);
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReverseBits
+//	Purpose:	Reverses the low bitCount bits, deflate sends Huffman codes most significant bit first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int ReverseBits(int value, int bitCount)
+{
+	int reversed = 0;
+	for (int i = 0; i < bitCount; ++i)
+	{
+		reversed = (reversed << 1) | (value & 1);
+		value >>= 1;
+	}
+
+	return reversed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RefillInput
+//	Purpose:	Reads the next compressed bytes into the input buffer, FALSE once the input has ended
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL RefillInput(InflateStream* stream)
+{
+	if (stream->inputEnded == TRUE) return FALSE;
+
+	int byteCount = 0;
+	if (stream->input(stream->context, stream->inputBytes, InflateInputSize, &byteCount) == FALSE || byteCount <= 0)
+	{
+		stream->inputEnded = TRUE;
+		return FALSE;
+	}
+
+	stream->inputPosition = 0;
+	stream->inputEnd = byteCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FillBits
+//	Purpose:	Tops the bit buffer up to at least 57 bits, or as many as the input has left
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline void FillBits(InflateStream* stream)
+{
+	// whole 8 byte load while the input buffer has them
+	if (stream->inputEnd - stream->inputPosition >= 8)
+	{
+		unsigned __int64 value;
+		::memcpy(&value, stream->inputBytes + stream->inputPosition, sizeof(value));
+		stream->bitBuffer |= value << stream->bitCount;
+		int byteCount = (63 - stream->bitCount) >> 3;
+		stream->inputPosition += byteCount;
+		stream->bitCount += byteCount * 8;
+		stream->bitBuffer &= (1ull << stream->bitCount) - 1;
+		return;
+	}
+
+	while (stream->bitCount <= 56)
+	{
+		if (stream->inputPosition == stream->inputEnd && RefillInput(stream) == FALSE) return;
+
+		stream->bitBuffer |= (unsigned __int64) stream->inputBytes[stream->inputPosition++] << stream->bitCount;
+		stream->bitCount += 8;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetBits
+//	Purpose:	Takes the next bitCount (at most 32) bits
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline BOOL GetBits(InflateStream* stream, int bitCount, int* value)
+{
+	if (stream->bitCount < bitCount) FillBits(stream);
+	if (stream->bitCount < bitCount) return PrintCorruptStream("Unexpected end of compressed data");
+
+	*value = (int) (stream->bitBuffer & ((1ull << bitCount) - 1));
+	stream->bitBuffer >>= bitCount;
+	stream->bitCount -= bitCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildInflateCode
+//	Purpose:	Builds the decoding tables of a code from its code lengths, fails if the lengths are over-subscribed
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL BuildInflateCode(InflateCode* code, const BYTE* lengths, int symbolCount)
+{
+	::memset(code->counts, 0, sizeof(code->counts));
+	for (int i = 0; i < symbolCount; ++i)
+	{
+		code->counts[lengths[i]]++;
+	}
+
+	// incomplete codes are allowed, a code with a single symbol is one
+	int left = 1;
+	for (int length = 1; length <= DeflateMaxCodeLength; ++length)
+	{
+		left = (left << 1) - code->counts[length];
+		if (left < 0) return PrintCorruptStream("Over-subscribed Huffman code");
+	}
+
+	WORD offsets[16];
+	offsets[1] = 0;
+	for (int length = 1; length < DeflateMaxCodeLength; ++length)
+	{
+		offsets[length + 1] = offsets[length] + code->counts[length];
+	}
+
+	for (int i = 0; i < symbolCount; ++i)
+	{
+		if (lengths[i] != 0) code->symbols[offsets[lengths[i]]++] = (WORD) i;
+	}
+
+	// every code up to InflateFastBits fills all table entries that start with its reversed bits
+	::memset(code->fast, 0, sizeof(code->fast));
+	int canonical = 0;
+	int index = 0;
+	for (int length = 1; length <= InflateFastBits; ++length)
+	{
+		for (int i = 0; i < code->counts[length]; ++i)
+		{
+			WORD entry = (WORD) ((code->symbols[index++] << 4) | length);
+			for (int slot = ReverseBits(canonical++, length); slot < (1 << InflateFastBits); slot += 1 << length)
+			{
+				code->fast[slot] = entry;
+			}
+		}
+
+		canonical <<= 1;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeSymbol
+//	Purpose:	Decodes the next symbol of a code
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline BOOL DecodeSymbol(InflateStream* stream, const InflateCode* code, int* symbol)
+{
+	if (stream->bitCount < DeflateMaxCodeLength) FillBits(stream);
+
+	WORD entry = code->fast[stream->bitBuffer & ((1 << InflateFastBits) - 1)];
+	if (entry != 0 && (entry & 15) <= stream->bitCount)
+	{
+		stream->bitBuffer >>= entry & 15;
+		stream->bitCount -= entry & 15;
+		*symbol = entry >> 4;
+		return TRUE;
+	}
+
+	// canonical decode, first is the first code of the current length and index its first symbol
+	int value = 0;
+	int first = 0;
+	int index = 0;
+	for (int length = 1; length <= DeflateMaxCodeLength && length <= stream->bitCount; ++length)
+	{
+		value |= (int) ((stream->bitBuffer >> (length - 1)) & 1);
+		int count = code->counts[length];
+		if (value - first < count)
+		{
+			stream->bitBuffer >>= length;
+			stream->bitCount -= length;
+			*symbol = code->symbols[index + value - first];
+			return TRUE;
+		}
+
+		index += count;
+		first = (first + count) << 1;
+		value <<= 1;
+	}
+
+	if (stream->bitCount < DeflateMaxCodeLength) return PrintCorruptStream("Unexpected end of compressed data");
+
+	return PrintCorruptStream("Invalid Huffman code");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadDynamicCodes
+//	Purpose:	Reads the code lengths of a dynamic block and builds its codes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadDynamicCodes(InflateStream* stream)
+{
+	int lengthCount = 0;
+	int distanceCount = 0;
+	int codeLengthCount = 0;
+	if (GetBits(stream, 5, &lengthCount) == FALSE || GetBits(stream, 5, &distanceCount) == FALSE || GetBits(stream, 4, &codeLengthCount) == FALSE) return FALSE;
+
+	lengthCount += 257;
+	distanceCount += 1;
+	codeLengthCount += 4;
+	if (lengthCount > DeflateLengthCodes || distanceCount > DeflateDistanceCodes) return PrintCorruptStream("Too many length or distance codes");
+
+	BYTE lengths[DeflateLengthCodes + DeflateDistanceCodes] = {};
+	for (int i = 0; i < codeLengthCount; ++i)
+	{
+		int length = 0;
+		if (GetBits(stream, 3, &length) == FALSE) return FALSE;
+
+		lengths[CodeLengthOrder[i]] = (BYTE) length;
+	}
+
+	// the code length code is decoded with the distance code slot, it is rebuilt below
+	if (BuildInflateCode(&stream->distanceCode, lengths, DeflateCodeLengthCodes) == FALSE) return FALSE;
+
+	::memset(lengths, 0, DeflateCodeLengthCodes);
+	for (int i = 0; i < lengthCount + distanceCount;)
+	{
+		int symbol = 0;
+		if (DecodeSymbol(stream, &stream->distanceCode, &symbol) == FALSE) return FALSE;
+
+		if (symbol < 16)
+		{
+			lengths[i++] = (BYTE) symbol;
+			continue;
+		}
+
+		// 16 repeats the previous length 3 - 6 times, 17 and 18 repeat zero 3 - 10 and 11 - 138 times
+		int repeat = 0;
+		BYTE length = 0;
+		if (symbol == 16)
+		{
+			if (i == 0) return PrintCorruptStream("Repeated code length without a previous length");
+			if (GetBits(stream, 2, &repeat) == FALSE) return FALSE;
+
+			length = lengths[i - 1];
+			repeat += 3;
+		}
+		else if (symbol == 17)
+		{
+			if (GetBits(stream, 3, &repeat) == FALSE) return FALSE;
+
+			repeat += 3;
+		}
+		else
+		{
+			if (GetBits(stream, 7, &repeat) == FALSE) return FALSE;
+
+			repeat += 11;
+		}
+
+		if (i + repeat > lengthCount + distanceCount) return PrintCorruptStream("Code lengths overflow");
+
+		for (; repeat > 0; --repeat)
+		{
+			lengths[i++] = length;
+		}
+	}
+
+	if (lengths[DeflateEndOfBlock] == 0) return PrintCorruptStream("Missing end of block code");
+	if (BuildInflateCode(&stream->lengthCode, lengths, lengthCount) == FALSE) return FALSE;
+
+	return BuildInflateCode(&stream->distanceCode, lengths + lengthCount, distanceCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadBlockHeader
+//	Purpose:	Reads the header of the next block
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadBlockHeader(InflateStream* stream)
+{
+	int finalBlock = 0;
+	int blockType = 0;
+	if (GetBits(stream, 1, &finalBlock) == FALSE || GetBits(stream, 2, &blockType) == FALSE) return FALSE;
+
+	stream->finalBlock = (finalBlock != 0) ? TRUE : FALSE;
+	stream->blockType = blockType;
+	if (blockType == 0)
+	{
+		// stored blocks start at a byte boundary with the length and its complement
+		int length = 0;
+		int complement = 0;
+		stream->bitBuffer >>= stream->bitCount & 7;
+		stream->bitCount &= ~7;
+		if (GetBits(stream, 16, &length) == FALSE || GetBits(stream, 16, &complement) == FALSE) return FALSE;
+		if ((length ^ 0xFFFF) != complement) return PrintCorruptStream("Stored block length mismatch");
+
+		stream->storedLength = length;
+		return TRUE;
+	}
+
+	if (blockType == 1)
+	{
+		BYTE lengths[288 + DeflateDistanceCodes];
+		::memset(lengths, 8, 144);
+		::memset(lengths + 144, 9, 112);
+		::memset(lengths + 256, 7, 24);
+		::memset(lengths + 280, 8, 8);
+		::memset(lengths + 288, 5, DeflateDistanceCodes);
+		if (BuildInflateCode(&stream->lengthCode, lengths, 288) == FALSE) return FALSE;
+
+		return BuildInflateCode(&stream->distanceCode, lengths + 288, DeflateDistanceCodes);
+	}
+
+	if (blockType == 2) return ReadDynamicCodes(stream);
+
+	return PrintCorruptStream("Invalid block type");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenInflateStream
+//	Purpose:	Prepares to decompress a zlib stream read from input
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenInflateStream(InflateStream* stream, InflateInput input, void* context)
+{
+	// validate parameters
+	if (stream == NULL || input == NULL)
+	{
+		printf("Invalid parameter Stream or Input NULL.\n");
+		return FALSE;
+	}
+
+	::memset(stream, 0, sizeof(InflateStream));
+	stream->input = input;
+	stream->context = context;
+	stream->blockType = -1;
+	stream->adler = 1;
+	stream->inputBytes = (BYTE*) ::malloc(InflateInputSize);
+	stream->window = (BYTE*) ::malloc(DeflateWindowSize);
+	if (stream->inputBytes == NULL || stream->window == NULL)
+	{
+		printf("Failed to allocate decompression buffers.\n");
+		CloseInflateStream(stream);
+		return FALSE;
+	}
+
+	// zlib header, deflate with at most a 32 KB window and no preset dictionary
+	int method = 0;
+	int flags = 0;
+	if (GetBits(stream, 8, &method) == FALSE || GetBits(stream, 8, &flags) == FALSE)
+	{
+		CloseInflateStream(stream);
+		return FALSE;
+	}
+
+	if ((method & 15) != 8 || (method >> 4) > 7 || ((method << 8) | flags) % 31 != 0 || (flags & 0x20) != 0)
+	{
+		PrintCorruptStream("Invalid zlib header");
+		CloseInflateStream(stream);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InflateSome
+//	Purpose:	Decompresses up to byteCount bytes, stops early only at the end of the final block
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL InflateSome(InflateStream* stream, BYTE* target, int byteCount, int* produced)
+{
+	BYTE* window = stream->window;
+	const int windowMask = DeflateWindowSize - 1;
+	int position = (int) (stream->outputByteSize & windowMask);
+	int count = 0;
+	BOOL result = TRUE;
+
+	while (count < byteCount && result == TRUE)
+	{
+		// rest of a match
+		if (stream->copyLength > 0)
+		{
+			int copyCount = (stream->copyLength < byteCount - count) ? stream->copyLength : byteCount - count;
+			int source = position - stream->copyDistance;
+			for (int i = 0; i < copyCount; ++i)
+			{
+				BYTE value = window[(source + i) & windowMask];
+				window[(position + i) & windowMask] = value;
+				target[count + i] = value;
+			}
+
+			position = (position + copyCount) & windowMask;
+			count += copyCount;
+			stream->copyLength -= copyCount;
+			stream->outputByteSize += copyCount;
+			continue;
+		}
+
+		// rest of a stored block, whole bytes left in the bit buffer first
+		if (stream->storedLength > 0)
+		{
+			BYTE value = 0;
+			if (stream->bitCount >= 8)
+			{
+				value = (BYTE) stream->bitBuffer;
+				stream->bitBuffer >>= 8;
+				stream->bitCount -= 8;
+			}
+			else
+			{
+				if (stream->inputPosition == stream->inputEnd && RefillInput(stream) == FALSE)
+				{
+					result = PrintCorruptStream("Unexpected end of compressed data");
+					break;
+				}
+
+				// copy straight from the input buffer
+				int copyCount = stream->inputEnd - stream->inputPosition;
+				if (copyCount > stream->storedLength) copyCount = stream->storedLength;
+				if (copyCount > byteCount - count) copyCount = byteCount - count;
+				for (int i = 0; i < copyCount; ++i)
+				{
+					window[(position + i) & windowMask] = stream->inputBytes[stream->inputPosition + i];
+				}
+
+				::memcpy(target + count, stream->inputBytes + stream->inputPosition, copyCount);
+				stream->inputPosition += copyCount;
+				position = (position + copyCount) & windowMask;
+				count += copyCount;
+				stream->storedLength -= copyCount;
+				stream->outputByteSize += copyCount;
+				continue;
+			}
+
+			window[position] = value;
+			target[count++] = value;
+			position = (position + 1) & windowMask;
+			stream->storedLength--;
+			stream->outputByteSize++;
+			continue;
+		}
+
+		// next block, a stored block is done once its bytes are
+		if (stream->blockType == 0)
+		{
+			stream->blockType = -1;
+			if (stream->finalBlock == TRUE) stream->ended = TRUE;
+		}
+
+		if (stream->blockType < 0)
+		{
+			if (stream->ended == TRUE) break;
+
+			result = ReadBlockHeader(stream);
+			continue;
+		}
+
+		int symbol = 0;
+		result = DecodeSymbol(stream, &stream->lengthCode, &symbol);
+		if (result == FALSE) break;
+
+		if (symbol < DeflateEndOfBlock)
+		{
+			window[position] = (BYTE) symbol;
+			target[count++] = (BYTE) symbol;
+			position = (position + 1) & windowMask;
+			stream->outputByteSize++;
+			continue;
+		}
+
+		if (symbol == DeflateEndOfBlock)
+		{
+			stream->blockType = -1;
+			if (stream->finalBlock == TRUE) stream->ended = TRUE;
+			continue;
+		}
+
+		// match, its length then its distance
+		symbol -= 257;
+		int extra = 0;
+		int distanceSymbol = 0;
+		if (symbol >= 29)
+		{
+			result = PrintCorruptStream("Invalid length code");
+			break;
+		}
+
+		result = GetBits(stream, LengthExtraBits[symbol], &extra);
+		if (result == TRUE) result = DecodeSymbol(stream, &stream->distanceCode, &distanceSymbol);
+		if (result == FALSE) break;
+
+		stream->copyLength = LengthBases[symbol] + extra;
+		if (distanceSymbol >= DeflateDistanceCodes)
+		{
+			result = PrintCorruptStream("Invalid distance code");
+			break;
+		}
+
+		result = GetBits(stream, DistanceExtraBits[distanceSymbol], &extra);
+		stream->copyDistance = DistanceBases[distanceSymbol] + extra;
+		if (result == TRUE && (unsigned __int64) stream->copyDistance > stream->outputByteSize) result = PrintCorruptStream("Match distance too far back");
+	}
+
+	stream->adler = UpdateAdler32(stream->adler, target, count);
+	*produced = count;
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InflateBytes
+//	Purpose:	Decompresses exactly byteCount more bytes, fails if the stream is corrupt or ends first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InflateBytes(InflateStream* stream, BYTE* target, int byteCount)
+{
+	// validate parameters
+	if (stream == NULL || stream->window == NULL || target == NULL)
+	{
+		printf("Invalid parameter Stream or Target NULL.\n");
+		return FALSE;
+	}
+
+	int produced = 0;
+	if (InflateSome(stream, target, byteCount, &produced) == FALSE) return FALSE;
+	if (produced < byteCount) return PrintCorruptStream("Compressed data ended early");
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishInflateStream
+//	Purpose:	Skips what is left of the stream and checks its Adler-32
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FinishInflateStream(InflateStream* stream)
+{
+	// validate parameters
+	if (stream == NULL || stream->window == NULL)
+	{
+		printf("Invalid parameter Stream NULL.\n");
+		return FALSE;
+	}
+
+	// bytes past what the caller needed still count in the checksum
+	BYTE scratch[4096];
+	while (stream->ended == FALSE || stream->copyLength > 0 || stream->storedLength > 0)
+	{
+		int produced = 0;
+		if (InflateSome(stream, scratch, sizeof(scratch), &produced) == FALSE) return FALSE;
+	}
+
+	// the checksum is big endian and byte aligned
+	stream->bitBuffer >>= stream->bitCount & 7;
+	stream->bitCount &= ~7;
+	DWORD adler = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		int value = 0;
+		if (GetBits(stream, 8, &value) == FALSE) return FALSE;
+
+		adler = (adler << 8) | (DWORD) value;
+	}
+
+	if (adler != stream->adler) return PrintCorruptStream("Adler-32 mismatch");
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseInflateStream
+//	Purpose:	Frees the buffers of a decompressor
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseInflateStream(InflateStream* stream)
+{
+	if (stream == NULL) return;
+
+	free(stream->inputBytes);
+	free(stream->window);
+	stream->inputBytes = NULL;
+	stream->window = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FlushOutput
+//	Purpose:	Hands the buffered compressed bytes to the output
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FlushOutput(DeflateStream* stream)
+{
+	if (stream->outputFill > 0 && stream->failed == FALSE && stream->output(stream->context, stream->outputBytes, stream->outputFill) == FALSE) stream->failed = TRUE;
+
+	stream->outputFill = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteBits
+//	Purpose:	Appends up to 32 bits, least significant first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline void WriteBits(DeflateStream* stream, DWORD value, int bitCount)
+{
+	stream->bitBuffer |= (unsigned __int64) value << stream->bitCount;
+	stream->bitCount += bitCount;
+	if (stream->bitCount < 32) return;
+
+	DWORD bytes = (DWORD) stream->bitBuffer;
+	::memcpy(stream->outputBytes + stream->outputFill, &bytes, sizeof(bytes));
+	stream->outputFill += 4;
+	stream->bitBuffer >>= 32;
+	stream->bitCount -= 32;
+	if (stream->outputFill >= DeflateOutputSize) FlushOutput(stream);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AlignBits
+//	Purpose:	Pads to a byte boundary and moves the whole bytes of the bit buffer to the output buffer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AlignBits(DeflateStream* stream)
+{
+	WriteBits(stream, 0, (8 - (stream->bitCount & 7)) & 7);
+	while (stream->bitCount > 0)
+	{
+		stream->outputBytes[stream->outputFill++] = (BYTE) stream->bitBuffer;
+		stream->bitBuffer >>= 8;
+		stream->bitCount -= 8;
+	}
+
+	if (stream->outputFill >= DeflateOutputSize) FlushOutput(stream);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompareSymbolFrequencies
+//	Purpose:	qsort comparison, ascending frequency
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int CompareSymbolFrequencies(const void* first, const void* second)
+{
+	const SymbolFrequency* a = (const SymbolFrequency*) first;
+	const SymbolFrequency* b = (const SymbolFrequency*) second;
+	if (a->frequency != b->frequency) return (a->frequency < b->frequency) ? -1 : 1;
+
+	return a->symbol - b->symbol;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AssignHuffmanCodes
+//	Purpose:	Assigns the canonical codes of the code lengths, bit reversed for the least significant first writer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AssignHuffmanCodes(HuffmanCodes* codes, int symbolCount)
+{
+	int lengthCounts[DeflateMaxCodeLength + 1] = {};
+	for (int i = 0; i < symbolCount; ++i)
+	{
+		lengthCounts[codes->lengths[i]]++;
+	}
+
+	int nextCodes[DeflateMaxCodeLength + 1] = {};
+	int code = 0;
+	lengthCounts[0] = 0;
+	for (int length = 1; length <= DeflateMaxCodeLength; ++length)
+	{
+		code = (code + lengthCounts[length - 1]) << 1;
+		nextCodes[length] = code;
+	}
+
+	for (int i = 0; i < symbolCount; ++i)
+	{
+		int length = codes->lengths[i];
+		codes->codes[i] = (length > 0) ? (WORD) ReverseBits(nextCodes[length]++, length) : 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildFixedCodes
+//	Purpose:	Builds the fixed codes of block type 1
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void BuildFixedCodes(HuffmanCodes* lengthCodes, HuffmanCodes* distanceCodes)
+{
+	::memset(lengthCodes->lengths, 8, 144);
+	::memset(lengthCodes->lengths + 144, 9, 112);
+	::memset(lengthCodes->lengths + 256, 7, 24);
+	::memset(lengthCodes->lengths + 280, 8, 8);
+	::memset(distanceCodes->lengths, 5, DeflateDistanceCodes);
+	AssignHuffmanCodes(lengthCodes, 288);
+	AssignHuffmanCodes(distanceCodes, DeflateDistanceCodes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildHuffmanCodes
+//	Purpose:	Builds length limited codes for the frequencies. At least two symbols always get a code so that the
+//				code is complete.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void BuildHuffmanCodes(const DWORD* frequencies, int symbolCount, int maxLength, HuffmanCodes* codes)
+{
+	SymbolFrequency sorted[288];
+	int usedCount = 0;
+	::memset(codes->lengths, 0, sizeof(codes->lengths));
+	for (int i = 0; i < symbolCount; ++i)
+	{
+		if (frequencies[i] == 0) continue;
+
+		sorted[usedCount].frequency = (int) frequencies[i];
+		sorted[usedCount].symbol = i;
+		usedCount++;
+	}
+
+	if (usedCount < 2)
+	{
+		int symbol = (usedCount == 1) ? sorted[0].symbol : 0;
+		codes->lengths[symbol] = 1;
+		codes->lengths[(symbol == 0) ? 1 : 0] = 1;
+	}
+	else
+	{
+		::qsort(sorted, usedCount, sizeof(SymbolFrequency), CompareSymbolFrequencies);
+
+		// code lengths in place (Moffat and Katajainen), a[i] ends up as the length of the i-th least frequent symbol
+		int a[288];
+		for (int i = 0; i < usedCount; ++i)
+		{
+			a[i] = sorted[i].frequency;
+		}
+
+		a[0] += a[1];
+		int root = 0;
+		int leaf = 2;
+		for (int next = 1; next < usedCount - 1; ++next)
+		{
+			if (leaf >= usedCount || a[root] < a[leaf])
+			{
+				a[next] = a[root];
+				a[root++] = next;
+			}
+			else a[next] = a[leaf++];
+
+			if (leaf >= usedCount || (root < next && a[root] < a[leaf]))
+			{
+				a[next] += a[root];
+				a[root++] = next;
+			}
+			else a[next] += a[leaf++];
+		}
+
+		a[usedCount - 2] = 0;
+		for (int next = usedCount - 3; next >= 0; --next)
+		{
+			a[next] = a[a[next]] + 1;
+		}
+
+		int available = 1;
+		int used = 0;
+		int depth = 0;
+		root = usedCount - 2;
+		int next = usedCount - 1;
+		while (available > 0)
+		{
+			while (root >= 0 && a[root] == depth)
+			{
+				used++;
+				root--;
+			}
+
+			while (available > used)
+			{
+				a[next--] = depth;
+				available--;
+			}
+
+			available = 2 * used;
+			depth++;
+			used = 0;
+		}
+
+		// fold lengths above the limit into it, then lengthen shorter codes until the Kraft sum is exact again
+		int lengthCounts[DeflateMaxCodeLength + 1] = {};
+		for (int i = 0; i < usedCount; ++i)
+		{
+			lengthCounts[(a[i] > maxLength) ? maxLength : a[i]]++;
+		}
+
+		DWORD total = 0;
+		for (int length = maxLength; length > 0; --length)
+		{
+			total += (DWORD) lengthCounts[length] << (maxLength - length);
+		}
+
+		while (total != (1u << maxLength))
+		{
+			lengthCounts[maxLength]--;
+			for (int length = maxLength - 1; length > 0; --length)
+			{
+				if (lengthCounts[length] == 0) continue;
+
+				lengthCounts[length]--;
+				lengthCounts[length + 1] += 2;
+				break;
+			}
+
+			total--;
+		}
+
+		// the least frequent symbols get the longest codes
+		int index = 0;
+		for (int length = maxLength; length > 0; --length)
+		{
+			for (int i = 0; i < lengthCounts[length]; ++i)
+			{
+				codes->lengths[sorted[index++].symbol] = (BYTE) length;
+			}
+		}
+	}
+
+	AssignHuffmanCodes(codes, symbolCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetLengthCode
+//	Purpose:	Returns the length code (0 - 28) of a match length
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int GetLengthCode(int length)
+{
+	int value = length - DeflateMinMatch;
+	if (value < 8) return value;
+	if (value == DeflateMaxMatch - DeflateMinMatch) return 28;
+
+	unsigned long bit = 0;
+	::_BitScanReverse(&bit, (unsigned long) value);
+
+	return 4 * ((int) bit - 1) + ((value >> (bit - 2)) & 3);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetDistanceCode
+//	Purpose:	Returns the distance code (0 - 29) of a match distance
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int GetDistanceCode(int distance)
+{
+	int value = distance - 1;
+	if (value < 4) return value;
+
+	unsigned long bit = 0;
+	::_BitScanReverse(&bit, (unsigned long) value);
+
+	return 2 * (int) bit + ((value >> (bit - 1)) & 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetMatchLength
+//	Purpose:	Returns the number of equal leading bytes, up to maxLength, 16 at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int GetMatchLength(const BYTE* first, const BYTE* second, int maxLength)
+{
+	int length = 0;
+	for (; length + 16 <= maxLength; length += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*) (first + length));
+		__m128i b = _mm_loadu_si128((const __m128i*) (second + length));
+		unsigned long mask = (unsigned long) (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF);
+		if (mask != 0)
+		{
+			unsigned long bit = 0;
+			::_BitScanForward(&bit, mask);
+			return length + (int) bit;
+		}
+	}
+
+	while (length < maxLength && first[length] == second[length])
+	{
+		length++;
+	}
+
+	return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashPosition
+//	Purpose:	Hashes the 3 bytes at a window position
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int HashPosition(const BYTE* bytes)
+{
+	DWORD value = (DWORD) bytes[0] | ((DWORD) bytes[1] << 8) | ((DWORD) bytes[2] << 16);
+	return (int) ((value * 2654435761u) >> (32 - DeflateHashBits));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindSymbols
+//	Purpose:	Greedy LZ77 parse of the window from blockStart, returns the number of symbols
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int FindSymbols(DeflateStream* stream, DWORD* lengthFrequencies, DWORD* distanceFrequencies)
+{
+	const BYTE* window = stream->window;
+	int* heads = stream->hashHeads;
+	int* previous = stream->hashPrevious;
+	int end = stream->windowFill;
+	int symbolCount = 0;
+
+	for (int position = stream->blockStart; position < end;)
+	{
+		int maxLength = (end - position < DeflateMaxMatch) ? end - position : DeflateMaxMatch;
+		int bestLength = DeflateMinMatch - 1;
+		int bestDistance = 0;
+		if (maxLength >= DeflateMinMatch)
+		{
+			int hash = HashPosition(window + position);
+			int candidate = heads[hash];
+			previous[position] = candidate;
+			heads[hash] = position;
+
+			for (int chain = 0; candidate >= 0 && position - candidate <= DeflateWindowSize && chain < DeflateMaxChain; ++chain)
+			{
+				// the byte that would make the match longer than the best one is checked first
+				if (window[candidate + bestLength] == window[position + bestLength])
+				{
+					int length = GetMatchLength(window + candidate, window + position, maxLength);
+					if (length > bestLength)
+					{
+						bestLength = length;
+						bestDistance = position - candidate;
+						if (length == maxLength) break;
+					}
+				}
+
+				candidate = previous[candidate];
+			}
+		}
+
+		DeflateSymbol* symbol = &stream->symbols[symbolCount++];
+		if (bestDistance == 0)
+		{
+			symbol->length = window[position];
+			symbol->distance = 0;
+			lengthFrequencies[window[position]]++;
+			position++;
+			continue;
+		}
+
+		symbol->length = (WORD) bestLength;
+		symbol->distance = (WORD) bestDistance;
+		lengthFrequencies[257 + GetLengthCode(bestLength)]++;
+		distanceFrequencies[GetDistanceCode(bestDistance)]++;
+
+		// positions inside short matches are hashed too, long ones are runs that only need their start
+		if (bestLength <= 32)
+		{
+			for (int i = 1; i < bestLength && position + i + DeflateMinMatch <= end; ++i)
+			{
+				int hash = HashPosition(window + position + i);
+				previous[position + i] = heads[hash];
+				heads[hash] = position + i;
+			}
+		}
+
+		position += bestLength;
+	}
+
+	return symbolCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetCodeBitCount
+//	Purpose:	Returns the number of bits the symbols take with the given code lengths, extra bits included
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned __int64 GetCodeBitCount(const DWORD* lengthFrequencies, const BYTE* lengthLengths, const DWORD* distanceFrequencies, const BYTE* distanceLengths)
+{
+	unsigned __int64 bitCount = 0;
+	for (int i = 0; i < DeflateLengthCodes; ++i)
+	{
+		bitCount += (unsigned __int64) lengthFrequencies[i] * (lengthLengths[i] + ((i > DeflateEndOfBlock) ? LengthExtraBits[i - 257] : 0));
+	}
+
+	for (int i = 0; i < DeflateDistanceCodes; ++i)
+	{
+		bitCount += (unsigned __int64) distanceFrequencies[i] * (distanceLengths[i] + DistanceExtraBits[i]);
+	}
+
+	return bitCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteStoredBlocks
+//	Purpose:	Writes the block bytes uncompressed, in pieces of at most 65535 bytes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void WriteStoredBlocks(DeflateStream* stream, BOOL finalBlock)
+{
+	const BYTE* bytes = stream->window + stream->blockStart;
+	int byteCount = stream->windowFill - stream->blockStart;
+	do
+	{
+		int pieceSize = (byteCount < DeflateStoredMaxLength) ? byteCount : DeflateStoredMaxLength;
+		WriteBits(stream, (finalBlock == TRUE && pieceSize == byteCount) ? 1 : 0, 1);
+		WriteBits(stream, 0, 2);
+		AlignBits(stream);
+		WriteBits(stream, (DWORD) pieceSize | ((DWORD) (pieceSize ^ 0xFFFF) << 16), 32);
+
+		for (int copied = 0; copied < pieceSize;)
+		{
+			int copyCount = DeflateOutputSize - stream->outputFill;
+			if (copyCount > pieceSize - copied) copyCount = pieceSize - copied;
+			::memcpy(stream->outputBytes + stream->outputFill, bytes + copied, copyCount);
+			stream->outputFill += copyCount;
+			copied += copyCount;
+			if (stream->outputFill >= DeflateOutputSize) FlushOutput(stream);
+		}
+
+		bytes += pieceSize;
+		byteCount -= pieceSize;
+	}
+	while (byteCount > 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompressBlock
+//	Purpose:	Compresses the window from blockStart as one block
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CompressBlock(DeflateStream* stream, BOOL finalBlock)
+{
+	DWORD lengthFrequencies[DeflateLengthCodes] = {};
+	DWORD distanceFrequencies[DeflateDistanceCodes] = {};
+	int symbolCount = FindSymbols(stream, lengthFrequencies, distanceFrequencies);
+	lengthFrequencies[DeflateEndOfBlock] = 1;
+
+	HuffmanCodes lengthCodes;
+	HuffmanCodes distanceCodes;
+	BuildHuffmanCodes(lengthFrequencies, DeflateLengthCodes, DeflateMaxCodeLength, &lengthCodes);
+	BuildHuffmanCodes(distanceFrequencies, DeflateDistanceCodes, DeflateMaxCodeLength, &distanceCodes);
+
+	// code lengths of both codes run length encoded, symbol in the low byte and repeat count in the high byte
+	int lengthCount = DeflateLengthCodes;
+	int distanceCount = DeflateDistanceCodes;
+	while (lengthCount > 257 && lengthCodes.lengths[lengthCount - 1] == 0) lengthCount--;
+	while (distanceCount > 1 && distanceCodes.lengths[distanceCount - 1] == 0) distanceCount--;
+
+	BYTE lengths[DeflateLengthCodes + DeflateDistanceCodes];
+	::memcpy(lengths, lengthCodes.lengths, lengthCount);
+	::memcpy(lengths + lengthCount, distanceCodes.lengths, distanceCount);
+	WORD runs[DeflateLengthCodes + DeflateDistanceCodes];
+	int runCount = 0;
+	DWORD codeLengthFrequencies[DeflateCodeLengthCodes] = {};
+	for (int i = 0; i < lengthCount + distanceCount;)
+	{
+		int runLength = 1;
+		while (i + runLength < lengthCount + distanceCount && lengths[i + runLength] == lengths[i]) runLength++;
+
+		int symbol = lengths[i];
+		int repeat = 0;
+		if (lengths[i] == 0 && runLength >= 11)
+		{
+			symbol = 18;
+			repeat = (runLength > 138) ? 138 : runLength;
+		}
+		else if (lengths[i] == 0 && runLength >= 3)
+		{
+			symbol = 17;
+			repeat = runLength;
+		}
+		else if (lengths[i] != 0 && i > 0 && lengths[i - 1] == lengths[i] && runLength >= 3)
+		{
+			symbol = 16;
+			repeat = (runLength > 6) ? 6 : runLength;
+		}
+
+		runs[runCount++] = (WORD) (symbol | (repeat << 8));
+		codeLengthFrequencies[symbol]++;
+		i += (repeat > 0) ? repeat : 1;
+	}
+
+	HuffmanCodes codeLengthCodes;
+	BuildHuffmanCodes(codeLengthFrequencies, DeflateCodeLengthCodes, DeflateMaxCodeLengthLength, &codeLengthCodes);
+	int codeLengthCount = DeflateCodeLengthCodes;
+	while (codeLengthCount > 4 && codeLengthCodes.lengths[CodeLengthOrder[codeLengthCount - 1]] == 0) codeLengthCount--;
+
+	// dynamic, fixed and stored sizes
+	unsigned __int64 dynamicBits = 3 + 14 + 3 * codeLengthCount + GetCodeBitCount(lengthFrequencies, lengthCodes.lengths, distanceFrequencies, distanceCodes.lengths);
+	for (int i = 0; i < DeflateCodeLengthCodes; ++i)
+	{
+		dynamicBits += (unsigned __int64) codeLengthFrequencies[i] * (codeLengthCodes.lengths[i] + ((i == 16) ? 2 : (i == 17) ? 3 : (i == 18) ? 7 : 0));
+	}
+
+	HuffmanCodes fixedLengthCodes;
+	HuffmanCodes fixedDistanceCodes;
+	BuildFixedCodes(&fixedLengthCodes, &fixedDistanceCodes);
+	unsigned __int64 fixedBits = 3 + GetCodeBitCount(lengthFrequencies, fixedLengthCodes.lengths, distanceFrequencies, fixedDistanceCodes.lengths);
+
+	int byteCount = stream->windowFill - stream->blockStart;
+	unsigned __int64 storedBits = ((unsigned __int64) byteCount + 5 * (byteCount / DeflateStoredMaxLength + 1)) * 8 + 7;
+
+	if (storedBits <= dynamicBits && storedBits <= fixedBits)
+	{
+		WriteStoredBlocks(stream, finalBlock);
+		return;
+	}
+
+	const HuffmanCodes* writeLengthCodes = &lengthCodes;
+	const HuffmanCodes* writeDistanceCodes = &distanceCodes;
+	if (fixedBits < dynamicBits)
+	{
+		WriteBits(stream, (finalBlock == TRUE) ? 1 : 0, 1);
+		WriteBits(stream, 1, 2);
+		writeLengthCodes = &fixedLengthCodes;
+		writeDistanceCodes = &fixedDistanceCodes;
+	}
+	else
+	{
+		WriteBits(stream, (finalBlock == TRUE) ? 1 : 0, 1);
+		WriteBits(stream, 2, 2);
+		WriteBits(stream, lengthCount - 257, 5);
+		WriteBits(stream, distanceCount - 1, 5);
+		WriteBits(stream, codeLengthCount - 4, 4);
+		for (int i = 0; i < codeLengthCount; ++i)
+		{
+			WriteBits(stream, codeLengthCodes.lengths[CodeLengthOrder[i]], 3);
+		}
+
+		for (int i = 0; i < runCount; ++i)
+		{
+			int symbol = runs[i] & 0xFF;
+			int repeat = runs[i] >> 8;
+			WriteBits(stream, codeLengthCodes.codes[symbol], codeLengthCodes.lengths[symbol]);
+			if (symbol == 16) WriteBits(stream, repeat - 3, 2);
+			else if (symbol == 17) WriteBits(stream, repeat - 3, 3);
+			else if (symbol == 18) WriteBits(stream, repeat - 11, 7);
+		}
+	}
+
+	for (int i = 0; i < symbolCount; ++i)
+	{
+		const DeflateSymbol* symbol = &stream->symbols[i];
+		if (symbol->distance == 0)
+		{
+			WriteBits(stream, writeLengthCodes->codes[symbol->length], writeLengthCodes->lengths[symbol->length]);
+			continue;
+		}
+
+		int lengthCode = GetLengthCode(symbol->length);
+		int distanceCode = GetDistanceCode(symbol->distance);
+		WriteBits(stream, writeLengthCodes->codes[257 + lengthCode], writeLengthCodes->lengths[257 + lengthCode]);
+		WriteBits(stream, symbol->length - LengthBases[lengthCode], LengthExtraBits[lengthCode]);
+		WriteBits(stream, writeDistanceCodes->codes[distanceCode], writeDistanceCodes->lengths[distanceCode]);
+		WriteBits(stream, symbol->distance - DistanceBases[distanceCode], DistanceExtraBits[distanceCode]);
+	}
+
+	WriteBits(stream, writeLengthCodes->codes[DeflateEndOfBlock], writeLengthCodes->lengths[DeflateEndOfBlock]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenDeflateStream
+//	Purpose:	Prepares to compress a zlib stream written to output
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenDeflateStream(DeflateStream* stream, DeflateOutput output, void* context)
+{
+	// validate parameters
+	if (stream == NULL || output == NULL)
+	{
+		printf("Invalid parameter Stream or Output NULL.\n");
+		return FALSE;
+	}
+
+	::memset(stream, 0, sizeof(DeflateStream));
+	stream->output = output;
+	stream->context = context;
+	stream->adler = 1;
+
+	// the window and output buffer have slack for 16 byte loads and the last bytes of the bit buffer
+	stream->window = (BYTE*) ::malloc(DeflateWindowSize + DeflateBlockSize + 16);
+	stream->hashHeads = (int*) ::malloc(sizeof(int) << DeflateHashBits);
+	stream->hashPrevious = (int*) ::malloc(sizeof(int) * (DeflateWindowSize + DeflateBlockSize));
+	stream->symbols = (DeflateSymbol*) ::malloc(sizeof(DeflateSymbol) * DeflateBlockSize);
+	stream->outputBytes = (BYTE*) ::malloc(DeflateOutputSize + 16);
+	if (stream->window == NULL || stream->hashHeads == NULL || stream->hashPrevious == NULL || stream->symbols == NULL || stream->outputBytes == NULL)
+	{
+		printf("Failed to allocate compression buffers.\n");
+		CloseDeflateStream(stream);
+		return FALSE;
+	}
+
+	::memset(stream->hashHeads, 0xFF, sizeof(int) << DeflateHashBits);
+
+	// zlib header, deflate with a 32 KB window and the default level
+	WriteBits(stream, 0x78, 8);
+	WriteBits(stream, 0x9C, 8);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeflateBytes
+//	Purpose:	Adds byteCount bytes to the stream, a block is compressed whenever DeflateBlockSize bytes are buffered
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DeflateBytes(DeflateStream* stream, const BYTE* source, int byteCount)
+{
+	// validate parameters
+	if (stream == NULL || stream->window == NULL || (source == NULL && byteCount > 0))
+	{
+		printf("Invalid parameter Stream or Source NULL.\n");
+		return FALSE;
+	}
+
+	stream->adler = UpdateAdler32(stream->adler, source, byteCount);
+	while (byteCount > 0 && stream->failed == FALSE)
+	{
+		int copyCount = stream->blockStart + DeflateBlockSize - stream->windowFill;
+		if (copyCount > byteCount) copyCount = byteCount;
+		::memcpy(stream->window + stream->windowFill, source, copyCount);
+		stream->windowFill += copyCount;
+		source += copyCount;
+		byteCount -= copyCount;
+		if (stream->windowFill < stream->blockStart + DeflateBlockSize) break;
+
+		CompressBlock(stream, FALSE);
+		stream->blockStart = stream->windowFill;
+		if (stream->windowFill <= DeflateWindowSize) continue;
+
+		// keep the last DeflateWindowSize bytes as history, positions that fall out of it are dropped
+		int shift = stream->windowFill - DeflateWindowSize;
+		::memmove(stream->window, stream->window + shift, DeflateWindowSize);
+		for (int i = 0; i < (1 << DeflateHashBits); ++i)
+		{
+			stream->hashHeads[i] = (stream->hashHeads[i] >= shift) ? stream->hashHeads[i] - shift : -1;
+		}
+
+		for (int i = 0; i < DeflateWindowSize; ++i)
+		{
+			int position = stream->hashPrevious[i + shift];
+			stream->hashPrevious[i] = (position >= shift) ? position - shift : -1;
+		}
+
+		stream->windowFill = DeflateWindowSize;
+		stream->blockStart = DeflateWindowSize;
+	}
+
+	return (stream->failed == FALSE) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishDeflateStream
+//	Purpose:	Compresses the buffered bytes as the final block and writes the Adler-32
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FinishDeflateStream(DeflateStream* stream)
+{
+	// validate parameters
+	if (stream == NULL || stream->window == NULL)
+	{
+		printf("Invalid parameter Stream NULL.\n");
+		return FALSE;
+	}
+
+	CompressBlock(stream, TRUE);
+	stream->blockStart = stream->windowFill;
+
+	// big endian checksum at a byte boundary
+	AlignBits(stream);
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		stream->outputBytes[stream->outputFill++] = (BYTE) (stream->adler >> shift);
+	}
+
+	FlushOutput(stream);
+
+	return (stream->failed == FALSE) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseDeflateStream
+//	Purpose:	Frees the buffers of a compressor
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseDeflateStream(DeflateStream* stream)
+{
+	if (stream == NULL) return;
+
+	free(stream->window);
+	free(stream->hashHeads);
+	free(stream->hashPrevious);
+	free(stream->symbols);
+	free(stream->outputBytes);
+	::memset(stream, 0, sizeof(DeflateStream));
+}
@@ -0,0 +1,175 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file deflate.h
+* \brief deflate.h is a streaming zlib (RFC 1950 / 1951) compressor and decompressor, plus the CRC-32 and Adler-32
+* checksums, for the PNG converter
+* Example (optional):
+* \code
+* DeflateStream stream = {};
+* OpenDeflateStream(&stream, WriteCompressed, file);
+* DeflateBytes(&stream, rows, rowByteSize * rowCount);
+* FinishDeflateStream(&stream);
+* CloseDeflateStream(&stream);
+* \endcode
+* \author Blake Hamilton
+*
+* Both directions keep only the 32 KB window plus one block in memory, so any amount of data streams through.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+// consts
+const int DeflateWindowSize = 32768;			// farthest match distance
+const int DeflateBlockSize = 128 * 1024;		// input bytes compressed per block
+const int DeflateOutputSize = 64 * 1024;		// compressed bytes handed to the output at once
+const int DeflateHashBits = 15;
+const int DeflateMaxChain = 16;					// match candidates tried per position
+const int InflateInputSize = 64 * 1024;
+const int InflateFastBits = 10;					// codes up to 10 bits decode with one table lookup
+
+// supplies the next compressed bytes, byteCount 0 means the compressed data ended
+typedef BOOL (*InflateInput)(void* context, BYTE* bytes, int capacity, int* byteCount);
+
+// receives compressed bytes
+typedef BOOL (*DeflateOutput)(void* context, const BYTE* bytes, int byteCount);
+
+// decoding table of one Huffman code
+struct InflateCode
+{
+	WORD fast[1 << InflateFastBits];	// symbol << 4 | code length of every code up to InflateFastBits, 0 if longer
+	WORD counts[16];					// number of codes of each length
+	WORD symbols[288];					// symbols in canonical order
+};
+
+// streaming decompressor state
+struct InflateStream
+{
+	InflateInput input;
+	void* context;
+	BYTE* inputBytes;
+	int inputPosition;
+	int inputEnd;
+	BOOL inputEnded;
+	unsigned __int64 bitBuffer;
+	int bitCount;
+	BYTE* window;					// last DeflateWindowSize bytes of output
+	unsigned __int64 outputByteSize;
+	int blockType;					// type of the current block, -1 between blocks
+	BOOL finalBlock;
+	BOOL ended;						// the final block is done
+	int storedLength;				// bytes left in a stored block
+	int copyLength;					// bytes left of a match
+	int copyDistance;
+	DWORD adler;
+	InflateCode lengthCode;
+	InflateCode distanceCode;
+};
+
+// a literal (distance 0) or a match, as found by the compressor
+struct DeflateSymbol
+{
+	WORD length;
+	WORD distance;
+};
+
+// streaming compressor state
+struct DeflateStream
+{
+	DeflateOutput output;
+	void* context;
+	BYTE* window;					// up to DeflateWindowSize bytes of history, then the block being filled
+	int windowFill;
+	int blockStart;					// first byte of the window that isn't compressed yet
+	int* hashHeads;					// latest window position of every 3 byte hash, -1 if none
+	int* hashPrevious;				// previous position with the same hash for every window position
+	DeflateSymbol* symbols;
+	BYTE* outputBytes;
+	int outputFill;
+	unsigned __int64 bitBuffer;
+	int bitCount;
+	DWORD adler;
+	BOOL failed;					// the output failed, the rest of the stream is dropped
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UpdateCrc32
+//	Purpose:	Continues a CRC-32 (PNG, zip) over byteSize more bytes, start with 0
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD UpdateCrc32(DWORD crc, const BYTE* bytes, size_t byteSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UpdateAdler32
+//	Purpose:	Continues an Adler-32 (zlib) over byteSize more bytes, start with 1
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD UpdateAdler32(DWORD adler, const BYTE* bytes, size_t byteSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenInflateStream
+//	Purpose:	Prepares to decompress a zlib stream read from input
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenInflateStream(InflateStream* stream, InflateInput input, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InflateBytes
+//	Purpose:	Decompresses exactly byteCount more bytes, fails if the stream is corrupt or ends first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InflateBytes(InflateStream* stream, BYTE* target, int byteCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishInflateStream
+//	Purpose:	Skips what is left of the stream and checks its Adler-32
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FinishInflateStream(InflateStream* stream);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseInflateStream
+//	Purpose:	Frees the buffers of a decompressor
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseInflateStream(InflateStream* stream);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenDeflateStream
+//	Purpose:	Prepares to compress a zlib stream written to output
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenDeflateStream(DeflateStream* stream, DeflateOutput output, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeflateBytes
+//	Purpose:	Adds byteCount bytes to the stream, a block is compressed whenever DeflateBlockSize bytes are buffered
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DeflateBytes(DeflateStream* stream, const BYTE* source, int byteCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishDeflateStream
+//	Purpose:	Compresses the buffered bytes as the final block and writes the Adler-32
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FinishDeflateStream(DeflateStream* stream);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseDeflateStream
+//	Purpose:	Frees the buffers of a compressor
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseDeflateStream(DeflateStream* stream);
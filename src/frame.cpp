@@ -0,0 +1,335 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file frame.cpp
+* \brief frame.cpp implements the shared memory frame ring between a producer process and its consumers
+* \author Blake Hamilton
+*
+* The sequence numbers are only ever changed with Interlocked functions, which are full barriers, so the pixels of
+* a slot are in memory before its sequence turns even and the slot sequence is even before the frame is published.
+* Readers don't write to the mapping at all.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include "bif.h"
+#include "frame.h"
+
+// consts
+const BYTE FrameFourCC[4] = { 0x42, 0x49, 0x46, 0x53 };	// BIFS
+const int FrameSpinCount = 64;			// polls before a waiting consumer starts to sleep
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetFrameMappingName
+//	Purpose:	Builds the name of the mapping of a frame name, local to the session
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL GetFrameMappingName(const char* frameName, char* mappingName, size_t mappingNameSize)
+{
+	if (frameName == NULL || frameName[0] == '\0' || ::strchr(frameName, '\\') != NULL)
+	{
+		printf("Invalid frame name, it can't be empty or contain a backslash.\n");
+		return FALSE;
+	}
+
+	if (::sprintf_s(mappingName, mappingNameSize, "Local\\BifFrame.%s", frameName) < 0)
+	{
+		printf("Frame name %s is too long.\n", frameName);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenFrameProducer
+//	Purpose:	Creates the named frame mapping, or takes over the one a previous producer left open if its size and
+//				format match, in which case its sequence continues
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenFrameProducer(FrameProducer* producer, const char* frameName, unsigned short pixelWidth, unsigned short pixelHeight, SharedFrameFormat format, int slotCount)
+{
+	// validate parameters
+	if (producer == NULL || pixelWidth == 0 || pixelHeight == 0 || slotCount < 2 || slotCount > FrameMaxSlots)
+	{
+		printf("Invalid parameter Producer NULL, empty frame or slot count not between 2 and %d.\n", FrameMaxSlots);
+		return FALSE;
+	}
+
+	::memset(producer, 0, sizeof(FrameProducer));
+	char mappingName[MAX_PATH];
+	if (GetFrameMappingName(frameName, mappingName, sizeof(mappingName)) == FALSE) return FALSE;
+
+	// rows padded to 4 bytes like a DIB, slots padded to pages
+	DWORD rowStride = (((DWORD) pixelWidth * 24 + 31) / 32) * 4;
+	unsigned __int64 slotByteSize = ((unsigned __int64) rowStride * pixelHeight + FrameSlotAlignment - 1) / FrameSlotAlignment * FrameSlotAlignment;
+	unsigned __int64 mappingByteSize = FrameHeaderByteSize + slotByteSize * slotCount;
+	if (sizeof(size_t) < 8 && mappingByteSize > 0x7FFFFFFF)
+	{
+		printf("Frames of %u x %u don't fit the address space of a 32 bit process.\n", pixelWidth, pixelHeight);
+		return FALSE;
+	}
+
+	HANDLE mapping = ::CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) (mappingByteSize >> 32), (DWORD) mappingByteSize, mappingName);
+	if (mapping == NULL)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	BOOL existed = (::GetLastError() == ERROR_ALREADY_EXISTS) ? TRUE : FALSE;
+	BYTE* view = (BYTE*) ::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (view == NULL)
+	{
+		PrintOsErrorText();
+		::CloseHandle(mapping);
+		return FALSE;
+	}
+
+	SharedFrameHeader* header = (SharedFrameHeader*) view;
+	if (existed == TRUE)
+	{
+		// a consumer kept the frames of an earlier producer open, they can only be reused as they are
+		if (::memcmp(header->fourCC, FrameFourCC, sizeof(FrameFourCC)) != 0 || header->version != FrameVersion || header->pixelWidth != pixelWidth || header->pixelHeight != pixelHeight ||
+			header->format != (DWORD) format || header->slotCount != slotCount)
+		{
+			printf("Frame %s is already open with a different size or format.\n", frameName);
+			::UnmapViewOfFile(view);
+			::CloseHandle(mapping);
+			return FALSE;
+		}
+
+		// a frame the earlier producer didn't finish stays odd, readers skip it
+	}
+	else
+	{
+		header->version = FrameVersion;
+		header->slotCount = (WORD) slotCount;
+		header->pixelWidth = pixelWidth;
+		header->pixelHeight = pixelHeight;
+		header->format = (DWORD) format;
+		header->rowStride = rowStride;
+		header->slotByteSize = slotByteSize;
+		::MemoryBarrier();
+		::memcpy(header->fourCC, FrameFourCC, sizeof(FrameFourCC));
+	}
+
+	producer->mapping = mapping;
+	producer->header = header;
+	producer->slots = view + FrameHeaderByteSize;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BeginFrameWrite
+//	Purpose:	Returns the slot of the next frame to fill, rows are rowStride bytes apart
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BYTE* BeginFrameWrite(FrameProducer* producer, ptrdiff_t* rowStride)
+{
+	// validate parameters
+	if (producer == NULL || producer->header == NULL || rowStride == NULL || producer->writing != 0)
+	{
+		printf("Invalid parameter Producer or RowStride NULL, or a frame is already being written.\n");
+		return NULL;
+	}
+
+	SharedFrameHeader* header = producer->header;
+	LONG64 sequence = header->sequence + 1;
+	int slot = (int) (sequence % header->slotCount);
+
+	// odd while the slot is written, readers of the frame it held see the change
+	::InterlockedExchange64(&header->slotSequences[slot], sequence * 2 - 1);
+	producer->writing = sequence;
+
+	*rowStride = (ptrdiff_t) header->rowStride;
+	return producer->slots + (size_t) slot * header->slotByteSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EndFrameWrite
+//	Purpose:	Publishes the frame filled since BeginFrameWrite
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL EndFrameWrite(FrameProducer* producer)
+{
+	// validate parameters
+	if (producer == NULL || producer->header == NULL || producer->writing == 0)
+	{
+		printf("Invalid parameter Producer NULL, or no frame is being written.\n");
+		return FALSE;
+	}
+
+	SharedFrameHeader* header = producer->header;
+	LONG64 sequence = producer->writing;
+	int slot = (int) (sequence % header->slotCount);
+	::InterlockedExchange64(&header->slotSequences[slot], sequence * 2);
+	::InterlockedExchange64(&header->sequence, sequence);
+	producer->writing = 0;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFrameProducer
+//	Purpose:	Unmaps the frames, the mapping goes away once no consumer has it open either
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseFrameProducer(FrameProducer* producer)
+{
+	if (producer == NULL) return;
+
+	if (producer->header != NULL) ::UnmapViewOfFile(producer->header);
+	if (producer->mapping != NULL) ::CloseHandle(producer->mapping);
+	::memset(producer, 0, sizeof(FrameProducer));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenFrameConsumer
+//	Purpose:	Maps the named frames read only
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenFrameConsumer(FrameConsumer* consumer, const char* frameName)
+{
+	// validate parameters
+	if (consumer == NULL)
+	{
+		printf("Invalid parameter Consumer NULL.\n");
+		return FALSE;
+	}
+
+	::memset(consumer, 0, sizeof(FrameConsumer));
+	char mappingName[MAX_PATH];
+	if (GetFrameMappingName(frameName, mappingName, sizeof(mappingName)) == FALSE) return FALSE;
+
+	HANDLE mapping = ::OpenFileMapping(FILE_MAP_READ, FALSE, mappingName);
+	if (mapping == NULL)
+	{
+		printf("No producer publishes frame %s.\n", frameName);
+		return FALSE;
+	}
+
+	const BYTE* view = (const BYTE*) ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		PrintOsErrorText();
+		::CloseHandle(mapping);
+		return FALSE;
+	}
+
+	// the four character code is written last, without it the producer is still setting up
+	const SharedFrameHeader* header = (const SharedFrameHeader*) view;
+	if (::memcmp((const void*) header->fourCC, FrameFourCC, sizeof(FrameFourCC)) != 0 || header->version != FrameVersion)
+	{
+		printf("Frame %s isn't ready or was published by an unsupported version.\n", frameName);
+		::UnmapViewOfFile(view);
+		::CloseHandle(mapping);
+		return FALSE;
+	}
+
+	::MemoryBarrier();
+	consumer->mapping = mapping;
+	consumer->header = header;
+	consumer->slots = view + FrameHeaderByteSize;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WaitForFrame
+//	Purpose:	Waits up to timeout milliseconds for a frame newer than the last one and starts reading it. Frames
+//				published in between are skipped, the newest one is returned.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WaitForFrame(FrameConsumer* consumer, DWORD timeout, SharedFrame* frame)
+{
+	// validate parameters
+	if (consumer == NULL || consumer->header == NULL || frame == NULL)
+	{
+		printf("Invalid parameter Consumer or Frame NULL.\n");
+		return FALSE;
+	}
+
+	const SharedFrameHeader* header = consumer->header;
+	DWORD startTime = ::GetTickCount();
+	for (int poll = 0;; ++poll)
+	{
+		LONG64 sequence = header->sequence;
+		if (sequence > consumer->lastSequence)
+		{
+			// the slot still holds the frame unless the producer already lapped it, then try the newer one
+			int slot = (int) (sequence % header->slotCount);
+			if (header->slotSequences[slot] == sequence * 2)
+			{
+				::MemoryBarrier();
+				frame->pixels = consumer->slots + (size_t) slot * header->slotByteSize;
+				frame->rowStride = (ptrdiff_t) header->rowStride;
+				frame->pixelWidth = header->pixelWidth;
+				frame->pixelHeight = header->pixelHeight;
+				frame->format = (SharedFrameFormat) header->format;
+				frame->sequence = sequence;
+				frame->slot = slot;
+				consumer->lastSequence = sequence;
+
+				return TRUE;
+			}
+
+			continue;
+		}
+
+		if (::GetTickCount() - startTime >= timeout)
+		{
+			printf("Timed out waiting for a frame newer than %lld.\n", consumer->lastSequence);
+			return FALSE;
+		}
+
+		// spin briefly for producers that publish back to back, then give the processor away
+		if (poll < FrameSpinCount) ::YieldProcessor();
+		else ::Sleep((poll < FrameSpinCount * 2) ? 0 : 1);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EndFrameRead
+//	Purpose:	Returns TRUE if the frame wasn't overwritten while it was read, anything read from it is then valid
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL EndFrameRead(const FrameConsumer* consumer, const SharedFrame* frame)
+{
+	// validate parameters
+	if (consumer == NULL || consumer->header == NULL || frame == NULL || frame->slot < 0 || frame->slot >= consumer->header->slotCount)
+	{
+		printf("Invalid parameter Consumer or Frame NULL.\n");
+		return FALSE;
+	}
+
+	// reads of the pixels complete before the sequence is checked again
+	::MemoryBarrier();
+
+	return (consumer->header->slotSequences[frame->slot] == frame->sequence * 2) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFrameConsumer
+//	Purpose:	Unmaps the frames
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseFrameConsumer(FrameConsumer* consumer)
+{
+	if (consumer == NULL) return;
+
+	if (consumer->header != NULL) ::UnmapViewOfFile(consumer->header);
+	if (consumer->mapping != NULL) ::CloseHandle(consumer->mapping);
+	::memset(consumer, 0, sizeof(FrameConsumer));
+}
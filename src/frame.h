@@ -0,0 +1,174 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file frame.h
+* \brief frame.h hands decoded frames from one process to others on the same machine through named shared memory
+* Example (optional):
+* \code
+* FrameProducer producer = {};
+* OpenFrameProducer(&producer, "render", 1920, 1080, FrameFormatRgb, FrameDefaultSlots);
+* ptrdiff_t rowStride = 0;
+* BYTE* pixels = BeginFrameWrite(&producer, &rowStride);
+* RenderViewport(&image, &sourceRect, 1920, 1080, ResampleLanczos, pixels, rowStride);
+* EndFrameWrite(&producer);
+*
+* FrameConsumer consumer = {};
+* OpenFrameConsumer(&consumer, "render");
+* SharedFrame frame = {};
+* WaitForFrame(&consumer, 1000, &frame);
+* WriteImageRows(&writer, frame.pixels, frame.rowStride, frame.pixelHeight);
+* if (EndFrameRead(&consumer, &frame) == FALSE) ...the producer overwrote the frame while it was read...
+* \endcode
+* \author Blake Hamilton
+*
+* Frames live in a ring of slots in a named file mapping backed by the paging file. Consumers map it read only and
+* read the pixels where the producer wrote them, nothing is copied. Every slot has a sequence lock: the producer
+* makes its sequence odd while it writes the slot and even when the frame is complete, a reader checks that the
+* sequence didn't change while it read. The producer never waits for readers, a reader has slotCount - 1 frames of
+* time before its slot is reused. There is one producer per frame name.
+*
+* Layout of the mapping (Local\BifFrame.[Frame Name]):
+* 4 BYTES - Unique four letter character code = BIFS
+* 2 BYTES - Version
+* 2 BYTES - Slot Count
+* 2 BYTES - Pixel Width
+* 2 BYTES - Pixel Height
+* 4 BYTES - Pixel Format (SharedFrameFormat)
+* 4 BYTES - Row Stride (rows are padded to 4 bytes, so bgr frames can back a DIB section directly)
+* 8 BYTES - Slot Byte Size
+* 8 BYTES - Sequence number of the last published frame, 0 before the first
+* 16 x 8 BYTES - Sequence lock of every slot, 2n - 1 while frame n is written, 2n once it is complete
+* N BYTES - Slots from offset FrameHeaderByteSize, frame n is in slot n % Slot Count
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+// consts
+const WORD FrameVersion = 1;
+const int FrameMaxSlots = 16;
+const int FrameDefaultSlots = 3;				// one being written, one being read, one ready
+const int FrameHeaderByteSize = 4096;			// slots start on a page
+const int FrameSlotAlignment = 4096;
+const DWORD FrameDefaultTimeout = 5000;			// milliseconds a consumer waits for the next frame
+
+// pixel layout of a frame
+enum SharedFrameFormat
+{
+	FrameFormatRgb = 0,			// BIF order
+	FrameFormatBgr = 1			// DIB order
+};
+
+// start of the mapping, shared by every process
+struct SharedFrameHeader
+{
+	BYTE fourCC[4];				// written last, a consumer that sees it sees the whole header
+	WORD version;
+	WORD slotCount;
+	WORD pixelWidth;
+	WORD pixelHeight;
+	DWORD format;
+	DWORD rowStride;
+	unsigned __int64 slotByteSize;
+	volatile LONG64 sequence;
+	volatile LONG64 slotSequences[FrameMaxSlots];
+};
+
+// process that publishes frames
+struct FrameProducer
+{
+	HANDLE mapping;
+	SharedFrameHeader* header;
+	BYTE* slots;
+	LONG64 writing;				// sequence of the frame being written, 0 if none
+};
+
+// process that reads frames
+struct FrameConsumer
+{
+	HANDLE mapping;
+	const SharedFrameHeader* header;
+	const BYTE* slots;
+	LONG64 lastSequence;		// last frame handed out by WaitForFrame
+};
+
+// frame being read, the pixels point into the mapping
+struct SharedFrame
+{
+	const BYTE* pixels;
+	ptrdiff_t rowStride;
+	int pixelWidth;
+	int pixelHeight;
+	SharedFrameFormat format;
+	LONG64 sequence;
+	int slot;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenFrameProducer
+//	Purpose:	Creates the named frame mapping, or takes over the one a previous producer left open if its size and
+//				format match, in which case its sequence continues
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenFrameProducer(FrameProducer* producer, const char* frameName, unsigned short pixelWidth, unsigned short pixelHeight, SharedFrameFormat format, int slotCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BeginFrameWrite
+//	Purpose:	Returns the slot of the next frame to fill, rows are rowStride bytes apart
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BYTE* BeginFrameWrite(FrameProducer* producer, ptrdiff_t* rowStride);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EndFrameWrite
+//	Purpose:	Publishes the frame filled since BeginFrameWrite
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL EndFrameWrite(FrameProducer* producer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFrameProducer
+//	Purpose:	Unmaps the frames, the mapping goes away once no consumer has it open either
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseFrameProducer(FrameProducer* producer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenFrameConsumer
+//	Purpose:	Maps the named frames read only
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenFrameConsumer(FrameConsumer* consumer, const char* frameName);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WaitForFrame
+//	Purpose:	Waits up to timeout milliseconds for a frame newer than the last one and starts reading it. Frames
+//				published in between are skipped, the newest one is returned.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WaitForFrame(FrameConsumer* consumer, DWORD timeout, SharedFrame* frame);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EndFrameRead
+//	Purpose:	Returns TRUE if the frame wasn't overwritten while it was read, anything read from it is then valid
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL EndFrameRead(const FrameConsumer* consumer, const SharedFrame* frame);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFrameConsumer
+//	Purpose:	Unmaps the frames
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseFrameConsumer(FrameConsumer* consumer);
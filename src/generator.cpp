@@ -0,0 +1,781 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file generator.cpp
+* \brief generator.cpp implements the procedural image patterns
+* \author Blake Hamilton
+*
+* Every pattern first produces a row of intensities (0 - 255) which is then mapped through a 256 entry
+* color palette. The intensity math runs four pixels per SSE2 instruction: gradients, the lattice hashes, fades and
+* lerps of the noise octaves, normalisation and packing. The lattice values of four pixels are loaded one by one, as
+* SSE2 has no gather, and the palette lookup is a byte table lookup per pixel. Rows are split across threads.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "generator.h"
+#include "image.h"
+#include "parallel.h"
+#include "pipeline.h"
+
+// palette color stop
+struct PaletteStop
+{
+	float position;
+	BYTE red;
+	BYTE green;
+	BYTE blue;
+};
+
+// state shared by the threads generating one strip of rows
+struct GeneratorState
+{
+	const GeneratorOptions* options;
+	int pixelWidth;
+	int pixelHeight;
+	int firstRow;
+	BYTE* pixels;
+	ptrdiff_t stride;
+	BYTE palette[256][3];
+	volatile LONG failed;
+};
+
+// per thread scratch rows
+struct GeneratorScratch
+{
+	float* values;
+	float* latticeA;
+	float* latticeB;
+	BYTE* intensity;
+};
+
+// unit gradients used by the perlin noise, indexed by the low 3 bits of the lattice hash
+static const float PerlinGradientX[8] = { 1.0f, -1.0f, 0.0f, 0.0f, 0.7071f, -0.7071f, 0.7071f, -0.7071f };
+static const float PerlinGradientY[8] = { 0.0f, 0.0f, 1.0f, -1.0f, 0.7071f, 0.7071f, -0.7071f, -0.7071f };
+
+// synthetic photo palette - sky, horizon haze, vegetation, soil, shadow
+static const PaletteStop PhotoPalette[] =
+{
+	{ 0.00f, 70, 130, 200 },
+	{ 0.42f, 190, 215, 235 },
+	{ 0.50f, 95, 125, 65 },
+	{ 0.75f, 125, 105, 75 },
+	{ 1.00f, 40, 35, 30 },
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashCoordinates
+//	Purpose:	Integer hash of a lattice point, the only source of randomness so output is deterministic per seed
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int HashCoordinates(int x, int y, unsigned int seed)
+{
+	unsigned int hash = seed * 0x9E3779B9u ^ (unsigned int) x * 0x85EBCA6Bu ^ (unsigned int) y * 0xC2B2AE35u;
+	hash ^= hash >> 16;
+	hash *= 0x7FEB352Du;
+	hash ^= hash >> 15;
+	hash *= 0x846CA68Bu;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MultiplyLow32
+//	Purpose:	Low 32 bits of four 32 bit products, SSE2 only multiplies the even lanes at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i MultiplyLow32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashCoordinates4
+//	Purpose:	HashCoordinates of four lattice points of one row
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i HashCoordinates4(__m128i x, int y, unsigned int seed)
+{
+	__m128i hash = _mm_xor_si128(_mm_set1_epi32((int) (seed * 0x9E3779B9u ^ (unsigned int) y * 0xC2B2AE35u)), MultiplyLow32(x, _mm_set1_epi32((int) 0x85EBCA6Bu)));
+	hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 16));
+	hash = MultiplyLow32(hash, _mm_set1_epi32((int) 0x7FEB352Du));
+	hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 15));
+	hash = MultiplyLow32(hash, _mm_set1_epi32((int) 0x846CA68Bu));
+	return _mm_xor_si128(hash, _mm_srli_epi32(hash, 16));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		Fade
+//	Purpose:	Perlin's smootherstep curve 6t^5 - 15t^4 + 10t^3
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline float Fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		Fade4
+//	Purpose:	Fade of four values, in the same operation order so every lane matches the scalar curve
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128 Fade4(__m128 t)
+{
+	__m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+	return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LoadLattice
+//	Purpose:	Loads the lattice values of four pixels, cells[i] + offset is the column of pixel i
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128 LoadLattice(const float* lattice, const int* cells, int offset)
+{
+	return _mm_setr_ps(lattice[cells[0] + offset], lattice[cells[1] + offset], lattice[cells[2] + offset], lattice[cells[3] + offset]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildPalette
+//	Purpose:	Interpolates the color stops into a 256 entry palette
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void BuildPalette(BYTE palette[256][3], const PaletteStop* stops, int stopCount)
+{
+	int stop = 0;
+	for (int i = 0; i < 256; ++i)
+	{
+		float position = i / 255.0f;
+		while (stop < stopCount - 2 && position > stops[stop + 1].position) ++stop;
+
+		const PaletteStop& from = stops[stop];
+		const PaletteStop& to = stops[stop + 1];
+		float span = to.position - from.position;
+		float t = (span > 0.0f) ? (position - from.position) / span : 0.0f;
+		if (t < 0.0f) t = 0.0f;
+		if (t > 1.0f) t = 1.0f;
+
+		palette[i][0] = (BYTE) (from.red + (to.red - from.red) * t + 0.5f);
+		palette[i][1] = (BYTE) (from.green + (to.green - from.green) * t + 0.5f);
+		palette[i][2] = (BYTE) (from.blue + (to.blue - from.blue) * t + 0.5f);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PackIntensity
+//	Purpose:	Rounds and saturates a row of float intensities to bytes, 16 pixels per iteration
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void PackIntensity(const float* values, BYTE* intensity, int count)
+{
+	int x = 0;
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i a = _mm_cvtps_epi32(_mm_loadu_ps(values + x + 0));
+		__m128i b = _mm_cvtps_epi32(_mm_loadu_ps(values + x + 4));
+		__m128i c = _mm_cvtps_epi32(_mm_loadu_ps(values + x + 8));
+		__m128i d = _mm_cvtps_epi32(_mm_loadu_ps(values + x + 12));
+
+		// the saturating packs clamp to [0, 255] for free
+		_mm_storeu_si128((__m128i*) (intensity + x), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+
+	// the tail rounds with the same conversion, to nearest even, so a pixel doesn't change with its column
+	for (; x < count; ++x)
+	{
+		int value = _mm_cvtss_si32(_mm_set_ss(values[x]));
+		intensity[x] = (value <= 0) ? 0 : (value >= 255) ? 255 : (BYTE) value;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LinearGradientRow
+//	Purpose:	Intensity = position along the gradient direction, scaled so the image corners map to 0 and 255
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void LinearGradientRow(const GeneratorState* state, int y, float* values)
+{
+	float directionX = (float) ::cos(state->options->angle * 3.14159265358979 / 180.0);
+	float directionY = (float) ::sin(state->options->angle * 3.14159265358979 / 180.0);
+
+	// project the four corners to find the range of the gradient
+	float right = (float) (state->pixelWidth - 1);
+	float bottom = (float) (state->pixelHeight - 1);
+	float corners[4] = { 0.0f, right * directionX, bottom * directionY, right * directionX + bottom * directionY };
+	float low = corners[0];
+	float high = corners[0];
+	for (int i = 1; i < 4; ++i)
+	{
+		if (corners[i] < low) low = corners[i];
+		if (corners[i] > high) high = corners[i];
+	}
+
+	float scale = (high > low) ? 255.0f / (high - low) : 0.0f;
+
+	// value = x * stepX + rowBase
+	__m128 stepX = _mm_set1_ps(directionX * scale);
+	__m128 rowBase = _mm_set1_ps((y * directionY - low) * scale);
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i four = _mm_set1_epi32(4);
+
+	int x = 0;
+	for (; x + 4 <= state->pixelWidth; x += 4)
+	{
+		_mm_storeu_ps(values + x, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(index), stepX), rowBase));
+		index = _mm_add_epi32(index, four);
+	}
+
+	for (; x < state->pixelWidth; ++x)
+	{
+		values[x] = (x * directionX + y * directionY - low) * scale;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RadialGradientRow
+//	Purpose:	Intensity = distance from the image center, scaled so the corners map to 255
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void RadialGradientRow(const GeneratorState* state, int y, float* values)
+{
+	float centerX = (state->pixelWidth - 1) * 0.5f;
+	float centerY = (state->pixelHeight - 1) * 0.5f;
+	float radius = ::sqrtf(centerX * centerX + centerY * centerY);
+	float scale = (radius > 0.0f) ? 255.0f / radius : 0.0f;
+
+	float offsetY = y - centerY;
+	__m128 offsetY2 = _mm_set1_ps(offsetY * offsetY);
+	__m128 center = _mm_set1_ps(centerX);
+	__m128 scale4 = _mm_set1_ps(scale);
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i four = _mm_set1_epi32(4);
+
+	int x = 0;
+	for (; x + 4 <= state->pixelWidth; x += 4)
+	{
+		__m128 offsetX = _mm_sub_ps(_mm_cvtepi32_ps(index), center);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(offsetX, offsetX), offsetY2));
+		_mm_storeu_ps(values + x, _mm_mul_ps(distance, scale4));
+		index = _mm_add_epi32(index, four);
+	}
+
+	for (; x < state->pixelWidth; ++x)
+	{
+		float offsetX = x - centerX;
+		values[x] = ::sqrtf(offsetX * offsetX + offsetY * offsetY) * scale;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckerboardRow
+//	Purpose:	Writes alternating runs of 0 and 255 intensity directly, no float pass needed
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CheckerboardRow(const GeneratorState* state, int y, BYTE* intensity)
+{
+	int cellSize = (state->options->cellSize > 0) ? state->options->cellSize : 1;
+	int parity = (y / cellSize) & 1;
+
+	for (int x = 0; x < state->pixelWidth; x += cellSize)
+	{
+		int count = (state->pixelWidth - x < cellSize) ? state->pixelWidth - x : cellSize;
+		BYTE value = (((x / cellSize) & 1) ^ parity) ? 255 : 0;
+		::memset(intensity + x, value, count);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ValueNoiseOctave
+//	Purpose:	Adds one octave of smooth value noise (0 - 1) times amplitude to the row. The vertical interpolation
+//				is done once per lattice column so the per pixel work is a single horizontal lerp.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ValueNoiseOctave(const GeneratorState* state, GeneratorScratch* scratch, int y, float cellSize, unsigned int seed, float amplitude)
+{
+	float inverseCell = 1.0f / cellSize;
+	float fy = (y + 0.5f) * inverseCell;
+	int iy = (int) fy;
+	float ty = Fade(fy - iy);
+
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128 unit = _mm_set1_ps(1.0f / 16777216.0f);
+	__m128 ty4 = _mm_set1_ps(ty);
+
+	// vertically interpolated lattice column values
+	int columns = (int) (state->pixelWidth * inverseCell) + 2;
+	int ix = 0;
+	for (; ix + 4 <= columns; ix += 4)
+	{
+		__m128i column = _mm_add_epi32(_mm_set1_epi32(ix), lanes);
+		__m128 top = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(HashCoordinates4(column, iy, seed), 8)), unit);
+		__m128 bottom = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(HashCoordinates4(column, iy + 1, seed), 8)), unit);
+		_mm_storeu_ps(scratch->latticeA + ix, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty4)));
+	}
+
+	for (; ix < columns; ++ix)
+	{
+		float top = (HashCoordinates(ix, iy, seed) >> 8) * (1.0f / 16777216.0f);
+		float bottom = (HashCoordinates(ix, iy + 1, seed) >> 8) * (1.0f / 16777216.0f);
+		scratch->latticeA[ix] = top + (bottom - top) * ty;
+	}
+
+	__m128 inverseCell4 = _mm_set1_ps(inverseCell);
+	__m128 amplitude4 = _mm_set1_ps(amplitude);
+	int x = 0;
+	for (; x + 4 <= state->pixelWidth; x += 4)
+	{
+		__m128 fx = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), lanes)), _mm_set1_ps(0.5f)), inverseCell4);
+		__m128i cell = _mm_cvttps_epi32(fx);
+		int cells[4];
+		_mm_storeu_si128((__m128i*) cells, cell);
+
+		__m128 left = LoadLattice(scratch->latticeA, cells, 0);
+		__m128 right = LoadLattice(scratch->latticeA, cells, 1);
+		__m128 noise = _mm_add_ps(left, _mm_mul_ps(_mm_sub_ps(right, left), Fade4(_mm_sub_ps(fx, _mm_cvtepi32_ps(cell)))));
+		_mm_storeu_ps(scratch->values + x, _mm_add_ps(_mm_loadu_ps(scratch->values + x), _mm_mul_ps(noise, amplitude4)));
+	}
+
+	for (; x < state->pixelWidth; ++x)
+	{
+		float fx = (x + 0.5f) * inverseCell;
+		int ix = (int) fx;
+		float left = scratch->latticeA[ix];
+		float right = scratch->latticeA[ix + 1];
+		scratch->values[x] += (left + (right - left) * Fade(fx - ix)) * amplitude;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PerlinNoiseOctave
+//	Purpose:	Adds one octave of gradient noise (0 - 1) times amplitude to the row. For a fixed row the blend of
+//				the top and bottom corner gradients of a lattice column is A * dx + B, so A and B are computed
+//				once per column and each pixel evaluates two multiply-adds and one lerp.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void PerlinNoiseOctave(const GeneratorState* state, GeneratorScratch* scratch, int y, float cellSize, unsigned int seed, float amplitude)
+{
+	float inverseCell = 1.0f / cellSize;
+	float fy = (y + 0.5f) * inverseCell;
+	int iy = (int) fy;
+	float dy = fy - iy;
+	float ty = Fade(dy);
+
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i gradientMask = _mm_set1_epi32(7);
+	__m128 ty4 = _mm_set1_ps(ty);
+	__m128 dy4 = _mm_set1_ps(dy);
+	__m128 dyBelow4 = _mm_set1_ps(dy - 1.0f);
+
+	int columns = (int) (state->pixelWidth * inverseCell) + 2;
+	int ix = 0;
+	for (; ix + 4 <= columns; ix += 4)
+	{
+		__m128i column = _mm_add_epi32(_mm_set1_epi32(ix), lanes);
+		int top[4];
+		int bottom[4];
+		_mm_storeu_si128((__m128i*) top, _mm_and_si128(HashCoordinates4(column, iy, seed), gradientMask));
+		_mm_storeu_si128((__m128i*) bottom, _mm_and_si128(HashCoordinates4(column, iy + 1, seed), gradientMask));
+
+		__m128 topX = LoadLattice(PerlinGradientX, top, 0);
+		__m128 bottomX = LoadLattice(PerlinGradientX, bottom, 0);
+		__m128 topB = _mm_mul_ps(LoadLattice(PerlinGradientY, top, 0), dy4);
+		__m128 bottomB = _mm_mul_ps(LoadLattice(PerlinGradientY, bottom, 0), dyBelow4);
+		_mm_storeu_ps(scratch->latticeA + ix, _mm_add_ps(topX, _mm_mul_ps(_mm_sub_ps(bottomX, topX), ty4)));
+		_mm_storeu_ps(scratch->latticeB + ix, _mm_add_ps(topB, _mm_mul_ps(_mm_sub_ps(bottomB, topB), ty4)));
+	}
+
+	for (; ix < columns; ++ix)
+	{
+		unsigned int top = HashCoordinates(ix, iy, seed) & 7;
+		unsigned int bottom = HashCoordinates(ix, iy + 1, seed) & 7;
+		scratch->latticeA[ix] = PerlinGradientX[top] + (PerlinGradientX[bottom] - PerlinGradientX[top]) * ty;
+		float topB = PerlinGradientY[top] * dy;
+		float bottomB = PerlinGradientY[bottom] * (dy - 1.0f);
+		scratch->latticeB[ix] = topB + (bottomB - topB) * ty;
+	}
+
+	// 2d gradient noise with unit gradients lies in [-0.7071, 0.7071], remap to [0, 1]
+	float remapScale = amplitude * 0.7071f;
+	float remapOffset = amplitude * 0.5f;
+
+	__m128 inverseCell4 = _mm_set1_ps(inverseCell);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 remapScale4 = _mm_set1_ps(remapScale);
+	__m128 remapOffset4 = _mm_set1_ps(remapOffset);
+	int x = 0;
+	for (; x + 4 <= state->pixelWidth; x += 4)
+	{
+		__m128 fx = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), lanes)), _mm_set1_ps(0.5f)), inverseCell4);
+		__m128i cell = _mm_cvttps_epi32(fx);
+		int cells[4];
+		_mm_storeu_si128((__m128i*) cells, cell);
+
+		__m128 dx = _mm_sub_ps(fx, _mm_cvtepi32_ps(cell));
+		__m128 left = _mm_add_ps(_mm_mul_ps(dx, LoadLattice(scratch->latticeA, cells, 0)), LoadLattice(scratch->latticeB, cells, 0));
+		__m128 right = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(dx, one), LoadLattice(scratch->latticeA, cells, 1)), LoadLattice(scratch->latticeB, cells, 1));
+		__m128 noise = _mm_add_ps(left, _mm_mul_ps(_mm_sub_ps(right, left), Fade4(dx)));
+		_mm_storeu_ps(scratch->values + x, _mm_add_ps(_mm_loadu_ps(scratch->values + x), _mm_add_ps(_mm_mul_ps(noise, remapScale4), remapOffset4)));
+	}
+
+	for (; x < state->pixelWidth; ++x)
+	{
+		float fx = (x + 0.5f) * inverseCell;
+		int ix = (int) fx;
+		float dx = fx - ix;
+		float left = dx * scratch->latticeA[ix] + scratch->latticeB[ix];
+		float right = (dx - 1.0f) * scratch->latticeA[ix + 1] + scratch->latticeB[ix + 1];
+		scratch->values[x] += (left + (right - left) * Fade(dx)) * remapScale + remapOffset;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FractalNoiseRow
+//	Purpose:	Sums octaves of noise, each at half the cell size and half the amplitude of the one before
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FractalNoiseRow(const GeneratorState* state, GeneratorScratch* scratch, int y, BOOL perlin, float cellSize, int octaves)
+{
+	::memset(scratch->values, 0, state->pixelWidth * sizeof(float));
+
+	float amplitude = 1.0f;
+	float amplitudeSum = 0.0f;
+	for (int octave = 0; octave < octaves && cellSize >= 1.0f; ++octave)
+	{
+		unsigned int seed = state->options->seed + octave * 0x632BE5ABu;
+		if (perlin == TRUE) PerlinNoiseOctave(state, scratch, y, cellSize, seed, amplitude);
+		else ValueNoiseOctave(state, scratch, y, cellSize, seed, amplitude);
+
+		amplitudeSum += amplitude;
+		amplitude *= 0.5f;
+		cellSize *= 0.5f;
+	}
+
+	// normalize to [0, 255]
+	float scale = (amplitudeSum > 0.0f) ? 255.0f / amplitudeSum : 0.0f;
+	__m128 scale4 = _mm_set1_ps(scale);
+	int x = 0;
+	for (; x + 4 <= state->pixelWidth; x += 4)
+	{
+		_mm_storeu_ps(scratch->values + x, _mm_mul_ps(_mm_loadu_ps(scratch->values + x), scale4));
+	}
+
+	for (; x < state->pixelWidth; ++x)
+	{
+		scratch->values[x] *= scale;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PhotoRow
+//	Purpose:	Synthetic landscape - a vertical sky to ground ramp displaced by fractal noise, with sensor grain
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void PhotoRow(const GeneratorState* state, GeneratorScratch* scratch, int y, BYTE* target)
+{
+	int largest = (state->pixelWidth > state->pixelHeight) ? state->pixelWidth : state->pixelHeight;
+	FractalNoiseRow(state, scratch, y, TRUE, largest / 4.0f, 8);
+
+	// blend the terrain noise with the vertical position so the horizon wanders across the frame
+	float ramp = (state->pixelHeight > 1) ? 255.0f * y / (state->pixelHeight - 1) : 0.0f;
+	__m128 ramp4 = _mm_set1_ps(ramp * 0.6f);
+	__m128 weight = _mm_set1_ps(0.4f);
+	int x = 0;
+	for (; x + 4 <= state->pixelWidth; x += 4)
+	{
+		__m128 noise = _mm_loadu_ps(scratch->values + x);
+		_mm_storeu_ps(scratch->values + x, _mm_add_ps(ramp4, _mm_mul_ps(noise, weight)));
+	}
+
+	for (; x < state->pixelWidth; ++x)
+	{
+		scratch->values[x] = ramp * 0.6f + scratch->values[x] * 0.4f;
+	}
+
+	PackIntensity(scratch->values, scratch->intensity, state->pixelWidth);
+
+	// palette lookup plus +-4 of per channel grain, which keeps the image from compressing like a clean render. The
+	// grain is hashed four pixels at a time.
+	unsigned int grainSeed = state->options->seed ^ 0xA511E9B3u;
+	unsigned int grains[4] = {};
+	for (x = 0; x < state->pixelWidth; ++x)
+	{
+		if ((x & 3) == 0 && x + 4 <= state->pixelWidth) _mm_storeu_si128((__m128i*) grains, HashCoordinates4(_mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3)), y, grainSeed));
+		unsigned int grain = (x + 4 - (x & 3) <= state->pixelWidth) ? grains[x & 3] : HashCoordinates(x, y, grainSeed);
+		const BYTE* color = state->palette[scratch->intensity[x]];
+		for (int channel = 0; channel < 3; ++channel)
+		{
+			int value = color[channel] + (int) ((grain >> (channel * 8)) & 7) - 4;
+			target[channel] = (BYTE) ((value < 0) ? 0 : (value > 255) ? 255 : value);
+		}
+
+		target += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GenerateRange
+//	Purpose:	Thread callback, generates rows [begin, end) of the strip
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void GenerateRange(void* context, int begin, int end)
+{
+	GeneratorState* state = (GeneratorState*) context;
+	const GeneratorOptions* options = state->options;
+
+	// solid fill needs no scratch
+	if (options->pattern == PatternSolid)
+	{
+		PixelPipeline<FillStage> pipeline(FillStage(GetRValue(options->startColor), GetGValue(options->startColor), GetBValue(options->startColor)));
+		pipeline.Run(NULL, 0, state->pixels + begin * state->stride, state->stride, state->pixelWidth, end - begin);
+		return;
+	}
+
+	// allocate the scratch rows once per thread
+	GeneratorScratch scratch = {};
+	scratch.values = (float*) ::malloc(state->pixelWidth * sizeof(float));
+	scratch.latticeA = (float*) ::malloc((state->pixelWidth + 2) * sizeof(float));
+	scratch.latticeB = (float*) ::malloc((state->pixelWidth + 2) * sizeof(float));
+	scratch.intensity = (BYTE*) ::malloc(state->pixelWidth);
+	if (scratch.values == NULL || scratch.latticeA == NULL || scratch.latticeB == NULL || scratch.intensity == NULL)
+	{
+		::InterlockedExchange(&state->failed, TRUE);
+		free(scratch.values);
+		free(scratch.latticeA);
+		free(scratch.latticeB);
+		free(scratch.intensity);
+		return;
+	}
+
+	float cellSize = (float) ((options->cellSize > 0) ? options->cellSize : 1);
+
+	for (int row = begin; row < end; ++row)
+	{
+		int y = state->firstRow + row;
+		BYTE* target = state->pixels + row * state->stride;
+
+		switch (options->pattern)
+		{
+			case PatternCheckerboard:
+				CheckerboardRow(state, y, scratch.intensity);
+				break;
+			case PatternLinearGradient:
+				LinearGradientRow(state, y, scratch.values);
+				PackIntensity(scratch.values, scratch.intensity, state->pixelWidth);
+				break;
+			case PatternRadialGradient:
+				RadialGradientRow(state, y, scratch.values);
+				PackIntensity(scratch.values, scratch.intensity, state->pixelWidth);
+				break;
+			case PatternValueNoise:
+				FractalNoiseRow(state, &scratch, y, FALSE, cellSize, options->octaves);
+				PackIntensity(scratch.values, scratch.intensity, state->pixelWidth);
+				break;
+			case PatternPerlinNoise:
+				FractalNoiseRow(state, &scratch, y, TRUE, cellSize, options->octaves);
+				PackIntensity(scratch.values, scratch.intensity, state->pixelWidth);
+				break;
+			case PatternPhoto:
+				PhotoRow(state, &scratch, y, target);
+				continue;
+			default:
+				::memset(scratch.intensity, 0, state->pixelWidth);
+				break;
+		}
+
+		// map intensities through the palette
+		for (int x = 0; x < state->pixelWidth; ++x)
+		{
+			const BYTE* color = state->palette[scratch.intensity[x]];
+			target[0] = color[0];
+			target[1] = color[1];
+			target[2] = color[2];
+			target += 3;
+		}
+	}
+
+	// free heap memory
+	free(scratch.values);
+	free(scratch.latticeA);
+	free(scratch.latticeB);
+	free(scratch.intensity);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InitGeneratorOptions
+//	Purpose:	Sets the default options for a pattern
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitGeneratorOptions(GeneratorOptions* options, GeneratorPattern pattern)
+{
+	if (options == NULL) return;
+
+	options->pattern = pattern;
+	options->startColor = RGB(0, 0, 0);
+	options->endColor = RGB(255, 255, 255);
+	options->cellSize = (pattern == PatternCheckerboard) ? 32 : 256;
+	options->octaves = (pattern == PatternValueNoise) ? 1 : 5;
+	options->angle = 45.0;
+	options->seed = 0;
+	options->storeMetadata = FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseGeneratorPattern
+//	Purpose:	Converts a command line pattern name
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseGeneratorPattern(const char* name, GeneratorPattern* pattern)
+{
+	if (name == NULL || pattern == NULL) return FALSE;
+
+	static const struct { const char* name; GeneratorPattern pattern; } patterns[] =
+	{
+		{ "solid", PatternSolid },
+		{ "checker", PatternCheckerboard },
+		{ "linear", PatternLinearGradient },
+		{ "radial", PatternRadialGradient },
+		{ "value", PatternValueNoise },
+		{ "perlin", PatternPerlinNoise },
+		{ "photo", PatternPhoto },
+	};
+
+	for (int i = 0; i < (int) (sizeof(patterns) / sizeof(patterns[0])); ++i)
+	{
+		if (::_stricmp(name, patterns[i].name) == 0)
+		{
+			*pattern = patterns[i].pattern;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GenerateRows
+//	Purpose:	Generates rows [firstRow, firstRow + rowCount) of the image into pixels, split across all processors
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GenerateRows(const GeneratorOptions* options, unsigned short pixelWidth, unsigned short pixelHeight, int firstRow, int rowCount, BYTE* pixels, ptrdiff_t stride)
+{
+	// validate parameters
+	if (options == NULL || pixels == NULL)
+	{
+		printf("Invalid parameter Options or Pixels NULL.\n");
+		return FALSE;
+	}
+
+	GeneratorState* state = (GeneratorState*) ::malloc(sizeof(GeneratorState));
+	if (state == NULL)
+	{
+		printf("Out of memory.\n");
+		return FALSE;
+	}
+
+	state->options = options;
+	state->pixelWidth = pixelWidth;
+	state->pixelHeight = pixelHeight;
+	state->firstRow = firstRow;
+	state->pixels = pixels;
+	state->stride = stride;
+	state->failed = FALSE;
+
+	// the photo pattern has its own palette, everything else ramps from the start to the end color
+	if (options->pattern == PatternPhoto)
+	{
+		BuildPalette(state->palette, PhotoPalette, (int) (sizeof(PhotoPalette) / sizeof(PhotoPalette[0])));
+	}
+	else
+	{
+		PaletteStop stops[2] =
+		{
+			{ 0.0f, GetRValue(options->startColor), GetGValue(options->startColor), GetBValue(options->startColor) },
+			{ 1.0f, GetRValue(options->endColor), GetGValue(options->endColor), GetBValue(options->endColor) },
+		};
+		BuildPalette(state->palette, stops, 2);
+	}
+
+	ParallelFor(rowCount, GenerateRange, state);
+
+	BOOL result = (state->failed == FALSE) ? TRUE : FALSE;
+	if (result == FALSE) printf("Failed to allocate generator scratch memory.\n");
+
+	free(state);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GenerateImage
+//	Purpose:	Generates a BIF image file strip by strip, memory use doesn't depend on the image size
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GenerateImage(const char* filePath, const GeneratorOptions* options, unsigned short pixelWidth, unsigned short pixelHeight)
+{
+	// validate parameters
+	if (filePath == NULL || options == NULL)
+	{
+		printf("Invalid parameter FilePath or Options NULL.\n");
+		return FALSE;
+	}
+
+	// allocate one strip of rows
+	int stripRowCount = GetStripRowCount(pixelWidth, pixelHeight);
+	ptrdiff_t stride = pixelWidth * ImageColorChannels;
+	BYTE* strip = (BYTE*) ::malloc(stripRowCount * stride);
+	if (strip == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		return FALSE;
+	}
+
+	BifWriter writer = {};
+	if (OpenEncodedImageWriter(&writer, filePath, pixelWidth, pixelHeight, options->startColor, EncodingRaw, FilterNone, options->storeMetadata) == FALSE)
+	{
+		free(strip);
+		return FALSE;
+	}
+
+	// a solid strip is the same for every strip so it's only generated once
+	BOOL generated = FALSE;
+
+	for (int y = 0; y < pixelHeight; y += stripRowCount)
+	{
+		int rowCount = (pixelHeight - y < stripRowCount) ? pixelHeight - y : stripRowCount;
+
+		if (generated == FALSE && GenerateRows(options, pixelWidth, pixelHeight, y, rowCount, strip, stride) == FALSE)
+		{
+			AbortImageWriter(&writer);
+			free(strip);
+			return FALSE;
+		}
+
+		generated = (options->pattern == PatternSolid) ? TRUE : FALSE;
+
+		if (WriteImageRows(&writer, strip, stride, rowCount) == FALSE)
+		{
+			AbortImageWriter(&writer);
+			free(strip);
+			return FALSE;
+		}
+	}
+
+	// free heap memory
+	free(strip);
+
+	return CloseImageWriter(&writer);
+}
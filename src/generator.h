@@ -0,0 +1,81 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file generator.h
+* \brief generator.h creates procedural test images (fills, gradients, checkerboards, noise, synthetic photos)
+* Example (optional):
+* \code
+* GeneratorOptions options = {};
+* InitGeneratorOptions(&options, PatternPerlinNoise);
+* options.seed = 42;
+* GenerateImage("c:\\images\\noise.bif", &options, 8192, 8192);
+* \endcode
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+// procedural patterns, listed roughly from most to least compressible
+enum GeneratorPattern
+{
+	PatternSolid = 0,
+	PatternCheckerboard,
+	PatternLinearGradient,
+	PatternRadialGradient,
+	PatternValueNoise,
+	PatternPerlinNoise,
+	PatternPhoto,
+};
+
+// generator parameters, every pixel is a pure function of these and its coordinates so output is deterministic per seed
+struct GeneratorOptions
+{
+	GeneratorPattern pattern;
+	COLORREF startColor;	// solid color, gradient start, even checker cells, low noise values
+	COLORREF endColor;		// gradient end, odd checker cells, high noise values
+	int cellSize;			// checker cell size or noise lattice spacing in pixels
+	int octaves;			// number of noise octaves summed (fractal noise)
+	double angle;			// linear gradient direction in degrees
+	unsigned int seed;
+	BOOL storeMetadata;		// version 102 with statistics and hash, otherwise a plain version 100 file
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InitGeneratorOptions
+//	Purpose:	Sets the default options for a pattern
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitGeneratorOptions(GeneratorOptions* options, GeneratorPattern pattern);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseGeneratorPattern
+//	Purpose:	Converts a command line pattern name (solid, checker, linear, radial, value, perlin, photo)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseGeneratorPattern(const char* name, GeneratorPattern* pattern);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GenerateRows
+//	Purpose:	Generates rows [firstRow, firstRow + rowCount) of the image into pixels, split across all processors
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GenerateRows(const GeneratorOptions* options, unsigned short pixelWidth, unsigned short pixelHeight, int firstRow, int rowCount, BYTE* pixels, ptrdiff_t stride);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GenerateImage
+//	Purpose:	Generates a BIF image file strip by strip, memory use doesn't depend on the image size
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GenerateImage(const char* filePath, const GeneratorOptions* options, unsigned short pixelWidth, unsigned short pixelHeight);
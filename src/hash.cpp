@@ -0,0 +1,1012 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file hash.cpp
+* \brief hash.cpp implements the perceptual hash and the multi-index hash table used to find near duplicates
+* \author Blake Hamilton
+*
+* The hash is the sign of the 64 lowest non constant DCT frequencies of a 32 x 32 mean luma grid against their
+* median. The grid is built in one pass over the rows: rows are summed per byte column with SSE2 until a grid
+* row is complete, only then are the columns reduced to cells. Luma is linear in rgb so it is taken from the
+* cell means instead of from every pixel.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "hash.h"
+#include "image.h"
+#include "parallel.h"
+
+// consts
+const int HashIndexKeyCount = 1 << HashIndexKeyBits;
+const int HashMatchBlock = 1024;				// matches collected per query before a larger buffer is needed
+const double HashPi = 3.14159265358979323846;
+
+// state shared by the threads finding the duplicate pairs
+struct DuplicateState
+{
+	const HashIndex* index;
+	int maxDistance;
+	DWORD* pairs;								// two distinct hashes per pair
+	size_t pairCount;
+	size_t pairCapacity;
+	BOOL failed;
+	CRITICAL_SECTION lock;
+};
+
+// pairs found by one thread
+struct PairBuffer
+{
+	DWORD* pairs;								// two distinct hashes per pair
+	size_t pairCount;
+	size_t pairCapacity;
+	BOOL failed;
+};
+
+// a hash and its id, sorted to find the identical hashes
+struct HashEntry
+{
+	unsigned __int64 hash;
+	DWORD id;
+};
+
+// hash pass over a file
+struct HashSinkContext
+{
+	HashAccumulator* accumulator;
+};
+
+// state shared by the threads hashing a list of files
+struct HashFilesState
+{
+	const char* const* filePaths;
+	unsigned __int64* hashes;
+	BOOL* hashed;
+	volatile LONG headerCount;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetCellBegin
+//	Purpose:	Returns the first pixel of a grid cell along a dimension of size pixels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int GetCellBegin(int cell, int size)
+{
+	return (int) ((__int64) cell * size / HashGridSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetCellEnd
+//	Purpose:	Returns the pixel after a grid cell, cells of images smaller than the grid share pixels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int GetCellEnd(int cell, int size)
+{
+	int begin = GetCellBegin(cell, size);
+	int end = GetCellBegin(cell + 1, size);
+
+	return (end > begin) ? end : begin + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InitHashAccumulator
+//	Purpose:	Prepares an accumulator for an image of the given size
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InitHashAccumulator(HashAccumulator* accumulator, int pixelWidth, int pixelHeight)
+{
+	if (accumulator == NULL) return FALSE;
+
+	::memset(accumulator, 0, sizeof(HashAccumulator));
+	accumulator->pixelWidth = pixelWidth;
+	accumulator->pixelHeight = pixelHeight;
+	if (pixelWidth <= 0 || pixelHeight <= 0) return TRUE;
+
+	accumulator->columnSums = (DWORD*) ::calloc((size_t) pixelWidth * ImageColorChannels, sizeof(DWORD));
+	if (accumulator->columnSums == NULL)
+	{
+		printf("Failed to allocate hash column sums.\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AddRowToColumns
+//	Purpose:	Adds the bytes of a row to the column sums, 16 at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AddRowToColumns(DWORD* columnSums, const BYTE* row, int byteCount)
+{
+	__m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 16 <= byteCount; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*) (row + i));
+		__m128i low = _mm_unpacklo_epi8(bytes, zero);
+		__m128i high = _mm_unpackhi_epi8(bytes, zero);
+		__m128i* sums = (__m128i*) (columnSums + i);
+		_mm_storeu_si128(sums + 0, _mm_add_epi32(_mm_loadu_si128(sums + 0), _mm_unpacklo_epi16(low, zero)));
+		_mm_storeu_si128(sums + 1, _mm_add_epi32(_mm_loadu_si128(sums + 1), _mm_unpackhi_epi16(low, zero)));
+		_mm_storeu_si128(sums + 2, _mm_add_epi32(_mm_loadu_si128(sums + 2), _mm_unpacklo_epi16(high, zero)));
+		_mm_storeu_si128(sums + 3, _mm_add_epi32(_mm_loadu_si128(sums + 3), _mm_unpackhi_epi16(high, zero)));
+	}
+
+	for (; i < byteCount; ++i)
+	{
+		columnSums[i] += row[i];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReduceBand
+//	Purpose:	Turns the column sums of a finished band of rows into grid cells and starts the next band
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ReduceBand(HashAccumulator* accumulator)
+{
+	float cells[HashGridSize];
+	for (int c = 0; c < HashGridSize; ++c)
+	{
+		int begin = GetCellBegin(c, accumulator->pixelWidth);
+		int end = GetCellEnd(c, accumulator->pixelWidth);
+		unsigned __int64 sums[ImageColorChannels] = {};
+		for (int x = begin; x < end; ++x)
+		{
+			const DWORD* pixel = accumulator->columnSums + x * ImageColorChannels;
+			sums[0] += pixel[0];
+			sums[1] += pixel[1];
+			sums[2] += pixel[2];
+		}
+
+		double pixelCount = (double) (end - begin) * accumulator->bandRows;
+		cells[c] = (float) ((0.299 * sums[0] + 0.587 * sums[1] + 0.114 * sums[2]) / pixelCount);
+	}
+
+	// images shorter than the grid fill several grid rows from one band
+	do
+	{
+		::memcpy(accumulator->grid[accumulator->cellRow], cells, sizeof(cells));
+		accumulator->cellRow++;
+	}
+	while (accumulator->cellRow < HashGridSize && GetCellEnd(accumulator->cellRow, accumulator->pixelHeight) == accumulator->rowsAdded);
+
+	::memset(accumulator->columnSums, 0, (size_t) accumulator->pixelWidth * ImageColorChannels * sizeof(DWORD));
+	accumulator->bandRows = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateHashRows
+//	Purpose:	Adds the next rowCount rgb rows of the image
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AccumulateHashRows(HashAccumulator* accumulator, const BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	if (accumulator == NULL || accumulator->columnSums == NULL || rows == NULL) return;
+
+	int byteCount = accumulator->pixelWidth * ImageColorChannels;
+	for (int y = 0; y < rowCount && accumulator->rowsAdded < accumulator->pixelHeight; ++y)
+	{
+		AddRowToColumns(accumulator->columnSums, rows + y * rowStride, byteCount);
+		accumulator->bandRows++;
+		accumulator->rowsAdded++;
+
+		if (accumulator->cellRow < HashGridSize && accumulator->rowsAdded == GetCellEnd(accumulator->cellRow, accumulator->pixelHeight)) ReduceBand(accumulator);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompareCoefficients
+//	Purpose:	qsort comparison of two doubles
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int CompareCoefficients(const void* first, const void* second)
+{
+	double a = *(const double*) first;
+	double b = *(const double*) second;
+
+	return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishHashAccumulator
+//	Purpose:	Returns the perceptual hash of the rows added and frees the accumulator
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned __int64 FinishHashAccumulator(HashAccumulator* accumulator)
+{
+	if (accumulator == NULL) return 0;
+
+	FreeHashAccumulator(accumulator);
+	if (accumulator->cellRow < HashGridSize) return 0;
+
+	// frequencies 1 to 8 of the dct, the constant one only holds the brightness
+	double cosines[HashDctSize][HashGridSize];
+	for (int u = 0; u < HashDctSize; ++u)
+	{
+		for (int x = 0; x < HashGridSize; ++x)
+		{
+			cosines[u][x] = cos((2 * x + 1) * (u + 1) * HashPi / (2 * HashGridSize));
+		}
+	}
+
+	// separable, rows first then columns
+	double rowCoefficients[HashGridSize][HashDctSize];
+	for (int y = 0; y < HashGridSize; ++y)
+	{
+		for (int u = 0; u < HashDctSize; ++u)
+		{
+			double sum = 0.0;
+			for (int x = 0; x < HashGridSize; ++x)
+			{
+				sum += cosines[u][x] * accumulator->grid[y][x];
+			}
+
+			rowCoefficients[y][u] = sum;
+		}
+	}
+
+	double coefficients[HashDctSize * HashDctSize];
+	for (int v = 0; v < HashDctSize; ++v)
+	{
+		for (int u = 0; u < HashDctSize; ++u)
+		{
+			double sum = 0.0;
+			for (int y = 0; y < HashGridSize; ++y)
+			{
+				sum += cosines[v][y] * rowCoefficients[y][u];
+			}
+
+			coefficients[v * HashDctSize + u] = sum;
+		}
+	}
+
+	double sorted[HashDctSize * HashDctSize];
+	::memcpy(sorted, coefficients, sizeof(sorted));
+	::qsort(sorted, HashDctSize * HashDctSize, sizeof(double), CompareCoefficients);
+	double median = (sorted[HashDctSize * HashDctSize / 2 - 1] + sorted[HashDctSize * HashDctSize / 2]) * 0.5;
+
+	unsigned __int64 hash = 0;
+	for (int i = 0; i < HashDctSize * HashDctSize; ++i)
+	{
+		if (coefficients[i] > median) hash |= (unsigned __int64) 1 << i;
+	}
+
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FreeHashAccumulator
+//	Purpose:	Frees an accumulator that won't be finished
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeHashAccumulator(HashAccumulator* accumulator)
+{
+	if (accumulator == NULL) return;
+
+	free(accumulator->columnSums);
+	accumulator->columnSums = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetHashDistance
+//	Purpose:	Returns the number of bits two hashes differ in
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetHashDistance(unsigned __int64 first, unsigned __int64 second)
+{
+	// bit counting in registers, popcnt isn't part of the sse2 baseline
+	unsigned __int64 bits = first ^ second;
+	bits = bits - ((bits >> 1) & 0x5555555555555555ull);
+	bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+	bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+
+	return (int) ((bits * 0x0101010101010101ull) >> 56);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateHashFileRows
+//	Purpose:	Row sink of the hash pass over a file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL AccumulateHashFileRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	HashSinkContext* sink = (HashSinkContext*) context;
+	AccumulateHashRows(sink->accumulator, rows, rowStride, rowCount);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ComputeImageHash
+//	Purpose:	Returns the perceptual hash of a BIF file, from its metadata or with a pass over its pixels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ComputeImageHash(const char* filePath, unsigned __int64* hash, BOOL* fromHeader)
+{
+	// validate parameters
+	if (filePath == NULL || hash == NULL || fromHeader == NULL)
+	{
+		printf("Invalid parameter FilePath, Hash or FromHeader NULL.\n");
+		return FALSE;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, filePath) == FALSE) return FALSE;
+
+	// files written with metadata answer from the header alone
+	if (reader.header.hasHash == TRUE)
+	{
+		*hash = reader.header.hash;
+		*fromHeader = TRUE;
+		CloseImageReader(&reader);
+		return TRUE;
+	}
+
+	*fromHeader = FALSE;
+	HashAccumulator* accumulator = (HashAccumulator*) ::malloc(sizeof(HashAccumulator));
+	if (accumulator == NULL || InitHashAccumulator(accumulator, reader.header.pixelWidth, reader.header.pixelHeight) == FALSE)
+	{
+		free(accumulator);
+		CloseImageReader(&reader);
+		return FALSE;
+	}
+
+	HashSinkContext sink = {};
+	sink.accumulator = accumulator;
+	BOOL result = DecodeImageRows(&reader, ImageStripByteSize, AccumulateHashFileRows, &sink);
+	*hash = FinishHashAccumulator(accumulator);
+	free(accumulator);
+	CloseImageReader(&reader);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashFilesRange
+//	Purpose:	ParallelFor callback, hashes the files [begin, end)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void HashFilesRange(void* context, int begin, int end)
+{
+	HashFilesState* state = (HashFilesState*) context;
+	for (int i = begin; i < end; ++i)
+	{
+		BOOL fromHeader = FALSE;
+		state->hashed[i] = ComputeImageHash(state->filePaths[i], &state->hashes[i], &fromHeader);
+		if (state->hashed[i] == TRUE && fromHeader == TRUE) ::InterlockedIncrement(&state->headerCount);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashImageFiles
+//	Purpose:	Computes the hashes of fileCount BIF files in parallel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL HashImageFiles(const char* const* filePaths, int fileCount, unsigned __int64* hashes, BOOL* hashed, int* headerCount)
+{
+	// validate parameters
+	if (filePaths == NULL || hashes == NULL || hashed == NULL || headerCount == NULL)
+	{
+		printf("Invalid parameter FilePaths, Hashes, Hashed or HeaderCount NULL.\n");
+		return FALSE;
+	}
+
+	// files with metadata cost one header read, the others a decode that is itself parallel for lz files
+	HashFilesState state = {};
+	state.filePaths = filePaths;
+	state.hashes = hashes;
+	state.hashed = hashed;
+	ParallelFor(fileCount, HashFilesRange, &state);
+	*headerCount = (int) state.headerCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetIndexKey
+//	Purpose:	Returns the key of a hash in one of the index tables
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline DWORD GetIndexKey(unsigned __int64 hash, int table)
+{
+	return (DWORD) (hash >> (table * HashIndexKeyBits)) & (HashIndexKeyCount - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildIndexTables
+//	Purpose:	ParallelFor callback, counting sorts the distinct hashes by their key of tables [begin, end)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void BuildIndexTables(void* context, int begin, int end)
+{
+	HashIndex* index = (HashIndex*) context;
+	for (int table = begin; table < end; ++table)
+	{
+		DWORD* starts = index->bucketStarts[table];
+		DWORD* ids = index->bucketIds[table];
+		unsigned __int64* bucketHashes = index->bucketHashes[table];
+		for (int i = 0; i < index->distinctCount; ++i)
+		{
+			starts[GetIndexKey(index->hashes[i], table) + 1]++;
+		}
+
+		for (int key = 0; key < HashIndexKeyCount; ++key)
+		{
+			starts[key + 1] += starts[key];
+		}
+
+		// distinct hashes go in ascending order, the starts serve as fill cursors and end up one bucket ahead
+		for (int i = 0; i < index->distinctCount; ++i)
+		{
+			DWORD key = GetIndexKey(index->hashes[i], table);
+			bucketHashes[starts[key]] = index->hashes[i];
+			ids[starts[key]++] = (DWORD) i;
+		}
+
+		::memmove(starts + 1, starts, HashIndexKeyCount * sizeof(DWORD));
+		starts[0] = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CompareHashEntries
+//	Purpose:	qsort comparison of two hash entries, by hash and then by id
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int CompareHashEntries(const void* first, const void* second)
+{
+	const HashEntry* a = (const HashEntry*) first;
+	const HashEntry* b = (const HashEntry*) second;
+	if (a->hash != b->hash) return (a->hash < b->hash) ? -1 : 1;
+	if (a->id != b->id) return (a->id < b->id) ? -1 : 1;
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CollapseHashes
+//	Purpose:	Files the identical hashes once, fills the distinct hashes and their member ids. The entries are
+//				counting sorted by their first key, then each key is sorted by hash, so the sort stays linear for
+//				hashes that spread over the keys.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CollapseHashes(HashIndex* index, const unsigned __int64* hashes)
+{
+	int hashCount = index->hashCount;
+	HashEntry* entries = (HashEntry*) ::malloc((size_t) hashCount * sizeof(HashEntry) + 1);
+	DWORD* starts = (DWORD*) ::calloc(HashIndexKeyCount + 1, sizeof(DWORD));
+	if (entries == NULL || starts == NULL)
+	{
+		free(entries);
+		free(starts);
+		return FALSE;
+	}
+
+	for (int i = 0; i < hashCount; ++i)
+	{
+		starts[GetIndexKey(hashes[i], 0) + 1]++;
+	}
+
+	for (int key = 0; key < HashIndexKeyCount; ++key)
+	{
+		starts[key + 1] += starts[key];
+	}
+
+	for (int i = 0; i < hashCount; ++i)
+	{
+		DWORD key = GetIndexKey(hashes[i], 0);
+		entries[starts[key]].hash = hashes[i];
+		entries[starts[key]++].id = (DWORD) i;
+	}
+
+	// the cursors ended on the start of the next key
+	DWORD keyStart = 0;
+	for (int key = 0; key < HashIndexKeyCount; ++key)
+	{
+		if (starts[key] - keyStart > 1) ::qsort(entries + keyStart, starts[key] - keyStart, sizeof(HashEntry), CompareHashEntries);
+		keyStart = starts[key];
+	}
+
+	// runs of one hash become one distinct hash, their ids stay in ascending order
+	int distinctCount = 0;
+	for (int i = 0; i < hashCount; ++i)
+	{
+		if (i == 0 || entries[i].hash != entries[i - 1].hash)
+		{
+			index->hashes[distinctCount] = entries[i].hash;
+			index->memberStarts[distinctCount++] = (DWORD) i;
+		}
+
+		index->memberIds[i] = entries[i].id;
+	}
+
+	index->memberStarts[distinctCount] = (DWORD) hashCount;
+	index->distinctCount = distinctCount;
+
+	free(entries);
+	free(starts);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildHashIndex
+//	Purpose:	Indexes hashCount hashes, the hashes are copied
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL BuildHashIndex(HashIndex* index, const unsigned __int64* hashes, int hashCount)
+{
+	// validate parameters
+	if (index == NULL || (hashes == NULL && hashCount > 0) || hashCount < 0)
+	{
+		printf("Invalid parameter Index or Hashes NULL.\n");
+		return FALSE;
+	}
+
+	::memset(index, 0, sizeof(HashIndex));
+	index->hashCount = hashCount;
+	index->hashes = (unsigned __int64*) ::malloc((size_t) hashCount * sizeof(unsigned __int64) + 1);
+	index->memberStarts = (DWORD*) ::malloc(((size_t) hashCount + 1) * sizeof(DWORD));
+	index->memberIds = (DWORD*) ::malloc((size_t) hashCount * sizeof(DWORD) + 1);
+	BOOL allocated = (index->hashes != NULL && index->memberStarts != NULL && index->memberIds != NULL) ? TRUE : FALSE;
+	if (allocated == TRUE) allocated = CollapseHashes(index, hashes);
+
+	// the tables only file the distinct hashes
+	for (int table = 0; table < HashIndexTables && allocated == TRUE; ++table)
+	{
+		index->bucketStarts[table] = (DWORD*) ::calloc(HashIndexKeyCount + 1, sizeof(DWORD));
+		index->bucketIds[table] = (DWORD*) ::malloc((size_t) index->distinctCount * sizeof(DWORD) + 1);
+		index->bucketHashes[table] = (unsigned __int64*) ::malloc((size_t) index->distinctCount * sizeof(unsigned __int64) + 1);
+		if (index->bucketStarts[table] == NULL || index->bucketIds[table] == NULL || index->bucketHashes[table] == NULL) allocated = FALSE;
+	}
+
+	if (allocated == FALSE)
+	{
+		printf("Failed to allocate hash index of %d hashes.\n", hashCount);
+		FreeHashIndex(index);
+		return FALSE;
+	}
+
+	// one thread per table
+	ParallelFor(HashIndexTables, BuildIndexTables, index);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ProbeBucket
+//	Purpose:	Adds the ids of the hashes filed under key in table that are within maxDistance of hash and
+//				weren't found in an earlier table
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ProbeBucket(const HashIndex* index, int table, DWORD key, unsigned __int64 hash, int maxDistance, DWORD* matches, int maxMatches, int* matchCount)
+{
+	int keyDistance = maxDistance / HashIndexTables;
+	const DWORD* ids = index->bucketIds[table];
+	const unsigned __int64* bucketHashes = index->bucketHashes[table];
+	for (DWORD i = index->bucketStarts[table][key]; i < index->bucketStarts[table][key + 1]; ++i)
+	{
+		unsigned __int64 candidate = bucketHashes[i];
+		if (GetHashDistance(hash, candidate) > maxDistance) continue;
+
+		// an earlier table whose key is close enough has already found it
+		BOOL found = FALSE;
+		for (int earlier = 0; earlier < table && found == FALSE; ++earlier)
+		{
+			if (GetHashDistance(GetIndexKey(hash, earlier), GetIndexKey(candidate, earlier)) <= keyDistance) found = TRUE;
+		}
+
+		if (found == TRUE) continue;
+
+		// every id of the distinct hash matches
+		for (DWORD m = index->memberStarts[ids[i]]; m < index->memberStarts[ids[i] + 1]; ++m)
+		{
+			if (*matchCount < maxMatches) matches[*matchCount] = index->memberIds[m];
+			(*matchCount)++;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindHashMatches
+//	Purpose:	Stores the ids of the indexed hashes within maxDistance of hash in matches
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FindHashMatches(const HashIndex* index, unsigned __int64 hash, int maxDistance, DWORD* matches, int maxMatches)
+{
+	if (index == NULL || index->hashes == NULL || (matches == NULL && maxMatches > 0)) return 0;
+
+	if (maxDistance < 0) maxDistance = 0;
+	if (maxDistance > HashMaxDistance) maxDistance = HashMaxDistance;
+
+	// a match is at most maxDistance / 4 bits away in at least one table, probe every key that close
+	int keyDistance = maxDistance / HashIndexTables;
+	int matchCount = 0;
+	for (int table = 0; table < HashIndexTables; ++table)
+	{
+		DWORD key = GetIndexKey(hash, table);
+		ProbeBucket(index, table, key, hash, maxDistance, matches, maxMatches, &matchCount);
+		if (keyDistance < 1) continue;
+
+		for (int first = 0; first < HashIndexKeyBits; ++first)
+		{
+			DWORD firstKey = key ^ (1u << first);
+			ProbeBucket(index, table, firstKey, hash, maxDistance, matches, maxMatches, &matchCount);
+			if (keyDistance < 2) continue;
+
+			for (int second = first + 1; second < HashIndexKeyBits; ++second)
+			{
+				ProbeBucket(index, table, firstKey ^ (1u << second), hash, maxDistance, matches, maxMatches, &matchCount);
+			}
+		}
+	}
+
+	return matchCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AddPair
+//	Purpose:	Appends a pair of distinct hashes to the pairs of one thread
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AddPair(PairBuffer* buffer, DWORD first, DWORD second)
+{
+	if (buffer->failed == TRUE) return;
+
+	if (buffer->pairCount == buffer->pairCapacity)
+	{
+		size_t capacity = (buffer->pairCapacity > 0) ? buffer->pairCapacity * 2 : HashMatchBlock;
+		DWORD* grown = (DWORD*) ::realloc(buffer->pairs, capacity * 2 * sizeof(DWORD));
+		if (grown == NULL)
+		{
+			buffer->failed = TRUE;
+			return;
+		}
+
+		buffer->pairs = grown;
+		buffer->pairCapacity = capacity;
+	}
+
+	buffer->pairs[buffer->pairCount * 2 + 0] = first;
+	buffer->pairs[buffer->pairCount * 2 + 1] = second;
+	buffer->pairCount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		JoinBuckets
+//	Purpose:	Adds the pairs of distinct hashes within maxDistance between two buckets of a table, or within one
+//				bucket when the keys are the same, that no earlier table pairs up
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void JoinBuckets(const HashIndex* index, int table, DWORD key, DWORD otherKey, int maxDistance, PairBuffer* buffer)
+{
+	int keyDistance = maxDistance / HashIndexTables;
+	const DWORD* starts = index->bucketStarts[table];
+	const DWORD* ids = index->bucketIds[table];
+	const unsigned __int64* bucketHashes = index->bucketHashes[table];
+	for (DWORD i = starts[key]; i < starts[key + 1]; ++i)
+	{
+		DWORD first = (otherKey == key) ? i + 1 : starts[otherKey];
+		for (DWORD j = first; j < starts[otherKey + 1]; ++j)
+		{
+			if (GetHashDistance(bucketHashes[i], bucketHashes[j]) > maxDistance) continue;
+
+			BOOL found = FALSE;
+			for (int earlier = 0; earlier < table && found == FALSE; ++earlier)
+			{
+				if (GetHashDistance(GetIndexKey(bucketHashes[i], earlier), GetIndexKey(bucketHashes[j], earlier)) <= keyDistance) found = TRUE;
+			}
+
+			if (found == FALSE) AddPair(buffer, ids[i], ids[j]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindDuplicatePairs
+//	Purpose:	ParallelFor callback over every key of every table, joins the bucket of each key with itself and
+//				with the larger keys at most maxDistance / 4 bits away
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FindDuplicatePairs(void* context, int begin, int end)
+{
+	DuplicateState* state = (DuplicateState*) context;
+	const HashIndex* index = state->index;
+	int keyDistance = state->maxDistance / HashIndexTables;
+
+	PairBuffer buffer = {};
+	for (int item = begin; item < end && buffer.failed == FALSE; ++item)
+	{
+		int table = item / HashIndexKeyCount;
+		DWORD key = (DWORD) (item % HashIndexKeyCount);
+		if (index->bucketStarts[table][key] == index->bucketStarts[table][key + 1]) continue;
+
+		JoinBuckets(index, table, key, key, state->maxDistance, &buffer);
+		if (keyDistance < 1) continue;
+
+		for (int first = 0; first < HashIndexKeyBits; ++first)
+		{
+			DWORD firstKey = key ^ (1u << first);
+			if (firstKey > key) JoinBuckets(index, table, key, firstKey, state->maxDistance, &buffer);
+			if (keyDistance < 2) continue;
+
+			for (int second = first + 1; second < HashIndexKeyBits; ++second)
+			{
+				DWORD secondKey = firstKey ^ (1u << second);
+				if (secondKey > key) JoinBuckets(index, table, key, secondKey, state->maxDistance, &buffer);
+			}
+		}
+	}
+
+	// hand the pairs of this range over
+	::EnterCriticalSection(&state->lock);
+	BOOL failed = buffer.failed;
+	if (failed == FALSE && state->failed == FALSE && state->pairCount + buffer.pairCount > state->pairCapacity)
+	{
+		size_t capacity = (state->pairCapacity * 2 > state->pairCount + buffer.pairCount) ? state->pairCapacity * 2 : state->pairCount + buffer.pairCount;
+		DWORD* grown = (DWORD*) ::realloc(state->pairs, capacity * 2 * sizeof(DWORD));
+		if (grown == NULL) failed = TRUE;
+		else
+		{
+			state->pairs = grown;
+			state->pairCapacity = capacity;
+		}
+	}
+
+	if (failed == FALSE && state->failed == FALSE)
+	{
+		if (buffer.pairCount > 0) ::memcpy(state->pairs + state->pairCount * 2, buffer.pairs, buffer.pairCount * 2 * sizeof(DWORD));
+		state->pairCount += buffer.pairCount;
+	}
+
+	if (failed == TRUE) state->failed = TRUE;
+	::LeaveCriticalSection(&state->lock);
+
+	free(buffer.pairs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindGroup
+//	Purpose:	Returns the root of the group of id, the smallest id joined to it, halving the path on the way
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static DWORD FindGroup(DWORD* groups, DWORD id)
+{
+	while (groups[id] != id)
+	{
+		groups[id] = groups[groups[id]];
+		id = groups[id];
+	}
+
+	return id;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindDuplicateGroups
+//	Purpose:	Groups the indexed hashes that are connected by matches within maxDistance
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FindDuplicateGroups(const HashIndex* index, int maxDistance, DWORD* groups)
+{
+	// validate parameters
+	if (index == NULL || groups == NULL)
+	{
+		printf("Invalid parameter Index or Groups NULL.\n");
+		return FALSE;
+	}
+
+	if (maxDistance < 0) maxDistance = 0;
+	if (maxDistance > HashMaxDistance) maxDistance = HashMaxDistance;
+
+	DuplicateState state = {};
+	state.index = index;
+	state.maxDistance = maxDistance;
+	::InitializeCriticalSection(&state.lock);
+	ParallelFor(HashIndexTables * HashIndexKeyCount, FindDuplicatePairs, &state);
+	::DeleteCriticalSection(&state.lock);
+
+	if (state.failed == TRUE)
+	{
+		printf("Failed to allocate duplicate pairs.\n");
+		free(state.pairs);
+		return FALSE;
+	}
+
+	DWORD* distinctGroups = (DWORD*) ::malloc((size_t) index->distinctCount * 2 * sizeof(DWORD) + 1);
+	if (distinctGroups == NULL)
+	{
+		printf("Failed to allocate duplicate groups.\n");
+		free(state.pairs);
+		return FALSE;
+	}
+
+	// union find over the distinct hashes, the ids of one hash are already a group
+	DWORD* smallestIds = distinctGroups + index->distinctCount;
+	for (int d = 0; d < index->distinctCount; ++d)
+	{
+		distinctGroups[d] = (DWORD) d;
+		smallestIds[d] = MAXDWORD;
+	}
+
+	for (size_t p = 0; p < state.pairCount; ++p)
+	{
+		DWORD first = FindGroup(distinctGroups, state.pairs[p * 2 + 0]);
+		DWORD second = FindGroup(distinctGroups, state.pairs[p * 2 + 1]);
+		if (first < second) distinctGroups[second] = first;
+		else if (second < first) distinctGroups[first] = second;
+	}
+
+	// the group of an id is the smallest id of its group, the first member of a distinct hash is its smallest
+	for (int d = 0; d < index->distinctCount; ++d)
+	{
+		DWORD root = FindGroup(distinctGroups, (DWORD) d);
+		DWORD firstId = index->memberIds[index->memberStarts[d]];
+		if (firstId < smallestIds[root]) smallestIds[root] = firstId;
+	}
+
+	for (int d = 0; d < index->distinctCount; ++d)
+	{
+		DWORD smallestId = smallestIds[FindGroup(distinctGroups, (DWORD) d)];
+		for (DWORD m = index->memberStarts[d]; m < index->memberStarts[d + 1]; ++m)
+		{
+			groups[index->memberIds[m]] = smallestId;
+		}
+	}
+
+	free(distinctGroups);
+	free(state.pairs);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FreeHashIndex
+//	Purpose:	Frees the memory of an index
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeHashIndex(HashIndex* index)
+{
+	if (index == NULL) return;
+
+	free(index->hashes);
+	free(index->memberStarts);
+	free(index->memberIds);
+	for (int table = 0; table < HashIndexTables; ++table)
+	{
+		free(index->bucketStarts[table]);
+		free(index->bucketIds[table]);
+		free(index->bucketHashes[table]);
+	}
+
+	::memset(index, 0, sizeof(HashIndex));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		NextRandom
+//	Purpose:	splitmix64, the benchmark's source of random hashes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned __int64 NextRandom(unsigned __int64* state)
+{
+	unsigned __int64 value = (*state += 0x9E3779B97F4A7C15ull);
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+
+	return value ^ (value >> 31);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunHashIndexBenchmark
+//	Purpose:	Times indexing and grouping random hashes with planted near duplicates
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL RunHashIndexBenchmark(int hashCount, int maxDistance, unsigned int seed)
+{
+	// validate parameters
+	if (hashCount <= 0 || maxDistance < 0 || maxDistance > HashMaxDistance)
+	{
+		printf("Invalid parameter HashCount or MaxDistance, the distance is at most %d.\n", HashMaxDistance);
+		return FALSE;
+	}
+
+	unsigned __int64* hashes = (unsigned __int64*) ::malloc((size_t) hashCount * sizeof(unsigned __int64));
+	DWORD* originals = (DWORD*) ::malloc((size_t) hashCount * sizeof(DWORD));
+	DWORD* groups = (DWORD*) ::malloc((size_t) hashCount * sizeof(DWORD));
+	DWORD* matches = (DWORD*) ::malloc(HashMatchBlock * sizeof(DWORD));
+	if (hashes == NULL || originals == NULL || groups == NULL || matches == NULL)
+	{
+		printf("Failed to allocate %d hashes.\n", hashCount);
+		free(hashes);
+		free(originals);
+		free(groups);
+		free(matches);
+		return FALSE;
+	}
+
+	// every tenth hash is a copy of an earlier one with up to maxDistance bits flipped
+	unsigned __int64 random = seed;
+	int plantedCount = 0;
+	for (int i = 0; i < hashCount; ++i)
+	{
+		originals[i] = (DWORD) i;
+		if (i == 0 || NextRandom(&random) % 10 != 0)
+		{
+			hashes[i] = NextRandom(&random);
+			continue;
+		}
+
+		originals[i] = (DWORD) (NextRandom(&random) % i);
+		hashes[i] = hashes[originals[i]];
+		int flips = (maxDistance > 0) ? (int) (NextRandom(&random) % (maxDistance + 1)) : 0;
+		for (int f = 0; f < flips; ++f)
+		{
+			hashes[i] ^= (unsigned __int64) 1 << (NextRandom(&random) % 64);
+		}
+
+		plantedCount++;
+	}
+
+	DWORD startTime = ::GetTickCount();
+	HashIndex index = {};
+	BOOL result = BuildHashIndex(&index, hashes, hashCount);
+	DWORD buildElapsed = ::GetTickCount() - startTime;
+
+	startTime = ::GetTickCount();
+	if (result == TRUE) result = FindDuplicateGroups(&index, maxDistance, groups);
+	DWORD groupElapsed = ::GetTickCount() - startTime;
+
+	if (result == TRUE)
+	{
+		int foundCount = 0;
+		int groupCount = 0;
+		for (int i = 0; i < hashCount; ++i)
+		{
+			if (originals[i] != (DWORD) i && groups[i] == groups[originals[i]]) foundCount++;
+			if (groups[i] == (DWORD) i) groupCount++;
+		}
+
+		// a sample of queries checked against a linear scan, which also times the scan
+		int sampleCount = (hashCount < 1000) ? hashCount : 1000;
+		int mismatchCount = 0;
+		startTime = ::GetTickCount();
+		for (int s = 0; s < sampleCount; ++s)
+		{
+			unsigned __int64 query = hashes[(size_t) s * hashCount / sampleCount];
+			int scanCount = 0;
+			for (int i = 0; i < hashCount; ++i)
+			{
+				if (GetHashDistance(query, hashes[i]) <= maxDistance) scanCount++;
+			}
+
+			if (scanCount != FindHashMatches(&index, query, maxDistance, matches, HashMatchBlock)) mismatchCount++;
+		}
+
+		DWORD scanElapsed = ::GetTickCount() - startTime;
+
+		printf("Indexed %d hashes, %d distinct, in %lu ms. Grouped them within %d bits in %lu ms into %d groups.\n", hashCount, index.distinctCount, buildElapsed, maxDistance, groupElapsed, groupCount);
+		printf("Found %d of %d planted near duplicates. %d of %d sampled queries differ from a linear scan, which takes %lu ms for the sample.\n", foundCount, plantedCount, mismatchCount, sampleCount, scanElapsed);
+	}
+
+	FreeHashIndex(&index);
+	free(hashes);
+	free(originals);
+	free(groups);
+	free(matches);
+
+	return result;
+}
@@ -0,0 +1,152 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file hash.h
+* \brief hash.h computes 64 bit perceptual hashes of images and finds near duplicates by Hamming distance
+* Example (optional):
+* \code
+* HashIndex index = {};
+* BuildHashIndex(&index, hashes, hashCount);
+* FindDuplicateGroups(&index, HashDuplicateDistance, groups);
+* FreeHashIndex(&index);
+* \endcode
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+// consts
+const int HashGridSize = 32;				// the luma plane is reduced to 32 x 32 cells before the DCT
+const int HashDctSize = 8;					// 8 x 8 low frequencies, one bit each
+const int HashIndexTables = 4;				// the hash is split in 4 16 bit keys, one table each
+const int HashIndexKeyBits = 16;
+const int HashMaxDistance = 11;				// keys are probed at most 2 bits away, so 4 tables cover 11 bits
+const int HashDuplicateDistance = 6;		// default distance of near duplicates
+
+// builds the 32 x 32 mean luma grid of an image from its rows, which have to be added top to bottom
+struct HashAccumulator
+{
+	int pixelWidth;
+	int pixelHeight;
+	int rowsAdded;
+	int cellRow;							// next grid row to fill
+	int bandRows;							// rows summed in columnSums
+	DWORD* columnSums;						// per byte sum of the rows of the current grid row
+	float grid[HashGridSize][HashGridSize];
+};
+
+// multi-index hashing: every hash is filed under each of its 4 keys, a hash within distance d of a query
+// shares at least one key with it that is at most d / 4 bits away. Identical hashes are filed once, as one
+// distinct hash with a list of their ids, so a thousand copies of an image don't make a million pairs.
+struct HashIndex
+{
+	int hashCount;
+	int distinctCount;
+	unsigned __int64* hashes;				// distinct hashes
+	DWORD* memberStarts;					// ids of distinct hash d are memberIds[memberStarts[d]] up to memberIds[memberStarts[d + 1]]
+	DWORD* memberIds;						// ascending within a distinct hash
+	DWORD* bucketStarts[HashIndexTables];	// distinct hashes of key k are bucketIds[bucketStarts[k]] up to bucketIds[bucketStarts[k + 1]]
+	DWORD* bucketIds[HashIndexTables];
+	unsigned __int64* bucketHashes[HashIndexTables];	// hashes in bucket order so a probe reads one contiguous run
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InitHashAccumulator
+//	Purpose:	Prepares an accumulator for an image of the given size
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InitHashAccumulator(HashAccumulator* accumulator, int pixelWidth, int pixelHeight);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateHashRows
+//	Purpose:	Adds the next rowCount rgb rows of the image
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AccumulateHashRows(HashAccumulator* accumulator, const BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishHashAccumulator
+//	Purpose:	Returns the perceptual hash of the rows added and frees the accumulator
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned __int64 FinishHashAccumulator(HashAccumulator* accumulator);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FreeHashAccumulator
+//	Purpose:	Frees an accumulator that won't be finished
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeHashAccumulator(HashAccumulator* accumulator);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetHashDistance
+//	Purpose:	Returns the number of bits two hashes differ in
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetHashDistance(unsigned __int64 first, unsigned __int64 second);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ComputeImageHash
+//	Purpose:	Returns the perceptual hash of a BIF file, from its metadata when it has one and otherwise with a
+//				pass over its pixels. fromHeader tells which one it was.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ComputeImageHash(const char* filePath, unsigned __int64* hash, BOOL* fromHeader);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashImageFiles
+//	Purpose:	Computes the hashes of fileCount BIF files in parallel. hashed is FALSE for the files that couldn't
+//				be read, headerCount receives the number of hashes read from metadata.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL HashImageFiles(const char* const* filePaths, int fileCount, unsigned __int64* hashes, BOOL* hashed, int* headerCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildHashIndex
+//	Purpose:	Indexes hashCount hashes, the hashes are copied
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL BuildHashIndex(HashIndex* index, const unsigned __int64* hashes, int hashCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindHashMatches
+//	Purpose:	Stores the ids of the indexed hashes within maxDistance of hash in matches, up to maxMatches of
+//				them. Returns the number of matches, which can be more than maxMatches.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FindHashMatches(const HashIndex* index, unsigned __int64 hash, int maxDistance, DWORD* matches, int maxMatches);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindDuplicateGroups
+//	Purpose:	Groups the indexed hashes that are connected by matches within maxDistance. groups receives the
+//				smallest id of the group of every hash, a hash without duplicates is its own group.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FindDuplicateGroups(const HashIndex* index, int maxDistance, DWORD* groups);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FreeHashIndex
+//	Purpose:	Frees the memory of an index
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeHashIndex(HashIndex* index);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunHashIndexBenchmark
+//	Purpose:	Times indexing and grouping hashCount random hashes, a tenth of them planted near duplicates of
+//				others, and prints how many of the planted duplicates were found
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL RunHashIndexBenchmark(int hashCount, int maxDistance, unsigned int seed);
@@ -0,0 +1,1757 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file image.cpp
+* \brief image.cpp implements the streaming BIF image reader and writer
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include "bif.h"
+#include "image.h"
+#include "lz.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "simd.h"
+
+// consts
+const DWORD WriterMetadataByteSize = 4 + 8 + StatisticsPayloadByteSize + 8 + HashPayloadByteSize;	// [Metadata Byte Size] + statistics block + hash block
+
+// state shared by the threads decoding a run of chunks
+struct ChunkDecodeState
+{
+	BifReader* reader;
+	int firstChunk;
+	BYTE* rows;
+	ptrdiff_t rowStride;
+	volatile LONG failed;
+};
+
+// state shared by the threads compressing a batch of chunks
+struct ChunkEncodeState
+{
+	BifWriter* writer;
+	int compressedSlotSize;
+};
+
+// caller owned buffer that DecodeImageToBuffer copies rows into
+struct BufferSinkContext
+{
+	BYTE* target;
+	ptrdiff_t targetStride;
+	int rowByteSize;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteFileBytes
+//	Purpose:	Writes a buffer of any size, WriteFile can only take a DWORD byte count per call
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteFileBytes(HANDLE file, const void* buffer, __int64 byteSize)
+{
+	const BYTE* bytes = (const BYTE*) buffer;
+	while (byteSize > 0)
+	{
+		DWORD numberOfBytesToWrite = (byteSize > 0x40000000) ? 0x40000000 : (DWORD) byteSize;
+		DWORD numberOfBytesWritten = 0;
+		if (::WriteFile(file, bytes, numberOfBytesToWrite, &numberOfBytesWritten, NULL) == FALSE)
+		{
+			PrintOsErrorText();
+			return FALSE;
+		}
+
+		if (numberOfBytesWritten == 0)
+		{
+			printf("Failed to write file. Disk may be full.\n");
+			return FALSE;
+		}
+
+		bytes += numberOfBytesWritten;
+		byteSize -= numberOfBytesWritten;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadFileBytes
+//	Purpose:	Reads a buffer of any size, fails if the file ends first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadFileBytes(HANDLE file, void* buffer, __int64 byteSize)
+{
+	BYTE* bytes = (BYTE*) buffer;
+	while (byteSize > 0)
+	{
+		DWORD numberOfBytesToRead = (byteSize > 0x40000000) ? 0x40000000 : (DWORD) byteSize;
+		DWORD numberOfBytesRead = 0;
+		if (::ReadFile(file, bytes, numberOfBytesToRead, &numberOfBytesRead, NULL) == FALSE)
+		{
+			PrintOsErrorText();
+			return FALSE;
+		}
+
+		if (numberOfBytesRead == 0)
+		{
+			printf("Unsupported or corrupt file. Unexpected end of file.\n");
+			return FALSE;
+		}
+
+		bytes += numberOfBytesRead;
+		byteSize -= numberOfBytesRead;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		SeekFile
+//	Purpose:	Moves the file pointer to an absolute byte offset
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL SeekFile(HANDLE file, __int64 byteOffset)
+{
+	LARGE_INTEGER distance = {};
+	distance.QuadPart = byteOffset;
+	if (::SetFilePointerEx(file, distance, NULL, FILE_BEGIN) == FALSE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetStripRowCount
+//	Purpose:	Returns the number of rows that fit in ImageStripByteSize (at least one)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetStripRowCount(unsigned short pixelWidth, unsigned short pixelHeight)
+{
+	int rowByteSize = pixelWidth * ImageColorChannels;
+	int rowCount = (rowByteSize > 0) ? ImageStripByteSize / rowByteSize : pixelHeight;
+	if (rowCount < 1) rowCount = 1;
+	if (rowCount > pixelHeight) rowCount = pixelHeight;
+	return rowCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteImageHeader
+//	Purpose:	Writes the BIF file header at the current file position
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteImageHeader(HANDLE file, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor)
+{
+	// assemble the header in memory so it goes out in one write
+	BYTE header[FileHeaderByteSize] = {};
+	::memcpy(header + 0, BifFourCC, sizeof(BifFourCC));
+	::memcpy(header + 4, &FileVersion, sizeof(FileVersion));
+	::memcpy(header + 6, &pixelWidth, sizeof(pixelWidth));
+	::memcpy(header + 8, &pixelHeight, sizeof(pixelHeight));
+	::memcpy(header + 10, &fillColor, sizeof(fillColor));
+
+	return WriteFileBytes(file, header, sizeof(header));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PackStatistics
+//	Purpose:	Lays out the payload of a statistics block
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void PackStatistics(const ImageStatistics* statistics, BYTE* payload)
+{
+	unsigned short flags = (statistics->solid == TRUE) ? 1 : 0;
+	::memcpy(payload + 0, &statistics->pixelCount, sizeof(statistics->pixelCount));
+	::memcpy(payload + 8, statistics->minimum, sizeof(statistics->minimum));
+	::memcpy(payload + 11, statistics->maximum, sizeof(statistics->maximum));
+	::memcpy(payload + 14, &flags, sizeof(flags));
+	::memcpy(payload + 16, statistics->sums, sizeof(statistics->sums));
+	::memcpy(payload + 40, statistics->histogram, sizeof(statistics->histogram));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UnpackStatistics
+//	Purpose:	Reads the payload of a statistics block, the summary fields are derived again from the histograms
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL UnpackStatistics(const BYTE* payload, unsigned short pixelWidth, unsigned short pixelHeight, ImageStatistics* statistics)
+{
+	InitImageStatistics(statistics);
+	::memcpy(&statistics->pixelCount, payload + 0, sizeof(statistics->pixelCount));
+	::memcpy(statistics->histogram, payload + 40, sizeof(statistics->histogram));
+
+	// every histogram counts every pixel once
+	BOOL valid = (statistics->pixelCount == (unsigned __int64) pixelWidth * pixelHeight) ? TRUE : FALSE;
+	for (int c = 0; c < StatisticsChannels; ++c)
+	{
+		unsigned __int64 count = 0;
+		for (int v = 0; v < StatisticsLevels; ++v)
+		{
+			count += statistics->histogram[c][v];
+		}
+
+		if (count != statistics->pixelCount) valid = FALSE;
+	}
+
+	if (valid == FALSE)
+	{
+		printf("Unsupported or corrupt file. Statistics don't match the image size.\n");
+		return FALSE;
+	}
+
+	FinishImageStatistics(statistics);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadMetadata
+//	Purpose:	Reads the metadata blocks of a version 102 file, leaves the file positioned at the body
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadMetadata(HANDLE file, __int64 fileByteSize, BifHeader* header)
+{
+	DWORD metadataByteSize = 0;
+	if (fileByteSize < EncodedHeaderByteSize + sizeof(DWORD) || ReadFileBytes(file, &metadataByteSize, sizeof(metadataByteSize)) == FALSE ||
+		metadataByteSize > MetadataMaxByteSize || EncodedHeaderByteSize + sizeof(DWORD) + metadataByteSize > (unsigned __int64) fileByteSize)
+	{
+		printf("Unsupported or corrupt file. Invalid metadata size.\n");
+		return FALSE;
+	}
+
+	BYTE* metadata = (BYTE*) ::malloc(metadataByteSize + 1);
+	if (metadata == NULL)
+	{
+		printf("Failed to allocate metadata.\n");
+		return FALSE;
+	}
+
+	if (ReadFileBytes(file, metadata, metadataByteSize) == FALSE)
+	{
+		free(metadata);
+		return FALSE;
+	}
+
+	// walk the blocks, skipping the ones this reader doesn't know
+	BOOL result = TRUE;
+	DWORD offset = 0;
+	while (result == TRUE && offset + 8 <= metadataByteSize)
+	{
+		DWORD payloadByteSize = 0;
+		::memcpy(&payloadByteSize, metadata + offset + 4, sizeof(payloadByteSize));
+		if (payloadByteSize > metadataByteSize - offset - 8)
+		{
+			printf("Unsupported or corrupt file. Metadata block overruns the metadata.\n");
+			result = FALSE;
+			break;
+		}
+
+		if (::memcmp(metadata + offset, StatisticsTag, sizeof(StatisticsTag)) == 0 && payloadByteSize == StatisticsPayloadByteSize)
+		{
+			result = UnpackStatistics(metadata + offset + 8, header->pixelWidth, header->pixelHeight, &header->statistics);
+			header->hasStatistics = result;
+		}
+		else if (::memcmp(metadata + offset, HashTag, sizeof(HashTag)) == 0 && payloadByteSize == HashPayloadByteSize)
+		{
+			::memcpy(&header->hash, metadata + offset + 8, sizeof(header->hash));
+			header->hasHash = TRUE;
+		}
+
+		offset += 8 + payloadByteSize;
+	}
+
+	free(metadata);
+
+	header->bodyOffset = EncodedHeaderByteSize + sizeof(DWORD) + metadataByteSize;
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImageHeader
+//	Purpose:	Reads and validates the BIF file header, leaves the file positioned at the first pixel row
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImageHeader(HANDLE file, BifHeader* header)
+{
+	// validate parameters
+	if (header == NULL)
+	{
+		printf("Invalid parameter Header NULL.\n");
+		return FALSE;
+	}
+
+	// get file byte size
+	LARGE_INTEGER fileByteSize = {};
+	if (::GetFileSizeEx(file, &fileByteSize) == FALSE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	// validate mimimum file size, which in our case is the size of the header
+	if (fileByteSize.QuadPart < FileHeaderByteSize)
+	{
+		printf("Unsupported or corrupt file. File header must be %lu bytes.\n", FileHeaderByteSize);
+		return FALSE;
+	}
+
+	// read the whole header at once
+	BYTE bytes[FileHeaderByteSize] = {};
+	if (ReadFileBytes(file, bytes, sizeof(bytes)) == FALSE) return FALSE;
+
+	// validate its a BIF file by comparing 4 bytes of raw memory
+	if (::memcmp(bytes, BifFourCC, sizeof(BifFourCC)) != 0)
+	{
+		printf("Unsupported file type. File doesn't start with correct 4 bytes.\n");
+		return FALSE;
+	}
+
+	::memcpy(&header->fileVersion, bytes + 4, sizeof(header->fileVersion));
+	::memcpy(&header->pixelWidth, bytes + 6, sizeof(header->pixelWidth));
+	::memcpy(&header->pixelHeight, bytes + 8, sizeof(header->pixelHeight));
+	::memcpy(&header->fillColor, bytes + 10, sizeof(header->fillColor));
+
+	// every row size and strip size below divides by the width
+	if (header->pixelWidth == 0 || header->pixelHeight == 0)
+	{
+		printf("Unsupported or corrupt file. Image size %u x %u is empty.\n", header->pixelWidth, header->pixelHeight);
+		return FALSE;
+	}
+
+	// validate correct file version for this reader
+	if (header->fileVersion != FileVersion && header->fileVersion != EncodedFileVersion && header->fileVersion != MetadataFileVersion && header->fileVersion != AlphaFileVersion)
+	{
+		printf("Unsupported file version. This reader only supports versions %u, %u, %u and %u.\n", FileVersion, EncodedFileVersion, MetadataFileVersion, AlphaFileVersion);
+		return FALSE;
+	}
+
+	header->encoding = EncodingRaw;
+	header->filter = FilterNone;
+	header->chunkRows = 0;
+	header->chunkCount = 0;
+	header->bodyOffset = FileHeaderByteSize;
+	header->hasStatistics = FALSE;
+	header->hasHash = FALSE;
+	header->channelCount = (header->fileVersion == AlphaFileVersion) ? ImageAlphaChannels : ImageColorChannels;
+
+	// encoded files carry the encoding fields, their chunk table is validated by OpenImageReader
+	if (header->fileVersion != FileVersion)
+	{
+		BYTE encodingBytes[EncodedHeaderByteSize - FileHeaderByteSize] = {};
+		if (fileByteSize.QuadPart < EncodedHeaderByteSize || ReadFileBytes(file, encodingBytes, sizeof(encodingBytes)) == FALSE)
+		{
+			printf("Unsupported or corrupt file. File header must be %lu bytes.\n", EncodedHeaderByteSize);
+			return FALSE;
+		}
+
+		::memcpy(&header->encoding, encodingBytes + 0, sizeof(header->encoding));
+		::memcpy(&header->filter, encodingBytes + 2, sizeof(header->filter));
+		::memcpy(&header->chunkRows, encodingBytes + 4, sizeof(header->chunkRows));
+		::memcpy(&header->chunkCount, encodingBytes + 8, sizeof(header->chunkCount));
+		header->bodyOffset = EncodedHeaderByteSize;
+
+		// metadata blocks sit between the header and the body
+		if (header->fileVersion == MetadataFileVersion && ReadMetadata(file, fileByteSize.QuadPart, header) == FALSE) return FALSE;
+
+		if (header->encoding == EncodingLz)
+		{
+			__int64 chunkByteSize = (__int64) header->chunkRows * header->pixelWidth * header->channelCount;
+			if (header->filter > FilterDelta || header->chunkRows == 0 || chunkByteSize > 64 * ImageChunkByteSize ||
+				header->chunkCount != (header->pixelHeight + header->chunkRows - 1) / header->chunkRows)
+			{
+				printf("Unsupported or corrupt file. Unknown filter %u or chunk layout.\n", header->filter);
+				return FALSE;
+			}
+
+			return TRUE;
+		}
+
+		// raw bodies only come with metadata or alpha, a solid body needs the statistics that hold its color
+		BOOL raw = (header->encoding == EncodingRaw && (header->fileVersion == MetadataFileVersion || header->fileVersion == AlphaFileVersion)) ? TRUE : FALSE;
+		BOOL solid = (header->encoding == EncodingSolid && header->fileVersion == MetadataFileVersion && header->hasStatistics == TRUE && header->statistics.solid == TRUE) ? TRUE : FALSE;
+		if (raw == FALSE && solid == FALSE)
+		{
+			printf("Unsupported or corrupt file. Unknown encoding %u.\n", header->encoding);
+			return FALSE;
+		}
+
+		if (header->encoding == EncodingSolid) return TRUE;
+	}
+
+	// validate file size matches what we want to read out
+	__int64 pixelBufferSize = (__int64) header->pixelWidth * header->pixelHeight * header->channelCount;
+	if (header->bodyOffset + pixelBufferSize > fileByteSize.QuadPart)
+	{
+		printf("Unsupported or corrupt file. File size must be at least %I64d bytes.\n", header->bodyOffset + pixelBufferSize);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetChunkRowCount
+//	Purpose:	Returns the number of rows in a chunk, the last chunk may be short
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int GetChunkRowCount(int chunkRows, int pixelHeight, int chunkIndex)
+{
+	int rowCount = pixelHeight - chunkIndex * chunkRows;
+	return (rowCount < chunkRows) ? rowCount : chunkRows;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LoadChunkTable
+//	Purpose:	Reads the chunk sizes of an encoded file into file offsets
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL LoadChunkTable(BifReader* reader)
+{
+	DWORD chunkCount = reader->header.chunkCount;
+	DWORD* chunkSizes = (DWORD*) ::malloc(chunkCount * sizeof(DWORD) + 1);
+	reader->chunkOffsets = (__int64*) ::malloc((chunkCount + 1) * sizeof(__int64));
+	if (chunkSizes == NULL || reader->chunkOffsets == NULL)
+	{
+		printf("Failed to allocate chunk table.\n");
+		free(chunkSizes);
+		return FALSE;
+	}
+
+	if (ReadFileBytes(reader->file, chunkSizes, (__int64) chunkCount * sizeof(DWORD)) == FALSE)
+	{
+		free(chunkSizes);
+		return FALSE;
+	}
+
+	LARGE_INTEGER fileByteSize = {};
+	if (::GetFileSizeEx(reader->file, &fileByteSize) == FALSE)
+	{
+		PrintOsErrorText();
+		free(chunkSizes);
+		return FALSE;
+	}
+
+	// chunks follow the table back to back
+	reader->chunkOffsets[0] = reader->header.bodyOffset + (__int64) chunkCount * sizeof(DWORD);
+	for (DWORD i = 0; i < chunkCount; ++i)
+	{
+		int rawByteSize = GetChunkRowCount(reader->header.chunkRows, reader->header.pixelHeight, i) * reader->fileRowByteSize;
+		if (chunkSizes[i] == 0 || chunkSizes[i] > (DWORD) rawByteSize)
+		{
+			printf("Unsupported or corrupt file. Chunk %lu has an invalid size.\n", i);
+			free(chunkSizes);
+			return FALSE;
+		}
+
+		reader->chunkOffsets[i + 1] = reader->chunkOffsets[i] + chunkSizes[i];
+	}
+
+	free(chunkSizes);
+
+	if (reader->chunkOffsets[chunkCount] > fileByteSize.QuadPart)
+	{
+		printf("Unsupported or corrupt file. File size must be at least %I64d bytes.\n", reader->chunkOffsets[chunkCount]);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeChunk
+//	Purpose:	Decompresses and unfilters one chunk into rows that are rowStride bytes apart
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL DecodeChunk(BifReader* reader, int chunkIndex, const BYTE* compressed, BYTE* rows, ptrdiff_t rowStride, BYTE* scratch)
+{
+	int rowByteSize = reader->fileRowByteSize;
+	int rowCount = GetChunkRowCount(reader->header.chunkRows, reader->header.pixelHeight, chunkIndex);
+	int rawByteSize = rowCount * rowByteSize;
+	int compressedByteSize = (int) (reader->chunkOffsets[chunkIndex + 1] - reader->chunkOffsets[chunkIndex]);
+
+	// chunks that didn't get smaller are stored as is
+	const BYTE* pixels = compressed;
+	if (compressedByteSize != rawByteSize)
+	{
+		// unfiltered tightly packed rows decompress straight into place
+		BYTE* target = (reader->header.filter == FilterNone && rowStride == rowByteSize) ? rows : scratch;
+		if (LzDecompress(compressed, compressedByteSize, target, rawByteSize) == FALSE)
+		{
+			printf("Corrupt file. Chunk %d failed to decompress.\n", chunkIndex);
+			return FALSE;
+		}
+
+		if (target == rows) return TRUE;
+		pixels = scratch;
+	}
+
+	if (reader->header.filter == FilterDelta)
+	{
+		DeltaDecodeRows(pixels, rowByteSize, rows, rowStride, rowByteSize, rowCount, reader->header.channelCount);
+	}
+	else if (rowStride == rowByteSize)
+	{
+		::memcpy(rows, pixels, rawByteSize);
+	}
+	else
+	{
+		for (int y = 0; y < rowCount; ++y)
+		{
+			::memcpy(rows + y * rowStride, pixels + y * rowByteSize, rowByteSize);
+		}
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeChunkRange
+//	Purpose:	Thread callback, decodes chunks [begin, end) of a run read by DecodeChunks
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void DecodeChunkRange(void* context, int begin, int end)
+{
+	ChunkDecodeState* state = (ChunkDecodeState*) context;
+	BifReader* reader = state->reader;
+
+	// each thread decompresses into its own chunk sized scratch buffer, unfiltered tightly packed rows don't need one
+	BYTE* scratch = NULL;
+	if (reader->header.filter != FilterNone || state->rowStride != reader->fileRowByteSize)
+	{
+		scratch = (BYTE*) ::malloc((size_t) reader->header.chunkRows * reader->fileRowByteSize + 1);
+		if (scratch == NULL)
+		{
+			::InterlockedExchange(&state->failed, TRUE);
+			return;
+		}
+	}
+
+	for (int i = begin; i < end; ++i)
+	{
+		int chunkIndex = state->firstChunk + i;
+		const BYTE* compressed = reader->compressed + (reader->chunkOffsets[chunkIndex] - reader->chunkOffsets[state->firstChunk]);
+		BYTE* rows = state->rows + (ptrdiff_t) i * reader->header.chunkRows * state->rowStride;
+		if (DecodeChunk(reader, chunkIndex, compressed, rows, state->rowStride, scratch) == FALSE)
+		{
+			::InterlockedExchange(&state->failed, TRUE);
+			break;
+		}
+	}
+
+	free(scratch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeChunks
+//	Purpose:	Reads a run of chunks with one read and decodes them in parallel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL DecodeChunks(BifReader* reader, int firstChunk, int chunkCount, BYTE* rows, ptrdiff_t rowStride)
+{
+	// grow the compressed buffer to the largest run seen
+	__int64 byteSize = reader->chunkOffsets[firstChunk + chunkCount] - reader->chunkOffsets[firstChunk];
+	if (byteSize > reader->compressedByteSize)
+	{
+		BYTE* compressed = (BYTE*) ::realloc(reader->compressed, (size_t) byteSize);
+		if (compressed == NULL)
+		{
+			printf("Failed to allocate chunk buffer.\n");
+			return FALSE;
+		}
+
+		reader->compressed = compressed;
+		reader->compressedByteSize = byteSize;
+	}
+
+	if (SeekFile(reader->file, reader->chunkOffsets[firstChunk]) == FALSE) return FALSE;
+	if (ReadFileBytes(reader->file, reader->compressed, byteSize) == FALSE) return FALSE;
+
+	ChunkDecodeState state = {};
+	state.reader = reader;
+	state.firstChunk = firstChunk;
+	state.rows = rows;
+	state.rowStride = rowStride;
+	state.failed = FALSE;
+	ParallelFor(chunkCount, DecodeChunkRange, &state);
+
+	return (state.failed == FALSE) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadEncodedRows
+//	Purpose:	ReadImageRows for encoded files
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadEncodedRows(BifReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	int chunkRows = reader->header.chunkRows;
+	int pixelHeight = reader->header.pixelHeight;
+
+	while (rowCount > 0)
+	{
+		int chunkIndex = reader->rowsRead / chunkRows;
+		int chunkRow = reader->rowsRead % chunkRows;
+
+		// whole chunks are decoded in parallel straight into the caller's rows
+		if (chunkRow == 0)
+		{
+			int chunkCount = 0;
+			int wholeRows = 0;
+			while (chunkCount < reader->batchChunks && chunkIndex + chunkCount < (int) reader->header.chunkCount)
+			{
+				int chunkRowCount = GetChunkRowCount(chunkRows, pixelHeight, chunkIndex + chunkCount);
+				if (wholeRows + chunkRowCount > rowCount) break;
+				wholeRows += chunkRowCount;
+				chunkCount++;
+			}
+
+			if (chunkCount > 0)
+			{
+				if (DecodeChunks(reader, chunkIndex, chunkCount, rows, rowStride) == FALSE) return FALSE;
+				rows += wholeRows * rowStride;
+				rowCount -= wholeRows;
+				reader->rowsRead += wholeRows;
+				continue;
+			}
+		}
+
+		// part of a chunk comes out of the reader's chunk buffer, which keeps the chunk for the next read
+		if (reader->chunk == NULL)
+		{
+			reader->chunk = (BYTE*) ::malloc((size_t) chunkRows * reader->fileRowByteSize + 1);
+			if (reader->chunk == NULL)
+			{
+				printf("Failed to allocate chunk buffer.\n");
+				return FALSE;
+			}
+		}
+
+		if (reader->chunkIndex != chunkIndex)
+		{
+			if (DecodeChunks(reader, chunkIndex, 1, reader->chunk, reader->fileRowByteSize) == FALSE) return FALSE;
+			reader->chunkIndex = chunkIndex;
+		}
+
+		int copyRows = GetChunkRowCount(chunkRows, pixelHeight, chunkIndex) - chunkRow;
+		if (copyRows > rowCount) copyRows = rowCount;
+		for (int y = 0; y < copyRows; ++y)
+		{
+			::memcpy(rows + y * rowStride, reader->chunk + (chunkRow + y) * reader->fileRowByteSize, reader->fileRowByteSize);
+		}
+
+		rows += copyRows * rowStride;
+		rowCount -= copyRows;
+		reader->rowsRead += copyRows;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenReader
+//	Purpose:	Opens a BIF file for streaming reads of rows with channelCount channels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL OpenReader(BifReader* reader, const char* filePath, int channelCount)
+{
+	// validate parameters
+	if (reader == NULL || filePath == NULL)
+	{
+		printf("Invalid parameter Reader or FilePath NULL.\n");
+		return FALSE;
+	}
+
+	// open file for read only, the rows are read front to back
+	HANDLE file = ::CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	// read header
+	if (ReadImageHeader(file, &reader->header) == FALSE)
+	{
+		::CloseHandle(file);
+		return FALSE;
+	}
+
+	reader->file = file;
+	reader->channelCount = channelCount;
+	reader->rowByteSize = reader->header.pixelWidth * channelCount;
+	reader->fileRowByteSize = reader->header.pixelWidth * reader->header.channelCount;
+	reader->rowsRead = 0;
+	reader->chunkOffsets = NULL;
+	reader->chunk = NULL;
+	reader->chunkIndex = -1;
+	reader->compressed = NULL;
+	reader->compressedByteSize = 0;
+	reader->batchChunks = ImageBatchChunks;
+	reader->convertRows = NULL;
+	reader->convertRowCount = 0;
+
+	// encoded files need their chunk table
+	if (reader->header.encoding == EncodingLz && LoadChunkTable(reader) == FALSE)
+	{
+		CloseImageReader(reader);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenImageReader
+//	Purpose:	Opens a BIF file for streaming row reads
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenImageReader(BifReader* reader, const char* filePath)
+{
+	return OpenReader(reader, filePath, ImageColorChannels);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAlphaImageReader
+//	Purpose:	Opens a BIF file for streaming reads of rgba rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAlphaImageReader(BifReader* reader, const char* filePath)
+{
+	return OpenReader(reader, filePath, ImageAlphaChannels);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertPixelChannels
+//	Purpose:	Copies pixelCount pixels from rows of sourceChannels channels to rows of targetChannels channels,
+//				dropping the alpha of rgba pixels or adding an opaque one to rgb pixels. Both channel counts must be 3
+//				or 4.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ConvertPixelChannels(BYTE* target, int targetChannels, const BYTE* source, int sourceChannels, int pixelCount)
+{
+	// validate parameters
+	if ((sourceChannels != ImageColorChannels && sourceChannels != ImageAlphaChannels) || (targetChannels != ImageColorChannels && targetChannels != ImageAlphaChannels))
+	{
+		printf("Invalid parameter channel count %d to %d, expected 3 or 4.\n", sourceChannels, targetChannels);
+		return FALSE;
+	}
+
+	int x = 0;
+	if (CpuSupportsSsse3() == true && sourceChannels == ImageColorChannels && targetChannels == ImageAlphaChannels)
+	{
+		// four rgb pixels spread to rgba with the alpha lanes set, the load reads 16 bytes for 12 so it stops a pixel short
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i opaque = _mm_set1_epi32((int) 0xff000000);
+		for (; x + 6 <= pixelCount; x += 4)
+		{
+			__m128i rgb = _mm_loadu_si128((const __m128i*) (source + x * 3));
+			_mm_storeu_si128((__m128i*) (target + x * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, spread), opaque));
+		}
+	}
+	else if (CpuSupportsSsse3() == true && sourceChannels == ImageAlphaChannels && targetChannels == ImageColorChannels)
+	{
+		// four rgba pixels packed to rgb, the store writes 16 bytes for 12 so it stops a pixel short
+		const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		for (; x + 6 <= pixelCount; x += 4)
+		{
+			__m128i rgba = _mm_loadu_si128((const __m128i*) (source + x * 4));
+			_mm_storeu_si128((__m128i*) (target + x * 3), _mm_shuffle_epi8(rgba, pack));
+		}
+	}
+
+	for (; x < pixelCount; ++x)
+	{
+		const BYTE* pixel = source + x * sourceChannels;
+		BYTE* out = target + x * targetChannels;
+		out[0] = pixel[0];
+		out[1] = pixel[1];
+		out[2] = pixel[2];
+		if (targetChannels == ImageAlphaChannels) out[3] = (sourceChannels == ImageAlphaChannels) ? pixel[3] : 255;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadFileRows
+//	Purpose:	Reads the next rowCount rows as they are in the file, rows are rowStride bytes apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadFileRows(BifReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// encoded files are decoded a chunk at a time
+	if (reader->header.encoding == EncodingLz) return ReadEncodedRows(reader, rows, rowStride, rowCount);
+
+	// solid files have no body, every row is filled with the color from the statistics
+	if (reader->header.encoding == EncodingSolid)
+	{
+		const BYTE* color = reader->header.statistics.minimum;
+		FillStage fill(color[0], color[1], color[2]);
+		for (int y = 0; y < rowCount; ++y)
+		{
+			fill(rows + y * rowStride, reader->header.pixelWidth);
+		}
+
+		reader->rowsRead += rowCount;
+		return TRUE;
+	}
+
+	// tightly packed rows come in with a single read
+	if (rowStride == reader->fileRowByteSize)
+	{
+		if (ReadFileBytes(reader->file, rows, (__int64) rowStride * rowCount) == FALSE) return FALSE;
+	}
+	else
+	{
+		for (int y = 0; y < rowCount; ++y)
+		{
+			if (ReadFileBytes(reader->file, rows + y * rowStride, reader->fileRowByteSize) == FALSE) return FALSE;
+		}
+	}
+
+	reader->rowsRead += rowCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadConvertedRows
+//	Purpose:	Reads the next rowCount rows of a file whose channels differ from the reader's, a block of file
+//				rows at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadConvertedRows(BifReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// lz files convert up to a batch of chunks at a time, the rest up to a chunk's worth of rows
+	int blockRows = (reader->header.encoding == EncodingLz) ? reader->batchChunks * reader->header.chunkRows : ImageChunkByteSize / reader->fileRowByteSize;
+	if (blockRows > rowCount) blockRows = rowCount;
+	if (blockRows < 1) blockRows = 1;
+
+	// a budget set after the first read can grow the batch
+	if (reader->convertRowCount < blockRows)
+	{
+		free(reader->convertRows);
+		reader->convertRowCount = 0;
+		reader->convertRows = (BYTE*) ::malloc((size_t) blockRows * reader->fileRowByteSize + 1);
+		if (reader->convertRows == NULL)
+		{
+			printf("Failed to allocate pixel buffer.\n");
+			return FALSE;
+		}
+
+		reader->convertRowCount = blockRows;
+	}
+
+	while (rowCount > 0)
+	{
+		int copyRows = (rowCount < blockRows) ? rowCount : blockRows;
+		if (ReadFileRows(reader, reader->convertRows, reader->fileRowByteSize, copyRows) == FALSE) return FALSE;
+
+		if (ConvertImageRows(reader, reader->convertRows, reader->fileRowByteSize, rows, rowStride, copyRows) == FALSE) return FALSE;
+
+		rows += copyRows * rowStride;
+		rowCount -= copyRows;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImageRows
+//	Purpose:	Reads the next rowCount rows of rgb pixels, or rgba for OpenAlphaImageReader, rows are rowStride
+//				bytes apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImageRows(BifReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (reader == NULL || reader->file == NULL || rows == NULL)
+	{
+		printf("Invalid parameter Reader or Rows NULL.\n");
+		return FALSE;
+	}
+
+	if (reader->rowsRead + rowCount > reader->header.pixelHeight)
+	{
+		printf("Too many rows read. Image has %u rows.\n", reader->header.pixelHeight);
+		return FALSE;
+	}
+
+	// files whose channels match the reader's are read straight into the rows
+	if (reader->channelCount != reader->header.channelCount) return ReadConvertedRows(reader, rows, rowStride, rowCount);
+
+	return ReadFileRows(reader, rows, rowStride, rowCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImageRowsAt
+//	Purpose:	Reads rowCount rows starting at firstRow, the next ReadImageRows continues after them
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImageRowsAt(BifReader* reader, int firstRow, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (reader == NULL || reader->file == NULL || firstRow < 0 || firstRow > reader->header.pixelHeight)
+	{
+		printf("Invalid parameter Reader NULL or FirstRow out of range.\n");
+		return FALSE;
+	}
+
+	// raw rows sit at a fixed offset, encoded reads seek to their chunks anyway and solid reads don't touch the file
+	if (reader->header.encoding == EncodingRaw && SeekFile(reader->file, reader->header.bodyOffset + (__int64) firstRow * reader->fileRowByteSize) == FALSE) return FALSE;
+	reader->rowsRead = firstRow;
+
+	return ReadImageRows(reader, rows, rowStride, rowCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImageReader
+//	Purpose:	Closes the file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseImageReader(BifReader* reader)
+{
+	if (reader == NULL || reader->file == NULL) return;
+
+	// close file handle
+	::CloseHandle(reader->file);
+	reader->file = NULL;
+
+	// free heap memory
+	free(reader->chunkOffsets);
+	free(reader->chunk);
+	free(reader->compressed);
+	free(reader->convertRows);
+	reader->chunkOffsets = NULL;
+	reader->chunk = NULL;
+	reader->compressed = NULL;
+	reader->convertRows = NULL;
+	reader->convertRowCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		SetDecodeBatch
+//	Purpose:	Sizes the chunk batches of an lz reader to a memory budget where every chunk in a batch needs
+//				chunkBuffers chunk sized buffers. Returns the batch size, at least one chunk.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int SetDecodeBatch(BifReader* reader, size_t memoryBudget, int chunkBuffers)
+{
+	// compressed chunks are at most their raw size, filtered chunks are also unfiltered through a scratch chunk and
+	// converted chunks land in file rows first
+	if (reader->header.filter != FilterNone) chunkBuffers++;
+	if (reader->channelCount != reader->header.channelCount) chunkBuffers++;
+
+	size_t chunkByteSize = (size_t) reader->header.chunkRows * reader->fileRowByteSize;
+	size_t batchChunks = memoryBudget / (chunkByteSize * chunkBuffers);
+	if (batchChunks < 1) batchChunks = 1;
+	if (batchChunks > (size_t) ImageBatchChunks) batchChunks = ImageBatchChunks;
+
+	reader->batchChunks = (int) batchChunks;
+
+	return reader->batchChunks;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeImageRows
+//	Purpose:	Streams the remaining rows to a sink in strips that fit memoryBudget bytes. Peak memory is the
+//				budget, not the image size.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DecodeImageRows(BifReader* reader, size_t memoryBudget, ImageRowSink sink, void* context)
+{
+	// validate parameters
+	if (reader == NULL || reader->file == NULL || sink == NULL)
+	{
+		printf("Invalid parameter Reader or Sink NULL.\n");
+		return FALSE;
+	}
+
+	int remainingRows = reader->header.pixelHeight - reader->rowsRead;
+	if (remainingRows <= 0) return TRUE;
+
+	size_t stripRowCount = 0;
+	if (reader->header.encoding == EncodingLz)
+	{
+		// lz strips hold whole batches of chunks, the budget also covers their compressed bytes
+		stripRowCount = (size_t) SetDecodeBatch(reader, memoryBudget, 2) * reader->header.chunkRows;
+	}
+	else
+	{
+		// the strip is the only buffer, a budget below one row can't be honored
+		if (memoryBudget < (size_t) reader->rowByteSize)
+		{
+			printf("Memory budget of %llu bytes is smaller than one %d byte row.\n", (unsigned __int64) memoryBudget, reader->rowByteSize);
+			return FALSE;
+		}
+
+		stripRowCount = memoryBudget / reader->rowByteSize;
+	}
+
+	if (stripRowCount > (size_t) remainingRows) stripRowCount = remainingRows;
+
+	BYTE* strip = (BYTE*) ::malloc(stripRowCount * reader->rowByteSize);
+	if (strip == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		return FALSE;
+	}
+
+	BOOL result = TRUE;
+	while (result == TRUE && reader->rowsRead < reader->header.pixelHeight)
+	{
+		int firstRow = reader->rowsRead;
+		int rowCount = reader->header.pixelHeight - firstRow;
+		if (rowCount > (int) stripRowCount) rowCount = (int) stripRowCount;
+
+		result = ReadImageRows(reader, strip, reader->rowByteSize, rowCount);
+		if (result == TRUE) result = sink(context, strip, reader->rowByteSize, firstRow, rowCount);
+	}
+
+	// free heap memory
+	free(strip);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CopyRowsToBuffer
+//	Purpose:	Row sink that copies decoded rows into a caller owned buffer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CopyRowsToBuffer(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	BufferSinkContext* buffer = (BufferSinkContext*) context;
+	for (int y = 0; y < rowCount; ++y)
+	{
+		::memcpy(buffer->target + (firstRow + y) * buffer->targetStride, rows + y * rowStride, buffer->rowByteSize);
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeImageToBuffer
+//	Purpose:	Reads the remaining rows into a caller owned buffer, rows are targetStride bytes apart (may be
+//				negative for bottom-up buffers). Strided targets are filled through a strip of memoryBudget bytes.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DecodeImageToBuffer(BifReader* reader, size_t memoryBudget, BYTE* target, ptrdiff_t targetStride)
+{
+	// validate parameters
+	if (reader == NULL || reader->file == NULL || target == NULL)
+	{
+		printf("Invalid parameter Reader or Target NULL.\n");
+		return FALSE;
+	}
+
+	// tightly packed top-down targets are read into directly, no strip needed
+	if (targetStride == reader->rowByteSize)
+	{
+		if (reader->header.encoding == EncodingLz) SetDecodeBatch(reader, memoryBudget, 1);
+
+		int firstRow = reader->rowsRead;
+		return ReadImageRows(reader, target + firstRow * targetStride, targetStride, reader->header.pixelHeight - firstRow);
+	}
+
+	// anything else goes through a strip, one ReadFile per strip instead of per row
+	BufferSinkContext buffer = {};
+	buffer.target = target;
+	buffer.targetStride = targetStride;
+	buffer.rowByteSize = reader->rowByteSize;
+
+	return DecodeImageRows(reader, memoryBudget, CopyRowsToBuffer, &buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetImageChunkRowCount
+//	Purpose:	Returns the number of rows in a chunk of an lz file, the last chunk may be short
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetImageChunkRowCount(const BifReader* reader, int chunkIndex)
+{
+	return GetChunkRowCount(reader->header.chunkRows, reader->header.pixelHeight, chunkIndex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeImageChunk
+//	Purpose:	Decodes one chunk of an lz file from compressed bytes the caller read at reader->chunkOffsets, for
+//				callers that do their own file reads. scratch holds one chunk.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DecodeImageChunk(BifReader* reader, int chunkIndex, const BYTE* compressed, BYTE* rows, ptrdiff_t rowStride, BYTE* scratch)
+{
+	// validate parameters
+	if (reader == NULL || reader->header.encoding != EncodingLz || reader->chunkOffsets == NULL || chunkIndex < 0 || chunkIndex >= (int) reader->header.chunkCount || compressed == NULL || rows == NULL || scratch == NULL)
+	{
+		printf("Invalid parameter Reader, Compressed, Rows or Scratch NULL, or ChunkIndex out of range.\n");
+		return FALSE;
+	}
+
+	return DecodeChunk(reader, chunkIndex, compressed, rows, rowStride, scratch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertImageRows
+//	Purpose:	Converts rows as they are in the file, fileRowByteSize bytes each, to rows of the reader's channels,
+//				for callers that do their own file reads of files whose channels differ from the reader's
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ConvertImageRows(const BifReader* reader, const BYTE* fileRows, ptrdiff_t fileRowStride, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (reader == NULL || fileRows == NULL || rows == NULL || rowCount < 0)
+	{
+		printf("Invalid parameter Reader, FileRows or Rows NULL, or negative RowCount.\n");
+		return FALSE;
+	}
+
+	for (int y = 0; y < rowCount; ++y)
+	{
+		if (ConvertPixelChannels(rows + y * rowStride, reader->channelCount, fileRows + y * fileRowStride, reader->header.channelCount, reader->header.pixelWidth) == FALSE) return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenImageWriter
+//	Purpose:	Creates a BIF file, writes its header and prepares the writer for the pixel rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenImageWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor)
+{
+	// validate parameters, readers reject empty images
+	if (writer == NULL || filePath == NULL || pixelWidth == 0 || pixelHeight == 0)
+	{
+		printf("Invalid parameter Writer or FilePath NULL or image size zero.\n");
+		return FALSE;
+	}
+
+	// create file
+	HANDLE file = ::CreateFile(filePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	// write header
+	if (WriteImageHeader(file, pixelWidth, pixelHeight, fillColor) == FALSE)
+	{
+		::CloseHandle(file);
+		return FALSE;
+	}
+
+	::memset(writer, 0, sizeof(BifWriter));
+	writer->file = file;
+	writer->pixelWidth = pixelWidth;
+	writer->pixelHeight = pixelHeight;
+	writer->channelCount = ImageColorChannels;
+	writer->rowByteSize = pixelWidth * ImageColorChannels;
+	writer->rowsWritten = 0;
+	writer->encoding = EncodingRaw;
+	writer->filter = FilterNone;
+	writer->fileOffset = FileHeaderByteSize;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteWriterBytes
+//	Purpose:	Writes a buffer of any size at the writer's file offset, to the file or to its output
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteWriterBytes(BifWriter* writer, const void* buffer, __int64 byteSize)
+{
+	if (writer->output == NULL)
+	{
+		if (WriteFileBytes(writer->file, buffer, byteSize) == FALSE) return FALSE;
+		writer->fileOffset += byteSize;
+		return TRUE;
+	}
+
+	// the output takes a DWORD byte count per call, like WriteFile
+	const BYTE* bytes = (const BYTE*) buffer;
+	while (byteSize > 0)
+	{
+		DWORD partByteSize = (byteSize > 0x40000000) ? 0x40000000 : (DWORD) byteSize;
+		if (writer->output(writer->outputContext, bytes, partByteSize, writer->fileOffset) == FALSE) return FALSE;
+
+		bytes += partByteSize;
+		byteSize -= partByteSize;
+		writer->fileOffset += partByteSize;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		SeekWriter
+//	Purpose:	Moves the writer's file offset, the file pointer follows unless an output takes the writes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL SeekWriter(BifWriter* writer, __int64 byteOffset)
+{
+	if (writer->output == NULL && SeekFile(writer->file, byteOffset) == FALSE) return FALSE;
+
+	writer->fileOffset = byteOffset;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EndWriterFile
+//	Purpose:	Ends the file at the writer's file offset
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL EndWriterFile(BifWriter* writer)
+{
+	if (writer->output != NULL) return writer->output(writer->outputContext, NULL, 0, writer->fileOffset);
+
+	return ::SetEndOfFile(writer->file);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteEncodedHeader
+//	Purpose:	Writes the version 101, 102 or 103 file header at the current file position
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteEncodedHeader(BifWriter* writer, unsigned short fileVersion)
+{
+	// assemble the header in memory so it goes out in one write
+	BYTE header[EncodedHeaderByteSize] = {};
+	unsigned short headerEncoding = (unsigned short) writer->encoding;
+	unsigned short headerFilter = (unsigned short) writer->filter;
+	DWORD headerChunkRows = (DWORD) writer->chunkRows;
+	DWORD headerChunkCount = (DWORD) writer->chunkCount;
+	::memcpy(header + 0, BifFourCC, sizeof(BifFourCC));
+	::memcpy(header + 4, &fileVersion, sizeof(fileVersion));
+	::memcpy(header + 6, &writer->pixelWidth, sizeof(writer->pixelWidth));
+	::memcpy(header + 8, &writer->pixelHeight, sizeof(writer->pixelHeight));
+	::memcpy(header + 10, &writer->fillColor, sizeof(writer->fillColor));
+	::memcpy(header + 14, &headerEncoding, sizeof(headerEncoding));
+	::memcpy(header + 16, &headerFilter, sizeof(headerFilter));
+	::memcpy(header + 18, &headerChunkRows, sizeof(headerChunkRows));
+	::memcpy(header + 22, &headerChunkCount, sizeof(headerChunkCount));
+
+	return WriteWriterBytes(writer, header, sizeof(header));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteMetadata
+//	Purpose:	Writes the metadata byte size, the statistics block and the hash block at the current file position
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteMetadata(BifWriter* writer, const ImageStatistics* statistics, unsigned __int64 hash)
+{
+	BYTE metadata[WriterMetadataByteSize] = {};
+	DWORD metadataByteSize = WriterMetadataByteSize - 4;
+	DWORD statisticsByteSize = StatisticsPayloadByteSize;
+	DWORD hashByteSize = HashPayloadByteSize;
+	BYTE* block = metadata + 4;
+	::memcpy(metadata + 0, &metadataByteSize, sizeof(metadataByteSize));
+	::memcpy(block + 0, StatisticsTag, sizeof(StatisticsTag));
+	::memcpy(block + 4, &statisticsByteSize, sizeof(statisticsByteSize));
+	PackStatistics(statistics, block + 8);
+
+	block += 8 + StatisticsPayloadByteSize;
+	::memcpy(block + 0, HashTag, sizeof(HashTag));
+	::memcpy(block + 4, &hashByteSize, sizeof(hashByteSize));
+	::memcpy(block + 8, &hash, sizeof(hash));
+
+	return WriteWriterBytes(writer, metadata, sizeof(metadata));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FreeWriterBuffers
+//	Purpose:	Frees the chunk buffers of a writer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FreeWriterBuffers(BifWriter* writer)
+{
+	free(writer->chunkSizes);
+	free(writer->batch);
+	free(writer->compressed);
+	writer->chunkSizes = NULL;
+	writer->batch = NULL;
+	writer->compressed = NULL;
+	FreeHashAccumulator(&writer->hashAccumulator);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CreateEncodedWriter
+//	Purpose:	Creates a version 101 or 102 file of rgb rows, or a version 103 file of rgba rows when
+//				channelCount is 4, whose body is written with the given encoding and filter
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CreateEncodedWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata, int channelCount)
+{
+	// validate parameters
+	if (writer == NULL || filePath == NULL || pixelWidth == 0 || pixelHeight == 0 || (encoding != EncodingRaw && encoding != EncodingLz) || (filter != FilterNone && filter != FilterDelta))
+	{
+		printf("Invalid parameter Writer or FilePath NULL, image size zero or unknown Encoding or Filter.\n");
+		return FALSE;
+	}
+
+	::memset(writer, 0, sizeof(BifWriter));
+	writer->pixelWidth = pixelWidth;
+	writer->pixelHeight = pixelHeight;
+	writer->channelCount = channelCount;
+	writer->rowByteSize = pixelWidth * channelCount;
+	writer->encoding = encoding;
+	writer->filter = (encoding == EncodingLz) ? filter : FilterNone;
+	writer->fillColor = fillColor;
+	writer->storeMetadata = storeMetadata;
+	InitImageStatistics(&writer->statistics);
+	if (storeMetadata == TRUE && InitHashAccumulator(&writer->hashAccumulator, pixelWidth, pixelHeight) == FALSE) return FALSE;
+
+	if (encoding == EncodingLz)
+	{
+		// whole rows per chunk, at least one
+		writer->chunkRows = (writer->rowByteSize > 0) ? ImageChunkByteSize / writer->rowByteSize : pixelHeight;
+		if (writer->chunkRows > pixelHeight) writer->chunkRows = pixelHeight;
+		if (writer->chunkRows < 1) writer->chunkRows = 1;
+		writer->chunkCount = (pixelHeight + writer->chunkRows - 1) / writer->chunkRows;
+
+		int chunkByteSize = writer->chunkRows * writer->rowByteSize;
+		writer->chunkSizes = (DWORD*) ::calloc(writer->chunkCount + 1, sizeof(DWORD));
+		writer->batch = (BYTE*) ::malloc((size_t) ImageBatchChunks * chunkByteSize + 1);
+		writer->compressed = (BYTE*) ::malloc((size_t) ImageBatchChunks * LzCompressBound(chunkByteSize));
+		if (writer->chunkSizes == NULL || writer->batch == NULL || writer->compressed == NULL)
+		{
+			printf("Failed to allocate chunk buffers.\n");
+			FreeWriterBuffers(writer);
+			return FALSE;
+		}
+	}
+
+	// create file
+	HANDLE file = ::CreateFile(filePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		FreeWriterBuffers(writer);
+		return FALSE;
+	}
+
+	writer->file = file;
+
+	// the metadata is written empty here and filled in on close, as is the chunk table. The body goes after them.
+	writer->bodyOffset = EncodedHeaderByteSize;
+	unsigned short fileVersion = (channelCount == ImageAlphaChannels) ? AlphaFileVersion : (storeMetadata == TRUE) ? MetadataFileVersion : EncodedFileVersion;
+	BOOL result = WriteEncodedHeader(writer, fileVersion);
+	if (result == TRUE && storeMetadata == TRUE)
+	{
+		result = WriteMetadata(writer, &writer->statistics, 0);
+		writer->bodyOffset += WriterMetadataByteSize;
+	}
+
+	if (result == FALSE || SeekWriter(writer, writer->bodyOffset + (__int64) writer->chunkCount * sizeof(DWORD)) == FALSE)
+	{
+		::CloseHandle(file);
+		writer->file = NULL;
+		FreeWriterBuffers(writer);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenEncodedImageWriter
+//	Purpose:	Creates a BIF file whose pixel body is written with the given encoding and filter. EncodingRaw
+//				ignores the filter. With storeMetadata the file is version 102.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenEncodedImageWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata)
+{
+	if (encoding == EncodingRaw && storeMetadata == FALSE) return OpenImageWriter(writer, filePath, pixelWidth, pixelHeight, fillColor);
+
+	return CreateEncodedWriter(writer, filePath, pixelWidth, pixelHeight, fillColor, encoding, filter, storeMetadata, ImageColorChannels);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAlphaImageWriter
+//	Purpose:	Creates a version 103 BIF file of rgba rows whose body is written with the given encoding and
+//				filter
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAlphaImageWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter)
+{
+	return CreateEncodedWriter(writer, filePath, pixelWidth, pixelHeight, fillColor, encoding, filter, FALSE, ImageAlphaChannels);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EncodeChunkRange
+//	Purpose:	Thread callback, compresses chunks [begin, end) of the writer's batch
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void EncodeChunkRange(void* context, int begin, int end)
+{
+	ChunkEncodeState* state = (ChunkEncodeState*) context;
+	BifWriter* writer = state->writer;
+	int chunkByteSize = writer->chunkRows * writer->rowByteSize;
+
+	for (int i = begin; i < end; ++i)
+	{
+		int rowCount = writer->batchRows - i * writer->chunkRows;
+		if (rowCount > writer->chunkRows) rowCount = writer->chunkRows;
+		int rawByteSize = rowCount * writer->rowByteSize;
+
+		// a chunk that doesn't get smaller is stored as is, its size then equals the raw size
+		int compressedByteSize = LzCompress(writer->batch + (size_t) i * chunkByteSize, rawByteSize, writer->compressed + (size_t) i * state->compressedSlotSize, state->compressedSlotSize);
+		if (compressedByteSize == 0 || compressedByteSize >= rawByteSize) compressedByteSize = rawByteSize;
+		writer->chunkSizes[writer->chunksWritten + i] = (DWORD) compressedByteSize;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FlushChunks
+//	Purpose:	Compresses the batched rows, in parallel unless the writer is serialEncode, and appends the chunks
+//				to the file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL FlushChunks(BifWriter* writer)
+{
+	if (writer->batchRows == 0) return TRUE;
+
+	int chunkByteSize = writer->chunkRows * writer->rowByteSize;
+	int chunkCount = (writer->batchRows + writer->chunkRows - 1) / writer->chunkRows;
+
+	ChunkEncodeState state = {};
+	state.writer = writer;
+	state.compressedSlotSize = LzCompressBound(chunkByteSize);
+
+	// a writer driven from a thread pool would oversubscribe the processors with ParallelFor threads
+	if (writer->serialEncode == TRUE) EncodeChunkRange(&state, 0, chunkCount);
+	else ParallelFor(chunkCount, EncodeChunkRange, &state);
+
+	for (int i = 0; i < chunkCount; ++i)
+	{
+		int rowCount = writer->batchRows - i * writer->chunkRows;
+		if (rowCount > writer->chunkRows) rowCount = writer->chunkRows;
+
+		DWORD byteSize = writer->chunkSizes[writer->chunksWritten + i];
+		const BYTE* bytes = (byteSize == (DWORD) (rowCount * writer->rowByteSize)) ? writer->batch + (size_t) i * chunkByteSize : writer->compressed + (size_t) i * state.compressedSlotSize;
+		if (WriteWriterBytes(writer, bytes, byteSize) == FALSE) return FALSE;
+	}
+
+	writer->chunksWritten += chunkCount;
+	writer->batchRows = 0;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteBodyRows
+//	Purpose:	Appends rows to the body in the writer's encoding
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteBodyRows(BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// encoded files collect rows into a batch of chunks, filtering them on the way in
+	if (writer->encoding != EncodingRaw)
+	{
+		int batchCapacity = ImageBatchChunks * writer->chunkRows;
+		while (rowCount > 0)
+		{
+			int copyRows = batchCapacity - writer->batchRows;
+			if (copyRows > rowCount) copyRows = rowCount;
+
+			BYTE* target = writer->batch + (size_t) writer->batchRows * writer->rowByteSize;
+			if (writer->filter == FilterDelta)
+			{
+				DeltaEncodeRows(rows, rowStride, target, writer->rowByteSize, writer->rowByteSize, copyRows, writer->channelCount);
+			}
+			else
+			{
+				for (int y = 0; y < copyRows; ++y)
+				{
+					::memcpy(target + y * writer->rowByteSize, rows + y * rowStride, writer->rowByteSize);
+				}
+			}
+
+			writer->batchRows += copyRows;
+			writer->rowsWritten += copyRows;
+			rows += copyRows * rowStride;
+			rowCount -= copyRows;
+
+			if (writer->batchRows == batchCapacity && FlushChunks(writer) == FALSE) return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	// tightly packed rows go out in a single write
+	if (rowStride == writer->rowByteSize)
+	{
+		if (WriteWriterBytes(writer, rows, (__int64) rowStride * rowCount) == FALSE) return FALSE;
+	}
+	else
+	{
+		for (int y = 0; y < rowCount; ++y)
+		{
+			if (WriteWriterBytes(writer, rows + y * rowStride, writer->rowByteSize) == FALSE) return FALSE;
+		}
+	}
+
+	writer->rowsWritten += rowCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteHeldRows
+//	Purpose:	Writes the solid rows held back so far, the image turned out not to be solid
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteHeldRows(BifWriter* writer)
+{
+	int stripRowCount = GetStripRowCount(writer->pixelWidth, (unsigned short) writer->heldRows);
+	BYTE* strip = (BYTE*) ::malloc((size_t) stripRowCount * writer->rowByteSize);
+	if (strip == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		return FALSE;
+	}
+
+	FillStage fill(writer->heldColor[0], writer->heldColor[1], writer->heldColor[2]);
+	fill(strip, stripRowCount * writer->pixelWidth);
+
+	BOOL result = TRUE;
+	while (result == TRUE && writer->heldRows > 0)
+	{
+		int rowCount = (writer->heldRows < stripRowCount) ? writer->heldRows : stripRowCount;
+		result = WriteBodyRows(writer, strip, writer->rowByteSize, rowCount);
+		writer->heldRows -= rowCount;
+	}
+
+	free(strip);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteImageRows
+//	Purpose:	Appends rowCount rows of rgb pixels, or rgba for OpenAlphaImageWriter, rows are rowStride bytes
+//				apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteImageRows(BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (writer == NULL || writer->file == NULL || rows == NULL)
+	{
+		printf("Invalid parameter Writer or Rows NULL.\n");
+		return FALSE;
+	}
+
+	if (writer->rowsWritten + writer->heldRows + rowCount > writer->pixelHeight)
+	{
+		printf("Too many rows written. Image has %u rows.\n", writer->pixelHeight);
+		return FALSE;
+	}
+
+	if (writer->storeMetadata == FALSE) return WriteBodyRows(writer, rows, rowStride, rowCount);
+
+	// metadata comes from the caller's rows before they are filtered or compressed
+	AccumulateHashRows(&writer->hashAccumulator, rows, rowStride, rowCount);
+	ImageStatistics rowStatistics;
+	InitImageStatistics(&rowStatistics);
+	AccumulateImageStatistics(&rowStatistics, rows, rowStride, writer->pixelWidth, rowCount);
+	FinishImageStatistics(&rowStatistics);
+	MergeImageStatistics(&writer->statistics, &rowStatistics);
+
+	// leading solid rows are held back, an image that turns out solid gets no body at all
+	if (writer->rowsWritten == 0 && rowStatistics.solid == TRUE && (writer->heldRows == 0 || ::memcmp(writer->heldColor, rowStatistics.minimum, ImageColorChannels) == 0))
+	{
+		::memcpy(writer->heldColor, rowStatistics.minimum, ImageColorChannels);
+		writer->heldRows += rowCount;
+		return TRUE;
+	}
+
+	if (writer->heldRows > 0 && WriteHeldRows(writer) == FALSE) return FALSE;
+
+	return WriteBodyRows(writer, rows, rowStride, rowCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImageWriter
+//	Purpose:	Flushes and closes the file, fails if not every row was written
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseImageWriter(BifWriter* writer)
+{
+	if (writer == NULL || writer->file == NULL) return FALSE;
+
+	BOOL result = TRUE;
+	if (writer->rowsWritten + writer->heldRows != writer->pixelHeight)
+	{
+		printf("Incomplete image. Wrote %d of %u rows.\n", writer->rowsWritten + writer->heldRows, writer->pixelHeight);
+		result = FALSE;
+	}
+	else if (writer->heldRows > 0)
+	{
+		// every row was held back, the file ends after the metadata
+		writer->encoding = EncodingSolid;
+		writer->filter = FilterNone;
+		writer->chunkRows = 0;
+		writer->chunkCount = 0;
+		result = SeekWriter(writer, writer->bodyOffset);
+		if (result == TRUE) result = EndWriterFile(writer);
+	}
+	else if (writer->encoding != EncodingRaw)
+	{
+		// last batch, then the chunk table
+		result = FlushChunks(writer);
+		if (result == TRUE) result = SeekWriter(writer, writer->bodyOffset);
+		if (result == TRUE) result = WriteWriterBytes(writer, writer->chunkSizes, (__int64) writer->chunkCount * sizeof(DWORD));
+	}
+
+	// the header goes out again with the final encoding, followed by the metadata
+	if (result == TRUE && writer->storeMetadata == TRUE)
+	{
+		FinishImageStatistics(&writer->statistics);
+		unsigned __int64 hash = FinishHashAccumulator(&writer->hashAccumulator);
+		result = SeekWriter(writer, 0);
+		if (result == TRUE) result = WriteEncodedHeader(writer, MetadataFileVersion);
+		if (result == TRUE) result = WriteMetadata(writer, &writer->statistics, hash);
+	}
+
+	// flush data to disk, an output flushes what it wrote itself
+	if (writer->output == NULL) ::FlushFileBuffers(writer->file);
+
+	// close file handle
+	::CloseHandle(writer->file);
+	writer->file = NULL;
+
+	// free heap memory
+	FreeWriterBuffers(writer);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AbortImageWriter
+//	Purpose:	Closes the file and frees the buffers of a writer without finishing the image
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AbortImageWriter(BifWriter* writer)
+{
+	if (writer == NULL) return;
+
+	if (writer->file != NULL) ::CloseHandle(writer->file);
+	writer->file = NULL;
+
+	// free heap memory
+	FreeWriterBuffers(writer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseImageEncoding
+//	Purpose:	Converts an encoding name (raw, lz, lzdelta) to its encoding and filter
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseImageEncoding(const char* name, ImageEncoding* encoding, ImageFilter* filter)
+{
+	if (name == NULL || encoding == NULL || filter == NULL) return FALSE;
+
+	static const struct { const char* name; ImageEncoding encoding; ImageFilter filter; } encodings[] =
+	{
+		{ "raw", EncodingRaw, FilterNone },
+		{ "lz", EncodingLz, FilterNone },
+		{ "lzdelta", EncodingLz, FilterDelta },
+	};
+
+	for (int i = 0; i < (int) (sizeof(encodings) / sizeof(encodings[0])); ++i)
+	{
+		if (::_stricmp(name, encodings[i].name) == 0)
+		{
+			*encoding = encodings[i].encoding;
+			*filter = encodings[i].filter;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EncodeImage
+//	Purpose:	Rewrites a BIF file of any version with the given encoding and filter, optionally with statistics.
+//				Alpha files stay alpha files, which carry no statistics.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL EncodeImage(const char* sourcePath, const char* targetPath, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata)
+{
+	// validate parameters
+	if (sourcePath == NULL || targetPath == NULL)
+	{
+		printf("Invalid parameter SourcePath or TargetPath NULL.\n");
+		return FALSE;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, sourcePath) == FALSE) return FALSE;
+
+	// alpha files are reopened to read their rows with the alpha
+	BOOL alpha = (reader.header.channelCount == ImageAlphaChannels) ? TRUE : FALSE;
+	if (alpha == TRUE)
+	{
+		CloseImageReader(&reader);
+		if (OpenAlphaImageReader(&reader, sourcePath) == FALSE) return FALSE;
+		if (storeMetadata == TRUE) printf("%s has alpha, alpha files carry no metadata.\n", sourcePath);
+	}
+
+	// copy the image a strip at a time
+	int stripRowCount = GetStripRowCount(reader.header.pixelWidth, reader.header.pixelHeight);
+	BYTE* strip = (BYTE*) ::malloc((size_t) stripRowCount * reader.rowByteSize + 1);
+	if (strip == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		CloseImageReader(&reader);
+		return FALSE;
+	}
+
+	BifWriter writer = {};
+	BOOL opened = (alpha == TRUE) ? OpenAlphaImageWriter(&writer, targetPath, reader.header.pixelWidth, reader.header.pixelHeight, reader.header.fillColor, encoding, filter) :
+		OpenEncodedImageWriter(&writer, targetPath, reader.header.pixelWidth, reader.header.pixelHeight, reader.header.fillColor, encoding, filter, storeMetadata);
+	if (opened == FALSE)
+	{
+		free(strip);
+		CloseImageReader(&reader);
+		return FALSE;
+	}
+
+	BOOL result = TRUE;
+	for (int y = 0; y < reader.header.pixelHeight && result == TRUE; y += stripRowCount)
+	{
+		int rowCount = (reader.header.pixelHeight - y < stripRowCount) ? reader.header.pixelHeight - y : stripRowCount;
+		result = ReadImageRows(&reader, strip, reader.rowByteSize, rowCount);
+		if (result == TRUE) result = WriteImageRows(&writer, strip, reader.rowByteSize, rowCount);
+	}
+
+	if (result == TRUE) result = CloseImageWriter(&writer);
+	else AbortImageWriter(&writer);
+
+	// free heap memory
+	free(strip);
+	CloseImageReader(&reader);
+
+	return result;
+}
@@ -0,0 +1,352 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file image.h
+* \brief image.h holds the BIF file layout constants and the streaming image reader and writer
+* Example (optional):
+* \code
+* BifWriter writer = {};
+* OpenImageWriter(&writer, "c:\\images\\image.bif", 800, 600, RGB(255, 0, 255));
+* WriteImageRows(&writer, rows, rowStride, 600);
+* CloseImageWriter(&writer);
+* \endcode
+* \author Blake Hamilton
+*
+* Encoded file layout (version 101):
+* 14 BYTES - File header as in version 100, with File Version = 101
+* 2 BYTES  - Encoding (ImageEncoding)
+* 2 BYTES  - Filter (ImageFilter)
+* 4 BYTES  - Chunk Rows, every chunk holds this many rows except the last
+* 4 BYTES  - Chunk Count
+* N BYTES  - Chunk table, 4 byte compressed size of every chunk. A chunk whose size equals its raw size is stored as is.
+* N BYTES  - Chunks, back to back. Each is compressed on its own so chunks can be decoded in parallel.
+*
+* Metadata file layout (version 102):
+* 26 BYTES - Header as in version 101, with File Version = 102. Encoding can also be raw or solid.
+* 4 BYTES  - Metadata Byte Size
+* N BYTES  - Metadata blocks, each a 4 byte tag, a 4 byte payload size and the payload. Unknown tags are skipped.
+* N BYTES  - Body, rows as in version 100 (raw), chunk table and chunks as in version 101 (lz), nothing when solid
+*
+* Statistics block (tag STAT):
+* 8 BYTES    - Pixel Count
+* 3 BYTES    - Minimum of every channel
+* 3 BYTES    - Maximum of every channel
+* 2 BYTES    - Flags, 1 = solid
+* 24 BYTES   - Sum of every channel, 8 bytes each
+* 3072 BYTES - Histograms, 256 4 byte counts per channel
+*
+* Perceptual hash block (tag HASH):
+* 8 BYTES    - Hash, see hash.h
+*
+* Alpha file layout (version 103):
+* 26 BYTES - Header as in version 101, with File Version = 103. Encoding raw or lz.
+* N BYTES  - Body as in version 100 (raw) or 101 (lz), with rgba rows of 4 bytes per pixel. Alpha is straight, not
+*            premultiplied. The delta filter takes the difference to the same channel of the pixel on the left.
+* Alpha files carry no metadata. OpenImageReader reads them as rgb, OpenAlphaImageReader reads any file as rgba.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+#include "hash.h"
+#include "stats.h"
+
+// consts
+const unsigned short FileVersion = 100;
+const BYTE BifFourCC[4] = { 0x42, 0x49, 0x46, 0x46 }; // BIFF
+const DWORD FileHeaderByteSize = 14;					// [4CC] + [FileVersion] + [Pixel Width] + [Pixel Height] + [Fill Color]
+const int ImageColorChannels = 3;						// rgb, one byte per channel
+const int ImageStripByteSize = 16 * 1024 * 1024;		// size of the row strips that are generated and written at once
+const unsigned short EncodedFileVersion = 101;			// chunked and compressed pixel body
+const DWORD EncodedHeaderByteSize = 26;					// [File Header] + [Encoding] + [Filter] + [Chunk Rows] + [Chunk Count]
+const int ImageChunkByteSize = 256 * 1024;				// pixel bytes per independently compressed chunk, sized to stay in L2
+const int ImageBatchChunks = 64;						// most chunks compressed or decompressed in parallel at once
+const unsigned short MetadataFileVersion = 102;			// metadata block between the header and the body
+const BYTE StatisticsTag[4] = { 0x53, 0x54, 0x41, 0x54 };	// STAT
+const DWORD StatisticsPayloadByteSize = 3112;			// [Pixel Count] + [Minimum] + [Maximum] + [Flags] + [Sums] + [Histograms]
+const BYTE HashTag[4] = { 0x48, 0x41, 0x53, 0x48 };		// HASH
+const DWORD HashPayloadByteSize = 8;
+const DWORD MetadataMaxByteSize = 1024 * 1024;
+const unsigned short AlphaFileVersion = 103;			// rgba rows
+const int ImageAlphaChannels = 4;						// rgba, one byte per channel
+
+// pixel body encodings
+enum ImageEncoding
+{
+	EncodingRaw = 0,		// version 100, rows stored as is
+	EncodingLz = 1,			// version 101, rows grouped in chunks compressed with LzCompress
+	EncodingSolid = 2		// version 102 only, no body, every pixel is the statistics minimum
+};
+
+// filters applied to each row before it is compressed
+enum ImageFilter
+{
+	FilterNone = 0,
+	FilterDelta = 1			// difference to the same channel of the pixel on the left
+};
+
+// file header fields
+struct BifHeader
+{
+	unsigned short fileVersion;
+	unsigned short pixelWidth;
+	unsigned short pixelHeight;
+	COLORREF fillColor;
+	unsigned short encoding;	// ImageEncoding, version 101 and later
+	unsigned short filter;		// ImageFilter, version 101 and later
+	DWORD chunkRows;			// rows per chunk, lz encoding only
+	DWORD chunkCount;			// lz encoding only
+	__int64 bodyOffset;			// file offset of the first row or of the chunk table
+	BOOL hasStatistics;			// version 102 files with a statistics block
+	ImageStatistics statistics;
+	BOOL hasHash;				// version 102 files with a perceptual hash block
+	unsigned __int64 hash;
+	int channelCount;			// channels of the rows in the file, 4 in version 103 and 3 otherwise
+};
+
+// streaming reader state
+struct BifReader
+{
+	HANDLE file;
+	BifHeader header;
+	int channelCount;			// channels of the rows read, the alpha of a file is dropped or made opaque to match
+	int rowByteSize;			// bytes of a row read
+	int fileRowByteSize;		// bytes of a row in the file
+	int rowsRead;
+	__int64* chunkOffsets;		// file offset of every chunk plus the end of the last one
+	BYTE* chunk;				// last chunk decoded for a read that didn't cover whole chunks, allocated on first use
+	int chunkIndex;				// chunk held in chunk, -1 if none
+	BYTE* compressed;			// compressed bytes of the chunks being decoded
+	__int64 compressedByteSize;
+	int batchChunks;			// most chunks read and decoded at once, ImageBatchChunks unless a budget lowered it
+	BYTE* convertRows;			// file rows waiting for their channels to be converted, allocated on first use
+	int convertRowCount;		// rows convertRows holds
+};
+
+// receives decoded rows, firstRow is the image row of rows[0]. Return FALSE to stop decoding.
+typedef BOOL (*ImageRowSink)(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount);
+
+// takes the bytes a writer produced for byteOffset of its file, byteSize 0 ends the file at byteOffset. Return FALSE to
+// fail the write.
+typedef BOOL (*ImageByteSink)(void* context, const BYTE* bytes, DWORD byteSize, __int64 byteOffset);
+
+// streaming writer state
+struct BifWriter
+{
+	HANDLE file;
+	unsigned short pixelWidth;
+	unsigned short pixelHeight;
+	int channelCount;			// 4 for version 103 files, otherwise 3
+	int rowByteSize;
+	int rowsWritten;
+	ImageEncoding encoding;
+	ImageFilter filter;
+	int chunkRows;
+	int chunkCount;
+	int chunksWritten;
+	DWORD* chunkSizes;			// compressed byte size of every chunk, written to the chunk table on close
+	BYTE* batch;				// filtered rows waiting to be compressed, ImageBatchChunks chunks
+	int batchRows;
+	BYTE* compressed;			// one LzCompressBound sized slot per chunk in the batch
+	BOOL storeMetadata;			// version 102, statistics and the hash are gathered from the rows as they are written
+	COLORREF fillColor;
+	__int64 bodyOffset;
+	int heldRows;				// leading solid rows not written yet, the body is dropped if every row is solid
+	BYTE heldColor[ImageColorChannels];
+	ImageStatistics statistics;
+	HashAccumulator hashAccumulator;
+	__int64 fileOffset;			// where the next write goes
+	BOOL serialEncode;			// compresses on the calling thread instead of with ParallelFor, for writers driven from a thread pool
+	ImageByteSink output;		// takes the writes instead of the file once set, the file is then only closed
+	void* outputContext;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteFileBytes
+//	Purpose:	Writes a buffer of any size, WriteFile can only take a DWORD byte count per call
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteFileBytes(HANDLE file, const void* buffer, __int64 byteSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadFileBytes
+//	Purpose:	Reads a buffer of any size, fails if the file ends first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadFileBytes(HANDLE file, void* buffer, __int64 byteSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		SeekFile
+//	Purpose:	Moves the file pointer to an absolute byte offset
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL SeekFile(HANDLE file, __int64 byteOffset);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetStripRowCount
+//	Purpose:	Returns the number of rows that fit in ImageStripByteSize (at least one)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetStripRowCount(unsigned short pixelWidth, unsigned short pixelHeight);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteImageHeader
+//	Purpose:	Writes the BIF file header at the current file position
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteImageHeader(HANDLE file, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImageHeader
+//	Purpose:	Reads and validates the BIF file header, leaves the file positioned at the first pixel row
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImageHeader(HANDLE file, BifHeader* header);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenImageReader
+//	Purpose:	Opens a BIF file for streaming row reads
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenImageReader(BifReader* reader, const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAlphaImageReader
+//	Purpose:	Opens a BIF file for streaming reads of rgba rows, files without alpha read as opaque
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAlphaImageReader(BifReader* reader, const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImageRows
+//	Purpose:	Reads the next rowCount rows of rgb pixels, or rgba for OpenAlphaImageReader, rows are rowStride
+//				bytes apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImageRows(BifReader* reader, BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadImageRowsAt
+//	Purpose:	Reads rowCount rows starting at firstRow, the next ReadImageRows continues after them
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadImageRowsAt(BifReader* reader, int firstRow, BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImageReader
+//	Purpose:	Closes the file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseImageReader(BifReader* reader);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeImageRows
+//	Purpose:	Streams the remaining rows to a sink in strips that fit memoryBudget bytes. Peak memory is the
+//				budget, not the image size. lz files decode whole chunks, so their budget also holds the compressed
+//				chunks and the delta filter's scratch. One chunk of each, under 1 MB, is the least they can use and
+//				smaller budgets are rounded up to it.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DecodeImageRows(BifReader* reader, size_t memoryBudget, ImageRowSink sink, void* context);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeImageToBuffer
+//	Purpose:	Reads the remaining rows into a caller owned buffer, rows are targetStride bytes apart (may be
+//				negative for bottom-up buffers). Strided targets are filled through a strip of memoryBudget bytes,
+//				lz files read into tightly packed targets keep their compressed chunks within memoryBudget.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DecodeImageToBuffer(BifReader* reader, size_t memoryBudget, BYTE* target, ptrdiff_t targetStride);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetImageChunkRowCount
+//	Purpose:	Returns the number of rows in a chunk of an lz file, the last chunk may be short
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetImageChunkRowCount(const BifReader* reader, int chunkIndex);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DecodeImageChunk
+//	Purpose:	Decodes one chunk of an lz file from compressed bytes the caller read at reader->chunkOffsets, for
+//				callers that do their own file reads. scratch holds one chunk.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DecodeImageChunk(BifReader* reader, int chunkIndex, const BYTE* compressed, BYTE* rows, ptrdiff_t rowStride, BYTE* scratch);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ConvertImageRows
+//	Purpose:	Converts rows as they are in the file, fileRowByteSize bytes each, to rows of the reader's channels,
+//				for callers that do their own file reads of files whose channels differ from the reader's
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ConvertImageRows(const BifReader* reader, const BYTE* fileRows, ptrdiff_t fileRowStride, BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenImageWriter
+//	Purpose:	Creates a BIF file, writes its header and prepares the writer for the pixel rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenImageWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenEncodedImageWriter
+//	Purpose:	Creates a BIF file whose pixel body is written with the given encoding and filter. EncodingRaw
+//				ignores the filter. With storeMetadata the file is version 102 and carries the statistics and
+//				the perceptual hash of its pixels, otherwise it is a plain version 100 or 101 file.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenEncodedImageWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenAlphaImageWriter
+//	Purpose:	Creates a version 103 BIF file of rgba rows with the given encoding and filter
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenAlphaImageWriter(BifWriter* writer, const char* filePath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, ImageEncoding encoding, ImageFilter filter);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteImageRows
+//	Purpose:	Appends rowCount rows of rgb pixels, or rgba for OpenAlphaImageWriter, rows are rowStride bytes
+//				apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteImageRows(BifWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseImageWriter
+//	Purpose:	Flushes and closes the file, fails if not every row was written
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseImageWriter(BifWriter* writer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AbortImageWriter
+//	Purpose:	Closes the file and frees the buffers of a writer without finishing the image
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AbortImageWriter(BifWriter* writer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseImageEncoding
+//	Purpose:	Converts an encoding name (raw, lz, lzdelta) to its encoding and filter
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseImageEncoding(const char* name, ImageEncoding* encoding, ImageFilter* filter);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		EncodeImage
+//	Purpose:	Rewrites a BIF file of any version with the given encoding and filter, optionally with metadata.
+//				Alpha files stay alpha files, which carry no metadata.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL EncodeImage(const char* sourcePath, const char* targetPath, ImageEncoding encoding, ImageFilter filter, BOOL storeMetadata);
@@ -0,0 +1,390 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file lz.cpp
+* \brief lz.cpp implements the LZ block compressor and the delta filter
+* \author Blake Hamilton
+*
+* The decoder is what the format is built around: no entropy coding, byte aligned lengths and 16 byte copies
+* that are allowed to run past the end of a literal run or match as long as they stay inside the target.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <string.h>
+#include <emmintrin.h>
+#include "lz.h"
+
+// consts
+const int LzMinMatch = 4;			// shortest match worth a sequence
+const int LzLastLiterals = 5;		// a block always ends with this many literals
+const int LzMatchStartGap = 12;		// no match starts in the last 12 bytes of a block
+const int LzMaxOffset = 65535;
+const int LzHashLog = 12;			// 4096 entry match finder table, 16 KB on the stack
+const int LzSkipShift = 6;			// step size grows by one every 64 bytes without a match
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadU32
+//	Purpose:	Unaligned 4 byte load
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int ReadU32(const BYTE* bytes)
+{
+	unsigned int value;
+	::memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadU64
+//	Purpose:	Unaligned 8 byte load
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned __int64 ReadU64(const BYTE* bytes)
+{
+	unsigned __int64 value;
+	::memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzHash
+//	Purpose:	Maps 4 bytes to a match finder table slot (Knuth multiplicative hash)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int LzHash(unsigned int sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LzHashLog);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteLength
+//	Purpose:	Writes the part of a length that didn't fit in its token nibble
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline BYTE* WriteLength(BYTE* target, size_t length)
+{
+	while (length >= 255)
+	{
+		*target++ = 255;
+		length -= 255;
+	}
+
+	*target++ = (BYTE) length;
+	return target;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadLength
+//	Purpose:	Adds the extra length bytes that follow a saturated nibble, fails if the input ends first
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline BOOL ReadLength(const BYTE** source, const BYTE* sourceEnd, size_t* length)
+{
+	BYTE value = 0;
+	do
+	{
+		if (*source >= sourceEnd) return FALSE;
+		value = *(*source)++;
+		*length += value;
+	}
+	while (value == 255);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteSequence
+//	Purpose:	Writes a token, literals and (if matchLength isn't 0) a match
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline BYTE* WriteSequence(BYTE* target, const BYTE* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+	BYTE* token = target++;
+	*token = (BYTE) ((literalLength >= 15 ? 15 : literalLength) << 4);
+	if (literalLength >= 15) target = WriteLength(target, literalLength - 15);
+
+	::memcpy(target, literals, literalLength);
+	target += literalLength;
+
+	if (matchLength == 0) return target;
+
+	*target++ = (BYTE) offset;
+	*target++ = (BYTE) (offset >> 8);
+
+	size_t length = matchLength - LzMinMatch;
+	*token |= (BYTE) (length >= 15 ? 15 : length);
+	if (length >= 15) target = WriteLength(target, length - 15);
+
+	return target;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzCompressBound
+//	Purpose:	Returns the largest compressed size of sourceSize bytes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LzCompressBound(int sourceSize)
+{
+	return sourceSize + sourceSize / 255 + 16;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzCompress
+//	Purpose:	Compresses a block, returns the compressed byte size or 0 if targetCapacity is below the bound
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LzCompress(const BYTE* source, int sourceSize, BYTE* target, int targetCapacity)
+{
+	// validate parameters, with room for the worst case the output never has to be checked
+	if (source == NULL || target == NULL || sourceSize < 0 || targetCapacity < LzCompressBound(sourceSize))
+	{
+		return 0;
+	}
+
+	const BYTE* ip = source;
+	const BYTE* anchor = source;
+	const BYTE* end = source + sourceSize;
+	BYTE* op = target;
+
+	if (sourceSize > LzMatchStartGap)
+	{
+		const BYTE* matchStartLimit = end - LzMatchStartGap;
+		const BYTE* matchEndLimit = end - LzLastLiterals;
+
+		// positions of the last 4 byte sequences seen, relative to source
+		int table[1 << LzHashLog] = {};
+		++ip;
+
+		while (ip < matchStartLimit)
+		{
+			unsigned int sequence = ReadU32(ip);
+			unsigned int hash = LzHash(sequence);
+			const BYTE* candidate = source + table[hash];
+			table[hash] = (int) (ip - source);
+
+			if (candidate >= ip || ip - candidate > LzMaxOffset || ReadU32(candidate) != sequence)
+			{
+				ip += 1 + ((ip - anchor) >> LzSkipShift);
+				continue;
+			}
+
+			// extend the match backwards into the pending literals
+			while (ip > anchor && candidate > source && ip[-1] == candidate[-1])
+			{
+				--ip;
+				--candidate;
+			}
+
+			// extend the match forwards, 8 bytes at a time
+			const BYTE* matchEnd = ip + LzMinMatch;
+			const BYTE* candidateEnd = candidate + LzMinMatch;
+			while (matchEnd + 8 <= matchEndLimit && ReadU64(matchEnd) == ReadU64(candidateEnd))
+			{
+				matchEnd += 8;
+				candidateEnd += 8;
+			}
+
+			while (matchEnd < matchEndLimit && *matchEnd == *candidateEnd)
+			{
+				++matchEnd;
+				++candidateEnd;
+			}
+
+			op = WriteSequence(op, anchor, ip - anchor, ip - candidate, matchEnd - ip);
+			ip = anchor = matchEnd;
+
+			// remember a position inside the match so runs keep matching
+			if (ip < matchStartLimit) table[LzHash(ReadU32(ip - 2))] = (int) (ip - 2 - source);
+		}
+	}
+
+	// last literals
+	op = WriteSequence(op, anchor, end - anchor, 0, 0);
+
+	return (int) (op - target);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzDecompress
+//	Purpose:	Decompresses a block into exactly targetSize bytes, fails on corrupt input without writing past the target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL LzDecompress(const BYTE* source, int sourceSize, BYTE* target, int targetSize)
+{
+	// validate parameters
+	if (source == NULL || target == NULL || sourceSize <= 0 || targetSize < 0)
+	{
+		return FALSE;
+	}
+
+	const BYTE* ip = source;
+	const BYTE* ipEnd = source + sourceSize;
+	BYTE* op = target;
+	BYTE* opEnd = target + targetSize;
+
+	for (;;)
+	{
+		BYTE token = *ip++;
+
+		// literals, short runs are copied with a single 16 byte move when both buffers have the room
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && ReadLength(&ip, ipEnd, &literalLength) == FALSE) return FALSE;
+		if (literalLength > (size_t) (ipEnd - ip) || literalLength > (size_t) (opEnd - op)) return FALSE;
+
+		if (literalLength <= 16 && ipEnd - ip >= 16 && opEnd - op >= 16)
+		{
+			::memcpy(op, ip, 16);
+		}
+		else
+		{
+			::memcpy(op, ip, literalLength);
+		}
+
+		op += literalLength;
+		ip += literalLength;
+
+		// the last sequence has no match
+		if (ip == ipEnd) break;
+
+		if (ipEnd - ip < 2) return FALSE;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t) (op - target)) return FALSE;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && ReadLength(&ip, ipEnd, &matchLength) == FALSE) return FALSE;
+		matchLength += LzMinMatch;
+		if (matchLength > (size_t) (opEnd - op)) return FALSE;
+
+		// match
+		const BYTE* match = op - offset;
+		BYTE* copyEnd = op + matchLength;
+		if (offset >= 16 && (size_t) (opEnd - op) >= matchLength + 15)
+		{
+			// far matches - 16 byte moves that may run up to 15 bytes past the match
+			do
+			{
+				::memcpy(op, match, 16);
+				op += 16;
+				match += 16;
+			}
+			while (op < copyEnd);
+		}
+		else if (offset >= matchLength)
+		{
+			::memcpy(op, match, matchLength);
+		}
+		else
+		{
+			// repeating patterns (a run of one color has an offset of 3) - every copy doubles the pattern length,
+			// which also keeps the loads away from the stores that were just made
+			while (op < copyEnd)
+			{
+				size_t length = op - match;
+				if (length > (size_t) (copyEnd - op)) length = copyEnd - op;
+				::memcpy(op, match, length);
+				op += length;
+			}
+		}
+
+		op = copyEnd;
+		if (ip >= ipEnd) return FALSE;
+	}
+
+	return op == opEnd;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeltaEncodeRows
+//	Purpose:	Copies rows replacing every byte with its difference to the same channel of the pixel on the left,
+//				pixels are pixelByteSize bytes (3 for rgb, 4 for rgba)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeltaEncodeRows(const BYTE* source, ptrdiff_t sourceStride, BYTE* target, ptrdiff_t targetStride, int rowByteSize, int rowCount, int pixelByteSize)
+{
+	for (int y = 0; y < rowCount; ++y)
+	{
+		const BYTE* s = source + y * sourceStride;
+		BYTE* t = target + y * targetStride;
+
+		// the first pixel has nothing on its left
+		int i = (rowByteSize < pixelByteSize) ? rowByteSize : pixelByteSize;
+		::memcpy(t, s, i);
+
+		for (; i + 16 <= rowByteSize; i += 16)
+		{
+			__m128i current = _mm_loadu_si128((const __m128i*) (s + i));
+			__m128i left = _mm_loadu_si128((const __m128i*) (s + i - pixelByteSize));
+			_mm_storeu_si128((__m128i*) (t + i), _mm_sub_epi8(current, left));
+		}
+
+		for (; i < rowByteSize; ++i)
+		{
+			t[i] = (BYTE) (s[i] - s[i - pixelByteSize]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeltaDecodeRows
+//	Purpose:	Reverses DeltaEncodeRows while copying the rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeltaDecodeRows(const BYTE* source, ptrdiff_t sourceStride, BYTE* target, ptrdiff_t targetStride, int rowByteSize, int rowCount, int pixelByteSize)
+{
+	for (int y = 0; y < rowCount; ++y)
+	{
+		const BYTE* s = source + y * sourceStride;
+		BYTE* t = target + y * targetStride;
+
+		// running sum of every pixelByteSize byte, 16 bytes per step: a log step prefix sum inside the register plus
+		// the last decoded pixel of the previous step repeated across all lanes of its channel
+		__m128i carry = _mm_setzero_si128();
+		int i = 0;
+		if (pixelByteSize == 3)
+		{
+			for (; i + 16 <= rowByteSize; i += 16)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i*) (s + i));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 12));
+				x = _mm_add_epi8(x, carry);
+				_mm_storeu_si128((__m128i*) (t + i), x);
+
+				carry = _mm_srli_si128(x, 13);
+				carry = _mm_or_si128(carry, _mm_slli_si128(carry, 3));
+				carry = _mm_or_si128(carry, _mm_slli_si128(carry, 6));
+				carry = _mm_or_si128(carry, _mm_slli_si128(carry, 12));
+			}
+		}
+		else if (pixelByteSize == 4)
+		{
+			// four whole pixels per register, two steps sum them and the carry is the last one repeated
+			for (; i + 16 <= rowByteSize; i += 16)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i*) (s + i));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+				x = _mm_add_epi8(x, carry);
+				_mm_storeu_si128((__m128i*) (t + i), x);
+
+				carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+			}
+		}
+
+		for (; i < rowByteSize; ++i)
+		{
+			t[i] = (BYTE) (s[i] + ((i >= pixelByteSize) ? t[i - pixelByteSize] : 0));
+		}
+	}
+}
@@ -0,0 +1,72 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file lz.h
+* \brief lz.h is a byte oriented LZ compressor tuned for decode speed, plus the delta filter that can run before it
+* Example (optional):
+* \code
+* BYTE* packed = (BYTE*) malloc(LzCompressBound(byteSize));
+* int packedSize = LzCompress(pixels, byteSize, packed, LzCompressBound(byteSize));
+* LzDecompress(packed, packedSize, pixels, byteSize);
+* \endcode
+* \author Blake Hamilton
+*
+* Block layout (the LZ4 block format):
+* A block is a list of sequences. Each sequence is a token byte, literals, then a match.
+* 1 BYTE  - Token, high nibble is the literal length, low nibble is the match length - 4 (15 means more bytes follow)
+* N BYTES - Extra literal length bytes, each adds 0 - 255, a byte below 255 ends the length
+* N BYTES - Literals
+* 2 BYTES - Match offset back from the current output position (1 - 65535)
+* N BYTES - Extra match length bytes, same scheme as the literal length
+* The last sequence only has literals. The last 5 bytes of a block are always literals.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzCompressBound
+//	Purpose:	Returns the largest compressed size of sourceSize bytes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LzCompressBound(int sourceSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzCompress
+//	Purpose:	Compresses a block, returns the compressed byte size or 0 if targetCapacity is below the bound
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int LzCompress(const BYTE* source, int sourceSize, BYTE* target, int targetCapacity);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LzDecompress
+//	Purpose:	Decompresses a block into exactly targetSize bytes, fails on corrupt input without writing past the target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL LzDecompress(const BYTE* source, int sourceSize, BYTE* target, int targetSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeltaEncodeRows
+//	Purpose:	Copies rows replacing every byte with its difference to the same channel of the pixel on the left,
+//				pixels are pixelByteSize bytes (3 for rgb, 4 for rgba)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeltaEncodeRows(const BYTE* source, ptrdiff_t sourceStride, BYTE* target, ptrdiff_t targetStride, int rowByteSize, int rowCount, int pixelByteSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		DeltaDecodeRows
+//	Purpose:	Reverses DeltaEncodeRows while copying the rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeltaDecodeRows(const BYTE* source, ptrdiff_t sourceStride, BYTE* target, ptrdiff_t targetStride, int rowByteSize, int rowCount, int pixelByteSize);
@@ -0,0 +1,213 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file parallel.cpp
+* \brief parallel.cpp implements the thread pool used by the row parallel image passes
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include "parallel.h"
+
+// a ParallelFor call in flight, the pool threads and the calling thread take its ranges one at a time
+struct ParallelJob
+{
+	ParallelRangeCallback callback;
+	void* context;
+	int count;
+	int rangeCount;
+	int nextRange;			// next range to hand out
+	int finishedRanges;
+	ParallelJob* next;		// next job in the queue
+};
+
+// worker threads created on the first ParallelFor and kept for the life of the process. The pool is never freed,
+// its threads still wait on it while the process exits.
+struct ParallelPool
+{
+	std::mutex lock;
+	std::condition_variable queued;		// a job was queued
+	std::condition_variable finished;	// a range finished
+	ParallelJob* first;					// jobs with ranges left to hand out
+	ParallelJob* last;
+	int threadCount;
+};
+
+// set on pool threads and while the calling thread runs a range, a ParallelFor from there runs inline
+static thread_local BOOL insideParallelFor = FALSE;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		TakeRange
+//	Purpose:	Hands out the next range of a job and takes the job off the queue with its last range, call with
+//				the pool lock held
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int TakeRange(ParallelPool* pool, ParallelJob* job)
+{
+	int range = job->nextRange++;
+	if (job->nextRange < job->rangeCount) return range;
+
+	// the job is always first in the queue or owned by the caller that queued it
+	if (pool->first == job)
+	{
+		pool->first = job->next;
+		if (pool->first == NULL) pool->last = NULL;
+	}
+	else
+	{
+		for (ParallelJob* previous = pool->first; previous != NULL; previous = previous->next)
+		{
+			if (previous->next != job) continue;
+			previous->next = job->next;
+			if (pool->last == job) pool->last = previous;
+			break;
+		}
+	}
+
+	return range;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunRange
+//	Purpose:	Runs one range of a job outside the pool lock and counts it as finished
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void RunRange(ParallelPool* pool, ParallelJob* job, int range)
+{
+	int begin = (int) ((__int64) job->count * range / job->rangeCount);
+	int end = (int) ((__int64) job->count * (range + 1) / job->rangeCount);
+	job->callback(job->context, begin, end);
+
+	std::lock_guard<std::mutex> guard(pool->lock);
+	if (++job->finishedRanges == job->rangeCount) pool->finished.notify_all();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParallelThreadProc
+//	Purpose:	Pool thread entry point, runs ranges of the queued jobs until the process ends
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ParallelThreadProc(ParallelPool* pool)
+{
+	insideParallelFor = TRUE;
+
+	for (;;)
+	{
+		std::unique_lock<std::mutex> guard(pool->lock);
+		while (pool->first == NULL)
+		{
+			pool->queued.wait(guard);
+		}
+
+		ParallelJob* job = pool->first;
+		int range = TakeRange(pool, job);
+		guard.unlock();
+
+		RunRange(pool, job, range);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CreateParallelPool
+//	Purpose:	Starts one pool thread per processor but the first, the calling thread of ParallelFor is the last
+//				worker. Returns NULL if the pool can't be allocated, every call then runs inline.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static ParallelPool* CreateParallelPool()
+{
+	ParallelPool* pool = new (std::nothrow) ParallelPool();
+	if (pool == NULL) return NULL;
+
+	// if a thread can't be created the pool carries on with the ones it has
+	for (int i = 1; i < GetProcessorCount(); ++i)
+	{
+		try
+		{
+			std::thread(ParallelThreadProc, pool).detach();
+		}
+		catch (const std::system_error&)
+		{
+			break;
+		}
+
+		pool->threadCount++;
+	}
+
+	return pool;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetProcessorCount
+//	Purpose:	Returns the number of logical processors
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetProcessorCount()
+{
+	// a function local static is initialized once even when threads race to the first call
+	static const int processorCount = (std::thread::hardware_concurrency() > 0) ? (int) std::thread::hardware_concurrency() : 1;
+	return processorCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParallelFor
+//	Purpose:	Splits [0, count) into one contiguous range per processor and waits for every range to finish
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ParallelFor(int count, ParallelRangeCallback callback, void* context)
+{
+	if (count <= 0 || callback == NULL) return;
+
+	// a call from inside a range already has every processor busy, it runs inline instead of queueing behind itself
+	static ParallelPool* const pool = CreateParallelPool();
+	int rangeCount = (pool != NULL) ? pool->threadCount + 1 : 1;
+	if (rangeCount > count) rangeCount = count;
+	if (insideParallelFor == TRUE || rangeCount == 1)
+	{
+		callback(context, 0, count);
+		return;
+	}
+
+	ParallelJob job = {};
+	job.callback = callback;
+	job.context = context;
+	job.count = count;
+	job.rangeCount = rangeCount;
+
+	std::unique_lock<std::mutex> guard(pool->lock);
+	if (pool->last != NULL) pool->last->next = &job;
+	else pool->first = &job;
+	pool->last = &job;
+	pool->queued.notify_all();
+
+	// the calling thread takes ranges of its own job too, so it never waits while its ranges are still queued
+	insideParallelFor = TRUE;
+	while (job.nextRange < job.rangeCount)
+	{
+		int range = TakeRange(pool, &job);
+		guard.unlock();
+		RunRange(pool, &job, range);
+		guard.lock();
+	}
+
+	insideParallelFor = FALSE;
+
+	// wait for the ranges the pool threads took
+	while (job.finishedRanges < job.rangeCount)
+	{
+		pool->finished.wait(guard);
+	}
+}
@@ -0,0 +1,44 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file parallel.h
+* \brief parallel.h splits a range of work items (usually image rows) across all processors with a thread pool
+* Example (optional):
+* \code
+* void FillRows(void* context, int begin, int end) { ... }
+* ParallelFor(pixelHeight, FillRows, &state);
+* \endcode
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include "platform.h"
+
+// callback that processes the items in [begin, end), it is called once per range
+typedef void (*ParallelRangeCallback)(void* context, int begin, int end);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetProcessorCount
+//	Purpose:	Returns the number of logical processors
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int GetProcessorCount();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParallelFor
+//	Purpose:	Splits [0, count) into one contiguous range per processor and waits for every range to finish.
+//				The ranges run on a pool of threads started by the first call, and the calling thread takes
+//				ranges too. A call made from inside a range runs the whole count inline on its thread.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ParallelFor(int count, ParallelRangeCallback callback, void* context);
@@ -0,0 +1,158 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file pipeline.cpp
+* \brief pipeline.cpp implements the vectorized pixel pipeline stages
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <math.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include "pipeline.h"
+#include "simd.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FillStage
+//	Purpose:	Constructor, expands the fill color into a 16 pixel pattern
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+FillStage::FillStage(BYTE red, BYTE green, BYTE blue)
+{
+	for (int i = 0; i < 16; ++i)
+	{
+		pattern[i * 3 + 0] = red;
+		pattern[i * 3 + 1] = green;
+		pattern[i * 3 + 2] = blue;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		operator()
+//	Purpose:	Fills count pixels, 16 pixels per iteration using three 16 byte stores
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FillStage::operator()(BYTE* pixels, int count) const
+{
+	__m128i pattern0 = _mm_loadu_si128((const __m128i*) (pattern + 0));
+	__m128i pattern1 = _mm_loadu_si128((const __m128i*) (pattern + 16));
+	__m128i pattern2 = _mm_loadu_si128((const __m128i*) (pattern + 32));
+
+	int x = 0;
+	for (; x + 16 <= count; x += 16)
+	{
+		_mm_storeu_si128((__m128i*) (pixels + 0), pattern0);
+		_mm_storeu_si128((__m128i*) (pixels + 16), pattern1);
+		_mm_storeu_si128((__m128i*) (pixels + 32), pattern2);
+		pixels += 48;
+	}
+
+	// remaining pixels, the pattern starts on a pixel boundary so a partial copy is still correct
+	::memcpy(pixels, pattern, (count - x) * PipelineChannels);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		operator()
+//	Purpose:	Swaps the red and blue channel of count pixels in place
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SwapRedBlueStage::operator()(BYTE* pixels, int count) const
+{
+	int x = 0;
+
+	if (CpuSupportsSsse3() == true)
+	{
+		// a 16 byte register holds 5 whole pixels plus the first byte of the 6th, which is shuffled onto itself and
+		// rewritten unchanged, so the loop advances 5 pixels (15 bytes) at a time and needs 6 pixels left to load
+		const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+		for (; x + 6 <= count; x += 5)
+		{
+			__m128i value = _mm_loadu_si128((const __m128i*) pixels);
+			_mm_storeu_si128((__m128i*) pixels, _mm_shuffle_epi8(value, mask));
+			pixels += 15;
+		}
+	}
+
+	for (; x < count; ++x)
+	{
+		BYTE red = pixels[0];
+		pixels[0] = pixels[2];
+		pixels[2] = red;
+		pixels += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		operator()
+//	Purpose:	Maps count pixels through the per channel tables in place
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LookupStage::operator()(BYTE* pixels, int count) const
+{
+	// table lookups are gathers which SSE2 can't do, unrolling by channel keeps the three tables in registers
+	for (int x = 0; x < count; ++x)
+	{
+		pixels[0] = table[0][pixels[0]];
+		pixels[1] = table[1][pixels[1]];
+		pixels[2] = table[2][pixels[2]];
+		pixels += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MakeGammaStage
+//	Purpose:	Creates a lookup stage that applies a gamma curve to every channel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LookupStage MakeGammaStage(double gamma)
+{
+	LookupStage stage;
+
+	// a non positive gamma is treated as the identity curve
+	double exponent = (gamma > 0.0) ? 1.0 / gamma : 1.0;
+	for (int i = 0; i < 256; ++i)
+	{
+		BYTE value = (BYTE) (::pow(i / 255.0, exponent) * 255.0 + 0.5);
+		for (int channel = 0; channel < PipelineChannels; ++channel)
+		{
+			stage.table[channel][i] = value;
+		}
+	}
+
+	return stage;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MakeLevelsStage
+//	Purpose:	Creates a lookup stage that stretches the [black, white] input range to [0, 255]
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LookupStage MakeLevelsStage(BYTE black, BYTE white)
+{
+	LookupStage stage;
+
+	// an empty range is treated as a threshold at black
+	int range = (white > black) ? white - black : 1;
+	for (int i = 0; i < 256; ++i)
+	{
+		int value = ((i - black) * 255 + range / 2) / range;
+		if (value < 0) value = 0;
+		if (value > 255) value = 255;
+		for (int channel = 0; channel < PipelineChannels; ++channel)
+		{
+			stage.table[channel][i] = (BYTE) value;
+		}
+	}
+
+	return stage;
+}
@@ -0,0 +1,146 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file pipeline.h
+* \brief pipeline.h fuses per-pixel passes into a single loop over cache sized blocks
+* Example (optional):
+* \code
+* PixelPipeline<FillStage, LookupStage> pipeline(FillStage(255, 0, 255), MakeGammaStage(2.2));
+* pipeline.Run(NULL, 0, pixels, pixelWidth * 3, pixelWidth, pixelHeight);
+* \endcode
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+#include <string.h>
+#include <tuple>
+#include <utility>
+
+// consts
+const int PipelineChannels = 3;			// stages operate on interleaved rgb pixels
+const int PipelineBlockPixels = 4096;	// 4096 rgb pixels = 12 KB, small enough to stay in the L1 data cache while every stage runs over it
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Class		FillStage
+//	Purpose:	Pipeline stage that overwrites pixels with a solid color
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct FillStage
+{
+	FillStage(BYTE red, BYTE green, BYTE blue);
+	void operator()(BYTE* pixels, int count) const;
+
+	// 16 pixels of the fill color (48 bytes is the smallest run that is a multiple of both 3 channels and 16 byte registers)
+	BYTE pattern[48];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Class		SwapRedBlueStage
+//	Purpose:	Pipeline stage that swizzles rgb to bgr (and back)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SwapRedBlueStage
+{
+	void operator()(BYTE* pixels, int count) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Class		LookupStage
+//	Purpose:	Pipeline stage that maps every channel through a 256 entry table (gamma, levels, inversion, ...)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct LookupStage
+{
+	void operator()(BYTE* pixels, int count) const;
+
+	// one table per color channel
+	BYTE table[PipelineChannels][256];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MakeGammaStage
+//	Purpose:	Creates a lookup stage that applies a gamma curve to every channel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LookupStage MakeGammaStage(double gamma);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MakeLevelsStage
+//	Purpose:	Creates a lookup stage that stretches the [black, white] input range to [0, 255]
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+LookupStage MakeLevelsStage(BYTE black, BYTE white);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Class		PixelPipeline
+//	Purpose:	Runs a compile time list of stages over an image in a single pass. Each row is cut into blocks of
+//				PipelineBlockPixels and every stage is applied to a block before moving on, so the pixels are
+//				streamed through memory once no matter how many stages there are.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename... Stages>
+class PixelPipeline
+{
+public:
+	explicit PixelPipeline(const Stages&... stages) : mStages(stages...)
+	{
+	}
+
+	// source may be NULL when the first stage generates pixels, strides are in bytes and may be negative (bottom-up bitmaps)
+	void Run(const BYTE* source, ptrdiff_t sourceStride, BYTE* target, ptrdiff_t targetStride, int pixelWidth, int pixelHeight) const
+	{
+		for (int y = 0; y < pixelHeight; ++y)
+		{
+			const BYTE* sourceScan0 = (source != NULL) ? source + y * sourceStride : NULL;
+			BYTE* targetScan0 = target + y * targetStride;
+
+			for (int x = 0; x < pixelWidth; x += PipelineBlockPixels)
+			{
+				int count = (pixelWidth - x < PipelineBlockPixels) ? pixelWidth - x : PipelineBlockPixels;
+				BYTE* block = targetScan0 + x * PipelineChannels;
+
+				// pull the source block into the target, it is then hot in the cache for every stage that follows
+				if (sourceScan0 != NULL)
+				{
+					::memcpy(block, sourceScan0 + x * PipelineChannels, count * PipelineChannels);
+				}
+
+				RunStages(block, count, std::index_sequence_for<Stages...>());
+			}
+		}
+	}
+
+private:
+	template <size_t... Indices>
+	void RunStages(BYTE* block, int count, std::index_sequence<Indices...>) const
+	{
+		// expands to one call per stage in declaration order, the calls are inlined into the block loop
+		int expand[] = { 0, (std::get<Indices>(mStages)(block, count), 0)... };
+		(void) expand;
+	}
+
+	std::tuple<Stages...> mStages;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MakePixelPipeline
+//	Purpose:	Creates a pipeline and deduces the stage types from the arguments
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename... Stages>
+PixelPipeline<Stages...> MakePixelPipeline(const Stages&... stages)
+{
+	return PixelPipeline<Stages...>(stages...);
+}
@@ -0,0 +1,53 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file platform.h
+* \brief platform.h gives the modules that also build off Windows the Win32 names they use
+* \author Blake Hamilton
+*
+* On Windows this is windows.h. Elsewhere it defines the few types, macros and the RECT struct of the portable
+* modules (parallel, viewport) with the same sizes and layout, so their code reads the same as the rest of the tree.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <strings.h>
+
+typedef unsigned char BYTE;
+typedef int BOOL;
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+typedef DWORD COLORREF;
+
+#define TRUE 1
+#define FALSE 0
+#define __int64 long long
+#define _stricmp strcasecmp
+
+#define RGB(r, g, b) ((COLORREF) (((BYTE) (r)) | ((DWORD) ((BYTE) (g)) << 8) | ((DWORD) ((BYTE) (b)) << 16)))
+#define GetRValue(color) ((BYTE) (color))
+#define GetGValue(color) ((BYTE) ((color) >> 8))
+#define GetBValue(color) ((BYTE) ((color) >> 16))
+
+// same layout as the Win32 RECT
+struct RECT
+{
+	LONG left;
+	LONG top;
+	LONG right;
+	LONG bottom;
+};
+#endif
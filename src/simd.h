@@ -0,0 +1,60 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file simd.h
+* \brief simd.h detects which vector instruction sets the cpu supports at runtime
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <intrin.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CpuSupportsSsse3
+//	Purpose:	Returns true if the cpu supports the SSSE3 instruction set (SSE2 is always available on x64)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline bool CpuSupportsSsse3()
+{
+	// cpuid is slow so the answer is computed once and cached
+	static const bool supported = []()
+	{
+		int registers[4] = {};
+		::__cpuid(registers, 1);
+		return (registers[2] & (1 << 9)) != 0;
+	}();
+
+	return supported;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CpuSupportsAvx2
+//	Purpose:	Returns true if the cpu supports the AVX2 instruction set and the os saves the 32 byte registers
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline bool CpuSupportsAvx2()
+{
+	static const bool supported = []()
+	{
+		// osxsave and avx in leaf 1, ymm state enabled in xcr0, avx2 in leaf 7
+		int registers[4] = {};
+		::__cpuid(registers, 1);
+		if ((registers[2] & (1 << 27)) == 0 || (registers[2] & (1 << 28)) == 0) return false;
+		if ((::_xgetbv(0) & 6) != 6) return false;
+
+		::__cpuidex(registers, 7, 0);
+		return (registers[1] & (1 << 5)) != 0;
+	}();
+
+	return supported;
+}
@@ -0,0 +1,294 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file stats.cpp
+* \brief stats.cpp implements the image statistics kernel
+* \author Blake Hamilton
+*
+* Everything is derived from the per channel histograms, so the per pixel work is three bin increments. Runs of
+* equal pixels, the common case in flat and generated images, are found 16 pixels at a time with SSE2 and counted
+* with one increment per channel.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+#include "image.h"
+#include "parallel.h"
+#include "stats.h"
+
+// consts
+const int StatisticsRunPixels = 16;							// 48 bytes, three 16 byte registers
+const int StatisticsParallelByteSize = 1024 * 1024;			// smaller blocks of rows aren't worth starting threads for
+
+// state shared by the threads accumulating one block of rows
+struct StatisticsState
+{
+	ImageStatistics* statistics;
+	const BYTE* rows;
+	ptrdiff_t rowStride;
+	int pixelWidth;
+	CRITICAL_SECTION lock;
+};
+
+// statistics pass over a file
+struct StatisticsSinkContext
+{
+	ImageStatistics* statistics;
+	int pixelWidth;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InitImageStatistics
+//	Purpose:	Empties the statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitImageStatistics(ImageStatistics* statistics)
+{
+	if (statistics == NULL) return;
+
+	::memset(statistics, 0, sizeof(ImageStatistics));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateRows
+//	Purpose:	Single threaded kernel, adds rows to the histograms of statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AccumulateRows(ImageStatistics* statistics, const BYTE* rows, ptrdiff_t rowStride, int pixelWidth, int rowCount)
+{
+	DWORD (*even)[StatisticsLevels] = statistics->histogram;
+
+	// odd pixels count into their own bins so back to back increments of the same bin don't wait on each other
+	DWORD odd[StatisticsChannels][StatisticsLevels] = {};
+
+	for (int y = 0; y < rowCount; ++y)
+	{
+		const BYTE* row = rows + y * rowStride;
+		int x = 0;
+
+		// a pixel equals the next one when its 3 bytes match the 3 bytes after them, 48 matches make a run of 16
+		while (x + StatisticsRunPixels + 1 <= pixelWidth)
+		{
+			const BYTE* pixel = row + x * StatisticsChannels;
+			__m128i equal0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (pixel + 0)), _mm_loadu_si128((const __m128i*) (pixel + 3)));
+			__m128i equal1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (pixel + 16)), _mm_loadu_si128((const __m128i*) (pixel + 19)));
+			__m128i equal2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (pixel + 32)), _mm_loadu_si128((const __m128i*) (pixel + 35)));
+			if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(equal0, equal1), equal2)) == 0xFFFF)
+			{
+				even[0][pixel[0]] += StatisticsRunPixels;
+				even[1][pixel[1]] += StatisticsRunPixels;
+				even[2][pixel[2]] += StatisticsRunPixels;
+			}
+			else
+			{
+				for (int i = 0; i < StatisticsRunPixels * StatisticsChannels; i += 2 * StatisticsChannels)
+				{
+					even[0][pixel[i + 0]]++;
+					even[1][pixel[i + 1]]++;
+					even[2][pixel[i + 2]]++;
+					odd[0][pixel[i + 3]]++;
+					odd[1][pixel[i + 4]]++;
+					odd[2][pixel[i + 5]]++;
+				}
+			}
+
+			x += StatisticsRunPixels;
+		}
+
+		for (; x < pixelWidth; ++x)
+		{
+			const BYTE* pixel = row + x * StatisticsChannels;
+			even[0][pixel[0]]++;
+			even[1][pixel[1]]++;
+			even[2][pixel[2]]++;
+		}
+	}
+
+	for (int c = 0; c < StatisticsChannels; ++c)
+	{
+		for (int v = 0; v < StatisticsLevels; ++v)
+		{
+			even[c][v] += odd[c][v];
+		}
+	}
+
+	statistics->pixelCount += (unsigned __int64) pixelWidth * rowCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateStatisticsRange
+//	Purpose:	ParallelFor callback, accumulates rows [begin, end) and merges them into the shared statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AccumulateStatisticsRange(void* context, int begin, int end)
+{
+	StatisticsState* state = (StatisticsState*) context;
+
+	ImageStatistics* statistics = (ImageStatistics*) ::calloc(1, sizeof(ImageStatistics));
+	if (statistics == NULL)
+	{
+		// still counted, just without the private histograms
+		::EnterCriticalSection(&state->lock);
+		AccumulateRows(state->statistics, state->rows + begin * state->rowStride, state->rowStride, state->pixelWidth, end - begin);
+		::LeaveCriticalSection(&state->lock);
+		return;
+	}
+
+	AccumulateRows(statistics, state->rows + begin * state->rowStride, state->rowStride, state->pixelWidth, end - begin);
+
+	::EnterCriticalSection(&state->lock);
+	MergeImageStatistics(state->statistics, statistics);
+	::LeaveCriticalSection(&state->lock);
+
+	free(statistics);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateImageStatistics
+//	Purpose:	Adds rowCount rgb rows to the histograms, large blocks of rows are split across the processors
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AccumulateImageStatistics(ImageStatistics* statistics, const BYTE* rows, ptrdiff_t rowStride, int pixelWidth, int rowCount)
+{
+	if (statistics == NULL || rows == NULL || pixelWidth <= 0 || rowCount <= 0) return;
+
+	if ((__int64) pixelWidth * StatisticsChannels * rowCount < StatisticsParallelByteSize || rowCount < 2)
+	{
+		AccumulateRows(statistics, rows, rowStride, pixelWidth, rowCount);
+		return;
+	}
+
+	StatisticsState state = {};
+	state.statistics = statistics;
+	state.rows = rows;
+	state.rowStride = rowStride;
+	state.pixelWidth = pixelWidth;
+	::InitializeCriticalSection(&state.lock);
+	ParallelFor(rowCount, AccumulateStatisticsRange, &state);
+	::DeleteCriticalSection(&state.lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MergeImageStatistics
+//	Purpose:	Adds the histograms of source to target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void MergeImageStatistics(ImageStatistics* target, const ImageStatistics* source)
+{
+	if (target == NULL || source == NULL) return;
+
+	for (int c = 0; c < StatisticsChannels; ++c)
+	{
+		for (int v = 0; v < StatisticsLevels; ++v)
+		{
+			target->histogram[c][v] += source->histogram[c][v];
+		}
+	}
+
+	target->pixelCount += source->pixelCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishImageStatistics
+//	Purpose:	Derives minimum, maximum, sums and the solid flag from the histograms
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FinishImageStatistics(ImageStatistics* statistics)
+{
+	if (statistics == NULL) return;
+
+	statistics->solid = (statistics->pixelCount > 0) ? TRUE : FALSE;
+	for (int c = 0; c < StatisticsChannels; ++c)
+	{
+		int minimum = -1;
+		int maximum = 0;
+		unsigned __int64 sum = 0;
+		for (int v = 0; v < StatisticsLevels; ++v)
+		{
+			if (statistics->histogram[c][v] == 0) continue;
+			if (minimum < 0) minimum = v;
+			maximum = v;
+			sum += (unsigned __int64) v * statistics->histogram[c][v];
+		}
+
+		statistics->minimum[c] = (BYTE) ((minimum < 0) ? 0 : minimum);
+		statistics->maximum[c] = (BYTE) maximum;
+		statistics->sums[c] = sum;
+		if (minimum != maximum) statistics->solid = FALSE;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetChannelMean
+//	Purpose:	Returns the mean value of a channel, 0 for empty statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double GetChannelMean(const ImageStatistics* statistics, int channel)
+{
+	if (statistics == NULL || statistics->pixelCount == 0 || channel < 0 || channel >= StatisticsChannels) return 0.0;
+
+	return (double) statistics->sums[channel] / (double) statistics->pixelCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateStatisticsRows
+//	Purpose:	Row sink of the statistics pass over a file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL AccumulateStatisticsRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	StatisticsSinkContext* sink = (StatisticsSinkContext*) context;
+	AccumulateImageStatistics(sink->statistics, rows, rowStride, sink->pixelWidth, rowCount);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ComputeImageStatistics
+//	Purpose:	Returns the statistics of a BIF file, from its metadata or with a pass over its pixels
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ComputeImageStatistics(const char* filePath, ImageStatistics* statistics, BOOL* fromHeader)
+{
+	// validate parameters
+	if (filePath == NULL || statistics == NULL || fromHeader == NULL)
+	{
+		printf("Invalid parameter FilePath, Statistics or FromHeader NULL.\n");
+		return FALSE;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, filePath) == FALSE) return FALSE;
+
+	// files written with statistics answer from the header alone
+	if (reader.header.hasStatistics == TRUE)
+	{
+		::memcpy(statistics, &reader.header.statistics, sizeof(ImageStatistics));
+		*fromHeader = TRUE;
+		CloseImageReader(&reader);
+		return TRUE;
+	}
+
+	*fromHeader = FALSE;
+	InitImageStatistics(statistics);
+	StatisticsSinkContext sink = {};
+	sink.statistics = statistics;
+	sink.pixelWidth = reader.header.pixelWidth;
+	BOOL result = DecodeImageRows(&reader, ImageStripByteSize, AccumulateStatisticsRows, &sink);
+	FinishImageStatistics(statistics);
+	CloseImageReader(&reader);
+
+	return result;
+}
@@ -0,0 +1,86 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file stats.h
+* \brief stats.h computes per channel histograms, minimum, maximum, mean and solid color detection of rgb rows
+* Example (optional):
+* \code
+* ImageStatistics statistics;
+* InitImageStatistics(&statistics);
+* AccumulateImageStatistics(&statistics, rows, rowStride, pixelWidth, rowCount);
+* FinishImageStatistics(&statistics);
+* \endcode
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+// consts
+const int StatisticsChannels = 3;		// rgb
+const int StatisticsLevels = 256;		// histogram bins per channel, one per channel value
+
+// statistics of a set of rows, the summary fields are derived from the histogram by FinishImageStatistics
+struct ImageStatistics
+{
+	unsigned __int64 pixelCount;
+	BYTE minimum[StatisticsChannels];
+	BYTE maximum[StatisticsChannels];
+	unsigned __int64 sums[StatisticsChannels];
+	BOOL solid;							// every pixel has the same color, minimum holds it
+	DWORD histogram[StatisticsChannels][StatisticsLevels];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InitImageStatistics
+//	Purpose:	Empties the statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InitImageStatistics(ImageStatistics* statistics);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateImageStatistics
+//	Purpose:	Adds rowCount rgb rows to the histograms, large blocks of rows are split across the processors
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void AccumulateImageStatistics(ImageStatistics* statistics, const BYTE* rows, ptrdiff_t rowStride, int pixelWidth, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		MergeImageStatistics
+//	Purpose:	Adds the histograms of source to target
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void MergeImageStatistics(ImageStatistics* target, const ImageStatistics* source);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishImageStatistics
+//	Purpose:	Derives minimum, maximum, sums and the solid flag from the histograms
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FinishImageStatistics(ImageStatistics* statistics);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetChannelMean
+//	Purpose:	Returns the mean value of a channel, 0 for empty statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double GetChannelMean(const ImageStatistics* statistics, int channel);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ComputeImageStatistics
+//	Purpose:	Returns the statistics of a BIF file, from its metadata when it has them and otherwise with a pass
+//				over its pixels. fromHeader tells which one it was.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ComputeImageStatistics(const char* filePath, ImageStatistics* statistics, BOOL* fromHeader);
@@ -0,0 +1,1272 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file store.cpp
+* \brief store.cpp implements the content addressed tile store, its tile cache and the tile map reader and writer
+* \author Blake Hamilton
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "bif.h"
+#include "image.h"
+#include "parallel.h"
+#include "store.h"
+
+// consts
+const unsigned short StoreFileVersion = 100;
+const BYTE PackFourCC[4] = { 0x42, 0x49, 0x46, 0x50 };	// BIFP
+const BYTE IndexFourCC[4] = { 0x42, 0x49, 0x46, 0x49 };	// BIFI
+const BYTE MapFourCC[4] = { 0x42, 0x49, 0x46, 0x54 };	// BIFT
+const DWORD PackHeaderByteSize = 8;						// [4CC] + [File Version] + [Tile Size]
+const DWORD MapHeaderByteSize = 16;						// [4CC] + [File Version] + [Pixel Width] + [Pixel Height] + [Fill Color] + [Tile Size]
+
+// xxh64 primes
+const unsigned __int64 HashPrime1 = 11400714785074694791ULL;
+const unsigned __int64 HashPrime2 = 14029467366897019727ULL;
+const unsigned __int64 HashPrime3 = 1609587929392839161ULL;
+const unsigned __int64 HashPrime4 = 9650029242287828579ULL;
+const unsigned __int64 HashPrime5 = 2870177450012600261ULL;
+
+// state shared by the threads restoring one row of tiles
+struct RestoreBandState
+{
+	TileCache* cache;
+	const DWORD* bandTiles;
+	BYTE* band;
+	ptrdiff_t bandStride;
+	volatile LONG failed;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RotateLeft64
+//	Purpose:	64 bit rotate, compiles to a single rol instruction
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned __int64 RotateLeft64(unsigned __int64 value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashRound
+//	Purpose:	Mixes 8 input bytes into an xxh64 accumulator
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned __int64 HashRound(unsigned __int64 accumulator, unsigned __int64 input)
+{
+	accumulator += input * HashPrime2;
+	accumulator = RotateLeft64(accumulator, 31);
+	return accumulator * HashPrime1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashMerge
+//	Purpose:	Folds one of the four xxh64 lane accumulators into the hash
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned __int64 HashMerge(unsigned __int64 hash, unsigned __int64 lane)
+{
+	hash ^= HashRound(0, lane);
+	return hash * HashPrime1 + HashPrime4;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashBytes64
+//	Purpose:	Fast non-cryptographic 64 bit hash (XXH64), four independent lanes keep the multipliers busy
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned __int64 HashBytes64(const void* buffer, size_t byteSize, unsigned __int64 seed)
+{
+	const BYTE* bytes = (const BYTE*) buffer;
+	const BYTE* end = bytes + byteSize;
+	unsigned __int64 hash = 0;
+
+	if (byteSize >= 32)
+	{
+		unsigned __int64 lane1 = seed + HashPrime1 + HashPrime2;
+		unsigned __int64 lane2 = seed + HashPrime2;
+		unsigned __int64 lane3 = seed;
+		unsigned __int64 lane4 = seed - HashPrime1;
+
+		while (bytes + 32 <= end)
+		{
+			unsigned __int64 words[4];
+			::memcpy(words, bytes, sizeof(words));
+			lane1 = HashRound(lane1, words[0]);
+			lane2 = HashRound(lane2, words[1]);
+			lane3 = HashRound(lane3, words[2]);
+			lane4 = HashRound(lane4, words[3]);
+			bytes += 32;
+		}
+
+		hash = RotateLeft64(lane1, 1) + RotateLeft64(lane2, 7) + RotateLeft64(lane3, 12) + RotateLeft64(lane4, 18);
+		hash = HashMerge(hash, lane1);
+		hash = HashMerge(hash, lane2);
+		hash = HashMerge(hash, lane3);
+		hash = HashMerge(hash, lane4);
+	}
+	else
+	{
+		hash = seed + HashPrime5;
+	}
+
+	hash += (unsigned __int64) byteSize;
+
+	// tail
+	while (bytes + 8 <= end)
+	{
+		unsigned __int64 word;
+		::memcpy(&word, bytes, sizeof(word));
+		hash ^= HashRound(0, word);
+		hash = RotateLeft64(hash, 27) * HashPrime1 + HashPrime4;
+		bytes += 8;
+	}
+
+	if (bytes + 4 <= end)
+	{
+		unsigned int word;
+		::memcpy(&word, bytes, sizeof(word));
+		hash ^= word * HashPrime1;
+		hash = RotateLeft64(hash, 23) * HashPrime2 + HashPrime3;
+		bytes += 4;
+	}
+
+	while (bytes < end)
+	{
+		hash ^= (*bytes) * HashPrime5;
+		hash = RotateLeft64(hash, 11) * HashPrime1;
+		++bytes;
+	}
+
+	// avalanche
+	hash ^= hash >> 33;
+	hash *= HashPrime2;
+	hash ^= hash >> 29;
+	hash *= HashPrime3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		InsertSlot
+//	Purpose:	Adds a hash to the open addressing table, the caller keeps the load factor at or below one half
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void InsertSlot(TileStoreSlot* slots, DWORD slotCount, unsigned __int64 hash, DWORD tileIndex)
+{
+	DWORD mask = slotCount - 1;
+	DWORD slot = (DWORD) hash & mask;
+	while (slots[slot].tileIndex != StoreNoTile)
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	slots[slot].hash = hash;
+	slots[slot].tileIndex = tileIndex;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ResizeSlots
+//	Purpose:	Reallocates the hash table with slotCount slots and reinserts every entry
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ResizeSlots(TileStore* store, DWORD slotCount)
+{
+	TileStoreSlot* slots = (TileStoreSlot*) ::malloc(slotCount * sizeof(TileStoreSlot));
+	if (slots == NULL)
+	{
+		printf("Failed to allocate tile index.\n");
+		return FALSE;
+	}
+
+	for (DWORD i = 0; i < slotCount; ++i)
+	{
+		slots[i].hash = 0;
+		slots[i].tileIndex = StoreNoTile;
+	}
+
+	for (DWORD i = 0; i < store->slotCount; ++i)
+	{
+		if (store->slots[i].tileIndex != StoreNoTile)
+		{
+			InsertSlot(slots, slotCount, store->slots[i].hash, store->slots[i].tileIndex);
+		}
+	}
+
+	free(store->slots);
+	store->slots = slots;
+	store->slotCount = slotCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FinishPackIo
+//	Purpose:	Waits for a ReadFile or WriteFile on the pack and returns its byte count, an end of file reads
+//				zero bytes
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL FinishPackIo(HANDLE file, OVERLAPPED* position, BOOL started, DWORD* numberOfBytes)
+{
+	*numberOfBytes = 0;
+	if (started == FALSE && ::GetLastError() != ERROR_IO_PENDING)
+	{
+		if (::GetLastError() == ERROR_HANDLE_EOF) return TRUE;
+
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	// the call's own event tells it from the other reads in flight on the handle
+	if (::GetOverlappedResult(file, position, numberOfBytes, TRUE) == FALSE)
+	{
+		if (::GetLastError() == ERROR_HANDLE_EOF) return TRUE;
+
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadPackBytes
+//	Purpose:	Reads at a byte offset. The pack is opened overlapped, so reads of several threads are in flight at
+//				once instead of queueing on the handle.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadPackBytes(HANDLE file, __int64 byteOffset, void* buffer, DWORD byteSize)
+{
+	OVERLAPPED position = {};
+	position.Offset = (DWORD) byteOffset;
+	position.OffsetHigh = (DWORD) (byteOffset >> 32);
+	position.hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (position.hEvent == NULL)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	DWORD numberOfBytesRead = 0;
+	BOOL result = FinishPackIo(file, &position, ::ReadFile(file, buffer, byteSize, NULL, &position), &numberOfBytesRead);
+	::CloseHandle(position.hEvent);
+	if (result == FALSE) return FALSE;
+
+	if (numberOfBytesRead != byteSize)
+	{
+		printf("Unsupported or corrupt file. Unexpected end of file.\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WritePackBytes
+//	Purpose:	Writes at a byte offset, the pack is never written through its file pointer while readers use it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WritePackBytes(HANDLE file, __int64 byteOffset, const void* buffer, DWORD byteSize)
+{
+	OVERLAPPED position = {};
+	position.Offset = (DWORD) byteOffset;
+	position.OffsetHigh = (DWORD) (byteOffset >> 32);
+	position.hEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (position.hEvent == NULL)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	DWORD numberOfBytesWritten = 0;
+	BOOL result = FinishPackIo(file, &position, ::WriteFile(file, buffer, byteSize, NULL, &position), &numberOfBytesWritten);
+	::CloseHandle(position.hEvent);
+	if (result == FALSE) return FALSE;
+
+	if (numberOfBytesWritten != byteSize)
+	{
+		printf("Failed to write file. Disk may be full.\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckTileIndex
+//	Purpose:	Fails for a tile number that isn't in the pack, the caller holds the store lock
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CheckTileIndex(TileStore* store, DWORD tileIndex)
+{
+	// a writer may have appended tiles since a read only store was opened
+	LARGE_INTEGER fileByteSize = {};
+	if (tileIndex >= store->tileCount && store->readOnly == TRUE && ::GetFileSizeEx(store->packFile, &fileByteSize) == TRUE)
+	{
+		store->tileCount = (DWORD) ((fileByteSize.QuadPart - PackHeaderByteSize) / store->tileByteSize);
+	}
+
+	if (tileIndex >= store->tileCount)
+	{
+		printf("Corrupt tile map. Tile %lu is not in the pack.\n", tileIndex);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadTileUnlocked
+//	Purpose:	Reads a tile from the pack, the caller holds the store lock
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadTileUnlocked(TileStore* store, DWORD tileIndex, BYTE* tile)
+{
+	if (CheckTileIndex(store, tileIndex) == FALSE) return FALSE;
+	return ReadPackBytes(store->packFile, PackHeaderByteSize + (__int64) tileIndex * store->tileByteSize, tile, store->tileByteSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenStoreFile
+//	Purpose:	Opens (or creates) a pack or pack index file and validates its 8 byte header. Returns the number of
+//				whole records of recordByteSize after the header in recordCount. A read only open needs an existing
+//				file and shares it with writers. The header is read and written at its offset, so an overlapped
+//				file works too; the file pointer is left at zero.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static HANDLE OpenStoreFile(const char* filePath, const BYTE fourCC[4], int tileSize, int recordByteSize, BOOL readOnly, BOOL overlapped, DWORD* recordCount)
+{
+	DWORD flags = (overlapped == TRUE) ? FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED : FILE_ATTRIBUTE_NORMAL;
+	HANDLE file = (readOnly == TRUE) ?
+		::CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL) :
+		::CreateFile(filePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, flags, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		return INVALID_HANDLE_VALUE;
+	}
+
+	LARGE_INTEGER fileByteSize = {};
+	if (::GetFileSizeEx(file, &fileByteSize) == FALSE)
+	{
+		PrintOsErrorText();
+		::CloseHandle(file);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	BYTE header[PackHeaderByteSize] = {};
+	unsigned short headerTileSize = (unsigned short) tileSize;
+
+	// new file
+	if (fileByteSize.QuadPart == 0 && readOnly == FALSE)
+	{
+		::memcpy(header + 0, fourCC, 4);
+		::memcpy(header + 4, &StoreFileVersion, sizeof(StoreFileVersion));
+		::memcpy(header + 6, &headerTileSize, sizeof(headerTileSize));
+		if (WritePackBytes(file, 0, header, sizeof(header)) == FALSE)
+		{
+			::CloseHandle(file);
+			return INVALID_HANDLE_VALUE;
+		}
+
+		*recordCount = 0;
+		return file;
+	}
+
+	// existing file
+	unsigned short fileVersion = 0;
+	if (fileByteSize.QuadPart < PackHeaderByteSize || ReadPackBytes(file, 0, header, sizeof(header)) == FALSE)
+	{
+		printf("Unsupported or corrupt tile store %s.\n", filePath);
+		::CloseHandle(file);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	::memcpy(&fileVersion, header + 4, sizeof(fileVersion));
+	::memcpy(&headerTileSize, header + 6, sizeof(headerTileSize));
+	if (::memcmp(header, fourCC, 4) != 0 || fileVersion != StoreFileVersion || headerTileSize != tileSize)
+	{
+		printf("Unsupported tile store %s. Expected version %u with %d pixel tiles.\n", filePath, StoreFileVersion, tileSize);
+		::CloseHandle(file);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	*recordCount = (DWORD) ((fileByteSize.QuadPart - PackHeaderByteSize) / recordByteSize);
+	return file;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenTileStore
+//	Purpose:	Opens a pack file, creating it if it doesn't exist, and loads its hash index
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenTileStore(TileStore* store, const char* packPath, int tileSize)
+{
+	// validate parameters
+	if (store == NULL || packPath == NULL || tileSize <= 0 || tileSize > 1024)
+	{
+		printf("Invalid parameter Store or PackPath NULL or TileSize out of range.\n");
+		return FALSE;
+	}
+
+	::memset(store, 0, sizeof(TileStore));
+
+	// the hash index lives next to the pack
+	char* indexPath = (char*) ::malloc(strlen(packPath) + 5);
+	if (indexPath == NULL)
+	{
+		printf("Out of memory.\n");
+		return FALSE;
+	}
+
+	::strcpy(indexPath, packPath);
+	::strcat(indexPath, ".idx");
+
+	DWORD packTileCount = 0;
+	DWORD indexTileCount = 0;
+	store->packFile = OpenStoreFile(packPath, PackFourCC, tileSize, tileSize * tileSize * ImageColorChannels, FALSE, TRUE, &packTileCount);
+	store->indexFile = (store->packFile != INVALID_HANDLE_VALUE) ? OpenStoreFile(indexPath, IndexFourCC, tileSize, sizeof(unsigned __int64), FALSE, FALSE, &indexTileCount) : INVALID_HANDLE_VALUE;
+	free(indexPath);
+
+	if (store->packFile == INVALID_HANDLE_VALUE || store->indexFile == INVALID_HANDLE_VALUE)
+	{
+		if (store->packFile != INVALID_HANDLE_VALUE) ::CloseHandle(store->packFile);
+		return FALSE;
+	}
+
+	// from here on CloseTileStore cleans up
+	::InitializeCriticalSection(&store->lock);
+	store->tileSize = tileSize;
+	store->tileByteSize = tileSize * tileSize * ImageColorChannels;
+
+	// tiles are appended to the pack before their hash goes to the index, so after a crash (or if the index was
+	// deleted) the index is the shorter of the two. Its missing hashes are rebuilt from the pack, pack tiles are
+	// never dropped because tile maps point at them.
+	store->tileCount = packTileCount;
+	DWORD indexedCount = (indexTileCount < packTileCount) ? indexTileCount : packTileCount;
+
+	// size the hash table for a load factor of at most one half
+	DWORD slotCount = 1024;
+	while (slotCount < store->tileCount * 2) slotCount *= 2;
+	store->compareBuffer = (BYTE*) ::malloc(store->tileByteSize);
+	if (store->compareBuffer == NULL || ResizeSlots(store, slotCount) == FALSE)
+	{
+		CloseTileStore(store);
+		return FALSE;
+	}
+
+	// load the hashes in blocks, the index is read in order from after its header
+	const DWORD blockCount = 65536;
+	unsigned __int64* hashes = (unsigned __int64*) ::malloc(blockCount * sizeof(unsigned __int64));
+	if (hashes == NULL || SeekFile(store->indexFile, PackHeaderByteSize) == FALSE)
+	{
+		if (hashes == NULL) printf("Out of memory.\n");
+		free(hashes);
+		CloseTileStore(store);
+		return FALSE;
+	}
+
+	for (DWORD first = 0; first < indexedCount; first += blockCount)
+	{
+		DWORD count = (indexedCount - first < blockCount) ? indexedCount - first : blockCount;
+		if (ReadFileBytes(store->indexFile, hashes, (__int64) count * sizeof(unsigned __int64)) == FALSE)
+		{
+			free(hashes);
+			CloseTileStore(store);
+			return FALSE;
+		}
+
+		for (DWORD i = 0; i < count; ++i)
+		{
+			InsertSlot(store->slots, store->slotCount, hashes[i], first + i);
+		}
+	}
+
+	// rehash the pack tiles the index is missing and append their hashes
+	if (indexedCount < packTileCount)
+	{
+		// print log information message
+		printf("Rebuilding the index of %lu tiles of %s...\n", packTileCount - indexedCount, packPath);
+
+		if (SeekFile(store->indexFile, PackHeaderByteSize + (__int64) indexedCount * sizeof(unsigned __int64)) == FALSE)
+		{
+			free(hashes);
+			CloseTileStore(store);
+			return FALSE;
+		}
+
+		for (DWORD first = indexedCount; first < packTileCount; first += blockCount)
+		{
+			DWORD count = (packTileCount - first < blockCount) ? packTileCount - first : blockCount;
+			for (DWORD i = 0; i < count; ++i)
+			{
+				if (ReadTileUnlocked(store, first + i, store->compareBuffer) == FALSE)
+				{
+					free(hashes);
+					CloseTileStore(store);
+					return FALSE;
+				}
+
+				hashes[i] = HashBytes64(store->compareBuffer, store->tileByteSize, 0);
+				InsertSlot(store->slots, store->slotCount, hashes[i], first + i);
+			}
+
+			// the pack reads don't move a file pointer, the index is written in order
+			if (WriteFileBytes(store->indexFile, hashes, (__int64) count * sizeof(unsigned __int64)) == FALSE)
+			{
+				free(hashes);
+				CloseTileStore(store);
+				return FALSE;
+			}
+		}
+	}
+
+	free(hashes);
+
+	// drop only a partial tile at the end of the pack, and index entries of tiles that aren't in the pack. The
+	// overlapped pack has no file pointer to end it at.
+	FILE_END_OF_FILE_INFO packEnd = {};
+	packEnd.EndOfFile.QuadPart = PackHeaderByteSize + (__int64) store->tileCount * store->tileByteSize;
+	if (::SetFileInformationByHandle(store->packFile, FileEndOfFileInfo, &packEnd, sizeof(packEnd)) == FALSE ||
+		SeekFile(store->indexFile, PackHeaderByteSize + (__int64) store->tileCount * sizeof(unsigned __int64)) == FALSE ||
+		::SetEndOfFile(store->indexFile) == FALSE)
+	{
+		PrintOsErrorText();
+		CloseTileStore(store);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenTileStoreForReading
+//	Purpose:	Opens an existing pack file read only, for restoring. The pack is never created or truncated, and
+//				other restores and a writer can have it open at the same time.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenTileStoreForReading(TileStore* store, const char* packPath, int tileSize)
+{
+	// validate parameters
+	if (store == NULL || packPath == NULL || tileSize <= 0 || tileSize > 1024)
+	{
+		printf("Invalid parameter Store or PackPath NULL or TileSize out of range.\n");
+		return FALSE;
+	}
+
+	::memset(store, 0, sizeof(TileStore));
+
+	// the hash index is only needed to add tiles, a partial tile a writer is appending is not counted
+	DWORD packTileCount = 0;
+	store->packFile = OpenStoreFile(packPath, PackFourCC, tileSize, tileSize * tileSize * ImageColorChannels, TRUE, TRUE, &packTileCount);
+	if (store->packFile == INVALID_HANDLE_VALUE) return FALSE;
+
+	store->indexFile = INVALID_HANDLE_VALUE;
+	::InitializeCriticalSection(&store->lock);
+	store->tileSize = tileSize;
+	store->tileByteSize = tileSize * tileSize * ImageColorChannels;
+	store->tileCount = packTileCount;
+	store->readOnly = TRUE;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AddTile
+//	Purpose:	Returns the pack tile number of a tile, appending it to the pack only if it isn't there yet
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL AddTile(TileStore* store, const BYTE* tile, DWORD* tileIndex, BOOL* added)
+{
+	// validate parameters
+	if (store == NULL || tile == NULL || tileIndex == NULL)
+	{
+		printf("Invalid parameter Store, Tile or TileIndex NULL.\n");
+		return FALSE;
+	}
+
+	if (store->readOnly == TRUE)
+	{
+		printf("Tile store is open for reading only.\n");
+		return FALSE;
+	}
+
+	unsigned __int64 hash = HashBytes64(tile, store->tileByteSize, 0);
+
+	::EnterCriticalSection(&store->lock);
+
+	// look for the hash, a match is confirmed byte for byte so a collision can never alias two tiles
+	DWORD mask = store->slotCount - 1;
+	for (DWORD slot = (DWORD) hash & mask; store->slots[slot].tileIndex != StoreNoTile; slot = (slot + 1) & mask)
+	{
+		if (store->slots[slot].hash != hash) continue;
+
+		if (ReadTileUnlocked(store, store->slots[slot].tileIndex, store->compareBuffer) == FALSE)
+		{
+			::LeaveCriticalSection(&store->lock);
+			return FALSE;
+		}
+
+		if (::memcmp(store->compareBuffer, tile, store->tileByteSize) == 0)
+		{
+			*tileIndex = store->slots[slot].tileIndex;
+			if (added != NULL) *added = FALSE;
+			::LeaveCriticalSection(&store->lock);
+			return TRUE;
+		}
+	}
+
+	// grow before the table gets more than half full
+	if ((store->tileCount + 1) * 2 > store->slotCount && ResizeSlots(store, store->slotCount * 2) == FALSE)
+	{
+		::LeaveCriticalSection(&store->lock);
+		return FALSE;
+	}
+
+	// append the tile, then its hash
+	if (WritePackBytes(store->packFile, PackHeaderByteSize + (__int64) store->tileCount * store->tileByteSize, tile, store->tileByteSize) == FALSE ||
+		SeekFile(store->indexFile, PackHeaderByteSize + (__int64) store->tileCount * sizeof(hash)) == FALSE ||
+		WriteFileBytes(store->indexFile, &hash, sizeof(hash)) == FALSE)
+	{
+		::LeaveCriticalSection(&store->lock);
+		return FALSE;
+	}
+
+	InsertSlot(store->slots, store->slotCount, hash, store->tileCount);
+	*tileIndex = store->tileCount++;
+	if (added != NULL) *added = TRUE;
+
+	::LeaveCriticalSection(&store->lock);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadTile
+//	Purpose:	Reads a tile from the pack file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadTile(TileStore* store, DWORD tileIndex, BYTE* tile)
+{
+	// validate parameters
+	if (store == NULL || tile == NULL)
+	{
+		printf("Invalid parameter Store or Tile NULL.\n");
+		return FALSE;
+	}
+
+	// only the tile count needs the lock, tiles are never rewritten once they are in the pack
+	::EnterCriticalSection(&store->lock);
+	BOOL result = CheckTileIndex(store, tileIndex);
+	::LeaveCriticalSection(&store->lock);
+	if (result == FALSE) return FALSE;
+
+	return ReadPackBytes(store->packFile, PackHeaderByteSize + (__int64) tileIndex * store->tileByteSize, tile, store->tileByteSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseTileStore
+//	Purpose:	Closes the pack and frees the index
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseTileStore(TileStore* store)
+{
+	if (store == NULL || store->tileSize == 0) return;
+
+	::DeleteCriticalSection(&store->lock);
+
+	// flush data to disk
+	if (store->readOnly == FALSE)
+	{
+		::FlushFileBuffers(store->packFile);
+		::FlushFileBuffers(store->indexFile);
+		::CloseHandle(store->indexFile);
+	}
+
+	// close file handles
+	::CloseHandle(store->packFile);
+
+	free(store->slots);
+	free(store->compareBuffer);
+	::memset(store, 0, sizeof(TileStore));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetStoreTileCount
+//	Purpose:	Returns the tile count of a store, read under the store lock since AddTile and CheckTileIndex change
+//				it. Called without the cache lock so the two locks are never nested.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static DWORD GetStoreTileCount(TileStore* store)
+{
+	::EnterCriticalSection(&store->lock);
+	DWORD tileCount = store->tileCount;
+	::LeaveCriticalSection(&store->lock);
+
+	return tileCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GrowTileSlots
+//	Purpose:	Extends the tile number to cache slot map after the store has grown
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL GrowTileSlots(TileCache* cache, DWORD tileSlotCount)
+{
+	DWORD* tileSlot = (DWORD*) ::realloc(cache->tileSlot, (tileSlotCount + 1) * sizeof(DWORD));
+	if (tileSlot == NULL)
+	{
+		printf("Failed to allocate tile cache map.\n");
+		return FALSE;
+	}
+
+	for (DWORD i = cache->tileSlotCount; i < tileSlotCount; ++i)
+	{
+		tileSlot[i] = StoreNoTile;
+	}
+
+	cache->tileSlot = tileSlot;
+	cache->tileSlotCount = tileSlotCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenTileCache
+//	Purpose:	Creates a cache of capacity tiles in front of a store
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenTileCache(TileCache* cache, TileStore* store, int capacity)
+{
+	// validate parameters
+	if (cache == NULL || store == NULL || capacity <= 0)
+	{
+		printf("Invalid parameter Cache or Store NULL or Capacity zero.\n");
+		return FALSE;
+	}
+
+	::memset(cache, 0, sizeof(TileCache));
+	cache->store = store;
+	cache->capacity = capacity;
+	cache->tiles = (BYTE*) ::malloc((size_t) capacity * store->tileByteSize);
+	cache->slotTile = (DWORD*) ::malloc(capacity * sizeof(DWORD));
+	cache->referenced = (BYTE*) ::calloc(capacity, 1);
+	cache->loading = (BYTE*) ::calloc(capacity, 1);
+	if (cache->tiles == NULL || cache->slotTile == NULL || cache->referenced == NULL || cache->loading == NULL || GrowTileSlots(cache, GetStoreTileCount(store)) == FALSE)
+	{
+		printf("Failed to allocate tile cache.\n");
+		free(cache->tiles);
+		free(cache->slotTile);
+		free(cache->referenced);
+		free(cache->loading);
+		free(cache->tileSlot);
+		return FALSE;
+	}
+
+	for (int i = 0; i < capacity; ++i)
+	{
+		cache->slotTile[i] = StoreNoTile;
+	}
+
+	::InitializeCriticalSection(&cache->lock);
+	::InitializeConditionVariable(&cache->loaded);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadCachedTile
+//	Purpose:	Copies a tile out of the cache, reading it from the store on a miss. Safe to call from many threads.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadCachedTile(TileCache* cache, DWORD tileIndex, BYTE* tile)
+{
+	// validate parameters
+	if (cache == NULL || tile == NULL)
+	{
+		printf("Invalid parameter Cache or Tile NULL.\n");
+		return FALSE;
+	}
+
+	int tileByteSize = cache->store->tileByteSize;
+	DWORD storeTileCount = GetStoreTileCount(cache->store);
+
+	::EnterCriticalSection(&cache->lock);
+
+	// tiles added to the store after the cache was created
+	if (tileIndex >= cache->tileSlotCount && tileIndex < storeTileCount && GrowTileSlots(cache, storeTileCount) == FALSE)
+	{
+		::LeaveCriticalSection(&cache->lock);
+		return FALSE;
+	}
+
+	DWORD slot = StoreNoTile;
+	for (;;)
+	{
+		// hit, a slot another thread is still loading is waited for instead of read twice
+		slot = (tileIndex < cache->tileSlotCount) ? cache->tileSlot[tileIndex] : StoreNoTile;
+		if (slot != StoreNoTile && cache->loading[slot] != 0)
+		{
+			::SleepConditionVariableCS(&cache->loaded, &cache->lock, INFINITE);
+			continue;
+		}
+
+		if (slot != StoreNoTile)
+		{
+			cache->referenced[slot] = 1;
+			::memcpy(tile, cache->tiles + (size_t) slot * tileByteSize, tileByteSize);
+			cache->hits++;
+			::LeaveCriticalSection(&cache->lock);
+			return TRUE;
+		}
+
+		// miss - advance the clock hand past recently used and loading slots, clearing reference bits on the way
+		int step = 0;
+		while (step < cache->capacity * 2 && (cache->referenced[cache->hand] != 0 || cache->loading[cache->hand] != 0))
+		{
+			cache->referenced[cache->hand] = 0;
+			cache->hand = (cache->hand + 1) % cache->capacity;
+			step++;
+		}
+
+		if (cache->referenced[cache->hand] == 0 && cache->loading[cache->hand] == 0) break;
+
+		// every slot is loading, more threads than slots
+		::SleepConditionVariableCS(&cache->loaded, &cache->lock, INFINITE);
+	}
+
+	slot = (DWORD) cache->hand;
+	cache->hand = (cache->hand + 1) % cache->capacity;
+
+	// evict, then claim the slot so others wait for it rather than read the same tile
+	if (cache->slotTile[slot] != StoreNoTile)
+	{
+		cache->tileSlot[cache->slotTile[slot]] = StoreNoTile;
+	}
+
+	BOOL mapped = (tileIndex < cache->tileSlotCount) ? TRUE : FALSE;
+	cache->slotTile[slot] = mapped == TRUE ? tileIndex : StoreNoTile;
+	if (mapped == TRUE) cache->tileSlot[tileIndex] = slot;
+	cache->loading[slot] = 1;
+	cache->misses++;
+
+	// the disk read runs without the lock, the loading slot can't be evicted meanwhile
+	::LeaveCriticalSection(&cache->lock);
+	BYTE* cached = cache->tiles + (size_t) slot * tileByteSize;
+	BOOL result = ReadTile(cache->store, tileIndex, cached);
+	if (result == TRUE) ::memcpy(tile, cached, tileByteSize);
+	storeTileCount = GetStoreTileCount(cache->store);
+	::EnterCriticalSection(&cache->lock);
+
+	// a tile past the map that the store only just got is kept once the map has grown
+	if (result == TRUE && mapped == FALSE && GrowTileSlots(cache, storeTileCount) == TRUE && tileIndex < cache->tileSlotCount && cache->tileSlot[tileIndex] == StoreNoTile)
+	{
+		cache->slotTile[slot] = tileIndex;
+		cache->tileSlot[tileIndex] = slot;
+	}
+
+	// a failed read leaves the slot empty, waiting threads then read the tile themselves
+	if (result == FALSE && mapped == TRUE)
+	{
+		cache->tileSlot[tileIndex] = StoreNoTile;
+		cache->slotTile[slot] = StoreNoTile;
+	}
+
+	cache->referenced[slot] = (cache->slotTile[slot] != StoreNoTile) ? 1 : 0;
+	cache->loading[slot] = 0;
+	::WakeAllConditionVariable(&cache->loaded);
+
+	::LeaveCriticalSection(&cache->lock);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseTileCache
+//	Purpose:	Frees the cache
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseTileCache(TileCache* cache)
+{
+	if (cache == NULL || cache->tiles == NULL) return;
+
+	::DeleteCriticalSection(&cache->lock);
+	free(cache->tiles);
+	free(cache->slotTile);
+	free(cache->referenced);
+	free(cache->loading);
+	free(cache->tileSlot);
+	::memset(cache, 0, sizeof(TileCache));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteMapHeader
+//	Purpose:	Writes the tile map file header
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteMapHeader(HANDLE file, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor, int tileSize)
+{
+	BYTE header[MapHeaderByteSize] = {};
+	unsigned short headerTileSize = (unsigned short) tileSize;
+	::memcpy(header + 0, MapFourCC, sizeof(MapFourCC));
+	::memcpy(header + 4, &StoreFileVersion, sizeof(StoreFileVersion));
+	::memcpy(header + 6, &pixelWidth, sizeof(pixelWidth));
+	::memcpy(header + 8, &pixelHeight, sizeof(pixelHeight));
+	::memcpy(header + 10, &fillColor, sizeof(fillColor));
+	::memcpy(header + 14, &headerTileSize, sizeof(headerTileSize));
+
+	return WriteFileBytes(file, header, sizeof(header));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FlushBand
+//	Purpose:	Cuts the buffered row of tiles into tiles, adds them to the store and writes their numbers
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL FlushBand(StoredImageWriter* writer)
+{
+	int tileSize = writer->store->tileSize;
+	int tileRowByteSize = tileSize * ImageColorChannels;
+	ptrdiff_t bandStride = (ptrdiff_t) writer->tilesAcross * tileRowByteSize;
+
+	// the bottom row of tiles is padded with zero rows
+	if (writer->bandRows < tileSize)
+	{
+		::memset(writer->band + writer->bandRows * bandStride, 0, (tileSize - writer->bandRows) * bandStride);
+	}
+
+	for (int tileX = 0; tileX < writer->tilesAcross; ++tileX)
+	{
+		for (int y = 0; y < tileSize; ++y)
+		{
+			::memcpy(writer->tile + y * tileRowByteSize, writer->band + y * bandStride + tileX * tileRowByteSize, tileRowByteSize);
+		}
+
+		BOOL added = FALSE;
+		if (AddTile(writer->store, writer->tile, &writer->bandTiles[tileX], &added) == FALSE) return FALSE;
+		if (added == TRUE) writer->newTiles++;
+		writer->totalTiles++;
+	}
+
+	writer->bandRows = 0;
+
+	return WriteFileBytes(writer->mapFile, writer->bandTiles, writer->tilesAcross * sizeof(DWORD));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenStoredImageWriter
+//	Purpose:	Creates a tile map file, rows written to it are cut into tiles that go to the store
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenStoredImageWriter(StoredImageWriter* writer, TileStore* store, const char* mapPath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor)
+{
+	// validate parameters
+	if (writer == NULL || store == NULL || mapPath == NULL)
+	{
+		printf("Invalid parameter Writer, Store or MapPath NULL.\n");
+		return FALSE;
+	}
+
+	::memset(writer, 0, sizeof(StoredImageWriter));
+	writer->store = store;
+	writer->pixelWidth = pixelWidth;
+	writer->pixelHeight = pixelHeight;
+	writer->tilesAcross = (pixelWidth + store->tileSize - 1) / store->tileSize;
+
+	// the band is zeroed once, the padding columns on the right are never written so they stay zero
+	writer->band = (BYTE*) ::calloc((size_t) writer->tilesAcross * store->tileByteSize, 1);
+	writer->tile = (BYTE*) ::malloc(store->tileByteSize);
+	writer->bandTiles = (DWORD*) ::malloc(writer->tilesAcross * sizeof(DWORD) + 1);
+	if (writer->band == NULL || writer->tile == NULL || writer->bandTiles == NULL)
+	{
+		printf("Failed to allocate tile buffers.\n");
+		free(writer->band);
+		free(writer->tile);
+		free(writer->bandTiles);
+		return FALSE;
+	}
+
+	writer->mapFile = ::CreateFile(mapPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (writer->mapFile == INVALID_HANDLE_VALUE || WriteMapHeader(writer->mapFile, pixelWidth, pixelHeight, fillColor, store->tileSize) == FALSE)
+	{
+		if (writer->mapFile == INVALID_HANDLE_VALUE) PrintOsErrorText();
+		else ::CloseHandle(writer->mapFile);
+		free(writer->band);
+		free(writer->tile);
+		free(writer->bandTiles);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteStoredImageRows
+//	Purpose:	Appends rowCount rows of rgb pixels, rows are rowStride bytes apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteStoredImageRows(StoredImageWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	// validate parameters
+	if (writer == NULL || writer->mapFile == NULL || rows == NULL)
+	{
+		printf("Invalid parameter Writer or Rows NULL.\n");
+		return FALSE;
+	}
+
+	if (writer->rowsWritten + rowCount > writer->pixelHeight)
+	{
+		printf("Too many rows written. Image has %u rows.\n", writer->pixelHeight);
+		return FALSE;
+	}
+
+	ptrdiff_t bandStride = (ptrdiff_t) writer->tilesAcross * writer->store->tileSize * ImageColorChannels;
+	for (int y = 0; y < rowCount; ++y)
+	{
+		::memcpy(writer->band + writer->bandRows * bandStride, rows + y * rowStride, writer->pixelWidth * ImageColorChannels);
+		writer->rowsWritten++;
+
+		if (++writer->bandRows == writer->store->tileSize && FlushBand(writer) == FALSE) return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseStoredImageWriter
+//	Purpose:	Flushes the last row of tiles and closes the tile map, fails if not every row was written
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseStoredImageWriter(StoredImageWriter* writer)
+{
+	if (writer == NULL || writer->mapFile == NULL) return FALSE;
+
+	BOOL result = TRUE;
+	if (writer->rowsWritten != writer->pixelHeight)
+	{
+		printf("Incomplete image. Wrote %d of %u rows.\n", writer->rowsWritten, writer->pixelHeight);
+		result = FALSE;
+	}
+	else if (writer->bandRows > 0)
+	{
+		result = FlushBand(writer);
+	}
+
+	// flush data to disk
+	::FlushFileBuffers(writer->mapFile);
+
+	// close file handle
+	::CloseHandle(writer->mapFile);
+	writer->mapFile = NULL;
+
+	// free heap memory
+	free(writer->band);
+	free(writer->tile);
+	free(writer->bandTiles);
+	writer->band = NULL;
+	writer->tile = NULL;
+	writer->bandTiles = NULL;
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StoreImage
+//	Purpose:	Splits a BIF file into the store and writes its tile map
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL StoreImage(TileStore* store, const char* bifPath, const char* mapPath)
+{
+	// validate parameters
+	if (store == NULL || bifPath == NULL || mapPath == NULL)
+	{
+		printf("Invalid parameter Store, BifPath or MapPath NULL.\n");
+		return FALSE;
+	}
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, bifPath) == FALSE) return FALSE;
+
+	// read the image a strip at a time
+	int stripRowCount = GetStripRowCount(reader.header.pixelWidth, reader.header.pixelHeight);
+	BYTE* strip = (BYTE*) ::malloc((size_t) stripRowCount * reader.rowByteSize);
+	if (strip == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		CloseImageReader(&reader);
+		return FALSE;
+	}
+
+	StoredImageWriter writer = {};
+	if (OpenStoredImageWriter(&writer, store, mapPath, reader.header.pixelWidth, reader.header.pixelHeight, reader.header.fillColor) == FALSE)
+	{
+		free(strip);
+		CloseImageReader(&reader);
+		return FALSE;
+	}
+
+	BOOL result = TRUE;
+	for (int y = 0; y < reader.header.pixelHeight && result == TRUE; y += stripRowCount)
+	{
+		int rowCount = (reader.header.pixelHeight - y < stripRowCount) ? reader.header.pixelHeight - y : stripRowCount;
+		result = ReadImageRows(&reader, strip, reader.rowByteSize, rowCount);
+		if (result == TRUE) result = WriteStoredImageRows(&writer, strip, reader.rowByteSize, rowCount);
+	}
+
+	// the last row of tiles is flushed on close
+	if (CloseStoredImageWriter(&writer) == FALSE) result = FALSE;
+
+	// free heap memory
+	free(strip);
+	CloseImageReader(&reader);
+
+	if (result == TRUE)
+	{
+		printf("Stored %lu tiles, %lu new, %lu already in the store.\n", writer.totalTiles, writer.newTiles, writer.totalTiles - writer.newTiles);
+	}
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RestoreBandRange
+//	Purpose:	Thread callback, copies tiles [begin, end) of a row of tiles out of the cache into the band
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void RestoreBandRange(void* context, int begin, int end)
+{
+	RestoreBandState* state = (RestoreBandState*) context;
+	int tileSize = state->cache->store->tileSize;
+	int tileRowByteSize = tileSize * ImageColorChannels;
+
+	BYTE* tile = (BYTE*) ::malloc(state->cache->store->tileByteSize);
+	if (tile == NULL)
+	{
+		::InterlockedExchange(&state->failed, TRUE);
+		return;
+	}
+
+	for (int tileX = begin; tileX < end; ++tileX)
+	{
+		if (ReadCachedTile(state->cache, state->bandTiles[tileX], tile) == FALSE)
+		{
+			::InterlockedExchange(&state->failed, TRUE);
+			break;
+		}
+
+		for (int y = 0; y < tileSize; ++y)
+		{
+			::memcpy(state->band + y * state->bandStride + tileX * tileRowByteSize, tile + y * tileRowByteSize, tileRowByteSize);
+		}
+	}
+
+	free(tile);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RestoreImage
+//	Purpose:	Reassembles a BIF file from its tile map, reading tiles through the cache
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL RestoreImage(TileCache* cache, const char* mapPath, const char* bifPath)
+{
+	// validate parameters
+	if (cache == NULL || mapPath == NULL || bifPath == NULL)
+	{
+		printf("Invalid parameter Cache, MapPath or BifPath NULL.\n");
+		return FALSE;
+	}
+
+	// open tile map for read only
+	HANDLE mapFile = ::CreateFile(mapPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapFile == INVALID_HANDLE_VALUE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	// read and validate the tile map header
+	BYTE header[MapHeaderByteSize] = {};
+	unsigned short fileVersion = 0;
+	unsigned short pixelWidth = 0;
+	unsigned short pixelHeight = 0;
+	COLORREF fillColor = 0;
+	unsigned short tileSize = 0;
+	if (ReadFileBytes(mapFile, header, sizeof(header)) == FALSE)
+	{
+		::CloseHandle(mapFile);
+		return FALSE;
+	}
+
+	::memcpy(&fileVersion, header + 4, sizeof(fileVersion));
+	::memcpy(&pixelWidth, header + 6, sizeof(pixelWidth));
+	::memcpy(&pixelHeight, header + 8, sizeof(pixelHeight));
+	::memcpy(&fillColor, header + 10, sizeof(fillColor));
+	::memcpy(&tileSize, header + 14, sizeof(tileSize));
+	if (::memcmp(header, MapFourCC, sizeof(MapFourCC)) != 0 || fileVersion != StoreFileVersion || tileSize != cache->store->tileSize)
+	{
+		printf("Unsupported tile map %s. Expected version %u with %d pixel tiles.\n", mapPath, StoreFileVersion, cache->store->tileSize);
+		::CloseHandle(mapFile);
+		return FALSE;
+	}
+
+	// one row of tiles at a time
+	int tilesAcross = (pixelWidth + tileSize - 1) / tileSize;
+	ptrdiff_t bandStride = (ptrdiff_t) tilesAcross * tileSize * ImageColorChannels;
+	BYTE* band = (BYTE*) ::malloc((size_t) bandStride * tileSize);
+	DWORD* bandTiles = (DWORD*) ::malloc(tilesAcross * sizeof(DWORD) + 1);
+	BifWriter writer = {};
+	if (band == NULL || bandTiles == NULL || OpenImageWriter(&writer, bifPath, pixelWidth, pixelHeight, fillColor) == FALSE)
+	{
+		if (band == NULL || bandTiles == NULL) printf("Failed to allocate tile buffers.\n");
+		free(band);
+		free(bandTiles);
+		::CloseHandle(mapFile);
+		return FALSE;
+	}
+
+	BOOL result = TRUE;
+	for (int y = 0; y < pixelHeight && result == TRUE; y += tileSize)
+	{
+		result = ReadFileBytes(mapFile, bandTiles, tilesAcross * sizeof(DWORD));
+		if (result == FALSE) break;
+
+		RestoreBandState state = {};
+		state.cache = cache;
+		state.bandTiles = bandTiles;
+		state.band = band;
+		state.bandStride = bandStride;
+		state.failed = FALSE;
+		ParallelFor(tilesAcross, RestoreBandRange, &state);
+		if (state.failed != FALSE)
+		{
+			result = FALSE;
+			break;
+		}
+
+		int rowCount = (pixelHeight - y < tileSize) ? pixelHeight - y : tileSize;
+		result = WriteImageRows(&writer, band, bandStride, rowCount);
+	}
+
+	if (result == TRUE) result = CloseImageWriter(&writer);
+	else AbortImageWriter(&writer);
+
+	// free heap memory
+	free(band);
+	free(bandTiles);
+	::CloseHandle(mapFile);
+
+	return result;
+}
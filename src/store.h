@@ -0,0 +1,212 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file store.h
+* \brief store.h is a content addressed tile store that keeps each distinct tile once across many images
+* Example (optional):
+* \code
+* TileStore store = {};
+* OpenTileStore(&store, "c:\\images\\tiles.bifp", StoreTileSize);
+* StoreImage(&store, "c:\\images\\image.bif", "c:\\images\\image.bift");
+* CloseTileStore(&store);
+* \endcode
+* \author Blake Hamilton
+*
+* Layout
+*
+* Pack file (.bifp) - every distinct tile once:
+* 4 BYTES - Unique four letter character code = BIFP
+* 2 BYTES - File Version
+* 2 BYTES - Tile Size (pixels per tile side)
+* N BYTES - Tiles, [Tile Size] * [Tile Size] * 3 bytes each, numbered from 0 in the order they were added
+*
+* Pack index file (.bifp.idx) - lets the store be reopened without reading the tiles:
+* 4 BYTES - Unique four letter character code = BIFI
+* 2 BYTES - File Version
+* 2 BYTES - Tile Size
+* N BYTES - 64 bit hash of every tile in the pack, in tile order
+*
+* Tile map file (.bift) - one per image:
+* 4 BYTES - Unique four letter character code = BIFT
+* 2 BYTES - File Version
+* 2 BYTES - Pixel Width
+* 2 BYTES - Pixel Height
+* 4 BYTES - Fill Color
+* 2 BYTES - Tile Size
+* N BYTES - 4 byte pack tile number for every tile, row by row. Tiles on the right and bottom edge are zero padded.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <windows.h>
+#include <stddef.h>
+
+// consts
+const int StoreTileSize = 64;			// 64 x 64 rgb tile = 12 KB
+const DWORD StoreNoTile = 0xFFFFFFFF;
+const int StoreCacheTiles = 4096;		// 48 MB of 64 x 64 tiles
+
+// hash table slot, maps a tile hash to its pack tile number
+struct TileStoreSlot
+{
+	unsigned __int64 hash;
+	DWORD tileIndex;
+};
+
+// open pack file and its in memory hash index
+struct TileStore
+{
+	HANDLE packFile;
+	HANDLE indexFile;
+	int tileSize;
+	int tileByteSize;
+	DWORD tileCount;
+	TileStoreSlot* slots;		// open addressing hash table, StoreNoTile marks an empty slot
+	DWORD slotCount;			// power of two
+	BYTE* compareBuffer;		// used to verify tiles whose hash matched
+	BOOL readOnly;				// opened for restoring, no index and no AddTile
+	CRITICAL_SECTION lock;
+};
+
+// shared cache of tiles read from a store, CLOCK replacement
+struct TileCache
+{
+	TileStore* store;
+	int capacity;
+	BYTE* tiles;				// capacity tiles
+	DWORD* slotTile;			// tile number held by each cache slot
+	BYTE* referenced;			// CLOCK reference bit of each cache slot
+	BYTE* loading;				// set while a miss reads the slot's tile with the lock released
+	DWORD* tileSlot;			// cache slot of each tile number, StoreNoTile when not cached
+	DWORD tileSlotCount;
+	int hand;
+	__int64 hits;
+	__int64 misses;
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE loaded;	// woken when a slot finishes loading
+};
+
+// streaming writer that turns rows into tiles and a tile map
+struct StoredImageWriter
+{
+	TileStore* store;
+	HANDLE mapFile;
+	unsigned short pixelWidth;
+	unsigned short pixelHeight;
+	int tilesAcross;
+	BYTE* band;					// one row of tiles, padded to whole tiles
+	BYTE* tile;
+	DWORD* bandTiles;
+	int bandRows;
+	int rowsWritten;
+	DWORD totalTiles;
+	DWORD newTiles;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HashBytes64
+//	Purpose:	Fast non-cryptographic 64 bit hash (XXH64)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned __int64 HashBytes64(const void* buffer, size_t byteSize, unsigned __int64 seed);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenTileStore
+//	Purpose:	Opens a pack file, creating it if it doesn't exist, and loads its hash index
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenTileStore(TileStore* store, const char* packPath, int tileSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenTileStoreForReading
+//	Purpose:	Opens an existing pack file read only, for restoring. The pack is never created or truncated, and
+//				other restores and a writer can have it open at the same time.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenTileStoreForReading(TileStore* store, const char* packPath, int tileSize);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AddTile
+//	Purpose:	Returns the pack tile number of a tile, appending it to the pack only if it isn't there yet
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL AddTile(TileStore* store, const BYTE* tile, DWORD* tileIndex, BOOL* added);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadTile
+//	Purpose:	Reads a tile from the pack file
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadTile(TileStore* store, DWORD tileIndex, BYTE* tile);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseTileStore
+//	Purpose:	Closes the pack and frees the index
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseTileStore(TileStore* store);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenTileCache
+//	Purpose:	Creates a cache of capacity tiles in front of a store
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenTileCache(TileCache* cache, TileStore* store, int capacity);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadCachedTile
+//	Purpose:	Copies a tile out of the cache, reading it from the store on a miss. Safe to call from many threads.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadCachedTile(TileCache* cache, DWORD tileIndex, BYTE* tile);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseTileCache
+//	Purpose:	Frees the cache
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseTileCache(TileCache* cache);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenStoredImageWriter
+//	Purpose:	Creates a tile map file, rows written to it are cut into tiles that go to the store
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenStoredImageWriter(StoredImageWriter* writer, TileStore* store, const char* mapPath, unsigned short pixelWidth, unsigned short pixelHeight, COLORREF fillColor);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteStoredImageRows
+//	Purpose:	Appends rowCount rows of rgb pixels, rows are rowStride bytes apart in memory
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteStoredImageRows(StoredImageWriter* writer, const BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseStoredImageWriter
+//	Purpose:	Flushes the last row of tiles and closes the tile map, fails if not every row was written
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CloseStoredImageWriter(StoredImageWriter* writer);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StoreImage
+//	Purpose:	Splits a BIF file into the store and writes its tile map
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL StoreImage(TileStore* store, const char* bifPath, const char* mapPath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RestoreImage
+//	Purpose:	Reassembles a BIF file from its tile map, reading tiles through the cache
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL RestoreImage(TileCache* cache, const char* mapPath, const char* bifPath);
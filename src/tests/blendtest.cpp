@@ -0,0 +1,67 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file blendtest.cpp
+* \brief blendtest.cpp checks that the AVX2, SSE2 and scalar composite kernels give identical pixels
+* \author Blake Hamilton
+*
+* Blends rows of random premultiplied pixels of random lengths with every operator, through each kernel the cpu
+* supports, and compares the pixels with the scalar kernel. blendtest [Seed] repeats a run. Exits with 0 when the
+* kernels agree.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "composite.h"
+#include "simd.h"
+
+// consts
+const unsigned int TestSeed = 20211;
+const int TestRowCount = 4096;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrintOsErrorText
+//	Purpose:	Prints the friendly text associated with the last OS error message numeric code, bif.cpp isn't
+//				linked into the test
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintOsErrorText()
+{
+	LPVOID buffer = NULL;
+	::FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, ::GetLastError(), 0, (LPTSTR) &buffer, 0, NULL);
+	if (buffer == NULL) return;
+
+	printf("%s\n", (char*) buffer);
+	::LocalFree(buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		main
+//	Purpose:	Test entry point, returns 1 if a vector kernel disagrees with the scalar kernel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+	unsigned int seed = (argc > 1) ? (unsigned int) ::strtoul(argv[1], NULL, 10) : TestSeed;
+
+	if (CheckBlendKernels(seed, TestRowCount) == FALSE)
+	{
+		printf("FAIL seed %u: the vector kernels don't match the scalar kernel.\n", seed);
+		return 1;
+	}
+
+	printf("PASS seed %u: %d rows blended alike by the %s and scalar kernels.\n", seed, TestRowCount, (CpuSupportsAvx2() == true) ? "AVX2, SSE2" : "SSE2");
+
+	return 0;
+}
@@ -0,0 +1,311 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file memtest.cpp
+* \brief memtest.cpp checks that DecodeImageRows keeps the process working set within its memory budget
+* \author Blake Hamilton
+*
+* Writes a temporary image 100x larger than the budget in every encoding, decodes each one through a sink and into a
+* caller buffer, and compares the growth of the peak working set with the budget. The buffer itself isn't counted.
+* The decodes run in child processes, memtest sink|buffer <name> <file>, so the writer's buffers don't count towards
+* their peak. Exits with 0 when every check passes.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <windows.h>
+#include <Psapi.h>
+#include "bif.h"
+#include "image.h"
+
+// libs
+#pragma comment(lib, "Psapi.lib")
+
+// consts
+const size_t TestMemoryBudget = 1024 * 1024;
+const size_t TestMemorySlack = 512 * 1024;				// code, stacks and heap bookkeeping the decode touches
+const unsigned short TestPixelWidth = 8192;
+const unsigned short TestPixelHeight = (unsigned short) (TestMemoryBudget * 100 / (TestPixelWidth * ImageColorChannels) + 1);
+const int TestWriteRows = 16;
+
+// an encoding the test covers
+struct TestCase
+{
+	const char* name;
+	ImageEncoding encoding;
+	ImageFilter filter;
+};
+
+const TestCase TestCases[] =
+{
+	{ "raw", EncodingRaw, FilterNone },
+	{ "lz", EncodingLz, FilterNone },
+	{ "lz-delta", EncodingLz, FilterDelta }
+};
+
+// rows the sink has checked so far
+struct CheckSinkContext
+{
+	int nextRow;
+	BOOL mismatch;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PrintOsErrorText
+//	Purpose:	Prints the friendly text associated with the last OS error message numeric code, bif.cpp isn't
+//				linked into the test
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintOsErrorText()
+{
+	LPVOID buffer = NULL;
+	::FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, ::GetLastError(), 0, (LPTSTR) &buffer, 0, NULL);
+	if (buffer == NULL) return;
+
+	printf("%s\n", (char*) buffer);
+	::LocalFree(buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetTestPixel
+//	Purpose:	Returns the value of a channel of the test image, a hash of the position so no row is solid and
+//				the lz chunks stay about as large as the raw rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BYTE GetTestPixel(int x, int y, int channel)
+{
+	DWORD hash = ((DWORD) x * ImageColorChannels + channel) * 2654435761u ^ (DWORD) y * 40503u;
+	hash ^= hash >> 15;
+	hash *= 2246822519u;
+
+	return (BYTE) (hash >> 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		WriteTestImage
+//	Purpose:	Writes the test image a few rows at a time in one of the test encodings
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL WriteTestImage(const char* filePath, const TestCase* test)
+{
+	int rowByteSize = TestPixelWidth * ImageColorChannels;
+	BYTE* rows = (BYTE*) ::malloc((size_t) TestWriteRows * rowByteSize);
+	if (rows == NULL)
+	{
+		printf("Failed to allocate pixel buffer.\n");
+		return FALSE;
+	}
+
+	BifWriter writer = {};
+	BOOL result = (test->encoding == EncodingRaw) ? OpenImageWriter(&writer, filePath, TestPixelWidth, TestPixelHeight, RGB(0, 0, 0)) :
+		OpenEncodedImageWriter(&writer, filePath, TestPixelWidth, TestPixelHeight, RGB(0, 0, 0), test->encoding, test->filter, FALSE);
+	for (int firstRow = 0; result == TRUE && firstRow < TestPixelHeight; firstRow += TestWriteRows)
+	{
+		int rowCount = TestPixelHeight - firstRow;
+		if (rowCount > TestWriteRows) rowCount = TestWriteRows;
+
+		for (int y = 0; y < rowCount; ++y)
+		{
+			BYTE* pixel = rows + y * rowByteSize;
+			for (int x = 0; x < TestPixelWidth; ++x, pixel += ImageColorChannels)
+			{
+				for (int c = 0; c < ImageColorChannels; ++c) pixel[c] = GetTestPixel(x, firstRow + y, c);
+			}
+		}
+
+		result = WriteImageRows(&writer, rows, rowByteSize, rowCount);
+	}
+
+	if (writer.file != NULL && CloseImageWriter(&writer) == FALSE) result = FALSE;
+
+	// free heap memory
+	free(rows);
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CheckRows
+//	Purpose:	Row sink that checks the rows come in order and hold the test image
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CheckRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	CheckSinkContext* check = (CheckSinkContext*) context;
+	if (firstRow != check->nextRow)
+	{
+		check->mismatch = TRUE;
+		return FALSE;
+	}
+
+	for (int y = 0; y < rowCount; ++y)
+	{
+		const BYTE* pixel = rows + y * rowStride;
+		for (int x = 0; x < TestPixelWidth; x += 997, pixel += 997 * ImageColorChannels)
+		{
+			for (int c = 0; c < ImageColorChannels; ++c)
+			{
+				if (pixel[c] != GetTestPixel(x, firstRow + y, c))
+				{
+					check->mismatch = TRUE;
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	check->nextRow = firstRow + rowCount;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunDecodeTest
+//	Purpose:	Decodes a file with the test budget, to a sink or into a caller buffer, and checks how far the
+//				peak working set grew
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL RunDecodeTest(const char* name, const char* filePath, BOOL toBuffer)
+{
+	__int64 imageByteSize = (__int64) TestPixelWidth * TestPixelHeight * ImageColorChannels;
+	int rowByteSize = TestPixelWidth * ImageColorChannels;
+
+	BifReader reader = {};
+	if (OpenImageReader(&reader, filePath) == FALSE)
+	{
+		printf("FAIL %s: the test image didn't open.\n", name);
+		return FALSE;
+	}
+
+	// the growth is measured from the working set just before the decode starts
+	PROCESS_MEMORY_COUNTERS before = {};
+	before.cb = sizeof(before);
+	::GetProcessMemoryInfo(::GetCurrentProcess(), &before, sizeof(before));
+
+	CheckSinkContext check = {};
+	BOOL decoded = FALSE;
+	BYTE* target = NULL;
+	if (toBuffer == FALSE)
+	{
+		decoded = DecodeImageRows(&reader, TestMemoryBudget, CheckRows, &check);
+	}
+	else
+	{
+		// the untouched allocation doesn't count, the decode touches every byte of it
+		target = (BYTE*) ::malloc((size_t) imageByteSize);
+		if (target != NULL) decoded = DecodeImageToBuffer(&reader, TestMemoryBudget, target, rowByteSize);
+	}
+
+	PROCESS_MEMORY_COUNTERS after = {};
+	after.cb = sizeof(after);
+	::GetProcessMemoryInfo(::GetCurrentProcess(), &after, sizeof(after));
+
+	CloseImageReader(&reader);
+
+	__int64 growth = (__int64) after.PeakWorkingSetSize - (__int64) before.WorkingSetSize;
+	if (target != NULL)
+	{
+		growth -= imageByteSize;
+		if (decoded == TRUE) CheckRows(&check, target, rowByteSize, 0, TestPixelHeight);
+		free(target);
+	}
+
+	if (decoded == FALSE || check.mismatch == TRUE || check.nextRow != TestPixelHeight)
+	{
+		printf("FAIL %s %s: the decoded rows don't match the test image.\n", name, (toBuffer == TRUE) ? "buffer" : "sink");
+		return FALSE;
+	}
+
+	if (growth > (__int64) (TestMemoryBudget + TestMemorySlack))
+	{
+		printf("FAIL %s %s: the peak working set grew %I64d bytes decoding %I64d bytes with a budget of %I64d bytes.\n", name, (toBuffer == TRUE) ? "buffer" : "sink", growth, imageByteSize, (__int64) TestMemoryBudget);
+		return FALSE;
+	}
+
+	printf("PASS %s %s: the peak working set grew %I64d bytes decoding %I64d bytes with a budget of %I64d bytes.\n", name, (toBuffer == TRUE) ? "buffer" : "sink", growth, imageByteSize, (__int64) TestMemoryBudget);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RunChildDecodeTest
+//	Purpose:	Runs RunDecodeTest in a new process, whose peak working set only covers the decode
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL RunChildDecodeTest(const char* name, const char* filePath, BOOL toBuffer)
+{
+	char modulePath[MAX_PATH] = {};
+	if (::GetModuleFileName(NULL, modulePath, MAX_PATH) == 0)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	char commandLine[3 * MAX_PATH] = {};
+	::sprintf_s(commandLine, sizeof(commandLine), "\"%s\" %s %s \"%s\"", modulePath, (toBuffer == TRUE) ? "buffer" : "sink", name, filePath);
+
+	STARTUPINFO startup = {};
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION process = {};
+	if (::CreateProcess(NULL, commandLine, NULL, NULL, FALSE, 0, NULL, NULL, &startup, &process) == FALSE)
+	{
+		PrintOsErrorText();
+		return FALSE;
+	}
+
+	DWORD exitCode = 1;
+	::WaitForSingleObject(process.hProcess, INFINITE);
+	::GetExitCodeProcess(process.hProcess, &exitCode);
+	::CloseHandle(process.hThread);
+	::CloseHandle(process.hProcess);
+
+	return (exitCode == 0) ? TRUE : FALSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		main
+//	Purpose:	Test entry point, returns the number of failed checks
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+	// child process, decodes one file
+	if (argc == 4 && ::_stricmp(argv[1], "sink") == 0) return (RunDecodeTest(argv[2], argv[3], FALSE) == TRUE) ? 0 : 1;
+	if (argc == 4 && ::_stricmp(argv[1], "buffer") == 0) return (RunDecodeTest(argv[2], argv[3], TRUE) == TRUE) ? 0 : 1;
+
+	char directory[MAX_PATH] = {};
+	char filePath[MAX_PATH] = {};
+	if (::GetTempPath(MAX_PATH, directory) == 0 || ::GetTempFileName(directory, "bif", 0, filePath) == 0)
+	{
+		PrintOsErrorText();
+		return 1;
+	}
+
+	int failures = 0;
+	for (int i = 0; i < (int) (sizeof(TestCases) / sizeof(TestCases[0])); ++i)
+	{
+		if (WriteTestImage(filePath, &TestCases[i]) == FALSE)
+		{
+			printf("FAIL %s: the test image couldn't be written.\n", TestCases[i].name);
+			failures++;
+		}
+		else
+		{
+			if (RunChildDecodeTest(TestCases[i].name, filePath, FALSE) == FALSE) failures++;
+			if (RunChildDecodeTest(TestCases[i].name, filePath, TRUE) == FALSE) failures++;
+		}
+	}
+
+	::DeleteFile(filePath);
+
+	return failures;
+}
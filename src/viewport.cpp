@@ -0,0 +1,1034 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file viewport.cpp
+* \brief viewport.cpp implements the headless viewport renderer, its overview pyramid and its source and tile caches
+* \author Blake Hamilton
+*
+* Output pixels are addressed in scaled image space, pixel u covers source pixels [u / scale, (u + 1) / scale).
+* The viewport origin is rounded to a whole output pixel so tiles rendered for one frame line up with the next.
+* Nothing here needs windows.h, the locks are the standard library's and the pixels come from a ViewportSource.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <emmintrin.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include "parallel.h"
+#include "viewport.h"
+
+// consts
+const double ResamplePi = 3.14159265358979323846;
+const int ViewportTileByteSize = ViewportTileSize * ViewportTileSize * ViewportColorChannels;
+
+// state shared by the threads rendering the missing tiles of a frame
+struct ViewportFrame
+{
+	ViewportImage* image;
+	ResampleFilter filter;
+	int levelIndex;
+	int scaledWidth;				// image size in output pixels
+	int scaledHeight;
+	double levelStepX;				// level pixels per output pixel
+	double levelStepY;
+	double stretchX;				// kernel widening when minifying
+	double stretchY;
+	int taps;						// tap table stride, every level pixel under the widest kernel of the frame
+	ViewportTile** pending;
+	std::atomic<int> failed;
+};
+
+// locks of an open image
+struct ViewportSync
+{
+	std::mutex lock;					// guards the bands
+	std::condition_variable loaded;		// signaled when a band finishes loading
+	std::mutex readLock;				// guards the source, band reads take turns on it
+};
+
+// per thread tap tables and filtered rows, sized by the frame's tap count
+struct ViewportScratch
+{
+	int taps;
+	int xCount[ViewportTileSize];
+	int yCount[ViewportTileSize];
+	const float** filtered;			// ring rows under the current output row
+	int* xIndex;					// taps entries per tile column
+	float* xWeight;
+	int* yIndex;					// taps entries per tile row
+	float* yWeight;
+	int ringRows;					// horizontally filtered rows kept while a tile is rendered
+	int* ringRow;
+	float* ring;
+};
+
+// state of the pass that builds the first overview
+struct OverviewBuildState
+{
+	ViewportLevel* level;
+	int factor;						// source pixels per overview pixel side
+	int sourceWidth;
+	int sourceHeight;
+	DWORD* sums;					// channel sums of the overview row being built
+	const BYTE* rows;				// strip handed to the threads
+	ptrdiff_t rowStride;
+	int firstRow;
+	int rowCount;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		LoadPixel
+//	Purpose:	Loads an rgb pixel as 4 floats, reads one byte past the pixel so buffers carry a byte of padding
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128 LoadPixel(const BYTE* pixel)
+{
+	int bytes = 0;
+	::memcpy(&bytes, pixel, sizeof(bytes));
+	__m128i zero = _mm_setzero_si128();
+	__m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+	return _mm_cvtepi32_ps(values);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		StorePixel
+//	Purpose:	Rounds and saturates 4 floats to an rgb pixel, writes one byte past the pixel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline void StorePixel(BYTE* pixel, __m128 value)
+{
+	__m128i values = _mm_cvtps_epi32(value);
+	values = _mm_packs_epi32(values, values);
+	values = _mm_packus_epi16(values, values);
+	int bytes = _mm_cvtsi128_si32(values);
+	::memcpy(pixel, &bytes, sizeof(bytes));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ClampIndex
+//	Purpose:	Clamps a pixel index to [0, limit), edge pixels repeat outwards
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int ClampIndex(int index, int limit)
+{
+	if (index < 0) return 0;
+	if (index >= limit) return limit - 1;
+	return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ResampleKernel
+//	Purpose:	Evaluates the bilinear (tent) or Lanczos 3 kernel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double ResampleKernel(ResampleFilter filter, double x)
+{
+	x = fabs(x);
+	if (filter == ResampleBilinear) return (x < 1.0) ? 1.0 - x : 0.0;
+
+	if (x < 1e-8) return 1.0;
+	if (x >= 3.0) return 0.0;
+	double px = ResamplePi * x;
+	return 3.0 * sin(px) * sin(px / 3.0) / (px * px);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetKernelSupport
+//	Purpose:	Returns the radius of a filter's kernel in pixels before it is widened, 0 for nearest
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double GetKernelSupport(ResampleFilter filter)
+{
+	if (filter == ResampleNearest) return 0.0;
+	return (filter == ResampleBilinear) ? 1.0 : 3.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetMaxTaps
+//	Purpose:	Returns the most taps a kernel widened by stretch can have, one per pixel under its footprint
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int GetMaxTaps(ResampleFilter filter, double stretch)
+{
+	return 2 * (int) ceil(GetKernelSupport(filter) * stretch) + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ComputeTaps
+//	Purpose:	Fills the source indexes and normalized weights of one output pixel, returns the tap count. Every
+//				pixel under the footprint gets a tap, index and weight hold GetMaxTaps entries.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int ComputeTaps(ResampleFilter filter, double center, double stretch, int limit, int* index, float* weight)
+{
+	if (filter == ResampleNearest)
+	{
+		index[0] = ClampIndex((int) floor(center + 0.5), limit);
+		weight[0] = 1.0f;
+		return 1;
+	}
+
+	// footprint of the kernel, widened by the minification
+	double support = GetKernelSupport(filter) * stretch;
+	int first = (int) ceil(center - support);
+	int last = (int) floor(center + support);
+
+	int taps = 0;
+	double sum = 0.0;
+	for (int i = first; i <= last; ++i)
+	{
+		double w = ResampleKernel(filter, (i - center) / stretch);
+		if (w == 0.0) continue;
+		index[taps] = ClampIndex(i, limit);
+		weight[taps] = (float) w;
+		sum += w;
+		taps++;
+	}
+
+	// a footprint that only touches zeros of the kernel
+	if (taps == 0 || fabs(sum) < 1e-8)
+	{
+		index[0] = ClampIndex((int) floor(center + 0.5), limit);
+		weight[0] = 1.0f;
+		return 1;
+	}
+
+	for (int i = 0; i < taps; ++i)
+	{
+		weight[i] = (float) (weight[i] / sum);
+	}
+
+	return taps;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GetBandRowCount
+//	Purpose:	Returns the number of rows in a band, the last band can be short
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int GetBandRowCount(const ViewportImage* image, int bandIndex)
+{
+	int remainingRows = image->pixelHeight - bandIndex * image->bandRows;
+	return (remainingRows < image->bandRows) ? remainingRows : image->bandRows;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		PinLevelRow
+//	Purpose:	Returns a row of a pyramid level. Level 0 rows come from the band cache and stay pinned until
+//				UnpinLevelRow, band is -1 for rows that need no unpin.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const BYTE* PinLevelRow(ViewportImage* image, int levelIndex, int row, int* band)
+{
+	*band = -1;
+	if (levelIndex > 0)
+	{
+		const ViewportLevel* level = &image->levels[levelIndex];
+		return level->pixels + (size_t) row * level->pixelWidth * ViewportColorChannels;
+	}
+
+	int bandIndex = row / image->bandRows;
+	int rowByteSize = image->pixelWidth * ViewportColorChannels;
+
+	std::unique_lock<std::mutex> guard(image->sync->lock);
+
+	// hit, a band another thread is still reading is waited for instead of read twice
+	int slot = -1;
+	for (;;)
+	{
+		slot = -1;
+		for (int i = 0; i < image->bandCount; ++i)
+		{
+			if (image->bands[i].bandIndex == bandIndex)
+			{
+				slot = i;
+				break;
+			}
+		}
+
+		if (slot < 0 || image->bands[slot].loading == FALSE) break;
+		image->sync->loaded.wait(guard);
+	}
+
+	// miss - advance the clock hand past pinned and recently used bands, clearing their reference bits on the way.
+	// Loading bands are pinned by the thread reading them.
+	if (slot < 0)
+	{
+		while (image->bands[image->bandHand].pins > 0 || image->bands[image->bandHand].referenced != 0)
+		{
+			image->bands[image->bandHand].referenced = 0;
+			image->bandHand = (image->bandHand + 1) % image->bandCount;
+		}
+
+		slot = image->bandHand;
+		image->bandHand = (image->bandHand + 1) % image->bandCount;
+
+		ViewportBand* victim = &image->bands[slot];
+		victim->bandIndex = -1;
+		if (victim->rows == NULL) victim->rows = (BYTE*) ::malloc((size_t) image->bandRows * rowByteSize + 1);
+		if (victim->rows == NULL)
+		{
+			printf("Failed to allocate source band.\n");
+			return NULL;
+		}
+
+		// claim the band so others wait for it rather than read it too
+		victim->bandIndex = bandIndex;
+		victim->loading = TRUE;
+		victim->pins++;
+
+		// the read runs without the band lock so rows of cached bands are served meanwhile
+		guard.unlock();
+		BOOL result = FALSE;
+		{
+			std::lock_guard<std::mutex> readGuard(image->sync->readLock);
+			result = image->source.readRows(image->source.context, bandIndex * image->bandRows, victim->rows, rowByteSize, GetBandRowCount(image, bandIndex));
+		}
+
+		guard.lock();
+
+		// a failed read leaves the band empty, waiting threads then read it themselves
+		victim->loading = FALSE;
+		if (result == FALSE)
+		{
+			victim->bandIndex = -1;
+			victim->pins--;
+		}
+
+		image->sync->loaded.notify_all();
+		if (result == FALSE) return NULL;
+	}
+	else
+	{
+		image->bands[slot].pins++;
+	}
+
+	image->bands[slot].referenced = 1;
+	const BYTE* rows = image->bands[slot].rows;
+	guard.unlock();
+
+	*band = slot;
+	return rows + (size_t) (row - bandIndex * image->bandRows) * rowByteSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		UnpinLevelRow
+//	Purpose:	Releases a row returned by PinLevelRow
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void UnpinLevelRow(ViewportImage* image, int band)
+{
+	if (band < 0) return;
+
+	std::lock_guard<std::mutex> guard(image->sync->lock);
+	image->bands[band].pins--;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FilterLevelRow
+//	Purpose:	Horizontal pass, resamples one level row to the tile columns as 4 floats per pixel
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL FilterLevelRow(ViewportImage* image, int levelIndex, int row, const ViewportScratch* scratch, float* filtered)
+{
+	int band = -1;
+	const BYTE* pixels = PinLevelRow(image, levelIndex, row, &band);
+	if (pixels == NULL) return FALSE;
+
+	for (int i = 0; i < ViewportTileSize; ++i)
+	{
+		const int* index = scratch->xIndex + i * scratch->taps;
+		const float* weight = scratch->xWeight + i * scratch->taps;
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < scratch->xCount[i]; ++k)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(LoadPixel(pixels + index[k] * ViewportColorChannels), _mm_set1_ps(weight[k])));
+		}
+
+		_mm_storeu_ps(filtered + i * 4, sum);
+	}
+
+	UnpinLevelRow(image, band);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FindRingSlot
+//	Purpose:	Returns the ring slot holding a filtered row, or the slot to filter it into. The slot given up is
+//				the lowest row that the current output row doesn't use, rows only move down the image.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int FindRingSlot(const ViewportScratch* scratch, int row, const int* rowTaps, int rowTapCount)
+{
+	int victim = -1;
+	for (int i = 0; i < scratch->ringRows; ++i)
+	{
+		int slotRow = scratch->ringRow[i];
+		if (slotRow == row) return i;
+		if (slotRow < 0)
+		{
+			if (victim < 0 || scratch->ringRow[victim] >= 0) victim = i;
+			continue;
+		}
+
+		BOOL inUse = FALSE;
+		for (int k = 0; k < rowTapCount; ++k)
+		{
+			if (rowTaps[k] == slotRow) inUse = TRUE;
+		}
+
+		if (inUse == FALSE && (victim < 0 || (scratch->ringRow[victim] >= 0 && slotRow < scratch->ringRow[victim]))) victim = i;
+	}
+
+	return victim;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RenderTile
+//	Purpose:	Renders one output tile with a separable filter, the vertical pass reuses filtered rows between
+//				output rows
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL RenderTile(const ViewportFrame* frame, ViewportTile* tile, ViewportScratch* scratch)
+{
+	ViewportImage* image = frame->image;
+	const ViewportLevel* level = &image->levels[frame->levelIndex];
+
+	// background pixel for everything outside the image
+	BYTE fill[4] = { GetRValue(image->fillColor), GetGValue(image->fillColor), GetBValue(image->fillColor), 0 };
+
+	// taps of the tile columns and rows, in level pixels
+	for (int i = 0; i < ViewportTileSize; ++i)
+	{
+		int u = tile->tileX * ViewportTileSize + i;
+		int v = tile->tileY * ViewportTileSize + i;
+		scratch->xCount[i] = (u < 0 || u >= frame->scaledWidth) ? 0 : ComputeTaps(frame->filter, (u + 0.5) * frame->levelStepX - 0.5, frame->stretchX, level->pixelWidth, scratch->xIndex + i * scratch->taps, scratch->xWeight + i * scratch->taps);
+		scratch->yCount[i] = (v < 0 || v >= frame->scaledHeight) ? 0 : ComputeTaps(frame->filter, (v + 0.5) * frame->levelStepY - 0.5, frame->stretchY, level->pixelHeight, scratch->yIndex + i * scratch->taps, scratch->yWeight + i * scratch->taps);
+	}
+
+	for (int i = 0; i < scratch->ringRows; ++i)
+	{
+		scratch->ringRow[i] = -1;
+	}
+
+	for (int j = 0; j < ViewportTileSize; ++j)
+	{
+		BYTE* target = tile->pixels + (size_t) j * ViewportTileSize * ViewportColorChannels;
+		int rowTapCount = scratch->yCount[j];
+		if (rowTapCount == 0)
+		{
+			for (int i = 0; i < ViewportTileSize; ++i)
+			{
+				::memcpy(target + i * ViewportColorChannels, fill, ViewportColorChannels);
+			}
+
+			continue;
+		}
+
+		// horizontal pass for the rows under this output row that aren't in the ring yet
+		const int* rowTaps = scratch->yIndex + j * scratch->taps;
+		const float* rowWeights = scratch->yWeight + j * scratch->taps;
+		const float** filtered = scratch->filtered;
+		for (int k = 0; k < rowTapCount; ++k)
+		{
+			int slot = FindRingSlot(scratch, rowTaps[k], rowTaps, rowTapCount);
+			float* slotRow = scratch->ring + (size_t) slot * ViewportTileSize * 4;
+			if (scratch->ringRow[slot] != rowTaps[k])
+			{
+				scratch->ringRow[slot] = -1;
+				if (FilterLevelRow(image, frame->levelIndex, rowTaps[k], scratch, slotRow) == FALSE) return FALSE;
+				scratch->ringRow[slot] = rowTaps[k];
+			}
+
+			filtered[k] = slotRow;
+		}
+
+		// vertical pass
+		for (int i = 0; i < ViewportTileSize; ++i)
+		{
+			if (scratch->xCount[i] == 0)
+			{
+				::memcpy(target + i * ViewportColorChannels, fill, ViewportColorChannels);
+				continue;
+			}
+
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < rowTapCount; ++k)
+			{
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(filtered[k] + i * 4), _mm_set1_ps(rowWeights[k])));
+			}
+
+			StorePixel(target + i * ViewportColorChannels, sum);
+		}
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AllocateScratch
+//	Purpose:	Allocates the tap tables and filtered rows of a thread in one block, the ring keeps twice the taps
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static ViewportScratch* AllocateScratch(int taps)
+{
+	int ringRows = 2 * taps;
+	size_t tableSize = (size_t) ViewportTileSize * taps;
+	size_t byteSize = sizeof(ViewportScratch) + taps * sizeof(const float*) + 2 * tableSize * (sizeof(int) + sizeof(float)) +
+		ringRows * sizeof(int) + (size_t) ringRows * ViewportTileSize * 4 * sizeof(float);
+
+	BYTE* block = (BYTE*) ::malloc(byteSize);
+	if (block == NULL) return NULL;
+
+	// pointers first, then the 4 byte tables
+	ViewportScratch* scratch = (ViewportScratch*) block;
+	BYTE* next = block + sizeof(ViewportScratch);
+	scratch->taps = taps;
+	scratch->ringRows = ringRows;
+	scratch->filtered = (const float**) next;
+	next += taps * sizeof(const float*);
+	scratch->xIndex = (int*) next;
+	next += tableSize * sizeof(int);
+	scratch->xWeight = (float*) next;
+	next += tableSize * sizeof(float);
+	scratch->yIndex = (int*) next;
+	next += tableSize * sizeof(int);
+	scratch->yWeight = (float*) next;
+	next += tableSize * sizeof(float);
+	scratch->ringRow = (int*) next;
+	next += ringRows * sizeof(int);
+	scratch->ring = (float*) next;
+
+	return scratch;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RenderTileRange
+//	Purpose:	ParallelFor callback, renders a range of the frame's missing tiles
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void RenderTileRange(void* context, int begin, int end)
+{
+	ViewportFrame* frame = (ViewportFrame*) context;
+
+	ViewportScratch* scratch = AllocateScratch(frame->taps);
+	if (scratch == NULL)
+	{
+		printf("Failed to allocate viewport scratch buffers.\n");
+		frame->failed = 1;
+		return;
+	}
+
+	for (int i = begin; i < end && frame->failed == 0; ++i)
+	{
+		ViewportTile* tile = frame->pending[i];
+		if (RenderTile(frame, tile, scratch) == FALSE)
+		{
+			frame->failed = 1;
+			break;
+		}
+
+		tile->valid = TRUE;
+	}
+
+	free(scratch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		GrowTileCache
+//	Purpose:	Makes room for at least tileCount tiles
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL GrowTileCache(ViewportImage* image, int tileCount)
+{
+	if (tileCount <= image->tileCount) return TRUE;
+
+	ViewportTile* tiles = (ViewportTile*) ::realloc(image->tiles, tileCount * sizeof(ViewportTile));
+	if (tiles == NULL)
+	{
+		printf("Failed to allocate viewport tile cache.\n");
+		return FALSE;
+	}
+
+	image->tiles = tiles;
+	while (image->tileCount < tileCount)
+	{
+		ViewportTile* tile = &image->tiles[image->tileCount];
+		::memset(tile, 0, sizeof(ViewportTile));
+		tile->pixels = (BYTE*) ::malloc(ViewportTileByteSize + 1);
+		if (tile->pixels == NULL)
+		{
+			printf("Failed to allocate viewport tile cache.\n");
+			return FALSE;
+		}
+
+		image->tileCount++;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AcquireTile
+//	Purpose:	Returns the cached tile for a key, or evicts a tile not used by the current frame and claims it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static ViewportTile* AcquireTile(ViewportImage* image, double scaleX, double scaleY, ResampleFilter filter, int tileX, int tileY)
+{
+	// hit
+	for (int i = 0; i < image->tileCount; ++i)
+	{
+		ViewportTile* tile = &image->tiles[i];
+		if (tile->valid == TRUE && tile->tileX == tileX && tile->tileY == tileY && tile->scaleX == scaleX && tile->scaleY == scaleY && tile->filter == filter)
+		{
+			tile->frame = image->frame;
+			tile->referenced = 1;
+			image->tileHits++;
+			return tile;
+		}
+	}
+
+	// miss - advance the clock hand past tiles of this frame and recently used tiles
+	for (;;)
+	{
+		ViewportTile* tile = &image->tiles[image->tileHand];
+		image->tileHand = (image->tileHand + 1) % image->tileCount;
+		if (tile->frame == image->frame) continue;
+		if (tile->referenced != 0)
+		{
+			tile->referenced = 0;
+			continue;
+		}
+
+		tile->scaleX = scaleX;
+		tile->scaleY = scaleY;
+		tile->filter = filter;
+		tile->tileX = tileX;
+		tile->tileY = tileY;
+		tile->valid = FALSE;
+		tile->frame = image->frame;
+		tile->referenced = 1;
+		image->tileMisses++;
+		return tile;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FloorDivide
+//	Purpose:	Integer division rounding towards negative infinity
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int FloorDivide(int value, int divisor)
+{
+	return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RenderViewport
+//	Purpose:	Renders sourceRect scaled to targetWidth x targetHeight rgb pixels into a caller owned buffer
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL RenderViewport(ViewportImage* image, const RECT* sourceRect, int targetWidth, int targetHeight, ResampleFilter filter, BYTE* target, ptrdiff_t targetStride)
+{
+	// validate parameters
+	if (image == NULL || image->sync == NULL || sourceRect == NULL || target == NULL)
+	{
+		printf("Invalid parameter Image, SourceRect or Target NULL.\n");
+		return FALSE;
+	}
+
+	if (sourceRect->right <= sourceRect->left || sourceRect->bottom <= sourceRect->top || targetWidth <= 0 || targetHeight <= 0)
+	{
+		printf("Invalid parameter SourceRect or target size empty.\n");
+		return FALSE;
+	}
+
+	double scaleX = (double) targetWidth / (sourceRect->right - sourceRect->left);
+	double scaleY = (double) targetHeight / (sourceRect->bottom - sourceRect->top);
+
+	ViewportFrame frame = {};
+	frame.image = image;
+	frame.filter = filter;
+	frame.scaledWidth = (int) floor(image->pixelWidth * scaleX + 0.5);
+	frame.scaledHeight = (int) floor(image->pixelHeight * scaleY + 0.5);
+	if (frame.scaledWidth < 1) frame.scaledWidth = 1;
+	if (frame.scaledHeight < 1) frame.scaledHeight = 1;
+
+	// smallest level that still has at least as many pixels as the output. Between overviews the kernel widens by
+	// less than 2x, from level 0 by up to the first overview's factor and anisotropic views by more on one axis.
+	frame.levelIndex = 0;
+	for (int i = image->levelCount - 1; i > 0; --i)
+	{
+		if (image->levels[i].pixelWidth >= frame.scaledWidth && image->levels[i].pixelHeight >= frame.scaledHeight)
+		{
+			frame.levelIndex = i;
+			break;
+		}
+	}
+
+	const ViewportLevel* level = &image->levels[frame.levelIndex];
+	frame.levelStepX = (double) level->pixelWidth / frame.scaledWidth;
+	frame.levelStepY = (double) level->pixelHeight / frame.scaledHeight;
+	frame.stretchX = (frame.levelStepX > 1.0) ? frame.levelStepX : 1.0;
+	frame.stretchY = (frame.levelStepY > 1.0) ? frame.levelStepY : 1.0;
+
+	// the taps cover the whole footprint however wide, sampling a wide kernel sparsely would alias
+	frame.taps = GetMaxTaps(filter, (frame.stretchX > frame.stretchY) ? frame.stretchX : frame.stretchY);
+
+	// tiles under the viewport
+	int originX = (int) floor(sourceRect->left * scaleX + 0.5);
+	int originY = (int) floor(sourceRect->top * scaleY + 0.5);
+	int firstTileX = FloorDivide(originX, ViewportTileSize);
+	int firstTileY = FloorDivide(originY, ViewportTileSize);
+	int tilesAcross = FloorDivide(originX + targetWidth - 1, ViewportTileSize) - firstTileX + 1;
+	int tilesDown = FloorDivide(originY + targetHeight - 1, ViewportTileSize) - firstTileY + 1;
+	int frameTiles = tilesAcross * tilesDown;
+
+	if (GrowTileCache(image, frameTiles + 1) == FALSE) return FALSE;
+
+	ViewportTile** tiles = (ViewportTile**) ::malloc(frameTiles * sizeof(ViewportTile*) * 2);
+	if (tiles == NULL)
+	{
+		printf("Failed to allocate viewport frame.\n");
+		return FALSE;
+	}
+
+	// look every tile up, the ones not cached are claimed and rendered in parallel
+	image->frame++;
+	frame.pending = tiles + frameTiles;
+	int pendingCount = 0;
+	for (int ty = 0; ty < tilesDown; ++ty)
+	{
+		for (int tx = 0; tx < tilesAcross; ++tx)
+		{
+			ViewportTile* tile = AcquireTile(image, scaleX, scaleY, filter, firstTileX + tx, firstTileY + ty);
+			tiles[ty * tilesAcross + tx] = tile;
+			if (tile->valid == FALSE) frame.pending[pendingCount++] = tile;
+		}
+	}
+
+	ParallelFor(pendingCount, RenderTileRange, &frame);
+	if (frame.failed != 0)
+	{
+		free(tiles);
+		return FALSE;
+	}
+
+	// copy the visible part of every tile
+	for (int ty = 0; ty < tilesDown; ++ty)
+	{
+		for (int tx = 0; tx < tilesAcross; ++tx)
+		{
+			const ViewportTile* tile = tiles[ty * tilesAcross + tx];
+			int tileLeft = tile->tileX * ViewportTileSize;
+			int tileTop = tile->tileY * ViewportTileSize;
+			int left = (tileLeft > originX) ? tileLeft : originX;
+			int top = (tileTop > originY) ? tileTop : originY;
+			int right = (tileLeft + ViewportTileSize < originX + targetWidth) ? tileLeft + ViewportTileSize : originX + targetWidth;
+			int bottom = (tileTop + ViewportTileSize < originY + targetHeight) ? tileTop + ViewportTileSize : originY + targetHeight;
+
+			for (int y = top; y < bottom; ++y)
+			{
+				::memcpy(target + (y - originY) * targetStride + (ptrdiff_t) (left - originX) * ViewportColorChannels,
+					tile->pixels + ((size_t) (y - tileTop) * ViewportTileSize + (left - tileLeft)) * ViewportColorChannels,
+					(size_t) (right - left) * ViewportColorChannels);
+			}
+		}
+	}
+
+	free(tiles);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateOverviewRange
+//	Purpose:	ParallelFor callback, adds a strip to the overview sums of a range of overview columns and writes
+//				every overview row that is complete
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void AccumulateOverviewRange(void* context, int begin, int end)
+{
+	OverviewBuildState* state = (OverviewBuildState*) context;
+	int factor = state->factor;
+	int sourceWidth = state->sourceWidth;
+	int levelRowByteSize = state->level->pixelWidth * ViewportColorChannels;
+	int firstColumn = begin * factor;
+	int lastColumn = (end * factor < sourceWidth) ? end * factor : sourceWidth;
+
+	for (int y = 0; y < state->rowCount; ++y)
+	{
+		int row = state->firstRow + y;
+		const BYTE* source = state->rows + y * state->rowStride;
+
+		for (int x = firstColumn; x < lastColumn; ++x)
+		{
+			DWORD* sum = state->sums + (x / factor) * ViewportColorChannels;
+			const BYTE* pixel = source + x * ViewportColorChannels;
+			sum[0] += pixel[0];
+			sum[1] += pixel[1];
+			sum[2] += pixel[2];
+		}
+
+		// the last source row of an overview row, or of the image
+		if ((row + 1) % factor != 0 && row + 1 != state->sourceHeight) continue;
+
+		int cellRows = row % factor + 1;
+		BYTE* target = state->level->pixels + (size_t) (row / factor) * levelRowByteSize;
+		for (int cell = begin; cell < end; ++cell)
+		{
+			int cellColumns = (sourceWidth - cell * factor < factor) ? sourceWidth - cell * factor : factor;
+			DWORD count = (DWORD) (cellRows * cellColumns);
+			DWORD* sum = state->sums + cell * ViewportColorChannels;
+			for (int c = 0; c < ViewportColorChannels; ++c)
+			{
+				target[cell * ViewportColorChannels + c] = (BYTE) ((sum[c] + count / 2) / count);
+				sum[c] = 0;
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AccumulateOverviewRows
+//	Purpose:	Row sink of the overview pass, splits the strip across the processors by overview column
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL AccumulateOverviewRows(void* context, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount)
+{
+	OverviewBuildState* state = (OverviewBuildState*) context;
+	state->rows = rows;
+	state->rowStride = rowStride;
+	state->firstRow = firstRow;
+	state->rowCount = rowCount;
+	ParallelFor(state->level->pixelWidth, AccumulateOverviewRange, state);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		AllocateLevel
+//	Purpose:	Allocates the pixels of a pyramid level, plus the byte of padding LoadPixel reads
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL AllocateLevel(ViewportLevel* level, int pixelWidth, int pixelHeight)
+{
+	level->pixelWidth = pixelWidth;
+	level->pixelHeight = pixelHeight;
+	level->pixels = (BYTE*) ::calloc((size_t) pixelWidth * pixelHeight * ViewportColorChannels + 1, 1);
+	if (level->pixels == NULL)
+	{
+		printf("Failed to allocate overview of %d x %d pixels.\n", pixelWidth, pixelHeight);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		HalveLevel
+//	Purpose:	Builds a level from the one above with a 2 x 2 box filter
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void HalveLevel(const ViewportLevel* source, ViewportLevel* target)
+{
+	int sourceRowByteSize = source->pixelWidth * ViewportColorChannels;
+	for (int y = 0; y < target->pixelHeight; ++y)
+	{
+		const BYTE* top = source->pixels + (size_t) (2 * y) * sourceRowByteSize;
+		const BYTE* bottom = (2 * y + 1 < source->pixelHeight) ? top + sourceRowByteSize : top;
+		BYTE* row = target->pixels + (size_t) y * target->pixelWidth * ViewportColorChannels;
+		for (int x = 0; x < target->pixelWidth; ++x)
+		{
+			int left = 2 * x * ViewportColorChannels;
+			int right = (2 * x + 1 < source->pixelWidth) ? left + ViewportColorChannels : left;
+			for (int c = 0; c < ViewportColorChannels; ++c)
+			{
+				row[x * ViewportColorChannels + c] = (BYTE) ((top[left + c] + top[right + c] + bottom[left + c] + bottom[right + c] + 2) / 4);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		BuildOverviews
+//	Purpose:	Builds the pyramid below level 0, the first overview in one pass over the file and every further
+//				level from the one above until a level fits in a tile
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL BuildOverviews(ViewportImage* image)
+{
+	image->levelCount = 1;
+	if (image->pixelWidth <= ViewportTileSize && image->pixelHeight <= ViewportTileSize) return TRUE;
+
+	// first overview, the smallest power of two reduction that fits ViewportOverviewByteSize
+	int factor = 2;
+	while ((__int64) ((image->pixelWidth + factor - 1) / factor) * ((image->pixelHeight + factor - 1) / factor) * ViewportColorChannels > ViewportOverviewByteSize)
+	{
+		factor *= 2;
+	}
+
+	ViewportLevel* level = &image->levels[1];
+	if (AllocateLevel(level, (image->pixelWidth + factor - 1) / factor, (image->pixelHeight + factor - 1) / factor) == FALSE) return FALSE;
+	image->levelCount = 2;
+
+	OverviewBuildState state = {};
+	state.level = level;
+	state.factor = factor;
+	state.sourceWidth = image->pixelWidth;
+	state.sourceHeight = image->pixelHeight;
+	state.sums = (DWORD*) ::calloc((size_t) level->pixelWidth * ViewportColorChannels, sizeof(DWORD));
+	if (state.sums == NULL)
+	{
+		printf("Failed to allocate overview sums.\n");
+		return FALSE;
+	}
+
+	BOOL result = image->source.scanRows(image->source.context, AccumulateOverviewRows, &state);
+	free(state.sums);
+	if (result == FALSE) return FALSE;
+
+	// halve until a level fits in a tile
+	while (image->levelCount < ViewportMaxLevels && (level->pixelWidth > ViewportTileSize || level->pixelHeight > ViewportTileSize))
+	{
+		ViewportLevel* next = &image->levels[image->levelCount];
+		if (AllocateLevel(next, (level->pixelWidth + 1) / 2, (level->pixelHeight + 1) / 2) == FALSE) return FALSE;
+		image->levelCount++;
+		HalveLevel(level, next);
+		level = next;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		FreeViewportImage
+//	Purpose:	Frees the pyramid, the caches and the locks, everything but the source
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FreeViewportImage(ViewportImage* image)
+{
+	// free heap memory
+	for (int i = 0; i < image->bandCount; ++i)
+	{
+		free(image->bands[i].rows);
+	}
+
+	for (int i = 0; i < image->tileCount; ++i)
+	{
+		free(image->tiles[i].pixels);
+	}
+
+	for (int i = 1; i < image->levelCount; ++i)
+	{
+		free(image->levels[i].pixels);
+	}
+
+	free(image->bands);
+	free(image->tiles);
+	delete image->sync;
+	::memset(image, 0, sizeof(ViewportImage));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenViewportSource
+//	Purpose:	Opens an image for viewport rendering from any source and builds its overview pyramid
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenViewportSource(ViewportImage* image, const ViewportSource* source)
+{
+	// validate parameters
+	if (image == NULL || source == NULL || source->readRows == NULL || source->scanRows == NULL)
+	{
+		printf("Invalid parameter Image or Source NULL or Source without ReadRows or ScanRows.\n");
+		return FALSE;
+	}
+
+	if (source->pixelWidth <= 0 || source->pixelHeight <= 0 || source->bandRows <= 0)
+	{
+		printf("Invalid parameter Source size or BandRows empty.\n");
+		return FALSE;
+	}
+
+	::memset(image, 0, sizeof(ViewportImage));
+	image->source = *source;
+	image->pixelWidth = source->pixelWidth;
+	image->pixelHeight = source->pixelHeight;
+	image->fillColor = source->fillColor;
+	image->bandRows = source->bandRows;
+	image->levels[0].pixelWidth = image->pixelWidth;
+	image->levels[0].pixelHeight = image->pixelHeight;
+	image->levelCount = 1;
+
+	// every rendering thread pins at most one band at a time, so the clock always finds an unpinned band
+	image->bandCount = 2 * GetProcessorCount();
+	if (image->bandCount < ViewportSourceBands) image->bandCount = ViewportSourceBands;
+	image->bands = (ViewportBand*) ::calloc(image->bandCount, sizeof(ViewportBand));
+	image->sync = new (std::nothrow) ViewportSync();
+	if (image->bands == NULL || image->sync == NULL)
+	{
+		printf("Failed to allocate source band cache.\n");
+		FreeViewportImage(image);
+		return FALSE;
+	}
+
+	for (int i = 0; i < image->bandCount; ++i)
+	{
+		image->bands[i].bandIndex = -1;
+	}
+
+	// a failed open leaves the source to the caller
+	if (GrowTileCache(image, ViewportCacheTiles) == FALSE || BuildOverviews(image) == FALSE)
+	{
+		FreeViewportImage(image);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseViewportImage
+//	Purpose:	Closes the source and frees the pyramid and the caches
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseViewportImage(ViewportImage* image)
+{
+	if (image == NULL || image->sync == NULL) return;
+
+	if (image->source.close != NULL) image->source.close(image->source.context);
+	FreeViewportImage(image);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseResampleFilter
+//	Purpose:	Converts a command line filter name (nearest, bilinear, lanczos)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseResampleFilter(const char* name, ResampleFilter* filter)
+{
+	if (name == NULL || filter == NULL) return FALSE;
+
+	if (::_stricmp(name, "nearest") == 0) *filter = ResampleNearest;
+	else if (::_stricmp(name, "bilinear") == 0) *filter = ResampleBilinear;
+	else if (::_stricmp(name, "lanczos") == 0) *filter = ResampleLanczos;
+	else return FALSE;
+
+	return TRUE;
+}
@@ -0,0 +1,173 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file viewport.h
+* \brief viewport.h renders any rectangle of a BIF image at any size without a window, for pan and zoom of huge images
+* Example (optional):
+* \code
+* ViewportImage image = {};
+* OpenViewportImage(&image, "c:\\images\\huge.bif");
+* RECT sourceRect = { 10000, 20000, 14000, 22250 };
+* RenderViewport(&image, &sourceRect, 1920, 1080, ResampleLanczos, pixels, 1920 * 3);
+* CloseViewportImage(&image);
+* \endcode
+* \author Blake Hamilton
+*
+* Frames are assembled from output tiles that are kept between frames, so panning only renders the tiles that
+* scrolled in. Source pixels come from the file a band of rows at a time, only for the rows under the viewport.
+* Zoomed out views come from an in memory pyramid of box filtered overviews that is built when the image is opened.
+*
+* The renderer (viewport.cpp) builds without windows.h, it reads its pixels through a ViewportSource and uses the
+* standard library for its locks. OpenViewportImage (viewportfile.cpp) is the source for BIF files, which are read
+* with the Win32 file calls of image.h. Other platforms or formats open a ViewportSource of their own.
+*
+* $Header: $
+* $Log: $
+*/
+
+#pragma once
+
+// includes
+#include <stddef.h>
+#include "platform.h"
+
+// consts
+const int ViewportColorChannels = 3;						// rgb
+const int ViewportTileSize = 256;							// output pixels per tile side
+const int ViewportCacheTiles = 128;							// 24 MB of tiles, grown if a single frame needs more
+const int ViewportSourceBands = 64;							// cached bands of source rows
+const int ViewportOverviewByteSize = 64 * 1024 * 1024;		// largest in memory overview
+const int ViewportMaxLevels = 16;
+
+// resampling filters
+enum ResampleFilter
+{
+	ResampleNearest = 0,
+	ResampleBilinear = 1,
+	ResampleLanczos = 2			// 3 lobes
+};
+
+// reads rowCount rgb rows from firstRow, the calls never overlap
+typedef BOOL (*ViewportReadRows)(void* context, int firstRow, BYTE* rows, ptrdiff_t rowStride, int rowCount);
+
+// gets the rows of ViewportScanRows, a strip at a time
+typedef BOOL (*ViewportRowSink)(void* sinkContext, const BYTE* rows, ptrdiff_t rowStride, int firstRow, int rowCount);
+
+// hands every rgb row of the image to the sink once from the top, called once to build the overviews
+typedef BOOL (*ViewportScanRows)(void* context, ViewportRowSink sink, void* sinkContext);
+
+// frees the source
+typedef void (*ViewportCloseSource)(void* context);
+
+// where the pixels of a viewport image come from
+struct ViewportSource
+{
+	int pixelWidth;
+	int pixelHeight;
+	COLORREF fillColor;
+	int bandRows;				// rows per read, whole chunks of an encoded file are the cheapest reads
+	ViewportReadRows readRows;
+	ViewportScanRows scanRows;
+	ViewportCloseSource close;	// may be NULL
+	void* context;
+};
+
+// locks of an open image, defined in viewport.cpp
+struct ViewportSync;
+
+// one level of the image pyramid
+struct ViewportLevel
+{
+	int pixelWidth;
+	int pixelHeight;
+	BYTE* pixels;				// rgb rows, NULL for level 0 which is read from the file
+};
+
+// band of source rows read from the file
+struct ViewportBand
+{
+	int bandIndex;				// -1 when empty
+	int pins;					// threads using the band, pinned bands are never evicted
+	BOOL loading;				// the thread that claimed the band is still reading it
+	BYTE referenced;			// CLOCK reference bit
+	BYTE* rows;
+};
+
+// rendered output tile
+struct ViewportTile
+{
+	double scaleX;
+	double scaleY;
+	ResampleFilter filter;
+	int tileX;
+	int tileY;
+	BOOL valid;
+	DWORD frame;				// last frame that used the tile, tiles of the current frame are never evicted
+	BYTE referenced;			// CLOCK reference bit
+	BYTE* pixels;				// ViewportTileSize rows of rgb pixels
+};
+
+// open image with its pyramid, source band cache and tile cache
+struct ViewportImage
+{
+	ViewportSource source;
+	int pixelWidth;
+	int pixelHeight;
+	COLORREF fillColor;			// drawn where the viewport is outside the image
+	ViewportLevel levels[ViewportMaxLevels];
+	int levelCount;
+	int bandRows;
+	ViewportBand* bands;
+	int bandCount;
+	int bandHand;
+	ViewportSync* sync;			// guards the bands and the source
+	ViewportTile* tiles;
+	int tileCount;
+	int tileHand;
+	DWORD frame;
+	__int64 tileHits;
+	__int64 tileMisses;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenViewportSource
+//	Purpose:	Opens an image for viewport rendering from any source and builds its overview pyramid (one scan of
+//				the rows). The image owns the source once the open succeeds, CloseViewportImage closes it.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenViewportSource(ViewportImage* image, const ViewportSource* source);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenViewportImage
+//	Purpose:	Opens a BIF file of any version for viewport rendering and builds its overview pyramid (one pass over
+//				the file). Windows only, see viewportfile.cpp.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenViewportImage(ViewportImage* image, const char* filePath);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		RenderViewport
+//	Purpose:	Renders sourceRect (image pixels, may extend past the image) scaled to targetWidth x targetHeight rgb
+//				pixels into a caller owned buffer. Not reentrant for the same image.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL RenderViewport(ViewportImage* image, const RECT* sourceRect, int targetWidth, int targetHeight, ResampleFilter filter, BYTE* target, ptrdiff_t targetStride);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseViewportImage
+//	Purpose:	Closes the source and frees the pyramid and the caches
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CloseViewportImage(ViewportImage* image);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ParseResampleFilter
+//	Purpose:	Converts a command line filter name (nearest, bilinear, lanczos)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseResampleFilter(const char* name, ResampleFilter* filter);
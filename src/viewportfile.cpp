@@ -0,0 +1,113 @@
+/*
+* Copyright 2021 Blake Hamilton. All rights reserved
+* All tags in the source code that seem different are meant
+* for automatic documentation generator. Automatic documentation
+* generator used is DOXYGEN.
+*
+*/
+/**
+* \file viewportfile.cpp
+* \brief viewportfile.cpp opens BIF files for the viewport renderer through a ViewportSource
+* \author Blake Hamilton
+*
+* This is the Windows part of the viewport, the BifReader of image.h reads the file with the Win32 file calls.
+*
+* $Header: $
+* $Log: $
+*/
+
+// includes
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "image.h"
+#include "viewport.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ReadFileRows
+//	Purpose:	ViewportReadRows of a BIF file, seeks to the band and decodes it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ReadFileRows(void* context, int firstRow, BYTE* rows, ptrdiff_t rowStride, int rowCount)
+{
+	return ReadImageRowsAt((BifReader*) context, firstRow, rows, rowStride, rowCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		ScanFileRows
+//	Purpose:	ViewportScanRows of a BIF file, decodes the whole file in strips on every processor
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL ScanFileRows(void* context, ViewportRowSink sink, void* sinkContext)
+{
+	// the scan comes before any band read, the reader is still at the first row
+	return DecodeImageRows((BifReader*) context, ImageStripByteSize, sink, sinkContext);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		CloseFileSource
+//	Purpose:	ViewportCloseSource of a BIF file, closes the reader and frees it
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CloseFileSource(void* context)
+{
+	BifReader* reader = (BifReader*) context;
+	CloseImageReader(reader);
+	free(reader);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//	Method		OpenViewportImage
+//	Purpose:	Opens a BIF file for viewport rendering and builds its overview pyramid
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL OpenViewportImage(ViewportImage* image, const char* filePath)
+{
+	// validate parameters
+	if (image == NULL || filePath == NULL)
+	{
+		printf("Invalid parameter Image or FilePath NULL.\n");
+		return FALSE;
+	}
+
+	BifReader* reader = (BifReader*) ::calloc(1, sizeof(BifReader));
+	if (reader == NULL)
+	{
+		printf("Out of memory.\n");
+		return FALSE;
+	}
+
+	if (OpenImageReader(reader, filePath) == FALSE)
+	{
+		free(reader);
+		return FALSE;
+	}
+
+	ViewportSource source = {};
+	source.pixelWidth = reader->header.pixelWidth;
+	source.pixelHeight = reader->header.pixelHeight;
+	source.fillColor = reader->header.fillColor;
+	source.readRows = ReadFileRows;
+	source.scanRows = ScanFileRows;
+	source.close = CloseFileSource;
+	source.context = reader;
+
+	// bands match the chunks of encoded files so a band decodes exactly one chunk
+	if (reader->header.encoding == EncodingLz)
+	{
+		source.bandRows = (int) reader->header.chunkRows;
+	}
+	else
+	{
+		source.bandRows = ImageChunkByteSize / reader->rowByteSize;
+		if (source.bandRows < 1) source.bandRows = 1;
+	}
+
+	if (OpenViewportSource(image, &source) == FALSE)
+	{
+		CloseFileSource(reader);
+		return FALSE;
+	}
+
+	return TRUE;
+}